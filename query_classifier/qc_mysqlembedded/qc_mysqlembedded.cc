@@ -750,6 +750,13 @@ static uint32_t resolve_query_type(parsing_info_t *pi, THD* thd)
 
     case SQLCOM_BEGIN:
         type |= QUERY_TYPE_BEGIN_TRX;
+        /** The 5.5 embedded library doesn't parse START TRANSACTION READ ONLY */
+#if defined(MYSQL_START_TRANS_OPT_READ_ONLY)
+        if (lex->start_transaction_opt & MYSQL_START_TRANS_OPT_READ_ONLY)
+        {
+            type |= QUERY_TYPE_READONLY;
+        }
+#endif
         goto return_qtype;
         break;
 
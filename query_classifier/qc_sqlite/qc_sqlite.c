@@ -13,6 +13,7 @@
 
 #include <sqliteInt.h>
 
+#include <ctype.h>
 #include <signal.h>
 #include <string.h>
 #include <log_manager.h>
@@ -386,6 +387,86 @@ static QC_SQLITE_INFO* info_init(QC_SQLITE_INFO* info)
     return info;
 }
 
+/**
+ * Check whether a word is at the start of a string.
+ *
+ * @param ptr  Pointer into the string, updated to point past the word and
+ *             the whitespace following it if the word matches.
+ * @param end  End of the string.
+ * @param word The word, in upper case.
+ *
+ * @return True if the word was found.
+ */
+static bool consume_word(const char** ptr, const char* end, const char* word)
+{
+    const char* p = *ptr;
+
+    while (*word && p < end && toupper((unsigned char)*p) == *word)
+    {
+        ++p;
+        ++word;
+    }
+
+    if (*word || (p < end && (isalnum((unsigned char)*p) || *p == '_')))
+    {
+        return false;
+    }
+
+    while (p < end && (isspace((unsigned char)*p) || *p == ','))
+    {
+        ++p;
+    }
+
+    *ptr = p;
+    return true;
+}
+
+/**
+ * Check whether a statement starts a read-only transaction. The grammar
+ * only recognizes a plain START TRANSACTION, so the characteristics of the
+ * transaction are looked up from the statement itself.
+ *
+ * @param query The statement.
+ * @param len   The length of the statement.
+ *
+ * @return True if the statement is START TRANSACTION ... READ ONLY.
+ */
+static bool is_read_only_trx(const char* query, size_t len)
+{
+    const char* ptr = query;
+    const char* end = query + len;
+
+    while (ptr < end && isspace((unsigned char)*ptr))
+    {
+        ++ptr;
+    }
+
+    if (!consume_word(&ptr, end, "START") || !consume_word(&ptr, end, "TRANSACTION"))
+    {
+        return false;
+    }
+
+    while (ptr < end)
+    {
+        if (consume_word(&ptr, end, "READ"))
+        {
+            return consume_word(&ptr, end, "ONLY");
+        }
+
+        while (ptr < end && !isspace((unsigned char)*ptr) && *ptr != ',')
+        {
+            ++ptr;
+        }
+
+        while (ptr < end && (isspace((unsigned char)*ptr) || *ptr == ','))
+        {
+            ++ptr;
+        }
+    }
+
+    return false;
+}
+
 static void parse_query_string(const char* query, size_t len)
 {
     sqlite3_stmt* stmt = NULL;
@@ -478,6 +559,11 @@ static void parse_query_string(const char* query, size_t len)
         }
     }
 
+    if ((this_thread.info->types & QUERY_TYPE_BEGIN_TRX) && is_read_only_trx(query, len))
+    {
+        this_thread.info->types |= QUERY_TYPE_READONLY;
+    }
+
     if (stmt)
     {
         sqlite3_finalize(stmt);
@@ -0,0 +1,2 @@
+QUERY_TYPE_BEGIN_TRX|QUERY_TYPE_READONLY
+QUERY_TYPE_BEGIN_TRX
@@ -0,0 +1,2 @@
+START TRANSACTION READ ONLY;
+START TRANSACTION READ WRITE;
@@ -23,6 +23,8 @@
  * @endverbatim
  */
 
+#include <atomic.h>
+
 /**
  * Implementation of an atomic add operation for the GCC environment, or the
  * X86 processor.  If we are working within GNU C then we can use the GCC
@@ -53,3 +55,30 @@ atomic_add(int *variable, int value)
     return value;
 #endif
 }
+
+/**
+ * Atomically replace the value of a pointer if it has the expected value
+ *
+ * @param variable  Pointer to the pointer to modify
+ * @param old_value The expected current value
+ * @param new_value The value to store
+ * @return True if the value was @c old_value and it was replaced
+ */
+bool
+atomic_cas_ptr(void **variable, void *old_value, void *new_value)
+{
+    return __sync_bool_compare_and_swap(variable, old_value, new_value);
+}
+
+/**
+ * Atomic add operation for 64-bit integers
+ *
+ * @param variable  Pointer the the variable to add to
+ * @param value     Value to be added
+ * @return          The value of variable before the add occurred
+ */
+int64_t
+atomic_add_int64(int64_t *variable, int64_t value)
+{
+    return __sync_fetch_and_add(variable, value);
+}
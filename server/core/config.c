@@ -192,6 +192,7 @@ static char *server_params[] =
     "monitoruser",
     "monitorpw",
     "persistpoolmax",
+    "persistpoolmin",
     "persistmaxtime",
     "ssl_cert",
     "ssl_ca_cert",
@@ -864,6 +865,71 @@ config_pollsleep()
     return gateway.pollsleep;
 }
 
+/**
+ * Return the percentiles that are reported for latency histograms
+ *
+ * @param percentiles Pointer where the array of percentiles is stored
+ * @return Number of percentiles in the array
+ */
+int
+config_latency_percentiles(const double **percentiles)
+{
+    *percentiles = gateway.latency_percentiles;
+    return gateway.n_latency_percentiles;
+}
+
+/**
+ * Parse a comma separated list of latency percentiles
+ *
+ * @param value The list of percentiles
+ * @return True if the list was valid
+ */
+static bool
+config_parse_latency_percentiles(const char *value)
+{
+    double percentiles[MAX_LATENCY_PERCENTILES];
+    int n = 0;
+    const char *ptr = value;
+
+    while (*ptr)
+    {
+        char *end;
+        double pct = strtod(ptr, &end);
+
+        if (end == ptr || pct <= 0.0 || pct > 100.0 || n == MAX_LATENCY_PERCENTILES)
+        {
+            return false;
+        }
+
+        percentiles[n++] = pct;
+
+        while (isspace(*end))
+        {
+            end++;
+        }
+
+        if (*end == ',')
+        {
+            end++;
+        }
+        else if (*end != '\0')
+        {
+            return false;
+        }
+
+        ptr = end;
+    }
+
+    if (n == 0)
+    {
+        return false;
+    }
+
+    memcpy(gateway.latency_percentiles, percentiles, sizeof(percentiles[0]) * n);
+    gateway.n_latency_percentiles = n;
+    return true;
+}
+
 /**
  * Return the feedback config data pointer
  *
@@ -1004,6 +1070,16 @@ handle_global_item(const char *name, const char *value)
     {
         gateway.qc_args = strdup(value);
     }
+    else if (strcmp(name, "latency_percentiles") == 0)
+    {
+        if (!config_parse_latency_percentiles(value))
+        {
+            MXS_ERROR("Invalid value for 'latency_percentiles': %s. Expected a comma "
+                      "separated list of at most %d percentiles between 0 and 100.",
+                      value, MAX_LATENCY_PERCENTILES);
+            return 0;
+        }
+    }
     else
     {
         for (i = 0; lognames[i].name; i++)
@@ -1223,6 +1299,7 @@ global_defaults()
     gateway.auth_conn_timeout = DEFAULT_AUTH_CONNECT_TIMEOUT;
     gateway.auth_read_timeout = DEFAULT_AUTH_READ_TIMEOUT;
     gateway.auth_write_timeout = DEFAULT_AUTH_WRITE_TIMEOUT;
+    config_parse_latency_percentiles(DEFAULT_LATENCY_PERCENTILES);
     if (version_string != NULL)
     {
         gateway.version_string = strdup(version_string);
@@ -2472,6 +2549,22 @@ int create_new_server(CONFIG_CONTEXT *obj)
             }
         }
 
+        const char *poolmin = config_get_value_string(obj->parameters, "persistpoolmin");
+        if (poolmin)
+        {
+            long int persistpoolmin = strtol(poolmin, &endptr, 0);
+            if (*endptr != '\0' || persistpoolmin < 0)
+            {
+                MXS_ERROR("Invalid value for 'persistpoolmin' for server %s: %s",
+                          server->unique_name, poolmin);
+                error_count++;
+            }
+            else
+            {
+                server->persistpoolmin = persistpoolmin;
+            }
+        }
+
         const char *persistmax = config_get_value_string(obj->parameters, "persistmaxtime");
         if (persistmax)
         {
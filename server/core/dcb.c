@@ -88,6 +88,7 @@
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
 
 static  DCB             *allDCBs = NULL;        /* Diagnostics need a list of DCBs */
 static  DCB             *lastDCB = NULL;
@@ -110,6 +111,8 @@ static inline DCB * dcb_find_in_list(DCB *dcb);
 static inline void dcb_process_victim_queue(DCB *listofdcb);
 static void dcb_stop_polling_and_shutdown (DCB *dcb);
 static bool dcb_maybe_add_persistent(DCB *);
+static DCB *dcb_connect_new(SERVER *server, SESSION *session, const char *protocol, int flags);
+static void dcb_prewarm_done(DCB *dcb);
 static inline bool dcb_write_parameter_check(DCB *dcb, GWBUF *queue);
 static int dcb_bytes_readable(DCB *dcb);
 static int dcb_read_no_bytes_available(DCB *dcb, int nreadtotal);
@@ -413,6 +416,8 @@ dcb_final_free(DCB *dcb)
         MXS_ERROR("dcb_final_free: DCB %p has outstanding events.", dcb);
     }
 
+    dcb_prewarm_done(dcb);
+
     if (dcb->session)
     {
         /*<
@@ -800,9 +805,6 @@ DCB *
 dcb_connect(SERVER *server, SESSION *session, const char *protocol)
 {
     DCB         *dcb;
-    GWPROTOCOL  *funcs;
-    int         fd;
-    int         rc;
     char        *user;
 
     user = session_getUser(session);
@@ -811,6 +813,14 @@ dcb_connect(SERVER *server, SESSION *session, const char *protocol)
         MXS_DEBUG("%lu [dcb_connect] Looking for persistent connection DCB "
                   "user %s protocol %s\n", pthread_self(), user, protocol);
         dcb = server_get_persistent(server, user, protocol);
+
+        if (server_persistent_wanted(server, user, protocol))
+        {
+            /** Warm up the pool with a connection that is added to it
+             * as soon as it has been authenticated */
+            dcb_connect_new(server, session, protocol, DCBF_PREWARM);
+        }
+
         if (dcb)
         {
             /**
@@ -827,7 +837,17 @@ dcb_connect(SERVER *server, SESSION *session, const char *protocol)
             MXS_DEBUG("%lu [dcb_connect] Reusing a persistent connection, dcb %p\n",
                       pthread_self(), dcb);
             dcb->persistentstart = 0;
-            return dcb;
+
+            /** Clear the state left by the previous session */
+            if (dcb->func.reset == NULL || dcb->func.reset(dcb))
+            {
+                return dcb;
+            }
+
+            MXS_DEBUG("%lu [dcb_connect] Failed to reset persistent connection, dcb %p\n",
+                      pthread_self(), dcb);
+            dcb->dcb_errhandle_called = true;
+            dcb_close(dcb);
         }
         else
         {
@@ -836,11 +856,42 @@ dcb_connect(SERVER *server, SESSION *session, const char *protocol)
         }
     }
 
+    return dcb_connect_new(server, session, protocol, 0);
+}
+
+/**
+ * Create a new connection to a server
+ *
+ * @param server        The server to connect to
+ * @param session       The session this connection is being made for
+ * @param protocol      The protocol module to use
+ * @param flags         DCB flags to set before the connection is added to the
+ *                      poll set
+ * @return              The new allocated dcb or NULL if the DCB was not connected
+ */
+static DCB *
+dcb_connect_new(SERVER *server, SESSION *session, const char *protocol, int flags)
+{
+    DCB         *dcb;
+    GWPROTOCOL  *funcs;
+    int         fd;
+    int         rc;
+
     if ((dcb = dcb_alloc(DCB_ROLE_BACKEND_HANDLER, NULL)) == NULL)
     {
+        if (flags & DCBF_PREWARM)
+        {
+            atomic_add(&server->persistwarming, -1);
+        }
         return NULL;
     }
 
+    /**
+     * Add server pointer to dcb, dcb_final_free needs it for the flags
+     */
+    dcb->server = server;
+    dcb->flags |= flags;
+
     if ((funcs = (GWPROTOCOL *)load_module(protocol,
                                            MODULE_PROTOCOL)) == NULL)
     {
@@ -897,11 +948,6 @@ dcb_connect(SERVER *server, SESSION *session, const char *protocol)
      */
     dcb->fd = fd;
 
-    /**
-     * Add server pointer to dcb
-     */
-    dcb->server = server;
-
     /** Copy status field to DCB */
     dcb->dcb_server_status = server->status;
     dcb->dcb_port = server->port;
@@ -1413,6 +1459,119 @@ dcb_write(DCB *dcb, GWBUF *queue)
     return 1;
 }
 
+/**
+ * Write the contents of an I/O vector to a DCB
+ *
+ * If nothing is queued for writing and the connection does not use SSL, the
+ * data is written to the socket with one writev call without copying it.
+ * Whatever could not be written is copied into a buffer and queued as with
+ * dcb_write, so the caller may reuse the memory when the function returns.
+ *
+ * @param dcb    The DCB of the client
+ * @param iov    The data to write
+ * @param iovcnt Number of elements in @c iov, at most IOV_MAX
+ * @return       0 on failure, 1 on success
+ */
+int
+dcb_writev(DCB *dcb, const struct iovec *iov, int iovcnt)
+{
+    size_t total = 0;
+    ssize_t written = 0;
+    bool direct = false;
+
+    for (int i = 0; i < iovcnt; i++)
+    {
+        total += iov[i].iov_len;
+    }
+
+    if (total == 0)
+    {
+        return 1;
+    }
+
+    spinlock_acquire(&dcb->writeqlock);
+    if (dcb->ssl == NULL && dcb->fd > 0 && dcb->state == DCB_STATE_POLLING &&
+        dcb->writeq == NULL && !dcb->draining_flag)
+    {
+        /** Keep other threads from writing while the vector is written */
+        dcb->draining_flag = true;
+        direct = true;
+    }
+    spinlock_release(&dcb->writeqlock);
+
+    if (direct)
+    {
+        if ((written = writev(dcb->fd, iov, iovcnt)) < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                char errbuf[STRERROR_BUFLEN];
+                MXS_DEBUG("%lu [dcb_writev] Writing to socket %d failed due %d, %s.",
+                          pthread_self(), dcb->fd, errno,
+                          strerror_r(errno, errbuf, sizeof(errbuf)));
+            }
+            written = 0;
+        }
+    }
+
+    GWBUF *buffer = NULL;
+
+    if ((size_t)written < total)
+    {
+        if ((buffer = gwbuf_alloc(total - written)) != NULL)
+        {
+            uint8_t *ptr = GWBUF_DATA(buffer);
+            size_t skip = written;
+
+            for (int i = 0; i < iovcnt; i++)
+            {
+                if (skip >= iov[i].iov_len)
+                {
+                    skip -= iov[i].iov_len;
+                    continue;
+                }
+
+                memcpy(ptr, (uint8_t*)iov[i].iov_base + skip, iov[i].iov_len - skip);
+                ptr += iov[i].iov_len - skip;
+                skip = 0;
+            }
+        }
+        else
+        {
+            MXS_ERROR("Failed to allocate %lu bytes for a write to DCB %p.",
+                      (unsigned long)(total - written), dcb);
+        }
+    }
+
+    if (!direct)
+    {
+        return buffer ? dcb_write(dcb, buffer) : 0;
+    }
+
+    bool below_water = (dcb->high_water && dcb->writeqlen < dcb->high_water);
+    bool pending;
+
+    spinlock_acquire(&dcb->writeqlock);
+    if (buffer)
+    {
+        /** Anything queued while the vector was written goes after the remainder */
+        atomic_add(&dcb->writeqlen, gwbuf_length(buffer));
+        dcb->writeq = gwbuf_append(buffer, dcb->writeq);
+    }
+    dcb->draining_flag = false;
+    dcb->drain_called_while_busy = false;
+    pending = dcb->writeq != NULL;
+    spinlock_release(&dcb->writeqlock);
+
+    if (pending)
+    {
+        dcb_drain_writeq(dcb);
+    }
+    dcb_write_tidy_up(dcb, below_water);
+
+    return buffer || (size_t)written == total;
+}
+
 #if defined(FAKE_CODE)
 /**
  * Fake code for dcb_write
@@ -1868,14 +2027,18 @@ static bool
 dcb_maybe_add_persistent(DCB *dcb)
 {
     int  poolcount = -1;
+
+    dcb_prewarm_done(dcb);
+
     if (dcb->user != NULL
         && strlen(dcb->user)
+        && dcb->protoname
         && dcb->server
         && dcb->server->persistpoolmax
         && (dcb->server->status & SERVER_RUNNING)
         && !dcb->dcb_errhandle_called
         && !(dcb->flags & DCBF_HUNG)
-        && (poolcount = dcb_persistent_clean_count(dcb, false)) < dcb->server->persistpoolmax)
+        && (poolcount = dcb->server->stats.n_persistent) < dcb->server->persistpoolmax)
     {
         DCB_CALLBACK *loopcallback;
         MXS_DEBUG("%lu [dcb_maybe_add_persistent] Adding DCB to persistent pool, user %s.\n",
@@ -1903,13 +2066,12 @@ dcb_maybe_add_persistent(DCB *dcb)
             free(loopcallback);
         }
         spinlock_release(&dcb->cb_lock);
-        spinlock_acquire(&dcb->server->persistlock);
-        dcb->nextpersistent = dcb->server->persistent;
-        dcb->server->persistent = dcb;
-        spinlock_release(&dcb->server->persistlock);
-        atomic_add(&dcb->server->stats.n_persistent, 1);
-        atomic_add(&dcb->server->stats.n_current, -1);
-        return true;
+        if (server_add_persistent(dcb->server, dcb))
+        {
+            atomic_add(&dcb->server->stats.n_current, -1);
+            return true;
+        }
+        dcb->persistentstart = 0;
     }
     else
     {
@@ -2909,74 +3071,108 @@ dcb_null_auth(DCB *dcb, SERVER *server, SESSION *session, GWBUF *buf)
     return 0;
 }
 
+/**
+ * Release the warm-up slot of a DCB that was opened to warm up the
+ * persistent pool of its server
+ *
+ * @param dcb   The DCB that is being added to the pool or freed
+ */
+static void
+dcb_prewarm_done(DCB *dcb)
+{
+    if ((dcb->flags & DCBF_PREWARM) && dcb->server)
+    {
+        dcb->flags &= ~DCBF_PREWARM;
+        atomic_add(&dcb->server->persistwarming, -1);
+    }
+}
+
+/**
+ * Close DCBs that have been removed from a persistent pool
+ *
+ * @param disposals     The DCBs linked with nextpersistent
+ */
+void
+dcb_persistent_close(DCB *disposals)
+{
+    while (disposals)
+    {
+        DCB *nextdcb = disposals->nextpersistent;
+        disposals->persistentstart = -1;
+        if (DCB_STATE_POLLING == disposals->state)
+        {
+            dcb_stop_polling_and_shutdown(disposals);
+        }
+        dcb_close(disposals);
+        disposals = nextdcb;
+    }
+}
+
 /**
  * Check persistent pool for expiry or excess size and count
  *
- * @param dcb           The DCB being closed.
- * @param cleanall      Boolean, if true the whole pool is cleared for the
- *                      server related to the given DCB
+ * @param server        The server whose pool is checked
+ * @param cleanall      Boolean, if true the whole pool is cleared
  * @return              A count of the DCBs remaining in the pool
  */
 int
-dcb_persistent_clean_count(DCB *dcb, bool cleanall)
+dcb_persistent_clean_count(SERVER *server, bool cleanall)
 {
     int count = 0;
-    if (dcb && dcb->server)
+    if (server)
     {
-        SERVER *server = dcb->server;
-        DCB *previousdcb = NULL;
-        DCB *persistentdcb, *nextdcb;
         DCB *disposals = NULL;
+        int n_disposals = 0;
+        time_t now = time(NULL);
 
         CHK_SERVER(server);
         spinlock_acquire(&server->persistlock);
-        persistentdcb = server->persistent;
-        while (persistentdcb)
-        {
-            CHK_DCB(persistentdcb);
-            nextdcb = persistentdcb->nextpersistent;
-            if (cleanall
-                || persistentdcb-> dcb_errhandle_called
-                || count >= server->persistpoolmax
-                || persistentdcb->server == NULL
-                || !(persistentdcb->server->status & SERVER_RUNNING)
-                || (time(NULL) - persistentdcb->persistentstart) > server->persistmaxtime)
+        for (int i = 0; i < SERVER_POOL_BUCKETS; i++)
+        {
+            for (SERVER_POOL *pool = server->persistent[i]; pool; pool = pool->next)
             {
-                /* Remove from persistent pool */
-                if (previousdcb)
-                {
-                    previousdcb->nextpersistent = nextdcb;
-                }
-                else
+                DCB *previousdcb = NULL;
+                DCB *persistentdcb = pool->dcbs;
+
+                while (persistentdcb)
                 {
-                    server->persistent = nextdcb;
+                    CHK_DCB(persistentdcb);
+                    DCB *nextdcb = persistentdcb->nextpersistent;
+                    if (cleanall
+                        || persistentdcb-> dcb_errhandle_called
+                        || count >= server->persistpoolmax
+                        || !(server->status & SERVER_RUNNING)
+                        || (now - persistentdcb->persistentstart) > server->persistmaxtime)
+                    {
+                        /* Remove from persistent pool */
+                        if (previousdcb)
+                        {
+                            previousdcb->nextpersistent = nextdcb;
+                        }
+                        else
+                        {
+                            pool->dcbs = nextdcb;
+                        }
+                        pool->n_dcbs--;
+                        /* Add removed DCBs to disposal list for processing outside spinlock */
+                        persistentdcb->nextpersistent = disposals;
+                        disposals = persistentdcb;
+                        n_disposals++;
+                    }
+                    else
+                    {
+                        count++;
+                        previousdcb = persistentdcb;
+                    }
+                    persistentdcb = nextdcb;
                 }
-                /* Add removed DCBs to disposal list for processing outside spinlock */
-                persistentdcb->nextpersistent = disposals;
-                disposals = persistentdcb;
-                atomic_add(&server->stats.n_persistent, -1);
-            }
-            else
-            {
-                count++;
-                previousdcb = persistentdcb;
             }
-            persistentdcb = nextdcb;
         }
         server->persistmax = MAX(server->persistmax, count);
         spinlock_release(&server->persistlock);
+        atomic_add(&server->stats.n_persistent, -n_disposals);
         /** Call possible callback for this DCB in case of close */
-        while (disposals)
-        {
-            nextdcb = disposals->nextpersistent;
-            disposals->persistentstart = -1;
-            if (DCB_STATE_POLLING == disposals->state)
-            {
-                dcb_stop_polling_and_shutdown(disposals);
-            }
-            dcb_close(disposals);
-            disposals = nextdcb;
-        }
+        dcb_persistent_close(disposals);
     }
     return count;
 }
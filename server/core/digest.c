@@ -0,0 +1,480 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file digest.c - Statement digest tables
+ */
+
+#include <digest.h>
+#include <skygw_debug.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * One digest in a shard. The statistics with the latency histogram are
+ * allocated when the digest is first seen so that the unused slots of the
+ * hash table stay small.
+ */
+typedef struct
+{
+    uint64_t     hash;   /**< Hash of the text, 0 if the entry is not used */
+    char         *text;  /**< The canonical statement */
+    DIGEST_STATS *stats; /**< Statistics recorded by the owning thread */
+} DIGEST_ENTRY;
+
+/** The part of a digest table that one thread modifies */
+typedef struct
+{
+    int          used;           /**< Number of used entries */
+    DIGEST_ENTRY *entries;       /**< Hash table of the digests */
+    DIGEST_ENTRY overflow;       /**< Statements that did not fit into the table */
+    DIGEST_STATS overflow_stats; /**< Statistics of the overflow entry */
+} DIGEST_SHARD;
+
+struct digest_table
+{
+    int          max_digests; /**< Maximum number of digests in one shard */
+    int          size;        /**< Size of the hash table, a power of two */
+    int          n_shards;    /**< Number of shards */
+    DIGEST_SHARD *shards;     /**< One shard per thread */
+};
+
+/**
+ * Initialize the statistics of a new entry
+ *
+ * @param stats Statistics to initialize
+ */
+static void digest_stats_init(DIGEST_STATS *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->min = INT64_MAX;
+}
+
+/**
+ * Combine the statistics of two entries
+ *
+ * @param dest Where the statistics are added
+ * @param src  Statistics to add
+ */
+static void digest_stats_merge(DIGEST_STATS *dest, const DIGEST_STATS *src)
+{
+    dest->count += src->count;
+    dest->sum += src->sum;
+    dest->rows += src->rows;
+    dest->errors += src->errors;
+
+    if (src->min < dest->min)
+    {
+        dest->min = src->min;
+    }
+    if (src->max > dest->max)
+    {
+        dest->max = src->max;
+    }
+    if (src->first_seen && (dest->first_seen == 0 || src->first_seen < dest->first_seen))
+    {
+        dest->first_seen = src->first_seen;
+    }
+    if (src->last_seen > dest->last_seen)
+    {
+        dest->last_seen = src->last_seen;
+    }
+
+    for (int i = 0; i < DIGEST_BUCKETS; i++)
+    {
+        dest->buckets[i] += src->buckets[i];
+    }
+}
+
+/**
+ * Create a new digest table
+ *
+ * @param max_digests Maximum number of digests each thread tracks
+ * @return New digest table or NULL if memory allocation failed
+ */
+DIGEST_TABLE* digest_table_alloc(int max_digests)
+{
+    DIGEST_TABLE *table = malloc(sizeof(DIGEST_TABLE));
+
+    if (table == NULL)
+    {
+        return NULL;
+    }
+
+    /** Keep the load factor of the hash table at or below one half */
+    table->max_digests = max_digests > 0 ? max_digests : DEFAULT_MAX_DIGESTS;
+    table->size = 1;
+
+    while (table->size < table->max_digests * 2)
+    {
+        table->size *= 2;
+    }
+
+    table->n_shards = ts_stats_thread_count();
+
+    if ((table->shards = calloc(table->n_shards, sizeof(DIGEST_SHARD))) == NULL)
+    {
+        free(table);
+        return NULL;
+    }
+
+    for (int i = 0; i < table->n_shards; i++)
+    {
+        DIGEST_SHARD *shard = &table->shards[i];
+
+        if ((shard->entries = calloc(table->size, sizeof(DIGEST_ENTRY))) == NULL)
+        {
+            digest_table_free(table);
+            return NULL;
+        }
+
+        shard->overflow.stats = &shard->overflow_stats;
+        digest_stats_init(shard->overflow.stats);
+    }
+
+    return table;
+}
+
+/**
+ * Free a digest table
+ *
+ * @param table Table to free
+ */
+void digest_table_free(DIGEST_TABLE *table)
+{
+    if (table)
+    {
+        for (int i = 0; i < table->n_shards; i++)
+        {
+            DIGEST_SHARD *shard = &table->shards[i];
+
+            for (int j = 0; shard->entries && j < table->size; j++)
+            {
+                free(shard->entries[j].text);
+                free(shard->entries[j].stats);
+            }
+
+            free(shard->entries);
+        }
+
+        free(table->shards);
+        free(table);
+    }
+}
+
+/**
+ * Calculate the hash of a canonical statement
+ *
+ * Only the part of the statement that is stored in the table is hashed.
+ *
+ * @param text The canonical statement
+ * @return The 64-bit FNV-1a hash of the statement, never zero
+ */
+uint64_t digest_hash(const char *text)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (int i = 0; text[i] && i < DIGEST_TEXT_LEN - 1; i++)
+    {
+        hash ^= (unsigned char)text[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash ? hash : 1;
+}
+
+/**
+ * Find the entry of a statement in a shard, adding it if it is not found
+ *
+ * @param table The digest table
+ * @param shard Shard of the current thread
+ * @param text  The canonical statement
+ * @return The entry of the statement or the overflow entry if the table is full
+ */
+static DIGEST_ENTRY* digest_find(DIGEST_TABLE *table, DIGEST_SHARD *shard, const char *text)
+{
+    uint64_t hash = digest_hash(text);
+    int mask = table->size - 1;
+
+    for (int i = 0, idx = hash & mask; i < table->size; i++, idx = (idx + 1) & mask)
+    {
+        DIGEST_ENTRY *entry = &shard->entries[idx];
+
+        if (entry->hash == 0)
+        {
+            if (shard->used >= table->max_digests)
+            {
+                break;
+            }
+
+            entry->text = strndup(text, DIGEST_TEXT_LEN - 1);
+            entry->stats = malloc(sizeof(DIGEST_STATS));
+
+            if (entry->text == NULL || entry->stats == NULL)
+            {
+                free(entry->text);
+                free(entry->stats);
+                entry->text = NULL;
+                entry->stats = NULL;
+                break;
+            }
+
+            digest_stats_init(entry->stats);
+            entry->stats->first_seen = time(NULL);
+
+            /** Readers only look at entries with a hash so the entry must
+             * be complete before the hash is visible */
+            __sync_synchronize();
+            entry->hash = hash;
+            shard->used++;
+            return entry;
+        }
+        else if (entry->hash == hash && strncmp(entry->text, text, DIGEST_TEXT_LEN - 1) == 0)
+        {
+            return entry;
+        }
+    }
+
+    return &shard->overflow;
+}
+
+/**
+ * Record the execution of a statement
+ *
+ * Only the shard of the calling thread is modified so no locking is needed.
+ *
+ * @param table   The digest table
+ * @param text    The canonical form of the statement
+ * @param latency Execution time in microseconds
+ * @param rows    Number of rows returned
+ * @param error   Whether the statement returned an error
+ */
+void digest_table_record(DIGEST_TABLE *table, const char *text, int64_t latency,
+                         int64_t rows, bool error)
+{
+    int id = ts_stats_get_thread_id();
+    DIGEST_SHARD *shard = &table->shards[id < table->n_shards ? id : 0];
+    DIGEST_ENTRY *entry = digest_find(table, shard, text);
+    DIGEST_STATS *stats = entry->stats;
+
+    if (latency < 0)
+    {
+        latency = 0;
+    }
+
+    stats->count++;
+    stats->sum += latency;
+    stats->rows += rows;
+    stats->buckets[ts_histogram_bucket(latency) >> DIGEST_BUCKET_SHIFT]++;
+    stats->last_seen = time(NULL);
+
+    if (stats->first_seen == 0)
+    {
+        stats->first_seen = stats->last_seen;
+    }
+    if (error)
+    {
+        stats->errors++;
+    }
+    if (latency < stats->min)
+    {
+        stats->min = latency;
+    }
+    if (latency > stats->max)
+    {
+        stats->max = latency;
+    }
+}
+
+/** A reference to an entry of a shard, used when merging the shards */
+typedef struct
+{
+    uint64_t     hash;
+    DIGEST_ENTRY *entry;
+} DIGEST_REF;
+
+static int digest_ref_cmp(const void *a, const void *b)
+{
+    const DIGEST_REF *ra = (const DIGEST_REF*)a;
+    const DIGEST_REF *rb = (const DIGEST_REF*)b;
+
+    if (ra->hash != rb->hash)
+    {
+        return ra->hash < rb->hash ? -1 : 1;
+    }
+
+    return strcmp(ra->entry->text, rb->entry->text);
+}
+
+static int digest_summary_cmp(const void *a, const void *b)
+{
+    const DIGEST_SUMMARY *sa = (const DIGEST_SUMMARY*)a;
+    const DIGEST_SUMMARY *sb = (const DIGEST_SUMMARY*)b;
+
+    if (sa->stats.sum != sb->stats.sum)
+    {
+        return sa->stats.sum > sb->stats.sum ? -1 : 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Read the merged statistics of a digest table
+ *
+ * The shards are read without locking which means that statements recorded
+ * while the table is being read may or may not be included. The overflow
+ * entry is included only if a statement did not fit into the table.
+ *
+ * @param table     The digest table
+ * @param summaries Where the array of digests is stored, free it with
+ *                  digest_summary_free
+ * @return Number of digests, ordered by total latency, or -1 if memory
+ *         allocation failed
+ */
+int digest_table_read(DIGEST_TABLE *table, DIGEST_SUMMARY **summaries)
+{
+    int n_refs = 0;
+    DIGEST_REF *refs = malloc(sizeof(DIGEST_REF) * table->n_shards * table->max_digests);
+    DIGEST_STATS *overflow = malloc(sizeof(DIGEST_STATS));
+
+    if (refs == NULL || overflow == NULL)
+    {
+        free(refs);
+        free(overflow);
+        return -1;
+    }
+
+    digest_stats_init(overflow);
+
+    for (int i = 0; i < table->n_shards; i++)
+    {
+        DIGEST_SHARD *shard = &table->shards[i];
+
+        for (int j = 0; j < table->size && n_refs < table->n_shards * table->max_digests; j++)
+        {
+            uint64_t hash = shard->entries[j].hash;
+
+            if (hash)
+            {
+                __sync_synchronize();
+                refs[n_refs].hash = hash;
+                refs[n_refs].entry = &shard->entries[j];
+                n_refs++;
+            }
+        }
+
+        digest_stats_merge(overflow, shard->overflow.stats);
+    }
+
+    qsort(refs, n_refs, sizeof(DIGEST_REF), digest_ref_cmp);
+
+    int n = 0;
+    DIGEST_SUMMARY *rval = malloc(sizeof(DIGEST_SUMMARY) * (n_refs + 1));
+
+    if (rval == NULL)
+    {
+        free(refs);
+        free(overflow);
+        return -1;
+    }
+
+    for (int i = 0; i < n_refs; i++)
+    {
+        if (i == 0 || digest_ref_cmp(&refs[i - 1], &refs[i]) != 0)
+        {
+            rval[n].text = strdup(refs[i].entry->text);
+            digest_stats_init(&rval[n].stats);
+            n++;
+        }
+
+        digest_stats_merge(&rval[n - 1].stats, refs[i].entry->stats);
+    }
+
+    if (overflow->count > 0)
+    {
+        rval[n].text = NULL;
+        rval[n].stats = *overflow;
+        n++;
+    }
+
+    qsort(rval, n, sizeof(DIGEST_SUMMARY), digest_summary_cmp);
+    free(refs);
+    free(overflow);
+    *summaries = rval;
+    return n;
+}
+
+/**
+ * Free the digests returned by digest_table_read
+ *
+ * @param summaries   The digests
+ * @param n_summaries Number of digests
+ */
+void digest_summary_free(DIGEST_SUMMARY *summaries, int n_summaries)
+{
+    if (summaries)
+    {
+        for (int i = 0; i < n_summaries; i++)
+        {
+            free(summaries[i].text);
+        }
+
+        free(summaries);
+    }
+}
+
+/**
+ * Calculate a latency percentile of a digest
+ *
+ * @param stats      Statistics of the digest
+ * @param percentile Percentile to calculate, between 0 and 100
+ * @return The latency at the percentile or 0 if the digest has no executions
+ */
+int64_t digest_percentile(const DIGEST_STATS *stats, double percentile)
+{
+    if (stats->count == 0)
+    {
+        return 0;
+    }
+
+    int64_t target = (int64_t)((stats->count * percentile) / 100.0 + 0.5);
+    int64_t seen = 0;
+
+    if (target < 1)
+    {
+        target = 1;
+    }
+
+    for (int i = 0; i < DIGEST_BUCKETS; i++)
+    {
+        seen += stats->buckets[i];
+
+        if (seen >= target)
+        {
+            int64_t value = ts_histogram_bucket_upper(((i + 1) << DIGEST_BUCKET_SHIFT) - 1);
+
+            if (value > stats->max)
+            {
+                value = stats->max;
+            }
+            if (value < stats->min)
+            {
+                value = stats->min;
+            }
+            return value;
+        }
+    }
+
+    return stats->max;
+}
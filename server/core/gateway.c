@@ -1960,6 +1960,7 @@ int main(int argc, char **argv)
      * Start the housekeeper thread
      */
     hkinit();
+    hktask_add("Persistent pools", server_persistent_clean, NULL, SERVER_POOL_CLEAN_FREQ);
 
     /*<
      * Start the polling threads, note this is one less than is
@@ -23,8 +23,8 @@
 #include <errno.h>
 #include <syslog.h>
 #include <atomic.h>
+#include <pthread.h>
 
-#include <mlist.h>
 #include <skygw_debug.h>
 #include <skygw_types.h>
 #include <skygw_utils.h>
@@ -32,7 +32,13 @@
 #define MAX_PREFIXLEN 250
 #define MAX_SUFFIXLEN 250
 #define MAX_PATHLEN   512
-#define MAXNBLOCKBUFS 10
+
+/** Size of the log ring of one thread */
+#define LOG_RING_SIZE   (128 * 1024)
+/** Size of the buffer where the writer thread collects messages before writing them */
+#define LOG_WRITE_BATCH (64 * 1024)
+/** Size of a cache line, used to keep the fields of the reader and writer of a ring apart */
+#define LOG_CACHE_LINE  64
 
 /** for procname */
 #if !defined(_GNU_SOURCE)
@@ -45,13 +51,6 @@ static const char LOGFILE_NAME_SUFFIX[] = ".log";
 extern char *program_invocation_name;
 extern char *program_invocation_short_name;
 
-typedef enum
-{
-    BB_READY = 0x00,
-    BB_FULL,
-    BB_CLEARED
-} blockbuf_state_t;
-
 typedef enum
 {
     FILEWRITER_INIT,
@@ -86,7 +85,6 @@ enum log_flush
 
 #if defined(SS_DEBUG)
 static int write_index;
-static int block_start_index;
 static int prevval;
 static simple_mutex_t msg_mutex;
 #endif
@@ -183,27 +181,53 @@ struct filewriter
 #endif
 };
 
+/** States of a log ring */
+typedef enum
+{
+    RING_ACTIVE,    /**< Owned by a running thread */
+    RING_ABANDONED, /**< The owning thread has exited */
+    RING_FREE       /**< Abandoned and drained, can be taken by a new thread */
+} logring_state_t;
+
 /**
- * Log client's string is copied to block-sized log buffer, which is passed
- * to file writer thread.
+ * Header of a message in a log ring. The message follows the header. A
+ * record with zero length is padding that fills the end of the ring when
+ * a message doesn't fit there.
  */
-typedef struct blockbuf
+typedef struct logrec
 {
-#if defined(SS_DEBUG)
-    skygw_chk_t    bb_chk_top;
-#endif
-    blockbuf_state_t bb_state; /**State of the block buffer*/
-    simple_mutex_t bb_mutex;    /**< bb_buf_used, bb_isfull */
-    int            bb_refcount; /**< protected by list mutex. #of clients */
-//        int            bb_blankcount; /**< # of blanks used btw strings */
-    size_t         bb_buf_size;
-    size_t         bb_buf_left;
-    size_t         bb_buf_used;
-    char           bb_buf[MAX_LOGSTRLEN];
-#if defined(SS_DEBUG)
-    skygw_chk_t    bb_chk_tail;
-#endif
-} blockbuf_t;
+    uint32_t lr_size;  /**< Bytes used by the record, including the header */
+    uint16_t lr_len;   /**< Length of the message, at most MAX_LOGSTRLEN */
+    uint16_t lr_flush; /**< Whether the message must be synced to disk */
+    int64_t  lr_seqno; /**< Order of the message among all threads */
+} logrec_t;
+
+/** Space taken by a record, records are aligned to the size of the header */
+#define LOG_RECORD_SIZE(len) \
+    ((sizeof(logrec_t) + (len) + sizeof(logrec_t) - 1) & ~(sizeof(logrec_t) - 1))
+
+/**
+ * Every thread that logs formats its messages into its own ring from where the
+ * file writer thread copies them to the log file. Only the owning thread moves
+ * the tail and only the file writer moves the head so no locks are needed.
+ * If the ring is full the message is dropped instead of waiting for the file
+ * writer. The positions grow without wrapping, the offset in the buffer is the
+ * position modulo LOG_RING_SIZE.
+ */
+typedef struct logring
+{
+    /** Modified by the owning thread */
+    volatile size_t  lr_tail;             /**< End of the committed records */
+    volatile int64_t lr_dropped;          /**< Messages that didn't fit into the ring */
+    char             lr_pad1[LOG_CACHE_LINE - sizeof(size_t) - sizeof(int64_t)];
+    /** Modified by the file writer */
+    volatile size_t  lr_head;             /**< Start of the oldest unwritten record */
+    int64_t          lr_dropped_reported; /**< Dropped messages already reported */
+    char             lr_pad2[LOG_CACHE_LINE - sizeof(size_t) - sizeof(int64_t)];
+    volatile int     lr_state;            /**< One of logring_state_t */
+    struct logring*  lr_next;             /**< Next ring of the log file */
+    char             lr_buf[LOG_RING_SIZE];
+} logring_t;
 
 /**
  * logfile object corresponds to physical file(s) where
@@ -229,13 +253,16 @@ struct logfile
     char*            lf_full_link_name; /**< complete symlink name */
     int              lf_nfiles_max;
     size_t           lf_file_size;
-    /** list of block-sized log buffers */
-    mlist_t          lf_blockbuf_list;
+    /** log rings of the threads, only added to while the log file is open */
+    logring_t* volatile lf_rings;
+    /** buffer where the file writer merges the messages of the rings */
+    char*            lf_batch;
     size_t           lf_buf_size;
     bool             lf_flushflag;
     bool                 lf_rotateflag;
     int              lf_spinlock; /**< lf_flushflag & lf_rotateflag */
-    int              lf_npending_writes;
+    int              lf_signaled; /**< non-zero if the file writer has been woken up */
+    int64_t          lf_next_seqno; /**< Sequence number of the next message to write */
 #if defined(SS_DEBUG)
     skygw_chk_t      lf_chk_tail;
 #endif
@@ -262,6 +289,7 @@ struct logmanager
     bool             lm_enabled;
     simple_mutex_t   lm_mutex;
     size_t           lm_nlinks;
+    size_t           lm_generation; /**< identifies the rings of this log manager */
     /** fwr_logmes is for messages from log clients */
     skygw_message_t* lm_logmes;
     /** fwr_clientmes is for messages to log clients */
@@ -286,6 +314,26 @@ typedef struct strpart
     struct strpart* sp_next;
 } strpart_t;
 
+/** Number of log manager instances created, protected by lmlock */
+static size_t log_generation;
+/** Sequence number of the next log message */
+static int64_t log_seqno;
+
+/**
+ * The log ring of the current thread. If the generation doesn't match the
+ * current log manager the ring belonged to a log manager that has been
+ * shut down.
+ */
+static __thread struct
+{
+    logring_t* ring;
+    size_t     generation;
+} log_thread = {NULL, 0};
+
+/** Used to release the ring when the thread exits */
+static pthread_key_t  log_thread_key;
+static pthread_once_t log_thread_once = PTHREAD_ONCE_INIT;
+
 
 /** Static function declarations */
 static bool logfiles_init(logmanager_t* lmgr);
@@ -321,14 +369,10 @@ static int logmanager_write_log(int            priority,
                                 size_t         len,
                                 const char*    str);
 
-static blockbuf_t* blockbuf_init();
-static void blockbuf_node_done(void* bb_data);
-static char* blockbuf_get_writepos(blockbuf_t** p_bb,
-                                   size_t       str_len,
-                                   bool         flush);
-
-static void blockbuf_register(blockbuf_t* bb);
-static void blockbuf_unregister(blockbuf_t* bb);
+static logring_t* logring_get(logfile_t* lf);
+static logrec_t* logring_reserve(logring_t* ring, size_t len);
+static void logring_commit(logring_t* ring, logrec_t* rec, bool flush);
+static void logring_free_all(logfile_t* lf);
 static char* add_slash(char* str);
 
 static bool check_file_and_path(char* filename,
@@ -358,11 +402,11 @@ static bool logmanager_init_nomutex(const char* ident,
     }
 
     lm->lm_target = (target == MXS_LOG_TARGET_DEFAULT ? MXS_LOG_TARGET_FS : target);
+    lm->lm_generation = ++log_generation;
 #if defined(SS_DEBUG)
     lm->lm_chk_top   = CHK_NUM_LOGMANAGER;
     lm->lm_chk_tail  = CHK_NUM_LOGMANAGER;
     write_index = 0;
-    block_start_index = 0;
     prevval = -1;
     simple_mutex_init(&msg_mutex, "Message mutex");
 #endif
@@ -577,7 +621,8 @@ static logfile_t* logmanager_get_logfile(logmanager_t* lmgr)
 }
 
 /**
- * Finds write position from block buffer for log string and writes there.
+ * Reserves space from the log ring of the calling thread and writes the log
+ * string there.
  *
  * Parameters:
  *
@@ -590,7 +635,8 @@ static logfile_t* logmanager_get_logfile(logmanager_t* lmgr)
  * @param str_len       length of formatted string (including terminating NULL).
  * @param str           string to be written to log
  *
- * @return 0 if succeed, -1 otherwise
+ * @return 0 if succeed, -1 otherwise. If the ring of the thread is full the
+ *         message is dropped and -1 is returned.
  *
  */
 static int logmanager_write_log(int            priority,
@@ -602,8 +648,8 @@ static int logmanager_write_log(int            priority,
     logfile_t*   lf;
     char*        wp;
     int          err = 0;
-    blockbuf_t*  bb;
-    blockbuf_t*  bb_c;
+    logring_t*   ring = NULL;
+    logrec_t*    rec = NULL;
     size_t       timestamp_len;
     int          i;
 
@@ -662,7 +708,7 @@ static int logmanager_write_log(int            priority,
         safe_str_len = timestamp_len - sizeof(char) + cmplen + str_len;
     }
     /**
-     * Seek write position and register to block buffer.
+     * Reserve space from the ring of the thread.
      * Then print formatted string to write position.
      */
 
@@ -694,7 +740,14 @@ static int logmanager_write_log(int            priority,
     if (do_maxlog)
     {
         // All messages are now logged to the error log file.
-        wp = blockbuf_get_writepos(&bb, safe_str_len, flush);
+        if ((ring = logring_get(lf)) != NULL && (rec = logring_reserve(ring, safe_str_len)) != NULL)
+        {
+            wp = (char*)(rec + 1);
+        }
+        else
+        {
+            wp = NULL;
+        }
     }
     else
     {
@@ -703,6 +756,16 @@ static int logmanager_write_log(int            priority,
 
     if (wp == NULL)
     {
+        if (ring)
+        {
+            /**
+             * The ring is full. The message is dropped rather than making
+             * the thread wait for the file writer, which reports the number
+             * of dropped messages in the log.
+             */
+            ring->lr_dropped += 1;
+            skygw_message_send(lf->lf_logmes);
+        }
         return -1;
     }
 
@@ -779,7 +842,13 @@ static int logmanager_write_log(int            priority,
 
     if (do_maxlog)
     {
-        blockbuf_unregister(bb);
+        logring_commit(ring, rec, flush == LOG_FLUSH_YES);
+
+        /** Only the first message after the file writer has woken up wakes it */
+        if (atomic_add(&lf->lf_signaled, 1) == 0 || flush == LOG_FLUSH_YES)
+        {
+            skygw_message_send(lf->lf_logmes);
+        }
     }
     else
     {
@@ -790,349 +859,194 @@ static int logmanager_write_log(int            priority,
 }
 
 /**
- * Register writer to a block buffer. When reference counter is non-zero the
- * flusher thread doesn't write the block to disk.
+ * Release the ring of a thread that is exiting. The ring is left for the file
+ * writer to drain after which it can be used by another thread.
  *
- * @param bb    block buffer
+ * @param data The ring of the thread
  */
-static void blockbuf_register(blockbuf_t* bb)
+static void logring_thread_exit(void* data)
 {
-    CHK_BLOCKBUF(bb);
-    ss_dassert(bb->bb_refcount >= 0);
-    atomic_add(&bb->bb_refcount, 1);
-}
-
-/**
- * Unregister writer from block buffer. If the buffer got filled up and there
- * are no other registered writers anymore, notify the flusher thread.
- *
- * @param bb    block buffer
- */
-static void blockbuf_unregister(blockbuf_t* bb)
-{
-    logfile_t* lf;
+    acquire_lock(&lmlock);
 
-    CHK_BLOCKBUF(bb);
-    ss_dassert(bb->bb_refcount >= 1);
-    lf = &lm->lm_logfile;
-    CHK_LOGFILE(lf);
-    /**
-     * if this is the last client in a full buffer, send write request.
-     */
-    if (atomic_add(&bb->bb_refcount, -1) == 1 && bb->bb_state == BB_FULL)
+    /** The ring has been freed if the log manager has been shut down */
+    if (lm && lm->lm_generation == log_thread.generation)
     {
-        skygw_message_send(lf->lf_logmes);
+        ((logring_t*)data)->lr_state = RING_ABANDONED;
     }
-    ss_dassert(bb->bb_refcount >= 0);
+
+    release_lock(&lmlock);
 }
 
+static void logring_key_init(void)
+{
+    pthread_key_create(&log_thread_key, logring_thread_exit);
+}
 
 /**
- * @node (write brief function description here)
- *
- * Parameters:
- * @param id - <usage>
- *          <description>
- *
- * @param str_len - <usage>
- *          <description>
+ * Get the log ring of the calling thread. On the first call of a thread a ring
+ * left by an exited thread is reused or a new ring is added to the log file.
  *
- * @return
- *
- *
- * @details List mutex now protects both the list and the contents of it.
- * TODO : It should be so that adding and removing nodes of the list is protected
- * by the list mutex. Buffer modifications should be protected by buffer
- * mutex.
+ * @param lf    logfile pointer
  *
+ * @return The ring of the thread or NULL if memory allocation failed
  */
-static char* blockbuf_get_writepos(blockbuf_t** p_bb,
-                                   size_t       str_len,
-                                   bool         flush)
-{
-    logfile_t*     lf;
-    mlist_t*       bb_list;
-    char*          pos = NULL;
-    mlist_node_t*  node;
-    blockbuf_t*    bb;
-#if defined(SS_DEBUG)
-    bool           succ;
-#endif
-
-    CHK_LOGMANAGER(lm);
-    lf = &lm->lm_logfile;
-    CHK_LOGFILE(lf);
-    bb_list = &lf->lf_blockbuf_list;
+static logring_t* logring_get(logfile_t* lf)
+{
+    if (log_thread.ring == NULL || log_thread.generation != lm->lm_generation)
+    {
+        logring_t* ring;
 
-    /** Lock list */
-    simple_mutex_lock(&bb_list->mlist_mutex, true);
-    CHK_MLIST(bb_list);
+        pthread_once(&log_thread_once, logring_key_init);
 
-    if (bb_list->mlist_nodecount > 0)
-    {
         /**
-         * At least block buffer exists on the list.
+         * The file writer reads the list without locking. Rings are never
+         * removed from the list while the log file is open so a new ring
+         * only needs to be complete before it is made visible.
          */
-        node = bb_list->mlist_first;
+        acquire_lock(&lmlock);
 
-        /** Loop over blockbuf list to find write position */
-        while (true)
+        for (ring = lf->lf_rings; ring && ring->lr_state != RING_FREE; ring = ring->lr_next)
         {
-            CHK_MLIST_NODE(node);
-
-            /** Unlock list */
-            simple_mutex_unlock(&bb_list->mlist_mutex);
-
-            bb = (blockbuf_t *)node->mlnode_data;
-            CHK_BLOCKBUF(bb);
-
-            /** Lock buffer */
-            simple_mutex_lock(&bb->bb_mutex, true);
-
-            if (bb->bb_state == BB_FULL || bb->bb_buf_left < str_len)
-            {
-                /**
-                 * This block buffer is too full.
-                 * Send flush request to file writer thread. This causes
-                 * flushing all buffers, and (eventually) frees buffer space.
-                 */
-                blockbuf_register(bb);
-
-                bb->bb_state = BB_FULL;
-
-                blockbuf_unregister(bb);
-
-                /** Unlock buffer */
-                simple_mutex_unlock(&bb->bb_mutex);
-
-                /** Lock list */
-                simple_mutex_lock(&bb_list->mlist_mutex, true);
-
-
-                /**
-                 * If next node exists move forward. Else check if there is
-                 * space for a new block buffer on the list.
-                 */
-                if (node != bb_list->mlist_last)
-                {
-                    node = node->mlnode_next;
-                    continue;
-                }
-                /**
-                 * All buffers on the list are full.
-                 */
-                if (bb_list->mlist_nodecount < bb_list->mlist_nodecount_max)
-                {
-                    /**
-                     * New node is created
-                     */
-                    if ((bb = blockbuf_init()) == NULL)
-                    {
-                        simple_mutex_unlock(&bb_list->mlist_mutex);
-                        return NULL;
-                    }
-
-                    CHK_BLOCKBUF(bb);
-
-                    /**
-                     * Increase version to odd to mark list update active
-                     * update.
-                     */
-                    bb_list->mlist_versno += 1;
-                    ss_dassert(bb_list->mlist_versno % 2 == 1);
-
-                    ss_debug(succ = ) mlist_add_data_nomutex(bb_list, bb);
-                    ss_dassert(succ);
-
-                    /**
-                     * Increase version to even to mark completion of update.
-                     */
-                    bb_list->mlist_versno += 1;
-                    ss_dassert(bb_list->mlist_versno % 2 == 0);
-                }
-                else
-                {
-                    /**
-                     * List and buffers are full.
-                     * Reset to the beginning of the list, and wait until
-                     * there is a block buffer with enough space.
-                     */
-                    simple_mutex_unlock(&bb_list->mlist_mutex);
-                    simple_mutex_lock(&bb_list->mlist_mutex, true);
-
-                    node = bb_list->mlist_first;
-                    continue;
-                }
-
-            }
-            else if (bb->bb_state == BB_CLEARED)
-            {
-
-                /**
-                 *Move the cleared buffer to the end of the list if it is the first one in the list
-                 */
-
-                simple_mutex_unlock(&bb->bb_mutex);
-                simple_mutex_lock(&bb_list->mlist_mutex, true);
-
-                if (node == bb_list->mlist_first)
-                {
-
-                    if ((bb_list->mlist_nodecount > 1) && (node != bb_list->mlist_last))
-                    {
-                        bb_list->mlist_last->mlnode_next = bb_list->mlist_first;
-                        bb_list->mlist_first = bb_list->mlist_first->mlnode_next;
-                        bb_list->mlist_last->mlnode_next->mlnode_next = NULL;
-                        bb_list->mlist_last = bb_list->mlist_last->mlnode_next;
-                    }
-
-                    ss_dassert(node == bb_list->mlist_last);
-
-                    simple_mutex_unlock(&bb_list->mlist_mutex);
-                    simple_mutex_lock(&bb->bb_mutex, true);
-
-                    bb->bb_state = BB_READY;
-
-                    simple_mutex_unlock(&bb->bb_mutex);
-                    simple_mutex_lock(&bb_list->mlist_mutex, true);
-                    node = bb_list->mlist_first;
-                }
-                else
-                {
-                    if (node->mlnode_next)
-                    {
-                        node = node->mlnode_next;
-                    }
-                    else
-                    {
-                        node = bb_list->mlist_first;
-                    }
-                    continue;
-                }
+            ;
+        }
 
-            }
-            else if (bb->bb_state == BB_READY)
-            {
-                /**
-                 * There is space for new log string.
-                 */
-                break;
-            }
-        } /** while (true) */
-    }
-    else
-    {
+        if (ring)
+        {
+            ring->lr_state = RING_ACTIVE;
+        }
+        else if ((ring = (logring_t*)calloc(1, sizeof(logring_t))) != NULL)
+        {
+            ring->lr_state = RING_ACTIVE;
+            ring->lr_next = lf->lf_rings;
+            __sync_synchronize();
+            lf->lf_rings = ring;
+        }
 
-        /**
-         * Create the first block buffer to logfile's blockbuf list.
-         */
+        release_lock(&lmlock);
 
-        if ((bb = blockbuf_init()) == NULL)
+        if (ring == NULL)
         {
+            fprintf(stderr, "Error: Memory allocation failed when allocating a log ring.\n");
             return NULL;
         }
 
-        CHK_BLOCKBUF(bb);
+        log_thread.ring = ring;
+        log_thread.generation = lm->lm_generation;
+        pthread_setspecific(log_thread_key, ring);
+    }
 
-        /** Lock buffer */
-        simple_mutex_lock(&bb->bb_mutex, true);
-        /**
-         * Increase version to odd to mark list update active update.
-         */
-        bb_list->mlist_versno += 1;
-        ss_dassert(bb_list->mlist_versno % 2 == 1);
+    return log_thread.ring;
+}
 
-        ss_debug(succ = ) mlist_add_data_nomutex(bb_list, bb);
-        ss_dassert(succ);
+/**
+ * Reserve space for a message from a log ring. Only called by the thread
+ * owning the ring.
+ *
+ * @param ring  The ring of the calling thread
+ * @param len   Length of the message
+ *
+ * @return The record whose message area follows it, NULL if the ring is full
+ */
+static logrec_t* logring_reserve(logring_t* ring, size_t len)
+{
+    size_t size = LOG_RECORD_SIZE(len);
+    size_t pos = ring->lr_tail % LOG_RING_SIZE;
+    size_t pad = pos + size > LOG_RING_SIZE ? LOG_RING_SIZE - pos : 0;
 
-        /**
-         * Increase version to even to mark completion of update.
-         */
-        bb_list->mlist_versno += 1;
-        ss_dassert(bb_list->mlist_versno % 2 == 0);
+    ss_dassert(len <= UINT16_MAX && size <= LOG_RING_SIZE / 2);
 
-        /** Unlock list */
-        simple_mutex_unlock(&bb_list->mlist_mutex);
-    } /* if (bb_list->mlist_nodecount > 0) */
+    if (ring->lr_tail + pad + size - ring->lr_head > LOG_RING_SIZE)
+    {
+        return NULL;
+    }
 
-    ss_dassert(pos == NULL);
-    ss_dassert(!(bb->bb_state == BB_FULL || bb->bb_buf_left < str_len));
-    ss_dassert(bb_list->mlist_nodecount <= bb_list->mlist_nodecount_max);
+    if (pad > 0)
+    {
+        /** The message doesn't fit at the end of the ring, skip to the start */
+        logrec_t* padding = (logrec_t*)&ring->lr_buf[pos];
+        padding->lr_size = pad;
+        padding->lr_len = 0;
+        __sync_synchronize();
+        ring->lr_tail += pad;
+        pos = 0;
+    }
 
-    /**
-     * Registration to blockbuf adds reference for the write operation.
-     * It indicates that client has allocated space from the buffer,
-     * but not written yet. As long as refcount > 0 buffer can't be
-     * written to disk.
-     */
-    blockbuf_register(bb);
-    *p_bb = bb;
-    /**
-     * At this point list mutex is held and bb points to a node with
-     * enough space available. pos is not yet set.
-     */
-    pos = &bb->bb_buf[bb->bb_buf_used];
-    bb->bb_buf_used += str_len;
-    bb->bb_buf_left -= str_len;
+    logrec_t* rec = (logrec_t*)&ring->lr_buf[pos];
+    rec->lr_size = size;
+    rec->lr_len = len;
+    return rec;
+}
 
-    ss_dassert((pos >= &bb->bb_buf[0]) && (pos <= &bb->bb_buf[MAX_LOGSTRLEN - str_len]));
+/**
+ * Make a formatted message visible to the file writer.
+ *
+ * The sequence number is taken before the message becomes visible, so the
+ * file writer may see a message of another thread with a larger sequence
+ * number first. It waits for the missing message, see logfile_write_rings.
+ *
+ * @param ring  The ring of the calling thread
+ * @param rec   Record returned by logring_reserve
+ * @param flush Whether the message must be synced to disk
+ */
+static void logring_commit(logring_t* ring, logrec_t* rec, bool flush)
+{
+    rec->lr_flush = flush;
+    rec->lr_seqno = atomic_add_int64(&log_seqno, 1);
+    __sync_synchronize();
+    ring->lr_tail += rec->lr_size;
+}
 
-    /** read checkmark */
-    /** TODO: add buffer overflow checkmark
-        chk_val = (int)bb->bb_buf[bb->bb_buf_used-count_len];
-        ss_dassert(chk_val == bb->bb_strcount);
-    */
+/**
+ * Find the oldest message of a ring. Called by the file writer.
+ *
+ * @param ring  The ring
+ *
+ * @return The oldest record or NULL if the ring is empty
+ */
+static logrec_t* logring_peek(logring_t* ring)
+{
+    while (ring->lr_head != ring->lr_tail)
+    {
+        __sync_synchronize();
+        logrec_t* rec = (logrec_t*)&ring->lr_buf[ring->lr_head % LOG_RING_SIZE];
 
-    /** TODO : write next checkmark
-        bb->bb_strcount += 1;
-        memcpy(&bb->bb_buf[bb->bb_buf_used], &bb->bb_strcount, count_len);
-        bb->bb_buf_used += count_len;
-        bb->bb_buf_left -= count_len;
-    */
+        if (rec->lr_len > 0)
+        {
+            return rec;
+        }
 
-    /**
-     * If flush flag is set, set buffer full. As a consequence, no-one
-     * can write to it before it is flushed to disk.
-     */
-    bb->bb_state = (flush == true ? BB_FULL : bb->bb_state);
+        /** Skip the padding at the end of the ring */
+        ring->lr_head += rec->lr_size;
+    }
 
-    /** Unlock buffer */
-    simple_mutex_unlock(&bb->bb_mutex);
-    return pos;
+    return NULL;
 }
 
-static void blockbuf_node_done(void* bb_data)
+/**
+ * Release the oldest message of a ring after it has been copied.
+ *
+ * @param ring  The ring
+ * @param rec   Record returned by logring_peek
+ */
+static void logring_pop(logring_t* ring, logrec_t* rec)
 {
-    blockbuf_t* bb = (blockbuf_t *)bb_data;
-    simple_mutex_done(&bb->bb_mutex);
+    __sync_synchronize();
+    ring->lr_head += rec->lr_size;
 }
 
-
-static blockbuf_t* blockbuf_init()
+/**
+ * Free the rings of a log file. The file writer must have stopped.
+ *
+ * @param lf    logfile pointer
+ */
+static void logring_free_all(logfile_t* lf)
 {
-    blockbuf_t* bb;
-
-    if ((bb = (blockbuf_t *) calloc(1, sizeof (blockbuf_t))))
+    while (lf->lf_rings)
     {
-#if defined(SS_DEBUG)
-        bb->bb_chk_top = CHK_NUM_BLOCKBUF;
-        bb->bb_chk_tail = CHK_NUM_BLOCKBUF;
-#endif
-        simple_mutex_init(&bb->bb_mutex, "Blockbuf mutex");
-        bb->bb_buf_left = MAX_LOGSTRLEN;
-        bb->bb_buf_size = MAX_LOGSTRLEN;
-#if defined(SS_LOG_DEBUG)
-        sprintf(bb->bb_buf, "[block:%d]", atomic_add(&block_start_index, 1));
-        bb->bb_buf_used += strlen(bb->bb_buf);
-        bb->bb_buf_left -= strlen(bb->bb_buf);
-#endif
-        CHK_BLOCKBUF(bb);
+        logring_t* ring = lf->lf_rings;
+        lf->lf_rings = ring->lr_next;
+        free(ring);
     }
-    else
-    {
-        fprintf(stderr, "Error: Memory allocation failed when initializing log manager block buffers.");
-    }
-    return bb;
 }
 
 /**
@@ -1854,7 +1768,8 @@ static bool logfile_init(logfile_t*    logfile,
     logfile->lf_logmes = logmanager->lm_logmes;
     logfile->lf_name_prefix = LOGFILE_NAME_PREFIX;
     logfile->lf_name_suffix = LOGFILE_NAME_SUFFIX;
-    logfile->lf_npending_writes = 0;
+    logfile->lf_signaled = 0;
+    logfile->lf_next_seqno = log_seqno;
     logfile->lf_name_seqno = 1;
     logfile->lf_lmgr = logmanager;
     logfile->lf_flushflag = false;
@@ -1905,14 +1820,13 @@ static bool logfile_init(logfile_t*    logfile,
         goto return_with_succ;
     }
     /**
-     * Create a block buffer list for log file. Clients' writes go to buffers
-     * from where separate log flusher thread writes them to disk.
+     * Clients' writes go to the rings of the threads, from where the file
+     * writer thread collects them into a buffer and writes them to disk.
+     * The rings are created when the threads first log something.
      */
-    if (mlist_init(&logfile->lf_blockbuf_list,
-                   NULL,
-                   strdup("logfile block buffer list"),
-                   blockbuf_node_done,
-                   MAXNBLOCKBUFS) == NULL)
+    logfile->lf_rings = NULL;
+
+    if ((logfile->lf_batch = (char *)malloc(LOG_WRITE_BATCH)) == NULL)
     {
         ss_dfprintf(stderr,
                     "*\n* Error : Initializing buffers for log files "
@@ -1959,14 +1873,11 @@ static void logfile_done(logfile_t* lf)
     {
         case RUN:
             CHK_LOGFILE(lf);
-            ss_dassert(lf->lf_npending_writes == 0);
         /** fallthrough */
         case INIT:
-            /** Test if list is initialized before freeing it */
-            if (lf->lf_blockbuf_list.mlist_versno != 0)
-            {
-                mlist_done(&lf->lf_blockbuf_list);
-            }
+            logring_free_all(lf);
+            free(lf->lf_batch);
+            lf->lf_batch = NULL;
             logfile_free_memory(lf);
             lf->lf_state = DONE;
         /** fallthrough */
@@ -2069,6 +1980,162 @@ static void filewriter_done(filewriter_t* fw)
     }
 }
 
+/**
+ * Append a warning about dropped messages to the batch buffer.
+ *
+ * @param batch   The batch buffer
+ * @param used    Bytes used in the batch buffer
+ * @param dropped Number of dropped messages
+ *
+ * @return Bytes used in the batch buffer after the warning
+ */
+static size_t logfile_add_drop_warning(char* batch, size_t used, int64_t dropped)
+{
+    size_t timestamp_len = get_timestamp_len();
+    size_t len = snprint_timestamp(batch + used, timestamp_len);
+
+    len += snprintf(batch + used + len, LOG_WRITE_BATCH - used - len,
+                    "warning: %ld log messages were dropped because the log "
+                    "buffer of a thread was full.\n", (long)dropped);
+
+    return used + len;
+}
+
+/**
+ * Write the messages in the rings of a log file in the order they were logged.
+ *
+ * Messages are copied into a batch buffer which is written to the file when
+ * it fills up. Only the messages that have been committed when the function
+ * is called are written so that a constant stream of new messages doesn't keep
+ * the file writer from handling flush and rotate requests. The writing stops
+ * at a gap in the sequence numbers so that messages of different threads are
+ * never written out of order.
+ *
+ * @param lf    logfile pointer
+ * @param file  The log file
+ * @param sync  Whether the file must be synced even if no message asks for it
+ *
+ * @return 0 on success, errno of the failed write otherwise
+ */
+static int logfile_write_rings(logfile_t* lf, skygw_file_t* file, bool sync)
+{
+    char*   batch = lf->lf_batch;
+    size_t  used = 0;
+    int     err = 0;
+    int64_t dropped = 0;
+    bool    more = false;
+
+    /** The messages logged after this will wake the file writer again */
+    __sync_lock_test_and_set(&lf->lf_signaled, 0);
+    __sync_synchronize();
+    int64_t last_seqno = log_seqno;
+
+    while (true)
+    {
+        logring_t* oldest = NULL;
+        logrec_t*  oldest_rec = NULL;
+
+        /** Merge the rings by picking the message with the smallest sequence number */
+        for (logring_t* ring = lf->lf_rings; ring; ring = ring->lr_next)
+        {
+            logrec_t* rec = logring_peek(ring);
+
+            if (rec && (oldest_rec == NULL || rec->lr_seqno < oldest_rec->lr_seqno))
+            {
+                oldest = ring;
+                oldest_rec = rec;
+            }
+        }
+
+        if (oldest_rec == NULL)
+        {
+            break;
+        }
+        else if (oldest_rec->lr_seqno >= last_seqno)
+        {
+            more = true;
+            break;
+        }
+        else if (oldest_rec->lr_seqno != lf->lf_next_seqno)
+        {
+            /**
+             * A message with a smaller sequence number is still being
+             * committed by another thread. It wakes the file writer once
+             * it is visible and the messages are written then.
+             */
+            break;
+        }
+
+        if (used + oldest_rec->lr_len > LOG_WRITE_BATCH)
+        {
+            if (err == 0 && fwrite(batch, used, 1, file->sf_file) != 1)
+            {
+                err = errno;
+            }
+            used = 0;
+        }
+
+        memcpy(batch + used, oldest_rec + 1, oldest_rec->lr_len);
+        used += oldest_rec->lr_len;
+        sync = sync || oldest_rec->lr_flush;
+        lf->lf_next_seqno = oldest_rec->lr_seqno + 1;
+        logring_pop(oldest, oldest_rec);
+    }
+
+    for (logring_t* ring = lf->lf_rings; ring; ring = ring->lr_next)
+    {
+        int64_t ring_dropped = ring->lr_dropped;
+
+        dropped += ring_dropped - ring->lr_dropped_reported;
+        ring->lr_dropped_reported = ring_dropped;
+
+        /** The ring of an exited thread can be reused once it is empty */
+        if (ring->lr_state == RING_ABANDONED && ring->lr_head == ring->lr_tail)
+        {
+            ring->lr_state = RING_FREE;
+        }
+    }
+
+    if (dropped > 0)
+    {
+        if (used + MAX_LOGSTRLEN > LOG_WRITE_BATCH)
+        {
+            if (err == 0 && fwrite(batch, used, 1, file->sf_file) != 1)
+            {
+                err = errno;
+            }
+            used = 0;
+        }
+
+        used = logfile_add_drop_warning(batch, used, dropped);
+    }
+
+    if (err == 0 && used > 0 && fwrite(batch, used, 1, file->sf_file) != 1)
+    {
+        err = errno;
+    }
+
+    /**
+     * The data is always handed over to the OS but it is synced to disk only
+     * when a message or a flush request asks for it. This is done here in the
+     * file writer so the logging threads never wait for the disk.
+     */
+    fflush(file->sf_file);
+
+    if (sync && err == 0)
+    {
+        fsync(fileno(file->sf_file));
+    }
+
+    if (more)
+    {
+        /** Newer messages were left in the rings, process them on the next round */
+        skygw_message_send(lf->lf_logmes);
+    }
+
+    return err;
+}
+
 static bool thr_flush_file(logmanager_t *lm, filewriter_t *fwr)
 {
     /**
@@ -2123,92 +2190,21 @@ static bool thr_flush_file(logmanager_t *lm, filewriter_t *fwr)
         }
         return true;
     }
-    /**
-     * get logfile's block buffer list
-     */
-    mlist_t *bb_list = &lf->lf_blockbuf_list;
-#if defined(SS_DEBUG)
-    simple_mutex_lock(&bb_list->mlist_mutex, true);
-    CHK_MLIST(bb_list);
-    simple_mutex_unlock(&bb_list->mlist_mutex);
-#endif
-    mlist_node_t *node = bb_list->mlist_first;
+    int err = logfile_write_rings(lf, file, flush_logfile || do_flushall);
 
-    while (node != NULL)
+    if (err)
     {
-        int err = 0;
-
-        CHK_MLIST_NODE(node);
-        blockbuf_t *bb = (blockbuf_t *)node->mlnode_data;
-        CHK_BLOCKBUF(bb);
+        // TODO: Log this to syslog.
+        char errbuf[STRERROR_BUFLEN];
+        fprintf(stderr,
+                "Error : Writing to the log-file %s failed due to (%d, %s). "
+                "Disabling writing to the log.",
+                lf->lf_full_file_name,
+                err,
+                strerror_r(err, errbuf, sizeof(errbuf)));
 
-        /** Lock block buffer */
-        simple_mutex_lock(&bb->bb_mutex, true);
-
-        blockbuf_state_t flush_blockbuf = bb->bb_state;
-
-        if (bb->bb_buf_used != 0 &&
-            ((flush_blockbuf == BB_FULL) || flush_logfile || do_flushall))
-        {
-            /**
-             * buffer is at least half-full
-             * -> write to disk
-             */
-            while (bb->bb_refcount > 0)
-            {
-                simple_mutex_unlock(&bb->bb_mutex);
-                simple_mutex_lock(&bb->bb_mutex, true);
-            }
-            err = skygw_file_write(file,
-                                   (void *)bb->bb_buf,
-                                   bb->bb_buf_used,
-                                   (flush_logfile || do_flushall));
-            if (err)
-            {
-                // TODO: Log this to syslog.
-                char errbuf[STRERROR_BUFLEN];
-                fprintf(stderr,
-                        "Error : Writing to the log-file %s failed due to (%d, %s). "
-                        "Disabling writing to the log.",
-                        lf->lf_full_file_name,
-                        err,
-                        strerror_r(err, errbuf, sizeof(errbuf)));
-
-                mxs_log_set_maxlog_enabled(false);
-            }
-            /**
-             * Reset buffer's counters and mark
-             * not full.
-             */
-            bb->bb_buf_left = bb->bb_buf_size;
-            bb->bb_buf_used = 0;
-            memset(bb->bb_buf, 0, bb->bb_buf_size);
-            bb->bb_state = BB_CLEARED;
-#if defined(SS_LOG_DEBUG)
-            sprintf(bb->bb_buf, "[block:%d]", atomic_add(&block_start_index, 1));
-            bb->bb_buf_used += strlen(bb->bb_buf);
-            bb->bb_buf_left -= strlen(bb->bb_buf);
-#endif
-
-        }
-        /** Release lock to block buffer */
-        simple_mutex_unlock(&bb->bb_mutex);
-
-        size_t vn1;
-        size_t vn2;
-        /** Consistent lock-free read on the list */
-        do
-        {
-            while ((vn1 = bb_list->mlist_versno) % 2 != 0)
-            {
-                continue;
-            }
-            node = node->mlnode_next;
-            vn2 = bb_list->mlist_versno;
-        }
-        while (vn1 != vn2 && node);
-
-    } /* while (node != NULL) */
+        mxs_log_set_maxlog_enabled(false);
+    }
 
     /**
      * Writer's exit flag was set after checking it.
@@ -2229,7 +2225,7 @@ static bool thr_flush_file(logmanager_t *lm, filewriter_t *fwr)
 }
 
 /**
- * @node Writes block buffers of logfiles to physical log files on disk.
+ * @node Writes the log rings of the threads to the physical log file on disk.
  *
  * Parameters:
  * @param data - thread context, skygw_thread_t
@@ -2238,38 +2234,26 @@ static bool thr_flush_file(logmanager_t *lm, filewriter_t *fwr)
  * @return
  *
  *
- * @details Waits until receives wake-up message. Scans through block buffer
- * lists of each logfile object.
+ * @details Waits until receives wake-up message. Each thread that logs has
+ * its own ring where it formats its messages. The file writer merges the
+ * messages of all rings in the order of their sequence numbers into a batch
+ * buffer and writes the buffer to the log file.
  *
- * Block buffer is written to log file if
- * 1. bb_state == true,
+ * Log file is synced (fsync'd) if
+ * 1. a message that must be flushed was written,
  * 2. logfile object's lf_flushflag == true, or
  * 3. skygw_thread_must_exit returns true.
  *
- * Log file is flushed (fsync'd) in cases #2 and #3.
- *
- * Concurrency control : block buffer is accessed by file writer (this) and
- * log clients. File writer reads and sets each logfile object's flushflag
- * with spinlock. Another protected section is when block buffer's metadata is
- * read, and optionally the write operation.
- *
- * When block buffer is marked full, logfile's flushflag is set, other
- * log clients don't try to access buffer(s). There may, however, be
- * active writes, on the block in parallel with file writer operations.
- * Each active write corresponds to bb_refcounter values.
- * On the other hand, file writer doesn't process the block buffer before
- * its refcount is zero.
- *
- * Every log file obj. has its own block buffer (linked) list.
- * List is accessed by log clients, which add nodes if necessary, and
- * by file writer which traverses the list and accesses block buffers
- * included in list nodes.
- * List modifications are protected with version numbers.
- * Before
- modification, version is increased by one to be odd. After the
- * completion, it is increased again to even. List can be read only when
- * version is even and read is consistent only if version hasn't changed
- * during the read.
+ * Concurrency control : a ring is accessed by the thread owning it and the
+ * file writer. The owner only moves the tail of the ring and the file writer
+ * only moves the head so neither has to lock the ring. If a ring is full, the
+ * message is dropped and the file writer adds a warning with the number of
+ * dropped messages to the log. The file writer reads and sets logfile
+ * object's flushflag and rotateflag with spinlock.
+ *
+ * The rings are in a list that is only added to while the log file is open.
+ * The ring of an exited thread is reused by the next new thread once the
+ * file writer has written all of its messages.
  */
 static void* thr_filewriter_fun(void* data)
 {
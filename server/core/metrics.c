@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file metrics.c - Metrics in the Prometheus text exposition format
+ */
+
+#include <metrics.h>
+#include <maxconfig.h>
+#include <buffer.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+/**
+ * Allocate the state of a metrics response
+ *
+ * @param dcb The DCB where the metrics are written
+ * @return New metrics state or NULL if memory allocation failed
+ */
+MXS_METRICS* metrics_alloc(DCB *dcb)
+{
+    MXS_METRICS *metrics = malloc(sizeof(MXS_METRICS));
+
+    if (metrics)
+    {
+        metrics->dcb = dcb;
+        metrics->len = 0;
+    }
+
+    return metrics;
+}
+
+/**
+ * Write out the remaining metrics and free the state
+ *
+ * @param metrics Metrics to free
+ */
+void metrics_free(MXS_METRICS *metrics)
+{
+    if (metrics)
+    {
+        metrics_flush(metrics);
+        free(metrics);
+    }
+}
+
+/**
+ * Write the buffered output to the client
+ *
+ * @param metrics Metrics state
+ */
+void metrics_flush(MXS_METRICS *metrics)
+{
+    if (metrics->len > 0)
+    {
+        GWBUF *buf = gwbuf_alloc_and_load(metrics->len, metrics->buf);
+
+        if (buf)
+        {
+            metrics->dcb->func.write(metrics->dcb, buf);
+        }
+
+        metrics->len = 0;
+    }
+}
+
+/**
+ * Append formatted output to the buffer, flushing it if the output doesn't fit
+ *
+ * @param metrics Metrics state
+ * @param fmt     Format string
+ */
+static void metrics_printf(MXS_METRICS *metrics, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void metrics_printf(MXS_METRICS *metrics, const char *fmt, ...)
+{
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        size_t avail = METRICS_BUFSIZE - metrics->len;
+        va_list args;
+        va_start(args, fmt);
+        int n = vsnprintf(metrics->buf + metrics->len, avail, fmt, args);
+        va_end(args);
+
+        if (n >= 0 && (size_t)n < avail)
+        {
+            metrics->len += n;
+            return;
+        }
+
+        /** Lines are always much shorter than the buffer so one flush is enough */
+        metrics_flush(metrics);
+    }
+}
+
+/**
+ * Write the HELP and TYPE lines of a metric family
+ *
+ * @param metrics Metrics state
+ * @param name    Name of the metric without METRICS_PREFIX
+ * @param type    The type: counter, gauge or summary
+ * @param help    Description of the metric
+ */
+void metrics_header(MXS_METRICS *metrics, const char *name, const char *type, const char *help)
+{
+    metrics_printf(metrics, "# HELP " METRICS_PREFIX "%s %s\n# TYPE " METRICS_PREFIX "%s %s\n",
+                   name, help, name, type);
+}
+
+/**
+ * Write a sample with a floating point value
+ *
+ * @param metrics Metrics state
+ * @param name    Name of the metric without METRICS_PREFIX
+ * @param labels  Label list created with metrics_label or NULL
+ * @param value   The value
+ */
+void metrics_value(MXS_METRICS *metrics, const char *name, const char *labels, double value)
+{
+    if (labels && *labels)
+    {
+        metrics_printf(metrics, METRICS_PREFIX "%s{%s} %.17g\n", name, labels, value);
+    }
+    else
+    {
+        metrics_printf(metrics, METRICS_PREFIX "%s %.17g\n", name, value);
+    }
+}
+
+/**
+ * Write a sample with an integer value
+ *
+ * @param metrics Metrics state
+ * @param name    Name of the metric without METRICS_PREFIX
+ * @param labels  Label list created with metrics_label or NULL
+ * @param value   The value
+ */
+void metrics_int(MXS_METRICS *metrics, const char *name, const char *labels, int64_t value)
+{
+    if (labels && *labels)
+    {
+        metrics_printf(metrics, METRICS_PREFIX "%s{%s} %" PRId64 "\n", name, labels, value);
+    }
+    else
+    {
+        metrics_printf(metrics, METRICS_PREFIX "%s %" PRId64 "\n", name, value);
+    }
+}
+
+/**
+ * Read a histogram into a summary with the configured latency percentiles
+ *
+ * @param metrics Metrics state
+ * @param hist    The histogram, NULL if nothing has been recorded
+ * @param scale   Multiplier that converts the recorded values to the unit
+ *                of the metric
+ * @param summary Where the values are stored
+ */
+void metrics_summary_read(MXS_METRICS *metrics, ts_histogram_t *hist, double scale,
+                          MXS_METRICS_SUMMARY *summary)
+{
+    const double *percentiles;
+    int n_percentiles = config_latency_percentiles(&percentiles);
+
+    ts_histogram_merge(hist, &metrics->snapshot);
+
+    for (int i = 0; i < n_percentiles; i++)
+    {
+        summary->quantiles[i] = ts_histogram_percentile(&metrics->snapshot, percentiles[i]) * scale;
+    }
+
+    summary->sum = metrics->snapshot.sum * scale;
+    summary->count = metrics->snapshot.count;
+}
+
+/**
+ * Write a summary read with metrics_summary_read
+ *
+ * @param metrics Metrics state
+ * @param name    Name of the metric without METRICS_PREFIX
+ * @param labels  Label list created with metrics_label or NULL
+ * @param summary The values of the summary
+ */
+void metrics_summary_write(MXS_METRICS *metrics, const char *name, const char *labels,
+                           const MXS_METRICS_SUMMARY *summary)
+{
+    const double *percentiles;
+    int n_percentiles = config_latency_percentiles(&percentiles);
+    const char *sep = labels && *labels ? "," : "";
+
+    if (labels == NULL)
+    {
+        labels = "";
+    }
+
+    for (int i = 0; i < n_percentiles; i++)
+    {
+        metrics_printf(metrics, METRICS_PREFIX "%s{%s%squantile=\"%g\"} %.17g\n",
+                       name, labels, sep, percentiles[i] / 100.0, summary->quantiles[i]);
+    }
+
+    if (*labels)
+    {
+        metrics_printf(metrics, METRICS_PREFIX "%s_sum{%s} %.17g\n" METRICS_PREFIX "%s_count{%s} %" PRId64 "\n",
+                       name, labels, summary->sum, name, labels, summary->count);
+    }
+    else
+    {
+        metrics_printf(metrics, METRICS_PREFIX "%s_sum %.17g\n" METRICS_PREFIX "%s_count %" PRId64 "\n",
+                       name, summary->sum, name, summary->count);
+    }
+}
+
+/**
+ * Write a histogram as a summary with the configured latency percentiles
+ *
+ * @param metrics Metrics state
+ * @param name    Name of the metric without METRICS_PREFIX
+ * @param labels  Label list created with metrics_label or NULL
+ * @param hist    The histogram, NULL if nothing has been recorded
+ * @param scale   Multiplier that converts the recorded values to the unit
+ *                of the metric
+ */
+void metrics_summary(MXS_METRICS *metrics, const char *name, const char *labels,
+                     ts_histogram_t *hist, double scale)
+{
+    MXS_METRICS_SUMMARY summary;
+
+    metrics_summary_read(metrics, hist, scale, &summary);
+    metrics_summary_write(metrics, name, labels, &summary);
+}
+
+/**
+ * Create a label list with one label
+ *
+ * Backslashes, double quotes and newlines in the value are escaped.
+ *
+ * @param dest  Where the label is stored
+ * @param size  Size of @c dest
+ * @param name  Name of the label
+ * @param value Value of the label
+ */
+void metrics_label(char *dest, size_t size, const char *name, const char *value)
+{
+    int n = snprintf(dest, size, "%s=\"", name);
+    size_t len = n > 0 && (size_t)n < size ? n : 0;
+
+    for (const char *ptr = value; *ptr && len + 4 < size; ptr++)
+    {
+        switch (*ptr)
+        {
+        case '\\':
+        case '"':
+            dest[len++] = '\\';
+            dest[len++] = *ptr;
+            break;
+
+        case '\n':
+            dest[len++] = '\\';
+            dest[len++] = 'n';
+            break;
+
+        default:
+            dest[len++] = *ptr;
+            break;
+        }
+    }
+
+    dest[len++] = '"';
+    dest[len] = '\0';
+}
+
+/**
+ * Get the name of a metric type
+ *
+ * @param type The type
+ * @return The name used in the TYPE line
+ */
+const char* metrics_type_str(metric_type_t type)
+{
+    return type == METRIC_COUNTER ? "counter" : "gauge";
+}
@@ -0,0 +1,289 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file mxs_crc32.c - CRC32 checksums
+ */
+
+#include <mxs_crc32.h>
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__clang__) || __GNUC__ > 4 || \
+                            (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define CRC32_HAVE_CLMUL 1
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+/** The reflected CRC-32 polynomial */
+#define CRC32_POLY 0xedb88320
+
+/** Buffers shorter than this are not worth the setup of the folding */
+#define CRC32_CLMUL_MIN 64
+
+static uint32_t crc32_table[16][256];
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+static uint32_t (*crc32_func)(uint32_t crc, const uint8_t *buf, size_t len);
+static const char *crc32_name;
+
+/**
+ * Calculate the checksum one byte at a time
+ *
+ * @param crc Inverted checksum of the preceding data
+ * @param buf Data to checksum
+ * @param len Length of the data
+ * @return Inverted checksum
+ */
+static inline uint32_t crc32_bytes(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    while (len--)
+    {
+        crc = crc32_table[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+/**
+ * Calculate the checksum 16 bytes at a time with table lookups
+ *
+ * @param crc Inverted checksum of the preceding data
+ * @param buf Data to checksum
+ * @param len Length of the data
+ * @return Inverted checksum
+ */
+static uint32_t crc32_slice16(uint32_t crc, const uint8_t *buf, size_t len)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    const uint32_t (*t)[256] = (const uint32_t (*)[256])crc32_table;
+
+    while (len >= 16)
+    {
+        uint32_t w[4];
+        memcpy(w, buf, sizeof(w));
+        w[0] ^= crc;
+
+        crc = t[15][w[0] & 0xff] ^ t[14][(w[0] >> 8) & 0xff] ^
+              t[13][(w[0] >> 16) & 0xff] ^ t[12][w[0] >> 24] ^
+              t[11][w[1] & 0xff] ^ t[10][(w[1] >> 8) & 0xff] ^
+              t[9][(w[1] >> 16) & 0xff] ^ t[8][w[1] >> 24] ^
+              t[7][w[2] & 0xff] ^ t[6][(w[2] >> 8) & 0xff] ^
+              t[5][(w[2] >> 16) & 0xff] ^ t[4][w[2] >> 24] ^
+              t[3][w[3] & 0xff] ^ t[2][(w[3] >> 8) & 0xff] ^
+              t[1][(w[3] >> 16) & 0xff] ^ t[0][w[3] >> 24];
+
+        buf += 16;
+        len -= 16;
+    }
+#endif
+
+    return crc32_bytes(crc, buf, len);
+}
+
+#ifdef CRC32_HAVE_CLMUL
+
+/**
+ * Calculate the checksum by folding the data with carry-less multiplication
+ *
+ * This is the algorithm described in the Intel paper "Fast CRC Computation
+ * for Generic Polynomials Using PCLMULQDQ Instruction". The data is folded
+ * 64 bytes at a time into four 128-bit lanes which are then folded into one
+ * and reduced to 32 bits with Barrett reduction.
+ *
+ * @param crc Inverted checksum of the preceding data
+ * @param buf Data to checksum
+ * @param len Length of the data, at least CRC32_CLMUL_MIN bytes and a multiple of 16
+ * @return Inverted checksum
+ */
+__attribute__((target("sse2,pclmul")))
+static uint32_t crc32_clmul_fold(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    static const uint64_t k1k2[2] __attribute__((aligned(16))) = {0x0154442bd4, 0x01c6e41596};
+    static const uint64_t k3k4[2] __attribute__((aligned(16))) = {0x01751997d0, 0x00ccaa009e};
+    static const uint64_t k5k0[2] __attribute__((aligned(16))) = {0x0163cd6124, 0x0000000000};
+    static const uint64_t poly[2] __attribute__((aligned(16))) = {0x01db710641, 0x01f7011641};
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+    x1 = _mm_loadu_si128((const __m128i*)(buf + 0x00));
+    x2 = _mm_loadu_si128((const __m128i*)(buf + 0x10));
+    x3 = _mm_loadu_si128((const __m128i*)(buf + 0x20));
+    x4 = _mm_loadu_si128((const __m128i*)(buf + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+    x0 = _mm_load_si128((const __m128i*)k1k2);
+    buf += 64;
+    len -= 64;
+
+    /** Fold four lanes of 16 bytes in parallel */
+    while (len >= 64)
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*)(buf + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i*)(buf + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i*)(buf + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i*)(buf + 0x30)));
+        buf += 64;
+        len -= 64;
+    }
+
+    /** Fold the four lanes into one */
+    x0 = _mm_load_si128((const __m128i*)k3k4);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    /** Fold the remaining blocks of 16 bytes */
+    while (len >= 16)
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i*)buf)), x5);
+        buf += 16;
+        len -= 16;
+    }
+
+    /** Fold 128 bits into 64 bits */
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+    x0 = _mm_loadl_epi64((const __m128i*)k5k0);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    /** Barrett reduction to 32 bits */
+    x0 = _mm_load_si128((const __m128i*)poly);
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return _mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+
+/**
+ * Calculate the checksum with carry-less multiplication, the tail that
+ * does not fill a block of 16 bytes is done with table lookups
+ *
+ * @param crc Inverted checksum of the preceding data
+ * @param buf Data to checksum
+ * @param len Length of the data
+ * @return Inverted checksum
+ */
+static uint32_t crc32_clmul(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    if (len >= CRC32_CLMUL_MIN)
+    {
+        size_t n = len & ~(size_t)15;
+        crc = crc32_clmul_fold(crc, buf, n);
+        buf += n;
+        len -= n;
+    }
+
+    return crc32_slice16(crc, buf, len);
+}
+
+#endif
+
+/**
+ * Build the lookup tables and select the implementation
+ */
+static void crc32_init()
+{
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t crc = n;
+
+        for (int k = 0; k < 8; k++)
+        {
+            crc = crc & 1 ? (crc >> 1) ^ CRC32_POLY : crc >> 1;
+        }
+
+        crc32_table[0][n] = crc;
+    }
+
+    for (int k = 1; k < 16; k++)
+    {
+        for (int n = 0; n < 256; n++)
+        {
+            uint32_t prev = crc32_table[k - 1][n];
+            crc32_table[k][n] = (prev >> 8) ^ crc32_table[0][prev & 0xff];
+        }
+    }
+
+    crc32_func = crc32_slice16;
+    crc32_name = "slice-by-16";
+
+#ifdef CRC32_HAVE_CLMUL
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("sse2") && __builtin_cpu_supports("pclmul"))
+    {
+        crc32_func = crc32_clmul;
+        crc32_name = "pclmul";
+    }
+#endif
+}
+
+/**
+ * Calculate a CRC32 checksum
+ *
+ * The function is a drop-in replacement for zlib's crc32(): the checksum of
+ * data that is split into several parts is calculated by passing the checksum
+ * of the preceding parts as @c crc.
+ *
+ * @param crc Checksum of the preceding data, 0 for the first part
+ * @param buf Data to checksum, if NULL the initial value 0 is returned
+ * @param len Length of the data
+ * @return The checksum
+ */
+uint32_t mxs_crc32(uint32_t crc, const void *buf, size_t len)
+{
+    if (buf == NULL)
+    {
+        return 0;
+    }
+
+    pthread_once(&crc32_once, crc32_init);
+    return ~crc32_func(~crc, (const uint8_t*)buf, len);
+}
+
+/**
+ * Get the name of the selected implementation
+ *
+ * @return "pclmul" or "slice-by-16"
+ */
+const char* mxs_crc32_impl()
+{
+    pthread_once(&crc32_once, crc32_init);
+    return crc32_name;
+}
@@ -21,10 +21,13 @@
  */
 
 #include <mysql_utils.h>
+#include <mysql_client_server_protocol.h>
 #include <string.h>
 #include <stdbool.h>
 #include <log_manager.h>
 #include <skygw_debug.h>
+#include <service.h>
+#include <statistics.h>
 
 /**
  * @brief Calculate the length of a length-encoded integer in bytes
@@ -145,7 +148,361 @@ char* lestr_consume(uint8_t** c, size_t *size)
     return start;
 }
 
+/** Packets with a payload of this size are continued in the next packet */
+#define REPLY_MAX_PAYLOAD 0xffffff
 
+/** The largest part of a payload that is needed to interpret a packet */
+#define REPLY_PEEK_SIZE 32
+
+/**
+ * @brief Copy bytes from a buffer chain without modifying it
+ *
+ * @param link   Buffer to start from
+ * @param offset Offset into @c link
+ * @param dest   Destination
+ * @param len    Number of bytes to copy
+ * @return Number of bytes copied
+ */
+static size_t reply_peek(GWBUF *link, size_t offset, uint8_t *dest, size_t len)
+{
+    size_t copied = 0;
+
+    while (link && copied < len)
+    {
+        size_t avail = GWBUF_LENGTH(link) - offset;
+        size_t n = avail < len - copied ? avail : len - copied;
+        memcpy(dest + copied, (uint8_t*)GWBUF_DATA(link) + offset, n);
+        copied += n;
+        link = link->next;
+        offset = 0;
+    }
+
+    return copied;
+}
+
+/**
+ * @brief Advance a position in a buffer chain
+ *
+ * @param link   Pointer to the current buffer, updated to the new buffer
+ * @param offset Pointer to the offset in the current buffer
+ * @param len    Number of bytes to skip
+ * @return True if @c len bytes could be skipped
+ */
+static bool reply_skip(GWBUF **link, size_t *offset, size_t len)
+{
+    while (*link)
+    {
+        size_t avail = GWBUF_LENGTH(*link) - *offset;
+
+        if (len < avail)
+        {
+            *offset += len;
+            return true;
+        }
+
+        len -= avail;
+        *link = (*link)->next;
+        *offset = 0;
+
+        if (len == 0)
+        {
+            return true;
+        }
+    }
+
+    return len == 0;
+}
+
+/** Check whether a packet is an EOF packet */
+static inline bool reply_is_eof(const uint8_t *payload, size_t len)
+{
+    return payload[0] == 0xfe && len < 9;
+}
+
+/** Read the server status of an EOF packet */
+static inline uint16_t reply_eof_status(const uint8_t *payload)
+{
+    return payload[3] | (payload[4] << 8);
+}
+
+/**
+ * @brief Process the first packet of a reply
+ *
+ * @param reply   Reply being tracked
+ * @param payload Start of the packet payload
+ * @param len     Length of the payload
+ * @param copied  Number of bytes of the payload available in @c payload
+ */
+static void reply_process_first(mxs_mysql_reply_t *reply, uint8_t *payload, size_t len, size_t copied)
+{
+    switch (payload[0])
+    {
+    case 0x00:
+        if (reply->command == MYSQL_COM_STMT_PREPARE)
+        {
+            /** Statement ID, number of columns and number of parameters */
+            uint16_t columns = copied >= 7 ? payload[5] | (payload[6] << 8) : 0;
+            uint16_t params = copied >= 9 ? payload[7] | (payload[8] << 8) : 0;
+            reply->n_eof = (columns > 0) + (params > 0);
+            reply->state = reply->n_eof ? MXS_REPLY_PREPARE : MXS_REPLY_DONE;
+        }
+        else
+        {
+            /** Skip the affected rows and read the last insert ID */
+            uint8_t *ptr = payload + 1;
+            reply->status = 0;
+            reply->warnings = 0;
+            leint_consume(&ptr);
+            reply->insert_id = leint_consume(&ptr);
+
+            if (ptr + 2 <= payload + copied)
+            {
+                reply->status = ptr[0] | (ptr[1] << 8);
+            }
+
+            if (ptr + 4 <= payload + copied)
+            {
+                reply->warnings = ptr[2] | (ptr[3] << 8);
+            }
+
+            reply->state = (reply->status & SERVER_MORE_RESULTS_EXIST) ?
+                           MXS_REPLY_START : MXS_REPLY_DONE;
+        }
+        break;
+
+    case 0xff:
+        reply->error = copied >= 3 ? payload[1] | (payload[2] << 8) : 0;
+        reply->state = MXS_REPLY_DONE;
+        break;
+
+    case 0xfb:
+    case 0xfe:
+        /** LOAD DATA LOCAL INFILE request or an authentication switch
+         * request, the rest of the exchange is driven by the client. */
+        reply->state = MXS_REPLY_DONE;
+        break;
+
+    default:
+        if (reply->command == MYSQL_COM_FIELD_LIST)
+        {
+            /** The reply is a list of column definitions */
+            reply->state = MXS_REPLY_COLDEF;
+        }
+        else if (reply->command == MYSQL_COM_STATISTICS)
+        {
+            /** The reply is a single string */
+            reply->state = MXS_REPLY_DONE;
+        }
+        else
+        {
+            /** The column count of a result set */
+            reply->state = MXS_REPLY_COLDEF;
+        }
+        break;
+    }
+}
+
+/**
+ * @brief Process one packet of a reply
+ *
+ * @param reply   Reply being tracked
+ * @param payload Start of the packet payload
+ * @param len     Length of the payload
+ * @param copied  Number of bytes of the payload available in @c payload
+ */
+static void reply_process_packet(mxs_mysql_reply_t *reply, uint8_t *payload, size_t len, size_t copied)
+{
+    if (copied == 0)
+    {
+        return;
+    }
+
+    switch (reply->state)
+    {
+    case MXS_REPLY_START:
+        reply_process_first(reply, payload, len, copied);
+        break;
+
+    case MXS_REPLY_COLDEF:
+        if (reply_is_eof(payload, len))
+        {
+            reply->state = reply->command == MYSQL_COM_FIELD_LIST ?
+                           MXS_REPLY_DONE : MXS_REPLY_ROWS;
+        }
+        break;
+
+    case MXS_REPLY_ROWS:
+        if (reply_is_eof(payload, len))
+        {
+            reply->status = copied >= 5 ? reply_eof_status(payload) : 0;
+            reply->warnings = copied >= 5 ? payload[1] | (payload[2] << 8) : 0;
+            reply->state = (reply->status & SERVER_MORE_RESULTS_EXIST) ?
+                           MXS_REPLY_START : MXS_REPLY_DONE;
+        }
+        else if (payload[0] == 0xff)
+        {
+            reply->error = copied >= 3 ? payload[1] | (payload[2] << 8) : 0;
+            reply->state = MXS_REPLY_DONE;
+        }
+        else
+        {
+            reply->rows++;
+        }
+        break;
+
+    case MXS_REPLY_PREPARE:
+        if (reply_is_eof(payload, len) && --reply->n_eof == 0)
+        {
+            reply->state = MXS_REPLY_DONE;
+        }
+        break;
+
+    case MXS_REPLY_DONE:
+        break;
+    }
+}
+
+/**
+ * @brief Check whether a command is answered by the server
+ *
+ * @param command The command byte
+ * @return True if the server sends a reply to the command
+ */
+bool mxs_mysql_command_has_reply(uint8_t command)
+{
+    return command != MYSQL_COM_QUIT &&
+           command != MYSQL_COM_STMT_SEND_LONG_DATA &&
+           command != MYSQL_COM_STMT_CLOSE;
+}
+
+/**
+ * @brief Start tracking the reply to a command
+ *
+ * @param reply   Reply to initialize
+ * @param command The command that was sent to the server
+ */
+void mxs_mysql_reply_start(mxs_mysql_reply_t *reply, uint8_t command)
+{
+    memset(reply, 0, sizeof(*reply));
+    reply->command = command;
+
+    if (!mxs_mysql_command_has_reply(command))
+    {
+        reply->state = MXS_REPLY_DONE;
+    }
+    else if (command == MYSQL_COM_STMT_FETCH)
+    {
+        /** Rows of an open cursor followed by an EOF packet */
+        reply->state = MXS_REPLY_ROWS;
+    }
+    else
+    {
+        reply->state = MXS_REPLY_START;
+    }
+}
+
+/**
+ * @brief Process a part of a reply
+ *
+ * The buffer must contain only complete packets. The buffer is not modified.
+ *
+ * @param reply  Reply being tracked
+ * @param buffer Packets received from the server
+ * @return True if the reply is complete
+ */
+bool mxs_mysql_reply_process(mxs_mysql_reply_t *reply, GWBUF *buffer)
+{
+    GWBUF *link = buffer;
+    size_t offset = 0;
+    uint8_t header[MYSQL_HEADER_LEN];
+    uint8_t payload[REPLY_PEEK_SIZE];
+
+    while (reply->state != MXS_REPLY_DONE &&
+           reply_peek(link, offset, header, MYSQL_HEADER_LEN) == MYSQL_HEADER_LEN)
+    {
+        size_t len = header[0] | (header[1] << 8) | (header[2] << 16);
+        reply_skip(&link, &offset, MYSQL_HEADER_LEN);
+
+        /** Continuation packets of large packets are not interpreted */
+        if (!reply->large)
+        {
+            size_t peek = len < REPLY_PEEK_SIZE ? len : REPLY_PEEK_SIZE;
+            size_t copied = reply_peek(link, offset, payload, peek);
+            reply_process_packet(reply, payload, len, copied);
+        }
+
+        reply->large = len == REPLY_MAX_PAYLOAD;
+
+        if (!reply_skip(&link, &offset, len))
+        {
+            break;
+        }
+    }
+
+    return reply->state == MXS_REPLY_DONE;
+}
+
+/**
+ * @brief Check whether a reply is complete
+ *
+ * @param reply Reply to check
+ * @return True if the whole reply has been processed
+ */
+bool mxs_mysql_reply_is_complete(const mxs_mysql_reply_t *reply)
+{
+    return reply->state == MXS_REPLY_DONE;
+}
+
+/**
+ * @brief Start measuring the latency of a query
+ *
+ * @param latency Latency of the backend connection
+ * @param query   The query that was sent to the backend
+ */
+void mxs_mysql_latency_start(mxs_mysql_latency_t *latency, GWBUF *query)
+{
+    uint8_t command;
+
+    if (gwbuf_copy_data(query, MYSQL_HEADER_LEN, 1, &command) == 1 &&
+        mxs_mysql_command_has_reply(command))
+    {
+        mxs_mysql_reply_start(&latency->reply, command);
+        latency->sent = ts_stats_time_us();
+        latency->first_byte = 0;
+    }
+}
+
+/**
+ * @brief Follow the reply to a query and record its latency once it is complete
+ *
+ * @param latency Latency of the backend connection
+ * @param reply   Complete packets of the reply
+ * @param server  Server the reply came from
+ * @param service Service the query was routed by
+ */
+void mxs_mysql_latency_track(mxs_mysql_latency_t *latency, GWBUF *reply,
+                             SERVER *server, SERVICE *service)
+{
+    if (latency->sent && reply)
+    {
+        int64_t now = ts_stats_time_us();
+
+        if (latency->first_byte == 0)
+        {
+            latency->first_byte = now;
+        }
+
+        if (mxs_mysql_reply_process(&latency->reply, reply))
+        {
+            int64_t first_byte = latency->first_byte - latency->sent;
+            int64_t response_time = now - latency->sent;
+
+            server_add_response_time(server, first_byte, response_time);
+            service_add_response_time(service, first_byte, response_time);
+            latency->sent = 0;
+        }
+    }
+}
 
 /**
  * Creates a connection to a MySQL database engine. If necessary, initializes SSL.
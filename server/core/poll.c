@@ -13,6 +13,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <signal.h>
@@ -32,6 +33,7 @@
 #include <resultset.h>
 #include <session.h>
 #include <statistics.h>
+#include <metrics.h>
 #include <query_classifier.h>
 
 #define         PROFILE_POLL    0
@@ -168,6 +170,7 @@ static struct
     int evq_max;                /*< Maximum event queue length */
     int wake_evqpending;        /*< Woken from epoll_wait with pending events in queue */
     ts_stats_t *blockingpolls;  /*< Number of epoll_waits with a timeout specified */
+    ts_histogram_t *exectime;   /*< Event execution times in microseconds */
 } pollStats;
 
 #define N_QUEUE_TIMES   30
@@ -237,7 +240,8 @@ poll_init()
         (pollStats.n_pollev = ts_stats_alloc()) == NULL ||
         (pollStats.n_nbpollev = ts_stats_alloc()) == NULL ||
         (pollStats.n_nothreads = ts_stats_alloc()) == NULL ||
-        (pollStats.blockingpolls = ts_stats_alloc()) == NULL)
+        (pollStats.blockingpolls = ts_stats_alloc()) == NULL ||
+        (pollStats.exectime = ts_histogram_alloc()) == NULL)
     {
         perror("Fatal error: Memory allocation failed.");
         exit(-1);
@@ -869,6 +873,7 @@ process_pollq(int thread_id)
 #endif
     qtime = hkheartbeat - dcb->evq.inserted;
     dcb->evq.started = hkheartbeat;
+    int64_t started_us = ts_stats_time_us();
 
     if (qtime > N_QUEUE_TIMES)
     {
@@ -1110,6 +1115,7 @@ process_pollq(int thread_id)
         }
     }
 #endif
+    ts_histogram_record(pollStats.exectime, ts_stats_time_us() - started_us);
     qtime = hkheartbeat - dcb->evq.started;
 
     if (qtime > N_QUEUE_TIMES)
@@ -1254,25 +1260,25 @@ dprintPollStats(DCB *dcb)
     int i;
 
     dcb_printf(dcb, "\nPoll Statistics.\n\n");
-    dcb_printf(dcb, "No. of epoll cycles:                           %d\n",
+    dcb_printf(dcb, "No. of epoll cycles:                           %" PRId64 "\n",
                ts_stats_sum(pollStats.n_polls));
-    dcb_printf(dcb, "No. of epoll cycles with wait:                         %d\n",
+    dcb_printf(dcb, "No. of epoll cycles with wait:                         %" PRId64 "\n",
                ts_stats_sum(pollStats.blockingpolls));
-    dcb_printf(dcb, "No. of epoll calls returning events:           %d\n",
+    dcb_printf(dcb, "No. of epoll calls returning events:           %" PRId64 "\n",
                ts_stats_sum(pollStats.n_pollev));
-    dcb_printf(dcb, "No. of non-blocking calls returning events:    %d\n",
+    dcb_printf(dcb, "No. of non-blocking calls returning events:    %" PRId64 "\n",
                ts_stats_sum(pollStats.n_nbpollev));
-    dcb_printf(dcb, "No. of read events:                            %d\n",
+    dcb_printf(dcb, "No. of read events:                            %" PRId64 "\n",
                ts_stats_sum(pollStats.n_read));
-    dcb_printf(dcb, "No. of write events:                           %d\n",
+    dcb_printf(dcb, "No. of write events:                           %" PRId64 "\n",
                ts_stats_sum(pollStats.n_write));
-    dcb_printf(dcb, "No. of error events:                           %d\n",
+    dcb_printf(dcb, "No. of error events:                           %" PRId64 "\n",
                ts_stats_sum(pollStats.n_error));
-    dcb_printf(dcb, "No. of hangup events:                          %d\n",
+    dcb_printf(dcb, "No. of hangup events:                          %" PRId64 "\n",
                ts_stats_sum(pollStats.n_hup));
-    dcb_printf(dcb, "No. of accept events:                          %d\n",
+    dcb_printf(dcb, "No. of accept events:                          %" PRId64 "\n",
                ts_stats_sum(pollStats.n_accept));
-    dcb_printf(dcb, "No. of times no threads polling:               %d\n",
+    dcb_printf(dcb, "No. of times no threads polling:               %" PRId64 "\n",
                ts_stats_sum(pollStats.n_nothreads));
     dcb_printf(dcb, "Current event queue length:                    %d\n",
                pollStats.evq_length);
@@ -1358,30 +1364,38 @@ event_to_string(uint32_t event)
 }
 
 /**
- * Print the thread status for all the polling threads
+ * Calculate the 1, 5 and 15 minute averages of the thread load and of the
+ * pending event queue length from the samples collected by poll_loadav.
  *
- * @param dcb   The DCB to send the thread status data
+ * @param avg1   The 1 minute thread load average
+ * @param avg5   The 5 minute thread load average
+ * @param avg15  The 15 minute thread load average
+ * @param qavg1  The 1 minute pending event queue length average
+ * @param qavg5  The 5 minute pending event queue length average
+ * @param qavg15 The 15 minute pending event queue length average
  */
-void
-dShowThreads(DCB *dcb)
+static void
+poll_load_averages(double *avg1, double *avg5, double *avg15,
+                   double *qavg1, double *qavg5, double *qavg15)
 {
     int i, j, n;
-    char *state;
-    double avg1 = 0.0, avg5 = 0.0, avg15 = 0.0;
-    double qavg1 = 0.0, qavg5 = 0.0, qavg15 = 0.0;
 
-    dcb_printf(dcb, "Polling Threads.\n\n");
-    dcb_printf(dcb, "Historic Thread Load Average: %.2f.\n", load_average);
-    dcb_printf(dcb, "Current Thread Load Average: %.2f.\n", current_avg);
+    *avg1 = *avg5 = *avg15 = 0.0;
+    *qavg1 = *qavg5 = *qavg15 = 0.0;
+
+    if (avg_samples == NULL)
+    {
+        return;
+    }
 
     /* Average all the samples to get the 15 minute average */
     for (i = 0; i < n_avg_samples; i++)
     {
-        avg15 += avg_samples[i];
-        qavg15 += evqp_samples[i];
+        *avg15 += avg_samples[i];
+        *qavg15 += evqp_samples[i];
     }
-    avg15 = avg15 / n_avg_samples;
-    qavg15 = qavg15 / n_avg_samples;
+    *avg15 = *avg15 / n_avg_samples;
+    *qavg15 = *qavg15 / n_avg_samples;
 
     /* Average the last third of the samples to get the 5 minute average */
     n = 5 * 60 / POLL_LOAD_FREQ;
@@ -1392,11 +1406,11 @@ dShowThreads(DCB *dcb)
     }
     for (j = i; j < i + n; j++)
     {
-        avg5 += avg_samples[j % n_avg_samples];
-        qavg5 += evqp_samples[j % n_avg_samples];
+        *avg5 += avg_samples[j % n_avg_samples];
+        *qavg5 += evqp_samples[j % n_avg_samples];
     }
-    avg5 = (3 * avg5) / (n_avg_samples);
-    qavg5 = (3 * qavg5) / (n_avg_samples);
+    *avg5 = (3 * *avg5) / (n_avg_samples);
+    *qavg5 = (3 * *qavg5) / (n_avg_samples);
 
     /* Average the last 15th of the samples to get the 1 minute average */
     n =  60 / POLL_LOAD_FREQ;
@@ -1407,11 +1421,31 @@ dShowThreads(DCB *dcb)
     }
     for (j = i; j < i + n; j++)
     {
-        avg1 += avg_samples[j % n_avg_samples];
-        qavg1 += evqp_samples[j % n_avg_samples];
+        *avg1 += avg_samples[j % n_avg_samples];
+        *qavg1 += evqp_samples[j % n_avg_samples];
     }
-    avg1 = (15 * avg1) / (n_avg_samples);
-    qavg1 = (15 * qavg1) / (n_avg_samples);
+    *avg1 = (15 * *avg1) / (n_avg_samples);
+    *qavg1 = (15 * *qavg1) / (n_avg_samples);
+}
+
+/**
+ * Print the thread status for all the polling threads
+ *
+ * @param dcb   The DCB to send the thread status data
+ */
+void
+dShowThreads(DCB *dcb)
+{
+    int i;
+    char *state;
+    double avg1, avg5, avg15;
+    double qavg1, qavg5, qavg15;
+
+    dcb_printf(dcb, "Polling Threads.\n\n");
+    dcb_printf(dcb, "Historic Thread Load Average: %.2f.\n", load_average);
+    dcb_printf(dcb, "Current Thread Load Average: %.2f.\n", current_avg);
+
+    poll_load_averages(&avg1, &avg5, &avg15, &qavg1, &qavg5, &qavg15);
 
     dcb_printf(dcb, "15 Minute Average: %.2f, 5 Minute Average: %.2f, "
                "1 Minute Average: %.2f\n\n", avg15, avg5, avg1);
@@ -1817,6 +1851,24 @@ dShowEventStats(DCB *pdcb)
     }
     dcb_printf(pdcb, " > %2d00ms      | %-10d | %-10d\n", N_QUEUE_TIMES,
                queueStats.qtimes[N_QUEUE_TIMES], queueStats.exectimes[N_QUEUE_TIMES]);
+
+    ts_histogram_snapshot_t *exectime = malloc(sizeof(ts_histogram_snapshot_t));
+
+    if (exectime)
+    {
+        ts_histogram_merge(pollStats.exectime, exectime);
+        dcb_printf(pdcb, "\nEvent execution time distribution (microseconds).\n");
+        dcb_printf(pdcb, "Events:  %-10" PRId64 " Mean:    %-10" PRId64 "\n",
+                   exectime->count, ts_histogram_mean(exectime));
+        dcb_printf(pdcb, "Median:  %-10" PRId64 " 90th:    %-10" PRId64 "\n",
+                   ts_histogram_percentile(exectime, 50.0),
+                   ts_histogram_percentile(exectime, 90.0));
+        dcb_printf(pdcb, "99th:    %-10" PRId64 " 99.9th:  %-10" PRId64 "\n",
+                   ts_histogram_percentile(exectime, 99.0),
+                   ts_histogram_percentile(exectime, 99.9));
+        dcb_printf(pdcb, "Maximum: %-10" PRId64 "\n", exectime->max);
+        free(exectime);
+    }
 }
 
 /**
@@ -1825,7 +1877,7 @@ dShowEventStats(DCB *pdcb)
  * @param stat  The required statistic
  * @return      The value of that statistic
  */
-int
+int64_t
 poll_get_stat(POLL_STAT stat)
 {
     switch (stat)
@@ -1927,3 +1979,62 @@ eventTimesGetList()
 
     return set;
 }
+
+/**
+ * Write the polling and event queue statistics in the Prometheus format
+ *
+ * @param metrics The metrics being written
+ */
+void
+poll_metrics(MXS_METRICS *metrics)
+{
+    static const struct
+    {
+        const char *name;
+        const char *help;
+        POLL_STAT  stat;
+    } counters[] =
+    {
+        { "poll_read_events_total", "Number of read events", POLL_STAT_READ },
+        { "poll_write_events_total", "Number of write events", POLL_STAT_WRITE },
+        { "poll_error_events_total", "Number of error events", POLL_STAT_ERROR },
+        { "poll_hangup_events_total", "Number of hangup events", POLL_STAT_HANGUP },
+        { "poll_accept_events_total", "Number of accept events", POLL_STAT_ACCEPT },
+        { NULL }
+    };
+
+    for (int i = 0; counters[i].name; i++)
+    {
+        metrics_header(metrics, counters[i].name, "counter", counters[i].help);
+        metrics_int(metrics, counters[i].name, NULL, poll_get_stat(counters[i].stat));
+    }
+
+    metrics_header(metrics, "event_queue_length", "gauge", "Number of events in the event queue");
+    metrics_int(metrics, "event_queue_length", NULL, pollStats.evq_length);
+    metrics_header(metrics, "event_queue_pending", "gauge", "Number of pending events");
+    metrics_int(metrics, "event_queue_pending", NULL, pollStats.evq_pending);
+    metrics_header(metrics, "event_queue_max_length", "gauge", "Maximum event queue length");
+    metrics_int(metrics, "event_queue_max_length", NULL, pollStats.evq_max);
+
+    metrics_header(metrics, "event_execution_seconds", "summary", "Event execution time");
+    metrics_summary(metrics, "event_execution_seconds", NULL, pollStats.exectime, 1e-6);
+
+    double avg[3], qavg[3];
+    poll_load_averages(&avg[0], &avg[1], &avg[2], &qavg[0], &qavg[1], &qavg[2]);
+    static const char *periods[] = { "period=\"1m\"", "period=\"5m\"", "period=\"15m\"" };
+
+    metrics_header(metrics, "thread_load_average", "gauge",
+                   "Average number of descriptors processed per poll");
+    metrics_value(metrics, "thread_load_average", "period=\"current\"", current_avg);
+    for (int i = 0; i < 3; i++)
+    {
+        metrics_value(metrics, "thread_load_average", periods[i], avg[i]);
+    }
+
+    metrics_header(metrics, "event_queue_pending_average", "gauge",
+                   "Average number of pending events");
+    for (int i = 0; i < 3; i++)
+    {
+        metrics_value(metrics, "event_queue_pending_average", periods[i], qavg[i]);
+    }
+}
@@ -43,6 +43,9 @@
 #include <skygw_utils.h>
 #include <log_manager.h>
 #include <gw_ssl.h>
+#include <maxconfig.h>
+#include <inttypes.h>
+#include <metrics.h>
 
 /** The latin1 charset */
 #define SERVER_DEFAULT_CHARSET 0x08
@@ -87,10 +90,10 @@ server_alloc(char *servname, char *protocol, unsigned short port)
     server->parameters = NULL;
     server->server_string = NULL;
     spinlock_init(&server->lock);
-    server->persistent = NULL;
     server->persistmax = 0;
     server->persistmaxtime = 0;
     server->persistpoolmax = 0;
+    server->persistpoolmin = 0;
     server->slave_configured = false;
     server->charset = SERVER_DEFAULT_CHARSET;
     spinlock_init(&server->persistlock);
@@ -142,17 +145,115 @@ server_free(SERVER *tofreeserver)
     free(tofreeserver->server_string);
     server_parameter_free(tofreeserver->parameters);
 
-    if (tofreeserver->persistent)
+    dcb_persistent_clean_count(tofreeserver, true);
+
+    for (int i = 0; i < SERVER_POOL_BUCKETS; i++)
     {
-        dcb_persistent_clean_count(tofreeserver->persistent, true);
+        while (tofreeserver->persistent[i])
+        {
+            SERVER_POOL *pool = tofreeserver->persistent[i];
+            tofreeserver->persistent[i] = pool->next;
+            free(pool->user);
+            free(pool->protocol);
+            free(pool);
+        }
     }
+    ts_histogram_free(tofreeserver->stats.first_byte);
+    ts_histogram_free(tofreeserver->stats.response_time);
+    ts_histogram_free(tofreeserver->stats.pool_wait);
     free(tofreeserver);
     return 1;
 }
 
+/**
+ * Calculate the hash of a user and a protocol
+ *
+ * @param user     The user name
+ * @param protocol The protocol name
+ * @return The 64-bit FNV-1a hash of the user and the protocol
+ */
+static uint64_t
+server_pool_hash(const char *user, const char *protocol)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    /** The terminating null of the user separates the two names */
+    for (const char *ptr = user; ; ptr++)
+    {
+        hash ^= (unsigned char)*ptr;
+        hash *= 1099511628211ULL;
+
+        if (*ptr == '\0')
+        {
+            break;
+        }
+    }
+
+    for (const char *ptr = protocol; *ptr; ptr++)
+    {
+        hash ^= (unsigned char)*ptr;
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+/**
+ * Find the persistent pool of a user and a protocol
+ *
+ * The caller must hold the persistlock of the server.
+ *
+ * @param server   The server
+ * @param user     The user name
+ * @param protocol The protocol name
+ * @param create   Whether to create the pool if it doesn't exist
+ * @return The pool or NULL if it doesn't exist or memory allocation failed
+ */
+static SERVER_POOL *
+server_pool_find(SERVER *server, const char *user, const char *protocol, bool create)
+{
+    uint64_t hash = server_pool_hash(user, protocol);
+    SERVER_POOL **bucket = &server->persistent[hash % SERVER_POOL_BUCKETS];
+    SERVER_POOL *pool;
+
+    for (pool = *bucket; pool; pool = pool->next)
+    {
+        if (pool->hash == hash && strcmp(pool->user, user) == 0 &&
+            strcmp(pool->protocol, protocol) == 0)
+        {
+            return pool;
+        }
+    }
+
+    if (create && (pool = calloc(1, sizeof(SERVER_POOL))) != NULL)
+    {
+        pool->hash = hash;
+        pool->user = strdup(user);
+        pool->protocol = strdup(protocol);
+
+        if (pool->user == NULL || pool->protocol == NULL)
+        {
+            free(pool->user);
+            free(pool->protocol);
+            free(pool);
+            return NULL;
+        }
+
+        pool->next = *bucket;
+        *bucket = pool;
+    }
+
+    return pool;
+}
+
 /**
  * Get a DCB from the persistent connection pool, if possible
  *
+ * The most recently returned connection of the user is taken from the pool.
+ * Connections that have failed or expired are closed. As the connections of
+ * a user are ordered by the time they were returned, each connection is
+ * examined at most once.
+ *
  * @param       server      The server to set the name on
  * @param       user        The name of the user needing the connection
  * @param       protocol    The name of the protocol needed for the connection
@@ -160,59 +261,172 @@ server_free(SERVER *tofreeserver)
 DCB *
 server_get_persistent(SERVER *server, char *user, const char *protocol)
 {
-    DCB *dcb, *previous = NULL;
+    DCB *dcb = NULL;
+    DCB *disposals = NULL;
+    int n_disposals = 0;
 
-    if (server->persistent
-        && dcb_persistent_clean_count(server->persistent, false)
-        && server->persistent
-        && (server->status & SERVER_RUNNING))
+    if (server->persistpoolmax && (server->status & SERVER_RUNNING))
     {
+        time_t now = time(NULL);
+
         spinlock_acquire(&server->persistlock);
-        dcb = server->persistent;
-        while (dcb)
+        SERVER_POOL *pool = server_pool_find(server, user, protocol, false);
+
+        while (dcb == NULL && pool && pool->dcbs)
         {
-            if (dcb->user
-                && dcb->protoname
-                && !dcb-> dcb_errhandle_called
-                && !(dcb->flags & DCBF_HUNG)
-                && 0 == strcmp(dcb->user, user)
-                && 0 == strcmp(dcb->protoname, protocol))
-            {
-                if (NULL == previous)
-                {
-                    server->persistent = dcb->nextpersistent;
-                }
-                else
-                {
-                    previous->nextpersistent = dcb->nextpersistent;
-                }
-                free(dcb->user);
-                dcb->user = NULL;
-                spinlock_release(&server->persistlock);
-                atomic_add(&server->stats.n_persistent, -1);
-                atomic_add(&server->stats.n_current, 1);
-                return dcb;
-            }
-            else
+            DCB *candidate = pool->dcbs;
+            pool->dcbs = candidate->nextpersistent;
+            pool->n_dcbs--;
+
+            if (candidate->dcb_errhandle_called
+                || (candidate->flags & DCBF_HUNG)
+                || (now - candidate->persistentstart) > server->persistmaxtime)
             {
                 MXS_DEBUG("%lu [server_get_persistent] Rejected dcb "
-                          "%p from pool, user %s looking for %s, protocol %s "
-                          "looking for %s, hung flag %s, error handle called %s.",
+                          "%p from pool, user %s, hung flag %s, error handle called %s.",
                           pthread_self(),
-                          dcb,
-                          dcb->user ? dcb->user : "NULL",
+                          candidate,
                           user,
-                          dcb->protoname ? dcb->protoname : "NULL",
-                          protocol,
-                          (dcb->flags & DCBF_HUNG) ? "true" : "false",
-                          dcb-> dcb_errhandle_called ? "true" : "false");
+                          (candidate->flags & DCBF_HUNG) ? "true" : "false",
+                          candidate->dcb_errhandle_called ? "true" : "false");
+                candidate->nextpersistent = disposals;
+                disposals = candidate;
+                n_disposals++;
+            }
+            else
+            {
+                candidate->nextpersistent = NULL;
+                dcb = candidate;
             }
-            previous = dcb;
-            dcb = dcb->nextpersistent;
+        }
+
+        if (dcb)
+        {
+            server->stats.n_pool_hits++;
+        }
+        else
+        {
+            server->stats.n_pool_misses++;
         }
         spinlock_release(&server->persistlock);
+
+        if (dcb)
+        {
+            free(dcb->user);
+            dcb->user = NULL;
+            atomic_add(&server->stats.n_persistent, -1);
+            atomic_add(&server->stats.n_current, 1);
+        }
+
+        if (disposals)
+        {
+            atomic_add(&server->stats.n_persistent, -n_disposals);
+            dcb_persistent_close(disposals);
+        }
     }
-    return NULL;
+    return dcb;
+}
+
+/**
+ * Add a DCB to the persistent connection pool
+ *
+ * The user name and the protocol name of the DCB must be set.
+ *
+ * @param server The server of the DCB
+ * @param dcb    The DCB to add
+ * @return True if the DCB was added, false if memory allocation failed
+ */
+bool
+server_add_persistent(SERVER *server, DCB *dcb)
+{
+    bool rval = false;
+
+    spinlock_acquire(&server->persistlock);
+    SERVER_POOL *pool = server_pool_find(server, dcb->user, dcb->protoname, true);
+
+    if (pool)
+    {
+        dcb->nextpersistent = pool->dcbs;
+        pool->dcbs = dcb;
+        pool->n_dcbs++;
+        rval = true;
+    }
+    spinlock_release(&server->persistlock);
+
+    if (rval)
+    {
+        atomic_add(&server->stats.n_persistent, 1);
+    }
+    return rval;
+}
+
+/**
+ * Check whether a connection should be opened to warm up the persistent pool
+ *
+ * A connection is wanted when the pool of the user has fewer idle connections
+ * than persistpoolmin. At most persistpoolmin connections are opened at a time
+ * and the pool never grows past persistpoolmax. If a connection is wanted, the
+ * caller must open it with the DCBF_PREWARM flag set.
+ *
+ * @param server   The server
+ * @param user     The user name
+ * @param protocol The protocol name
+ * @return True if a connection should be opened
+ */
+bool
+server_persistent_wanted(SERVER *server, const char *user, const char *protocol)
+{
+    bool rval = false;
+
+    if (server->persistpoolmin && (server->status & SERVER_RUNNING))
+    {
+        spinlock_acquire(&server->persistlock);
+        SERVER_POOL *pool = server_pool_find(server, user, protocol, false);
+        int idle = pool ? pool->n_dcbs : 0;
+
+        if (idle + server->persistwarming < server->persistpoolmin
+            && server->stats.n_persistent + server->persistwarming < server->persistpoolmax)
+        {
+            atomic_add(&server->persistwarming, 1);
+            rval = true;
+        }
+        spinlock_release(&server->persistlock);
+    }
+    return rval;
+}
+
+/**
+ * Housekeeper task that closes the expired persistent connections of all servers
+ *
+ * @param data Not used
+ */
+void
+server_persistent_clean(void *data)
+{
+    spinlock_acquire(&server_spin);
+
+    for (SERVER *server = allServers; server; server = server->next)
+    {
+        if (server->persistpoolmax)
+        {
+            dcb_persistent_clean_count(server, false);
+        }
+    }
+
+    spinlock_release(&server_spin);
+}
+
+/**
+ * Record the time a connection taken from the persistent pool waited for
+ * its reset to complete
+ *
+ * @param server The server
+ * @param wait   The time in microseconds
+ */
+void
+server_add_pool_wait(SERVER *server, int64_t wait)
+{
+    ts_histogram_record_lazy(&server->stats.pool_wait, wait);
 }
 
 /**
@@ -503,14 +717,22 @@ dprintServer(DCB *dcb, SERVER *server)
     dcb_printf(dcb, "\tNumber of connections:               %d\n", server->stats.n_connections);
     dcb_printf(dcb, "\tCurrent no. of conns:                %d\n", server->stats.n_current);
     dcb_printf(dcb, "\tCurrent no. of operations:           %d\n", server->stats.n_current_ops);
+    dprintLatency(dcb, "Time to first byte (us):             ", server->stats.first_byte);
+    dprintLatency(dcb, "Response time (us):                  ", server->stats.response_time);
+    dcb_printf(dcb, "\tAverage response time (us):          %" PRId64 "\n",
+               server_get_response_time_avg(server, ts_stats_time_us()));
     if (server->persistpoolmax)
     {
         dcb_printf(dcb, "\tPersistent pool size:                %d\n", server->stats.n_persistent);
         dcb_printf(dcb, "\tPersistent measured pool size:       %d\n",
-                   dcb_persistent_clean_count(server->persistent, false));
+                   dcb_persistent_clean_count(server, false));
         dcb_printf(dcb, "\tPersistent actual size max:          %d\n", server->persistmax);
         dcb_printf(dcb, "\tPersistent pool size limit:          %ld\n", server->persistpoolmax);
+        dcb_printf(dcb, "\tPersistent pool warm minimum:        %ld\n", server->persistpoolmin);
         dcb_printf(dcb, "\tPersistent max time (secs):          %ld\n", server->persistmaxtime);
+        dcb_printf(dcb, "\tPersistent pool hits:                %" PRId64 "\n", server->stats.n_pool_hits);
+        dcb_printf(dcb, "\tPersistent pool misses:              %" PRId64 "\n", server->stats.n_pool_misses);
+        dprintLatency(dcb, "Persistent pool wait (us):           ", server->stats.pool_wait);
     }
     if (server->server_ssl)
     {
@@ -551,18 +773,20 @@ spin_reporter(void *dcb, char *desc, int value)
 void
 dprintPersistentDCBs(DCB *pdcb, SERVER *server)
 {
-    DCB *dcb;
-
     spinlock_acquire(&server->persistlock);
 #if SPINLOCK_PROFILE
     dcb_printf(pdcb, "DCB List Spinlock Statistics:\n");
     spinlock_stats(&server->persistlock, spin_reporter, pdcb);
 #endif
-    dcb = server->persistent;
-    while (dcb)
+    for (int i = 0; i < SERVER_POOL_BUCKETS; i++)
     {
-        dprintOneDCB(pdcb, dcb);
-        dcb = dcb->nextpersistent;
+        for (SERVER_POOL *pool = server->persistent[i]; pool; pool = pool->next)
+        {
+            for (DCB *dcb = pool->dcbs; dcb; dcb = dcb->nextpersistent)
+            {
+                dprintOneDCB(pdcb, dcb);
+            }
+        }
     }
     spinlock_release(&server->persistlock);
 }
@@ -1035,3 +1259,374 @@ bool server_set_version_string(SERVER* server, const char* string)
     spinlock_release(&server->lock);
     return rval;
 }
+
+/**
+ * Record the latency of a reply from a server
+ *
+ * @param server        The server that replied
+ * @param first_byte    Time from sending the request to the first byte of the
+ *                      reply in microseconds
+ * @param response_time Time from sending the request to the last byte of the
+ *                      reply in microseconds
+ */
+void
+server_add_response_time(SERVER *server, int64_t first_byte, int64_t response_time)
+{
+    ts_histogram_record_lazy(&server->stats.first_byte, first_byte);
+    ts_histogram_record_lazy(&server->stats.response_time, response_time);
+
+    /**
+     * The average is updated without locking. Concurrent updates can lose
+     * samples but the average remains within the range of the samples.
+     */
+    int64_t avg = server->stats.response_time_avg;
+
+    if (avg == 0)
+    {
+        avg = response_time;
+    }
+    else
+    {
+        avg += (response_time - avg) / (1 << SERVER_RESPONSE_TIME_SHIFT);
+    }
+
+    server->stats.response_time_avg = avg > 0 ? avg : 1;
+    server->stats.response_time_updated = ts_stats_time_us();
+}
+
+/**
+ * Get the average response time of a server
+ *
+ * The average decays if no replies are received from the server. This lets
+ * a server that was slow in the past be tried again once it is no longer used.
+ *
+ * @param server The server
+ * @param now    The current time from ts_stats_time_us
+ * @return The average response time in microseconds, 0 if not known
+ */
+int64_t
+server_get_response_time_avg(SERVER *server, int64_t now)
+{
+    int64_t avg = server->stats.response_time_avg;
+    int64_t age = now - server->stats.response_time_updated;
+
+    if (age > SERVER_RESPONSE_TIME_HALFLIFE)
+    {
+        int64_t halvings = age / SERVER_RESPONSE_TIME_HALFLIFE;
+        avg = halvings < 63 ? avg >> halvings : 0;
+    }
+
+    return avg;
+}
+
+/**
+ * Print a summary of a latency histogram with the configured percentiles
+ *
+ * @param dcb   DCB to print to
+ * @param title Title of the line, padded to the width of the other titles
+ * @param hist  The histogram, NULL if nothing has been recorded
+ */
+void
+dprintLatency(DCB *dcb, const char *title, ts_histogram_t *hist)
+{
+    ts_histogram_snapshot_t *snapshot = malloc(sizeof(ts_histogram_snapshot_t));
+
+    if (snapshot == NULL)
+    {
+        return;
+    }
+
+    ts_histogram_merge(hist, snapshot);
+    dcb_printf(dcb, "\t%scount %" PRId64 ", mean %" PRId64, title,
+               snapshot->count, ts_histogram_mean(snapshot));
+
+    const double *percentiles;
+    int n_percentiles = config_latency_percentiles(&percentiles);
+
+    for (int i = 0; i < n_percentiles; i++)
+    {
+        dcb_printf(dcb, ", p%g %" PRId64, percentiles[i],
+                   ts_histogram_percentile(snapshot, percentiles[i]));
+    }
+
+    dcb_printf(dcb, ", max %" PRId64 "\n", snapshot->max);
+    free(snapshot);
+}
+
+/**
+ * Add the columns of a latency histogram to a result set
+ *
+ * The columns are the number of values, the mean, the configured percentiles
+ * and the maximum.
+ *
+ * @param set The result set
+ */
+void
+latency_add_columns(RESULTSET *set)
+{
+    const double *percentiles;
+    int n_percentiles = config_latency_percentiles(&percentiles);
+    char name[20];
+
+    resultset_add_column(set, "Count", 12, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Mean", 12, COL_TYPE_VARCHAR);
+
+    for (int i = 0; i < n_percentiles; i++)
+    {
+        snprintf(name, sizeof(name), "p%g", percentiles[i]);
+        resultset_add_column(set, name, 12, COL_TYPE_VARCHAR);
+    }
+
+    resultset_add_column(set, "Max", 12, COL_TYPE_VARCHAR);
+}
+
+/**
+ * Set the values of a latency histogram to a result set row
+ *
+ * @param row    The row to modify
+ * @param column The first column added by latency_add_columns
+ * @param hist   The histogram, NULL if nothing has been recorded
+ */
+void
+latency_set_row(RESULT_ROW *row, int column, ts_histogram_t *hist)
+{
+    const double *percentiles;
+    int n_percentiles = config_latency_percentiles(&percentiles);
+    ts_histogram_snapshot_t *snapshot = malloc(sizeof(ts_histogram_snapshot_t));
+    char buf[40];
+
+    if (snapshot == NULL)
+    {
+        return;
+    }
+
+    ts_histogram_merge(hist, snapshot);
+    sprintf(buf, "%" PRId64, snapshot->count);
+    resultset_row_set(row, column++, buf);
+    sprintf(buf, "%" PRId64, ts_histogram_mean(snapshot));
+    resultset_row_set(row, column++, buf);
+
+    for (int i = 0; i < n_percentiles; i++)
+    {
+        sprintf(buf, "%" PRId64, ts_histogram_percentile(snapshot, percentiles[i]));
+        resultset_row_set(row, column++, buf);
+    }
+
+    sprintf(buf, "%" PRId64, snapshot->max);
+    resultset_row_set(row, column, buf);
+    free(snapshot);
+}
+
+/**
+ * Provide a row to the result set that contains the server latencies
+ *
+ * Each server has one row for the time to the first byte and one row for
+ * the response time.
+ *
+ * @param set   The result set
+ * @param data  The index of the row to send
+ * @return The next row or NULL
+ */
+static RESULT_ROW *
+serverLatencyRowCallback(RESULTSET *set, void *data)
+{
+    int *rowno = (int *)data;
+    int i = 0;
+    RESULT_ROW *row;
+    SERVER *server;
+
+    spinlock_acquire(&server_spin);
+    server = allServers;
+    while (i < *rowno / 2 && server)
+    {
+        i++;
+        server = server->next;
+    }
+    if (server == NULL)
+    {
+        spinlock_release(&server_spin);
+        free(data);
+        return NULL;
+    }
+    bool first_byte = *rowno % 2 == 0;
+    (*rowno)++;
+    row = resultset_make_row(set);
+    resultset_row_set(row, 0, server->unique_name);
+    resultset_row_set(row, 1, first_byte ? "first_byte" : "response_time");
+    latency_set_row(row, 2, first_byte ? server->stats.first_byte : server->stats.response_time);
+    spinlock_release(&server_spin);
+    return row;
+}
+
+/**
+ * Return a resultset that has the response time percentiles of all servers
+ *
+ * @return A Result set
+ */
+RESULTSET *
+serverGetLatencyList()
+{
+    RESULTSET *set;
+    int *data;
+
+    if ((data = (int *)malloc(sizeof(int))) == NULL)
+    {
+        return NULL;
+    }
+    *data = 0;
+    if ((set = resultset_create(serverLatencyRowCallback, data)) == NULL)
+    {
+        free(data);
+        return NULL;
+    }
+    resultset_add_column(set, "Server", 20, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Metric", 13, COL_TYPE_VARCHAR);
+    latency_add_columns(set);
+
+    return set;
+}
+
+/** The server statistics exported as metrics */
+typedef enum
+{
+    SERVER_METRIC_UP,
+    SERVER_METRIC_CONNECTIONS,
+    SERVER_METRIC_CURRENT,
+    SERVER_METRIC_OPERATIONS,
+    SERVER_METRIC_PERSISTENT,
+    SERVER_METRIC_POOL_HITS,
+    SERVER_METRIC_POOL_MISSES,
+    SERVER_METRIC_POOL_WAIT,
+    SERVER_METRIC_FIRST_BYTE,
+    SERVER_METRIC_RESPONSE_TIME
+} server_metric_t;
+
+static const struct
+{
+    const char      *name;
+    const char      *type;
+    const char      *help;
+    server_metric_t metric;
+} server_metrics[] =
+{
+    { "server_up", "gauge", "Whether the server is running", SERVER_METRIC_UP },
+    { "server_connections_total", "counter", "Number of connections created", SERVER_METRIC_CONNECTIONS },
+    { "server_connections", "gauge", "Number of current connections", SERVER_METRIC_CURRENT },
+    { "server_operations", "gauge", "Number of active operations", SERVER_METRIC_OPERATIONS },
+    { "server_persistent_connections", "gauge", "Number of pooled connections", SERVER_METRIC_PERSISTENT },
+    { "server_pool_hits_total", "counter", "Connections taken from the pool", SERVER_METRIC_POOL_HITS },
+    { "server_pool_misses_total", "counter", "Connection requests the pool couldn't serve", SERVER_METRIC_POOL_MISSES },
+    { "server_pool_wait_seconds", "summary", "Time a pooled connection waited for its reset", SERVER_METRIC_POOL_WAIT },
+    { "server_first_byte_seconds", "summary", "Time to the first byte of a reply", SERVER_METRIC_FIRST_BYTE },
+    { "server_response_seconds", "summary", "Time to the last byte of a reply", SERVER_METRIC_RESPONSE_TIME },
+    { NULL }
+};
+
+/** Number of server metrics that are integers, they come first in server_metric_t */
+#define SERVER_N_INT_METRICS SERVER_METRIC_POOL_WAIT
+
+/** Number of server metrics that are summaries */
+#define SERVER_N_SUMMARY_METRICS (SERVER_METRIC_RESPONSE_TIME - SERVER_METRIC_POOL_WAIT + 1)
+
+/** The values of the metrics of one server */
+typedef struct
+{
+    char                labels[METRICS_LABEL_LEN];
+    int64_t             ints[SERVER_N_INT_METRICS];
+    MXS_METRICS_SUMMARY summaries[SERVER_N_SUMMARY_METRICS];
+} server_sample_t;
+
+/**
+ * Read the values of the metrics of a server
+ *
+ * @param metrics The metrics being written
+ * @param server  The server
+ * @param sample  Where the values are stored
+ */
+static void
+server_metrics_read(MXS_METRICS *metrics, SERVER *server, server_sample_t *sample)
+{
+    metrics_label(sample->labels, sizeof(sample->labels), "server", server->unique_name);
+
+    sample->ints[SERVER_METRIC_UP] = SERVER_IS_RUNNING(server) ? 1 : 0;
+    sample->ints[SERVER_METRIC_CONNECTIONS] = server->stats.n_connections;
+    sample->ints[SERVER_METRIC_CURRENT] = server->stats.n_current;
+    sample->ints[SERVER_METRIC_OPERATIONS] = server->stats.n_current_ops;
+    sample->ints[SERVER_METRIC_PERSISTENT] = server->stats.n_persistent;
+    sample->ints[SERVER_METRIC_POOL_HITS] = server->stats.n_pool_hits;
+    sample->ints[SERVER_METRIC_POOL_MISSES] = server->stats.n_pool_misses;
+
+    metrics_summary_read(metrics, server->stats.pool_wait, 1e-6,
+                         &sample->summaries[SERVER_METRIC_POOL_WAIT - SERVER_N_INT_METRICS]);
+    metrics_summary_read(metrics, server->stats.first_byte, 1e-6,
+                         &sample->summaries[SERVER_METRIC_FIRST_BYTE - SERVER_N_INT_METRICS]);
+    metrics_summary_read(metrics, server->stats.response_time, 1e-6,
+                         &sample->summaries[SERVER_METRIC_RESPONSE_TIME - SERVER_N_INT_METRICS]);
+}
+
+/**
+ * Write the statistics of all servers in the Prometheus format
+ *
+ * The values are read under the server lock and written to the client after
+ * the lock has been released so that a slow client does not block the
+ * threads that look up servers.
+ *
+ * @param metrics The metrics being written
+ */
+void
+serverMetrics(MXS_METRICS *metrics)
+{
+    server_sample_t *samples = NULL;
+    int n_servers = 0;
+
+    spinlock_acquire(&server_spin);
+
+    for (SERVER *server = allServers; server; server = server->next)
+    {
+        n_servers++;
+    }
+
+    if (n_servers > 0 && (samples = malloc(n_servers * sizeof(server_sample_t))) != NULL)
+    {
+        int j = 0;
+
+        for (SERVER *server = allServers; server; server = server->next)
+        {
+            server_metrics_read(metrics, server, &samples[j++]);
+        }
+    }
+
+    spinlock_release(&server_spin);
+
+    if (samples == NULL)
+    {
+        if (n_servers > 0)
+        {
+            MXS_ERROR("Failed to allocate memory for the metrics of %d servers.", n_servers);
+        }
+        return;
+    }
+
+    for (int i = 0; server_metrics[i].name; i++)
+    {
+        const char *name = server_metrics[i].name;
+        server_metric_t metric = server_metrics[i].metric;
+
+        metrics_header(metrics, name, server_metrics[i].type, server_metrics[i].help);
+
+        for (int j = 0; j < n_servers; j++)
+        {
+            if (metric < SERVER_N_INT_METRICS)
+            {
+                metrics_int(metrics, name, samples[j].labels, samples[j].ints[metric]);
+            }
+            else
+            {
+                metrics_summary_write(metrics, name, samples[j].labels,
+                                      &samples[j].summaries[metric - SERVER_N_INT_METRICS]);
+            }
+        }
+    }
+
+    free(samples);
+}
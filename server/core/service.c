@@ -49,6 +49,7 @@
 #include <server.h>
 #include <router.h>
 #include <spinlock.h>
+#include <atomic.h>
 #include <modules.h>
 #include <dcb.h>
 #include <users.h>
@@ -66,6 +67,9 @@
 #include <math.h>
 #include <version.h>
 #include <queuemanager.h>
+#include <metrics.h>
+#include <digest.h>
+#include <inttypes.h>
 
 /** To be used with configuration type checks */
 typedef struct typelib_st
@@ -710,6 +714,9 @@ service_free(SERVICE *service)
     users_free(service->users);
     hashtable_free(service->resources);
     serviceClearRouterOptions(service);
+    ts_histogram_free(service->stats.first_byte);
+    ts_histogram_free(service->stats.response_time);
+    digest_table_free(service->digests);
 
     free(service);
     return 1;
@@ -1312,6 +1319,8 @@ void dprintService(DCB *dcb, SERVICE *service)
                service->stats.n_sessions);
     dcb_printf(dcb, "\tCurrently connected:                 %d\n",
                service->stats.n_current);
+    dprintLatency(dcb, "Time to first byte (us):             ", service->stats.first_byte);
+    dprintLatency(dcb, "Response time (us):                  ", service->stats.response_time);
 }
 
 /**
@@ -1979,6 +1988,523 @@ serviceGetList()
     return set;
 }
 
+/**
+ * Provide a row to the result set that contains the service latencies
+ *
+ * Each service has one row for the time to the first byte and one row for
+ * the response time.
+ *
+ * @param set   The result set
+ * @param data  The index of the row to send
+ * @return The next row or NULL
+ */
+static RESULT_ROW *
+serviceLatencyRowCallback(RESULTSET *set, void *data)
+{
+    int *rowno = (int *)data;
+    int i = 0;
+    RESULT_ROW *row;
+    SERVICE *service;
+
+    spinlock_acquire(&service_spin);
+    service = allServices;
+    while (i < *rowno / 2 && service)
+    {
+        i++;
+        service = service->next;
+    }
+    if (service == NULL)
+    {
+        spinlock_release(&service_spin);
+        free(data);
+        return NULL;
+    }
+    bool first_byte = *rowno % 2 == 0;
+    (*rowno)++;
+    row = resultset_make_row(set);
+    resultset_row_set(row, 0, service->name);
+    resultset_row_set(row, 1, first_byte ? "first_byte" : "response_time");
+    latency_set_row(row, 2, first_byte ? service->stats.first_byte : service->stats.response_time);
+    spinlock_release(&service_spin);
+    return row;
+}
+
+/**
+ * Return a result set that has the response time percentiles of all services
+ *
+ * @return A Result set
+ */
+RESULTSET *
+serviceGetLatencyList()
+{
+    RESULTSET *set;
+    int *data;
+
+    if ((data = (int *)malloc(sizeof(int))) == NULL)
+    {
+        return NULL;
+    }
+    *data = 0;
+    if ((set = resultset_create(serviceLatencyRowCallback, data)) == NULL)
+    {
+        free(data);
+        return NULL;
+    }
+    resultset_add_column(set, "Service Name", 25, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Metric", 13, COL_TYPE_VARCHAR);
+    latency_add_columns(set);
+
+    return set;
+}
+
+/**
+ * Get the statement digest table of a service
+ *
+ * The table is created when it is first requested. If several callers
+ * request it at the same time, the size requested by the first one is used.
+ *
+ * @param service     The service
+ * @param max_digests Maximum number of digests if the table is created
+ * @return The digest table or NULL if memory allocation failed
+ */
+DIGEST_TABLE *
+serviceGetDigestTable(SERVICE *service, int max_digests)
+{
+    if (service->digests == NULL)
+    {
+        DIGEST_TABLE *table = digest_table_alloc(max_digests);
+
+        if (table && !atomic_cas_ptr((void**)&service->digests, NULL, table))
+        {
+            /** Another thread created the table first */
+            digest_table_free(table);
+        }
+    }
+
+    return service->digests;
+}
+
+/**
+ * Print the statement digests of all services
+ *
+ * The digests of each service are ordered by their total latency.
+ *
+ * @param dcb DCB to print to
+ */
+void
+dprintAllDigests(DCB *dcb)
+{
+    SERVICE *service;
+
+    spinlock_acquire(&service_spin);
+    for (service = allServices; service; service = service->next)
+    {
+        DIGEST_SUMMARY *digests;
+        int n;
+
+        if (service->digests == NULL ||
+            (n = digest_table_read(service->digests, &digests)) < 0)
+        {
+            continue;
+        }
+
+        dcb_printf(dcb, "Statement digests of service '%s'.\n", service->name);
+        dcb_printf(dcb, "------------+------------+------------+------------+------------+--------+-----------\n");
+        dcb_printf(dcb, "Count       | Total (ms) | Mean (us)  | p99 (us)   | Max (us)   | Errors | Statement\n");
+        dcb_printf(dcb, "------------+------------+------------+------------+------------+--------+-----------\n");
+
+        for (int i = 0; i < n; i++)
+        {
+            DIGEST_STATS *stats = &digests[i].stats;
+            dcb_printf(dcb, "%-11" PRId64 " | %-10" PRId64 " | %-10" PRId64 " | %-10" PRId64
+                       " | %-10" PRId64 " | %-6" PRId64 " | %s\n",
+                       stats->count, stats->sum / 1000,
+                       stats->count ? stats->sum / stats->count : 0,
+                       digest_percentile(stats, 99.0), stats->max, stats->errors,
+                       digests[i].text ? digests[i].text : "<other statements>");
+        }
+
+        dcb_printf(dcb, "------------+------------+------------+------------+------------+--------+-----------\n\n");
+        digest_summary_free(digests, n);
+    }
+    spinlock_release(&service_spin);
+}
+
+/** One row of the digest result set */
+typedef struct
+{
+    char           *service; /**< Name of the service */
+    DIGEST_SUMMARY digest;   /**< The digest */
+} DIGEST_LIST_ROW;
+
+/** The state of the digest result set */
+typedef struct
+{
+    int             rowno;  /**< Next row to send */
+    int             n_rows; /**< Number of rows */
+    DIGEST_LIST_ROW *rows;  /**< The rows */
+} DIGEST_LIST;
+
+/**
+ * Free the state of the digest result set
+ *
+ * @param list The state to free
+ */
+static void
+digest_list_free(DIGEST_LIST *list)
+{
+    for (int i = 0; i < list->n_rows; i++)
+    {
+        free(list->rows[i].service);
+        free(list->rows[i].digest.text);
+    }
+    free(list->rows);
+    free(list);
+}
+
+/**
+ * Provide a row to the result set that contains the statement digests
+ *
+ * @param set   The result set
+ * @param data  The digests read when the result set was created
+ * @return The next row or NULL
+ */
+static RESULT_ROW *
+serviceDigestRowCallback(RESULTSET *set, void *data)
+{
+    DIGEST_LIST *list = (DIGEST_LIST *)data;
+    const double *percentiles;
+    int n_percentiles = config_latency_percentiles(&percentiles);
+    int col = 0;
+    char buf[40];
+
+    if (list->rowno >= list->n_rows)
+    {
+        digest_list_free(list);
+        return NULL;
+    }
+
+    DIGEST_LIST_ROW *entry = &list->rows[list->rowno++];
+    DIGEST_STATS *stats = &entry->digest.stats;
+    RESULT_ROW *row = resultset_make_row(set);
+
+    resultset_row_set(row, col++, entry->service);
+    resultset_row_set(row, col++, entry->digest.text);
+    sprintf(buf, "%" PRId64, stats->count);
+    resultset_row_set(row, col++, buf);
+    sprintf(buf, "%" PRId64, stats->errors);
+    resultset_row_set(row, col++, buf);
+    sprintf(buf, "%" PRId64, stats->rows);
+    resultset_row_set(row, col++, buf);
+    sprintf(buf, "%" PRId64, stats->sum);
+    resultset_row_set(row, col++, buf);
+    sprintf(buf, "%" PRId64, stats->count ? stats->min : 0);
+    resultset_row_set(row, col++, buf);
+    sprintf(buf, "%" PRId64, stats->count ? stats->sum / stats->count : 0);
+    resultset_row_set(row, col++, buf);
+
+    for (int i = 0; i < n_percentiles; i++)
+    {
+        sprintf(buf, "%" PRId64, digest_percentile(stats, percentiles[i]));
+        resultset_row_set(row, col++, buf);
+    }
+
+    sprintf(buf, "%" PRId64, stats->max);
+    resultset_row_set(row, col++, buf);
+    return row;
+}
+
+/**
+ * Return a result set that has the statement digests of all services
+ *
+ * The digests are read when the result set is created.
+ *
+ * @return A Result set
+ */
+RESULTSET *
+serviceGetDigestList()
+{
+    RESULTSET *set;
+    DIGEST_LIST *list;
+    SERVICE *service;
+
+    if ((list = (DIGEST_LIST *)calloc(1, sizeof(DIGEST_LIST))) == NULL)
+    {
+        return NULL;
+    }
+
+    spinlock_acquire(&service_spin);
+    for (service = allServices; service; service = service->next)
+    {
+        DIGEST_SUMMARY *digests;
+        int n;
+
+        if (service->digests == NULL ||
+            (n = digest_table_read(service->digests, &digests)) <= 0)
+        {
+            continue;
+        }
+
+        DIGEST_LIST_ROW *rows = realloc(list->rows, sizeof(DIGEST_LIST_ROW) * (list->n_rows + n));
+
+        if (rows)
+        {
+            list->rows = rows;
+
+            for (int i = 0; i < n; i++)
+            {
+                rows[list->n_rows].service = strdup(service->name);
+                rows[list->n_rows].digest = digests[i];
+                list->n_rows++;
+            }
+
+            /** The texts are now owned by the rows */
+            free(digests);
+        }
+        else
+        {
+            digest_summary_free(digests, n);
+        }
+    }
+    spinlock_release(&service_spin);
+
+    if ((set = resultset_create(serviceDigestRowCallback, list)) == NULL)
+    {
+        digest_list_free(list);
+        return NULL;
+    }
+
+    const double *percentiles;
+    int n_percentiles = config_latency_percentiles(&percentiles);
+    char name[20];
+
+    resultset_add_column(set, "Service Name", 25, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Digest", 60, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Count", 12, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Errors", 12, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Rows", 12, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Total", 12, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Min", 12, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Mean", 12, COL_TYPE_VARCHAR);
+
+    for (int i = 0; i < n_percentiles; i++)
+    {
+        snprintf(name, sizeof(name), "p%g", percentiles[i]);
+        resultset_add_column(set, name, 12, COL_TYPE_VARCHAR);
+    }
+
+    resultset_add_column(set, "Max", 12, COL_TYPE_VARCHAR);
+
+    return set;
+}
+
+/** Maximum number of metrics a router can export */
+#define SERVICE_MAX_ROUTER_METRICS 64
+
+/** The values of the metrics of one service */
+typedef struct
+{
+    char                labels[METRICS_LABEL_LEN];
+    int64_t             n_sessions;
+    int64_t             n_current;
+    MXS_METRICS_SUMMARY first_byte;
+    MXS_METRICS_SUMMARY response_time;
+    ROUTER_OBJECT       *router;
+    ROUTER              *router_instance;
+} service_sample_t;
+
+/**
+ * Write the router specific metrics of all services
+ *
+ * The metrics of all services that use the same router are grouped together
+ * as the exposition format requires. The router instances are never freed
+ * so this is called without holding the service lock.
+ *
+ * @param metrics   The metrics being written
+ * @param samples   The services
+ * @param n_samples Number of services
+ */
+static void
+serviceRouterMetrics(MXS_METRICS *metrics, service_sample_t *samples, int n_samples)
+{
+    for (int s = 0; s < n_samples; s++)
+    {
+        ROUTER_OBJECT *router = samples[s].router;
+
+        if (router == NULL || router->metrics == NULL || samples[s].router_instance == NULL)
+        {
+            continue;
+        }
+
+        /** Only the first service of each router writes the metrics */
+        int prev = 0;
+
+        while (prev < s && samples[prev].router != router)
+        {
+            prev++;
+        }
+
+        if (prev != s)
+        {
+            continue;
+        }
+
+        int n_services = 0;
+
+        for (int k = s; k < n_samples; k++)
+        {
+            if (samples[k].router == router && samples[k].router_instance)
+            {
+                n_services++;
+            }
+        }
+
+        /** Collect the values of each service once, then emit them per metric */
+        MXS_METRIC *values = malloc(n_services * SERVICE_MAX_ROUTER_METRICS * sizeof(MXS_METRIC));
+        int *counts = malloc(n_services * sizeof(int));
+        int *services = malloc(n_services * sizeof(int));
+
+        if (values == NULL || counts == NULL || services == NULL)
+        {
+            MXS_ERROR("Failed to allocate memory for the router metrics of %d services.",
+                      n_services);
+            free(values);
+            free(counts);
+            free(services);
+            continue;
+        }
+
+        int j = 0;
+
+        for (int k = s; k < n_samples; k++)
+        {
+            if (samples[k].router == router && samples[k].router_instance)
+            {
+                int n = router->metrics(samples[k].router_instance,
+                                        values + j * SERVICE_MAX_ROUTER_METRICS,
+                                        SERVICE_MAX_ROUTER_METRICS);
+                services[j] = k;
+                counts[j] = n < 0 ? 0 : (n > SERVICE_MAX_ROUTER_METRICS ? SERVICE_MAX_ROUTER_METRICS : n);
+                j++;
+            }
+        }
+
+        for (int i = 0; i < counts[0]; i++)
+        {
+            MXS_METRIC *first = &values[i];
+            metrics_header(metrics, first->name, metrics_type_str(first->type), first->help);
+
+            for (j = 0; j < n_services; j++)
+            {
+                if (counts[j] > i)
+                {
+                    MXS_METRIC *value = &values[j * SERVICE_MAX_ROUTER_METRICS + i];
+                    metrics_value(metrics, value->name, samples[services[j]].labels, value->value);
+                }
+            }
+        }
+
+        free(values);
+        free(counts);
+        free(services);
+    }
+}
+
+/**
+ * Write the statistics of all services in the Prometheus format
+ *
+ * The values are read under the service lock and written to the client after
+ * the lock has been released so that a slow client does not block the
+ * threads that create sessions.
+ *
+ * @param metrics The metrics being written
+ */
+void
+serviceMetrics(MXS_METRICS *metrics)
+{
+    service_sample_t *samples = NULL;
+    int n = 0;
+
+    spinlock_acquire(&service_spin);
+
+    for (SERVICE *service = allServices; service; service = service->next)
+    {
+        n++;
+    }
+
+    if (n > 0 && (samples = malloc(n * sizeof(service_sample_t))) != NULL)
+    {
+        service_sample_t *sample = samples;
+
+        for (SERVICE *service = allServices; service; service = service->next, sample++)
+        {
+            metrics_label(sample->labels, sizeof(sample->labels), "service", service->name);
+            sample->n_sessions = service->stats.n_sessions;
+            sample->n_current = service->stats.n_current;
+            metrics_summary_read(metrics, service->stats.first_byte, 1e-6, &sample->first_byte);
+            metrics_summary_read(metrics, service->stats.response_time, 1e-6, &sample->response_time);
+            sample->router = service->router;
+            sample->router_instance = service->router_instance;
+        }
+    }
+
+    spinlock_release(&service_spin);
+
+    if (samples == NULL)
+    {
+        if (n > 0)
+        {
+            MXS_ERROR("Failed to allocate memory for the metrics of %d services.", n);
+        }
+        return;
+    }
+
+    metrics_header(metrics, "service_sessions_total", "counter", "Number of sessions created");
+    for (int i = 0; i < n; i++)
+    {
+        metrics_int(metrics, "service_sessions_total", samples[i].labels, samples[i].n_sessions);
+    }
+
+    metrics_header(metrics, "service_sessions", "gauge", "Number of current sessions");
+    for (int i = 0; i < n; i++)
+    {
+        metrics_int(metrics, "service_sessions", samples[i].labels, samples[i].n_current);
+    }
+
+    metrics_header(metrics, "service_first_byte_seconds", "summary", "Time to the first byte of a reply");
+    for (int i = 0; i < n; i++)
+    {
+        metrics_summary_write(metrics, "service_first_byte_seconds", samples[i].labels,
+                              &samples[i].first_byte);
+    }
+
+    metrics_header(metrics, "service_response_seconds", "summary", "Time to the last byte of a reply");
+    for (int i = 0; i < n; i++)
+    {
+        metrics_summary_write(metrics, "service_response_seconds", samples[i].labels,
+                              &samples[i].response_time);
+    }
+
+    serviceRouterMetrics(metrics, samples, n);
+    free(samples);
+}
+
+/**
+ * Record the latency of a reply to a query routed by a service
+ *
+ * @param service       The service that routed the query
+ * @param first_byte    Time from sending the query to the first byte of the
+ *                      reply in microseconds
+ * @param response_time Time from sending the query to the last byte of the
+ *                      reply in microseconds
+ */
+void
+service_add_response_time(SERVICE *service, int64_t first_byte, int64_t response_time)
+{
+    ts_histogram_record_lazy(&service->stats.first_byte, first_byte);
+    ts_histogram_record_lazy(&service->stats.response_time, response_time);
+}
+
 /**
  * Function called by the housekeeper thread to retry starting of a service
  * @param data Service to restart
@@ -14,13 +14,63 @@
 #include <statistics.h>
 #include <maxconfig.h>
 #include <string.h>
+#include <stdlib.h>
+#include <time.h>
 #include <platform.h>
+#include <atomic.h>
 
 thread_local int current_thread_id = 0;
 
 static int thread_count = 0;
 static bool initialized = false;
 
+/** Size of one per-thread slot of a counter */
+#define STATS_SLOT_SIZE TS_STATS_CACHE_LINE
+
+/** Round @c size up to the next multiple of the cache line size */
+#define STATS_CACHE_ALIGN(size) (((size) + TS_STATS_CACHE_LINE - 1) & ~((size_t)TS_STATS_CACHE_LINE - 1))
+
+/**
+ * A histogram with one cache line aligned slot per thread. The per-thread
+ * slots have the same layout as the merged snapshot.
+ */
+struct ts_histogram
+{
+    size_t stride; /**< Distance between two per-thread slots in bytes */
+    char   *slots; /**< The per-thread slots */
+};
+
+/** Return the slot of @c thread in @c stats */
+static inline int64_t* stats_slot(ts_stats_t stats, int thread)
+{
+    return (int64_t*)((char*)stats + (size_t)thread * STATS_SLOT_SIZE);
+}
+
+/** Return the histogram slot of @c thread in @c hist */
+static inline ts_histogram_snapshot_t* histogram_slot(ts_histogram_t *hist, int thread)
+{
+    return (ts_histogram_snapshot_t*)(hist->slots + (size_t)thread * hist->stride);
+}
+
+/**
+ * Allocate zeroed memory aligned to a cache line
+ *
+ * @param size Size of the memory area
+ * @return Pointer to the memory or NULL if memory allocation failed
+ */
+static void* stats_aligned_calloc(size_t size)
+{
+    void *ptr = NULL;
+
+    if (posix_memalign(&ptr, TS_STATS_CACHE_LINE, size) == 0)
+    {
+        memset(ptr, 0, size);
+        return ptr;
+    }
+
+    return NULL;
+}
+
 /**
  * Initialize the statistics gathering
  */
@@ -28,6 +78,12 @@ void ts_stats_init()
 {
     ss_dassert(!initialized);
     thread_count = config_threadcount();
+
+    if (thread_count < 1)
+    {
+        /** The configuration has not been loaded, e.g. in unit tests */
+        thread_count = 1;
+    }
     initialized = true;
 }
 
@@ -47,7 +103,7 @@ void ts_stats_end()
 ts_stats_t ts_stats_alloc()
 {
     ss_dassert(initialized);
-    return calloc(thread_count, sizeof(int));
+    return stats_aligned_calloc((size_t)thread_count * STATS_SLOT_SIZE);
 }
 
 /**
@@ -70,19 +126,41 @@ void ts_stats_free(ts_stats_t stats)
 void ts_stats_set_thread_id(int id)
 {
     ss_dassert(initialized);
+    ss_dassert(id >= 0 && id < thread_count);
     current_thread_id = id;
 }
 
+/**
+ * Get the id of the current thread
+ *
+ * @return The id set with ts_stats_set_thread_id, 0 for other threads
+ */
+int ts_stats_get_thread_id()
+{
+    return current_thread_id;
+}
+
+/**
+ * Get the number of per-thread slots in each statistic
+ *
+ * @return Number of threads
+ */
+int ts_stats_thread_count()
+{
+    ss_dassert(initialized);
+    return thread_count;
+}
+
 /**
  * Add @c value to @c stats
  *
  * @param stats Statistics to add to
  * @param value Value to add
  */
-void ts_stats_add(ts_stats_t stats, int value)
+void ts_stats_add(ts_stats_t stats, int64_t value)
 {
     ss_dassert(initialized);
-    ((int*)stats)[current_thread_id] += value;
+    *stats_slot(stats, current_thread_id) += value;
 }
 
 /**
@@ -92,10 +170,10 @@ void ts_stats_add(ts_stats_t stats, int value)
  * @param stats Statistics to set
  * @param value Value to set to
  */
-void ts_stats_set(ts_stats_t stats, int value)
+void ts_stats_set(ts_stats_t stats, int64_t value)
 {
     ss_dassert(initialized);
-    ((int*)stats)[current_thread_id] = value;
+    *stats_slot(stats, current_thread_id) = value;
 }
 
 /**
@@ -104,13 +182,279 @@ void ts_stats_set(ts_stats_t stats, int value)
  * @param stats Statistics to read
  * @return Value of statistics
  */
-int ts_stats_sum(ts_stats_t stats)
+int64_t ts_stats_sum(ts_stats_t stats)
 {
     ss_dassert(initialized);
-    int sum = 0;
+    int64_t sum = 0;
     for (int i = 0; i < thread_count; i++)
     {
-        sum += ((int*)stats)[i];
+        sum += *stats_slot(stats, i);
     }
     return sum;
 }
+
+/**
+ * Create a new histogram
+ *
+ * @return New histogram or NULL if memory allocation failed
+ */
+ts_histogram_t* ts_histogram_alloc()
+{
+    ss_dassert(initialized);
+    ts_histogram_t *hist = malloc(sizeof(ts_histogram_t));
+
+    if (hist)
+    {
+        hist->stride = STATS_CACHE_ALIGN(sizeof(ts_histogram_snapshot_t));
+
+        if ((hist->slots = stats_aligned_calloc(hist->stride * thread_count)) == NULL)
+        {
+            free(hist);
+            return NULL;
+        }
+
+        for (int i = 0; i < thread_count; i++)
+        {
+            histogram_slot(hist, i)->min = INT64_MAX;
+        }
+    }
+
+    return hist;
+}
+
+/**
+ * Free a histogram
+ *
+ * @param hist Histogram to free
+ */
+void ts_histogram_free(ts_histogram_t *hist)
+{
+    if (hist)
+    {
+        free(hist->slots);
+        free(hist);
+    }
+}
+
+/**
+ * Find the bucket a value belongs to
+ *
+ * @param value Value to look up, negative values are treated as zero
+ * @return Index of the bucket
+ */
+int ts_histogram_bucket(int64_t value)
+{
+    if (value < TS_HISTOGRAM_SUB_BUCKETS)
+    {
+        return value < 0 ? 0 : (int)value;
+    }
+
+    int msb = 63 - __builtin_clzll((unsigned long long)value);
+
+    if (msb >= TS_HISTOGRAM_MAX_BITS)
+    {
+        return TS_HISTOGRAM_BUCKETS - 1;
+    }
+
+    int shift = msb - TS_HISTOGRAM_SUB_BITS;
+    return (shift + 1) * TS_HISTOGRAM_SUB_BUCKETS +
+           (int)((value >> shift) - TS_HISTOGRAM_SUB_BUCKETS);
+}
+
+/**
+ * Get the largest value that is counted in a bucket
+ *
+ * @param bucket Bucket index
+ * @return The largest value of the bucket
+ */
+int64_t ts_histogram_bucket_upper(int bucket)
+{
+    if (bucket < TS_HISTOGRAM_SUB_BUCKETS)
+    {
+        return bucket;
+    }
+
+    int shift = bucket / TS_HISTOGRAM_SUB_BUCKETS - 1;
+    int64_t sub = bucket % TS_HISTOGRAM_SUB_BUCKETS + TS_HISTOGRAM_SUB_BUCKETS;
+    return ((sub + 1) << shift) - 1;
+}
+
+/**
+ * Record a value into a histogram
+ *
+ * Only the slot of the current thread is modified so no locking is needed.
+ * @param hist  Histogram to record into
+ * @param value Value to record
+ */
+void ts_histogram_record(ts_histogram_t *hist, int64_t value)
+{
+    ss_dassert(initialized);
+    ts_histogram_snapshot_t *slot = histogram_slot(hist, current_thread_id);
+
+    if (value < 0)
+    {
+        value = 0;
+    }
+
+    slot->buckets[ts_histogram_bucket(value)]++;
+    slot->count++;
+    slot->sum += value;
+
+    if (value < slot->min)
+    {
+        slot->min = value;
+    }
+    if (value > slot->max)
+    {
+        slot->max = value;
+    }
+}
+
+/**
+ * Record a value into a histogram that is allocated on first use
+ *
+ * Servers and services are created before the statistics are initialized
+ * so their histograms can only be allocated once the first value arrives.
+ *
+ * @param hist  Pointer to the histogram, NULL if not yet allocated
+ * @param value Value to record
+ */
+void ts_histogram_record_lazy(ts_histogram_t **hist, int64_t value)
+{
+    ts_histogram_t *current = *hist;
+
+    if (current == NULL)
+    {
+        ts_histogram_t *new_hist = ts_histogram_alloc();
+
+        if (new_hist == NULL)
+        {
+            return;
+        }
+
+        if (!atomic_cas_ptr((void**)hist, NULL, new_hist))
+        {
+            /** Another thread allocated the histogram first */
+            ts_histogram_free(new_hist);
+        }
+
+        current = *hist;
+    }
+
+    ts_histogram_record(current, value);
+}
+
+/**
+ * Merge the per-thread values of a histogram
+ *
+ * The values are read without locking which means that values recorded while
+ * the merge is in progress may or may not be included.
+ *
+ * @param hist     Histogram to read, NULL is treated as an empty histogram
+ * @param snapshot Where the merged values are stored
+ */
+void ts_histogram_merge(ts_histogram_t *hist, ts_histogram_snapshot_t *snapshot)
+{
+    ss_dassert(initialized);
+    memset(snapshot, 0, sizeof(*snapshot));
+    snapshot->min = INT64_MAX;
+
+    for (int i = 0; hist && i < thread_count; i++)
+    {
+        ts_histogram_snapshot_t *slot = histogram_slot(hist, i);
+
+        for (int j = 0; j < TS_HISTOGRAM_BUCKETS; j++)
+        {
+            snapshot->buckets[j] += slot->buckets[j];
+        }
+
+        snapshot->count += slot->count;
+        snapshot->sum += slot->sum;
+
+        if (slot->min < snapshot->min)
+        {
+            snapshot->min = slot->min;
+        }
+        if (slot->max > snapshot->max)
+        {
+            snapshot->max = slot->max;
+        }
+    }
+
+    if (snapshot->count == 0)
+    {
+        snapshot->min = 0;
+    }
+}
+
+/**
+ * Calculate a percentile from a merged histogram
+ *
+ * The returned value is the upper limit of the bucket that contains the
+ * percentile, limited by the smallest and largest recorded values.
+ *
+ * @param snapshot   Merged histogram
+ * @param percentile Percentile to calculate, between 0 and 100
+ * @return The value at the percentile or 0 if the histogram is empty
+ */
+int64_t ts_histogram_percentile(const ts_histogram_snapshot_t *snapshot, double percentile)
+{
+    if (snapshot->count == 0)
+    {
+        return 0;
+    }
+
+    int64_t target = (int64_t)((snapshot->count * percentile) / 100.0 + 0.5);
+    int64_t seen = 0;
+
+    if (target < 1)
+    {
+        target = 1;
+    }
+
+    for (int i = 0; i < TS_HISTOGRAM_BUCKETS; i++)
+    {
+        seen += snapshot->buckets[i];
+
+        if (seen >= target)
+        {
+            int64_t value = ts_histogram_bucket_upper(i);
+
+            if (value > snapshot->max)
+            {
+                value = snapshot->max;
+            }
+            if (value < snapshot->min)
+            {
+                value = snapshot->min;
+            }
+            return value;
+        }
+    }
+
+    /** The buckets were updated while the snapshot was being taken */
+    return snapshot->max;
+}
+
+/**
+ * Calculate the mean value of a merged histogram
+ *
+ * @param snapshot Merged histogram
+ * @return The mean of the recorded values or 0 if the histogram is empty
+ */
+int64_t ts_histogram_mean(const ts_histogram_snapshot_t *snapshot)
+{
+    return snapshot->count ? snapshot->sum / snapshot->count : 0;
+}
+
+/**
+ * Get the current monotonic time in microseconds
+ *
+ * @return Current time in microseconds
+ */
+int64_t ts_stats_time_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+#include <skygw_debug.h>
+#include <mxs_crc32.h>
+
+#define TEST_BUFSIZE 4096
+
+/**
+ * Test that the checksums match the ones calculated by zlib
+ */
+static int
+test_crc32()
+{
+    unsigned char *buf = malloc(TEST_BUFSIZE + 16);
+    ss_info_dassert(buf != NULL, "Allocating the buffer should succeed");
+
+    for (int i = 0; i < TEST_BUFSIZE + 16; i++)
+    {
+        buf[i] = random();
+    }
+
+    ss_info_dassert(mxs_crc32(0, NULL, 0) == crc32(0L, NULL, 0),
+                    "Initial value should match zlib");
+    ss_info_dassert(mxs_crc32(0, "123456789", 9) == 0xcbf43926,
+                    "Checksum of the check string should be correct");
+
+    /** All lengths up to a few blocks and all alignments */
+    for (int offset = 0; offset < 16; offset++)
+    {
+        for (int len = 0; len <= 300; len++)
+        {
+            ss_info_dassert(mxs_crc32(0, buf + offset, len) == crc32(0L, buf + offset, len),
+                            "Checksum should match zlib");
+        }
+    }
+
+    for (int len = 300; len <= TEST_BUFSIZE; len += 61)
+    {
+        ss_info_dassert(mxs_crc32(0, buf, len) == crc32(0L, buf, len),
+                        "Checksum of a long buffer should match zlib");
+    }
+
+    /** Checksums calculated in parts, like the events split into several packets */
+    for (int split = 0; split <= TEST_BUFSIZE; split += 97)
+    {
+        uint32_t crc = mxs_crc32(0, buf, split);
+        crc = mxs_crc32(crc, buf + split, TEST_BUFSIZE - split);
+        ss_info_dassert(crc == crc32(0L, buf, TEST_BUFSIZE),
+                        "Checksum calculated in parts should match zlib");
+    }
+
+    free(buf);
+    return 0;
+}
+
+/**
+ * Compare the speed of the checksum to zlib
+ *
+ * @param size Size of the checksummed buffer
+ */
+static void
+benchmark_crc32(int size)
+{
+    unsigned char *buf = calloc(1, size);
+    ss_info_dassert(buf != NULL, "Allocating the buffer should succeed");
+    long iterations = (256L * 1024 * 1024) / size;
+    uint32_t crc = 0;
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long i = 0; i < iterations; i++)
+    {
+        crc = crc32(crc, buf, size);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double zlib_time = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long i = 0; i < iterations; i++)
+    {
+        crc = mxs_crc32(crc, buf, size);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double mxs_time = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf("%6d bytes: zlib %8.1f MB/s, %s %8.1f MB/s (%u)\n", size,
+           256 / zlib_time, mxs_crc32_impl(), 256 / mxs_time, crc);
+    free(buf);
+}
+
+int
+main(int argc, char **argv)
+{
+    int result = 0;
+
+    printf("Using the %s implementation\n", mxs_crc32_impl());
+    result += test_crc32();
+
+    /** The benchmark is only run when requested: test_crc32 -b */
+    if (argc > 1 && strcmp(argv[1], "-b") == 0)
+    {
+        int sizes[] = {19, 64, 200, 1024, 8192, 65536};
+
+        for (int i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++)
+        {
+            benchmark_crc32(sizes[i]);
+        }
+    }
+
+    exit(result);
+}
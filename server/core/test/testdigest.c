@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <skygw_debug.h>
+#include <digest.h>
+
+/**
+ * Test recording and reading of digests
+ */
+static int
+test_digest()
+{
+    DIGEST_TABLE *table = digest_table_alloc(10);
+    ss_info_dassert(table != NULL, "Allocating digest table should succeed");
+
+    for (int i = 1; i <= 100; i++)
+    {
+        digest_table_record(table, "SELECT ?", i, 1, false);
+    }
+
+    digest_table_record(table, "UPDATE t SET a = ?", 5000, 0, false);
+    digest_table_record(table, "UPDATE t SET a = ?", 7000, 0, true);
+
+    DIGEST_SUMMARY *digests;
+    int n = digest_table_read(table, &digests);
+    ss_info_dassert(n == 2, "Table should have two digests");
+
+    ss_info_dassert(strcmp(digests[0].text, "UPDATE t SET a = ?") == 0,
+                    "Digest with the largest total latency should be first");
+    ss_info_dassert(digests[0].stats.count == 2, "UPDATE should have two executions");
+    ss_info_dassert(digests[0].stats.errors == 1, "UPDATE should have one error");
+    ss_info_dassert(digests[0].stats.min == 5000 && digests[0].stats.max == 7000,
+                    "UPDATE minimum and maximum should be correct");
+
+    ss_info_dassert(strcmp(digests[1].text, "SELECT ?") == 0, "SELECT should be second");
+    ss_info_dassert(digests[1].stats.count == 100, "SELECT should have 100 executions");
+    ss_info_dassert(digests[1].stats.rows == 100, "SELECT should have returned 100 rows");
+    ss_info_dassert(digests[1].stats.sum == 5050, "SELECT total latency should be 5050");
+
+    int64_t p99 = digest_percentile(&digests[1].stats, 99.0);
+    ss_info_dassert(p99 >= 99 && p99 <= 100, "SELECT p99 should be within the precision");
+    ss_info_dassert(digest_percentile(&digests[1].stats, 100.0) == 100,
+                    "100th percentile should be the maximum");
+
+    digest_summary_free(digests, n);
+    digest_table_free(table);
+    return 0;
+}
+
+/**
+ * Test that the table is bounded
+ */
+static int
+test_digest_overflow()
+{
+    DIGEST_TABLE *table = digest_table_alloc(2);
+    ss_info_dassert(table != NULL, "Allocating digest table should succeed");
+
+    digest_table_record(table, "SELECT 1", 100, 1, false);
+    digest_table_record(table, "SELECT 2", 100, 1, false);
+    digest_table_record(table, "SELECT 3", 100, 1, false);
+    digest_table_record(table, "SELECT 4", 100, 1, false);
+    digest_table_record(table, "SELECT 1", 100, 1, false);
+
+    DIGEST_SUMMARY *digests;
+    int n = digest_table_read(table, &digests);
+    ss_info_dassert(n == 3, "Table should have two digests and the overflow entry");
+
+    int64_t total = 0;
+    bool found_overflow = false;
+
+    for (int i = 0; i < n; i++)
+    {
+        total += digests[i].stats.count;
+
+        if (digests[i].text == NULL)
+        {
+            ss_info_dassert(digests[i].stats.count == 2,
+                            "Two statements should not fit into the table");
+            found_overflow = true;
+        }
+    }
+
+    ss_info_dassert(found_overflow, "Overflow entry should be present");
+    ss_info_dassert(total == 5, "All executions should be counted");
+
+    digest_summary_free(digests, n);
+
+    /** Statements that differ only after the stored prefix share a digest */
+    char *long1 = malloc(DIGEST_TEXT_LEN + 10);
+    char *long2 = malloc(DIGEST_TEXT_LEN + 10);
+    memset(long1, 'a', DIGEST_TEXT_LEN + 9);
+    memset(long2, 'a', DIGEST_TEXT_LEN + 9);
+    long1[DIGEST_TEXT_LEN + 9] = long2[DIGEST_TEXT_LEN + 9] = '\0';
+    long2[DIGEST_TEXT_LEN + 5] = 'b';
+    ss_info_dassert(digest_hash(long1) == digest_hash(long2),
+                    "Hash should only cover the stored prefix");
+
+    free(long1);
+    free(long2);
+    digest_table_free(table);
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    int result = 0;
+
+    ts_stats_init();
+    result += test_digest();
+    result += test_digest_overflow();
+    ts_stats_end();
+
+    exit(result);
+}
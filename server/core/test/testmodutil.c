@@ -35,6 +35,7 @@
 
 #include <modutil.h>
 #include <buffer.h>
+#include <mysql_utils.h>
 
 /**
  * test1    Allocate a service and do lots of other things
@@ -102,6 +103,12 @@ static char ok[] =
     0x07, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x02, 0x00, 0x00, 0x00
 };
 
+/** OK packet with last insert ID 5 and one warning */
+static char ok_insert[] =
+{
+    0x07, 0x00, 0x00, 0x01, 0x00, 0x01, 0x05, 0x02, 0x00, 0x01, 0x00
+};
+
 /** Created with:
  * CREATE OR REPLACE TABLE test.t1 (id int);
  * INSERT INTO test.t1 VALUES (3000);
@@ -383,6 +390,61 @@ void test_large_packets()
     }
 }
 
+void test_mysql_reply()
+{
+    mxs_mysql_reply_t reply;
+
+    /** OK packet */
+    GWBUF* buffer = gwbuf_alloc_and_load(sizeof(ok), ok);
+    mxs_mysql_reply_start(&reply, MYSQL_COM_QUERY);
+    ss_info_dassert(!mxs_mysql_reply_is_complete(&reply), "Reply should not be complete before processing");
+    ss_info_dassert(mxs_mysql_reply_process(&reply, buffer), "OK packet should complete the reply");
+    ss_info_dassert(reply.status == 2, "Server status should be autocommit");
+    ss_info_dassert(reply.insert_id == 0 && reply.warnings == 0, "OK packet should have no insert ID or warnings");
+    gwbuf_free(buffer);
+
+    /** OK packet of an insert */
+    buffer = gwbuf_alloc_and_load(sizeof(ok_insert), ok_insert);
+    mxs_mysql_reply_start(&reply, MYSQL_COM_QUERY);
+    ss_info_dassert(mxs_mysql_reply_process(&reply, buffer), "OK packet should complete the reply");
+    ss_info_dassert(reply.insert_id == 5, "Last insert ID should be read");
+    ss_info_dassert(reply.warnings == 1, "Warning count should be read");
+    gwbuf_free(buffer);
+
+    /** Result set in one buffer */
+    buffer = gwbuf_alloc_and_load(sizeof(resultset), resultset);
+    mxs_mysql_reply_start(&reply, MYSQL_COM_QUERY);
+    ss_info_dassert(mxs_mysql_reply_process(&reply, buffer), "Result set should complete the reply");
+    ss_info_dassert(reply.rows == 1, "Result set should have one row");
+    gwbuf_free(buffer);
+
+    /** Result set split into one byte buffers */
+    buffer = NULL;
+    for (size_t i = 0; i < sizeof(resultset); i++)
+    {
+        buffer = gwbuf_append(buffer, gwbuf_alloc_and_load(1, resultset + i));
+    }
+    mxs_mysql_reply_start(&reply, MYSQL_COM_QUERY);
+    ss_info_dassert(mxs_mysql_reply_process(&reply, buffer), "Split result set should complete the reply");
+    ss_info_dassert(reply.rows == 1, "Split result set should have one row");
+    gwbuf_free(buffer);
+
+    /** Result set received in two parts */
+    size_t first = 4 + 1 + 4 + 0x22 + 4 + 5;
+    GWBUF* part1 = gwbuf_alloc_and_load(first, resultset);
+    GWBUF* part2 = gwbuf_alloc_and_load(sizeof(resultset) - first, resultset + first);
+    mxs_mysql_reply_start(&reply, MYSQL_COM_QUERY);
+    ss_info_dassert(!mxs_mysql_reply_process(&reply, part1), "Partial result set should not complete the reply");
+    ss_info_dassert(reply.state == MXS_REPLY_ROWS, "Column definitions should be read");
+    ss_info_dassert(mxs_mysql_reply_process(&reply, part2), "Rest of the result set should complete the reply");
+    gwbuf_free(part1);
+    gwbuf_free(part2);
+
+    /** Commands without a reply */
+    mxs_mysql_reply_start(&reply, MYSQL_COM_STMT_CLOSE);
+    ss_info_dassert(mxs_mysql_reply_is_complete(&reply), "COM_STMT_CLOSE should not expect a reply");
+}
+
 int main(int argc, char **argv)
 {
     int result = 0;
@@ -394,5 +456,6 @@ int main(int argc, char **argv)
     test_strnchr_esc();
     test_strnchr_esc_mysql();
     test_large_packets();
+    test_mysql_reply();
     exit(result);
 }
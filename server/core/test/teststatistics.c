@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <skygw_debug.h>
+#include <statistics.h>
+
+/**
+ * Test the 64-bit counters
+ */
+static int
+test_counters()
+{
+    ts_stats_t stats = ts_stats_alloc();
+    ss_info_dassert(stats != NULL, "Allocating counter should succeed");
+    ss_info_dassert(((uintptr_t)stats % TS_STATS_CACHE_LINE) == 0,
+                    "Counter should be cache line aligned");
+
+    ts_stats_set_thread_id(0);
+    ts_stats_add(stats, INT32_MAX);
+    ts_stats_add(stats, INT32_MAX);
+    ss_info_dassert(ts_stats_sum(stats) == 2 * (int64_t)INT32_MAX,
+                    "Counter should not wrap at 32 bits");
+
+    ts_stats_set(stats, 5);
+    ss_info_dassert(ts_stats_sum(stats) == 5, "Counter should be set to 5");
+
+    ts_stats_free(stats);
+    return 0;
+}
+
+/**
+ * Test the bucket mapping and the percentile calculation
+ */
+static int
+test_histogram()
+{
+    for (int64_t i = 0; i < ((int64_t)1 << TS_HISTOGRAM_MAX_BITS); i = i * 3 / 2 + 1)
+    {
+        int bucket = ts_histogram_bucket(i);
+        ss_info_dassert(bucket >= 0 && bucket < TS_HISTOGRAM_BUCKETS, "Bucket should be valid");
+        ss_info_dassert(ts_histogram_bucket_upper(bucket) >= i,
+                        "Value should not be larger than its bucket");
+        ss_info_dassert(bucket == 0 || ts_histogram_bucket_upper(bucket - 1) < i,
+                        "Value should not fit in the previous bucket");
+    }
+
+    ts_histogram_t *hist = ts_histogram_alloc();
+    ss_info_dassert(hist != NULL, "Allocating histogram should succeed");
+
+    for (int64_t i = 1; i <= 10000; i++)
+    {
+        ts_histogram_record(hist, i);
+    }
+
+    ts_histogram_snapshot_t *snapshot = malloc(sizeof(ts_histogram_snapshot_t));
+    ss_info_dassert(snapshot != NULL, "Allocating snapshot should succeed");
+    ts_histogram_merge(hist, snapshot);
+
+    ss_info_dassert(snapshot->count == 10000, "Histogram should have 10000 values");
+    ss_info_dassert(snapshot->min == 1, "Minimum should be 1");
+    ss_info_dassert(snapshot->max == 10000, "Maximum should be 10000");
+    ss_info_dassert(ts_histogram_mean(snapshot) == 5000, "Mean should be 5000");
+
+    int64_t p50 = ts_histogram_percentile(snapshot, 50.0);
+    int64_t p99 = ts_histogram_percentile(snapshot, 99.0);
+    ss_info_dassert(p50 >= 5000 && p50 <= 5000 + 5000 / TS_HISTOGRAM_SUB_BUCKETS,
+                    "Median should be within the histogram precision");
+    ss_info_dassert(p99 >= 9900 && p99 <= 9900 + 9900 / TS_HISTOGRAM_SUB_BUCKETS,
+                    "99th percentile should be within the histogram precision");
+    ss_info_dassert(ts_histogram_percentile(snapshot, 100.0) == 10000,
+                    "100th percentile should be the maximum");
+
+    free(snapshot);
+    ts_histogram_free(hist);
+    return 0;
+}
+
+/**
+ * Test histograms that are allocated on first use
+ */
+static int
+test_histogram_lazy()
+{
+    ts_histogram_t *hist = NULL;
+    ts_histogram_snapshot_t *snapshot = malloc(sizeof(ts_histogram_snapshot_t));
+    ss_info_dassert(snapshot != NULL, "Allocating snapshot should succeed");
+
+    ts_histogram_merge(hist, snapshot);
+    ss_info_dassert(snapshot->count == 0 && snapshot->max == 0,
+                    "Unallocated histogram should be empty");
+
+    ts_histogram_record_lazy(&hist, 10);
+    ts_histogram_record_lazy(&hist, 20);
+    ss_info_dassert(hist != NULL, "Histogram should be allocated on first use");
+
+    ts_histogram_merge(hist, snapshot);
+    ss_info_dassert(snapshot->count == 2, "Histogram should have two values");
+    ss_info_dassert(snapshot->max == 20, "Maximum should be 20");
+
+    free(snapshot);
+    ts_histogram_free(hist);
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    int result = 0;
+
+    ts_stats_init();
+    result += test_counters();
+    result += test_histogram();
+    result += test_histogram_lazy();
+    ts_stats_end();
+
+    exit(result);
+}
@@ -26,9 +26,16 @@
  * @endverbatim
  */
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" int atomic_add(int *variable, int value);
+extern "C" bool atomic_cas_ptr(void **variable, void *old_value, void *new_value);
+extern "C" int64_t atomic_add_int64(int64_t *variable, int64_t value);
 #else
 extern int atomic_add(int *variable, int value);
+extern bool atomic_cas_ptr(void **variable, void *old_value, void *new_value);
+extern int64_t atomic_add_int64(int64_t *variable, int64_t value);
 #endif
 #endif
@@ -21,6 +21,7 @@
 #include <gwbitmask.h>
 #include <skygw_utils.h>
 #include <netinet/in.h>
+#include <sys/uio.h>
 
 #define ERRHANDLE
 
@@ -296,6 +297,7 @@ int           fail_accept_errno;
 
 DCB *dcb_get_zombies(void);
 int dcb_write(DCB *, GWBUF *);
+int dcb_writev(DCB *, const struct iovec *, int);
 DCB *dcb_accept(DCB *listener, GWPROTOCOL *protocol_funcs);
 DCB *dcb_alloc(dcb_role_t, struct servlistener *);
 void dcb_free(DCB *);
@@ -320,7 +322,8 @@ int dcb_add_callback(DCB *, DCB_REASON, int (*)(struct dcb *, DCB_REASON, void *
 int dcb_remove_callback(DCB *, DCB_REASON, int (*)(struct dcb *, DCB_REASON, void *), void *);
 int dcb_isvalid(DCB *);                     /* Check the DCB is in the linked list */
 int dcb_count_by_usage(DCB_USAGE);          /* Return counts of DCBs */
-int dcb_persistent_clean_count(DCB *, bool);      /* Clean persistent and return count */
+int dcb_persistent_clean_count(struct server *, bool); /* Clean persistent and return count */
+void dcb_persistent_close(DCB *disposals);
 
 void dcb_call_foreach (struct server* server, DCB_REASON reason);
 void dcb_hangup_foreach (struct server* server);
@@ -338,6 +341,7 @@ void dcb_append_readqueue(DCB *dcb, GWBUF *buffer);
 #define DCBF_CLONE              0x0001  /*< DCB is a clone */
 #define DCBF_HUNG               0x0002  /*< Hangup has been dispatched */
 #define DCBF_REPLIED    0x0004  /*< DCB was written to */
+#define DCBF_PREWARM    0x0008  /*< DCB is added to the persistent pool once authenticated */
 
 #define DCB_IS_CLONE(d) ((d)->flags & DCBF_CLONE)
 #define DCB_REPLIED(d) ((d)->flags & DCBF_REPLIED)
@@ -0,0 +1,79 @@
+#ifndef _DIGEST_H
+#define _DIGEST_H
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file digest.h - Statement digest tables
+ *
+ * A digest table aggregates the statistics of statements that have the same
+ * canonical form. Each worker thread has its own shard of the table which only
+ * it modifies so recording a statement needs no locks. The shards are merged
+ * when the table is read.
+ *
+ * The number of digests in a shard is limited. Statements that do not fit
+ * into the table are counted in a separate overflow entry.
+ */
+
+#include <statistics.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/** Maximum length of a stored canonical statement, longer ones are truncated */
+#define DIGEST_TEXT_LEN 1024
+
+/** The default maximum number of digests in a table */
+#define DEFAULT_MAX_DIGESTS 500
+
+/**
+ * The latency histograms of the digests have 4 buckets for each power of two
+ * instead of the TS_HISTOGRAM_SUB_BUCKETS used by ts_histogram_t. This keeps
+ * the entries small at the cost of a relative error of at most 25%.
+ */
+#define DIGEST_BUCKET_SHIFT 3
+#define DIGEST_BUCKETS      (TS_HISTOGRAM_BUCKETS >> DIGEST_BUCKET_SHIFT)
+
+/** The statistics of one digest */
+typedef struct
+{
+    int64_t count;                    /**< Number of executions */
+    int64_t sum;                      /**< Total latency in microseconds */
+    int64_t min;                      /**< Smallest latency */
+    int64_t max;                      /**< Largest latency */
+    int64_t rows;                     /**< Rows returned */
+    int64_t errors;                   /**< Executions that returned an error */
+    time_t  first_seen;               /**< When the digest was first seen */
+    time_t  last_seen;                /**< When the digest was last seen */
+    int64_t buckets[DIGEST_BUCKETS];  /**< Latency histogram */
+} DIGEST_STATS;
+
+/** A merged digest, created with digest_table_read */
+typedef struct
+{
+    char         *text;  /**< Canonical statement, NULL for the overflow entry */
+    DIGEST_STATS stats;  /**< Statistics of all threads */
+} DIGEST_SUMMARY;
+
+typedef struct digest_table DIGEST_TABLE;
+
+DIGEST_TABLE* digest_table_alloc(int max_digests);
+void digest_table_free(DIGEST_TABLE *table);
+void digest_table_record(DIGEST_TABLE *table, const char *text, int64_t latency,
+                         int64_t rows, bool error);
+int digest_table_read(DIGEST_TABLE *table, DIGEST_SUMMARY **summaries);
+void digest_summary_free(DIGEST_SUMMARY *summaries, int n_summaries);
+int64_t digest_percentile(const DIGEST_STATS *stats, double percentile);
+uint64_t digest_hash(const char *text);
+
+#endif
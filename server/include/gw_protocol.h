@@ -51,6 +51,10 @@ struct session;
  *      listen          Create a listener for the protocol
  *      auth            Authentication entry point
  *  session         Session handling entry point
+ *      auth_default    Name of the default authenticator
+ *      connlimit       Called when the connection limit is reached
+ *      reset           Reset a connection taken from the persistent
+ *                      pool, returns 0 if the connection can't be used
  * @endverbatim
  *
  * This forms the "module object" for protocol modules within the gateway.
@@ -72,6 +76,7 @@ typedef struct gw_protocol
     int (*session)(struct dcb *, void *);
     char *(*auth_default)();
     int (*connlimit)(struct dcb *, int limit);
+    int (*reset)(struct dcb *);
 } GWPROTOCOL;
 
 /**
@@ -79,7 +84,7 @@ typedef struct gw_protocol
  * the GWPROTOCOL structure is changed. See the rules defined in modinfo.h
  * that define how these numbers should change.
  */
-#define GWPROTOCOL_VERSION      {1, 1, 0}
+#define GWPROTOCOL_VERSION      {1, 2, 0}
 
 
 #endif /* GW_PROTOCOL_H */
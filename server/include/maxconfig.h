@@ -37,6 +37,8 @@
 #define _SYSNAME_STR_LENGTH     256     /**< sysname len */
 #define _RELEASE_STR_LENGTH     256     /**< release len */
 #define DEFAULT_NTHREADS        1 /**< Default number of polling threads */
+#define MAX_LATENCY_PERCENTILES 8       /**< Maximum number of reported latency percentiles */
+#define DEFAULT_LATENCY_PERCENTILES "50,90,99" /**< Default reported latency percentiles */
 /**
  * Maximum length for configuration parameter value.
  */
@@ -123,6 +125,8 @@ typedef struct
     unsigned int  auth_write_timeout;                  /**< Write timeout for the user authentication */
     char          qc_name[PATH_MAX];                   /**< The name of the query classifier to load */
     char*         qc_args;                             /**< Arguments for the query classifier */
+    double        latency_percentiles[MAX_LATENCY_PERCENTILES]; /**< Reported latency percentiles */
+    int           n_latency_percentiles;               /**< Number of reported latency percentiles */
 } GATEWAY_CONF;
 
 
@@ -147,6 +151,7 @@ bool                config_get_valtarget(target_t*           val,
                                          const char*         name, /*< if NULL examine current param only */
                                          config_param_type_t ptype);
 bool                config_load(char *);
+int                 config_latency_percentiles(const double **percentiles);
 unsigned int        config_nbpolls();
 double              config_percentage_value(char *str);
 unsigned int        config_pollsleep();
@@ -0,0 +1,94 @@
+#ifndef _METRICS_H
+#define _METRICS_H
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file metrics.h - Metrics in the Prometheus text exposition format
+ *
+ * The metrics are formatted into a fixed size buffer which is written to the
+ * client DCB whenever it fills up. The amount of memory used by one scrape
+ * does not depend on the number of sessions.
+ */
+
+#include <dcb.h>
+#include <maxconfig.h>
+#include <statistics.h>
+
+/** All metric names are prefixed with this */
+#define METRICS_PREFIX "maxscale_"
+
+/** Size of the output buffer */
+#define METRICS_BUFSIZE 8192
+
+/** Maximum length of the label list of one sample */
+#define METRICS_LABEL_LEN 512
+
+/** The Content-Type of the text exposition format */
+#define METRICS_CONTENT_TYPE "text/plain; version=0.0.4"
+
+/** Metric types */
+typedef enum
+{
+    METRIC_COUNTER,
+    METRIC_GAUGE
+} metric_type_t;
+
+/**
+ * A single value reported by a module, see the metrics entry point of
+ * the router API.
+ */
+typedef struct
+{
+    const char    *name;  /**< Name without METRICS_PREFIX */
+    const char    *help;  /**< Description of the metric */
+    metric_type_t type;   /**< Type of the metric */
+    double        value;  /**< The current value */
+} MXS_METRIC;
+
+/**
+ * The values of a summary read from a histogram. Lets the caller read the
+ * histograms under a lock and write the response after releasing it.
+ */
+typedef struct
+{
+    int64_t count;                               /**< Number of recorded values */
+    double  sum;                                 /**< Scaled sum of the values */
+    double  quantiles[MAX_LATENCY_PERCENTILES];  /**< Scaled configured percentiles */
+} MXS_METRICS_SUMMARY;
+
+/** The state of one metrics response */
+typedef struct
+{
+    DCB                     *dcb;                  /**< Client DCB */
+    size_t                  len;                   /**< Bytes used in buf */
+    char                    buf[METRICS_BUFSIZE];  /**< Output buffer */
+    ts_histogram_snapshot_t snapshot;              /**< Used to read histograms */
+} MXS_METRICS;
+
+MXS_METRICS* metrics_alloc(DCB *dcb);
+void metrics_free(MXS_METRICS *metrics);
+void metrics_flush(MXS_METRICS *metrics);
+void metrics_header(MXS_METRICS *metrics, const char *name, const char *type, const char *help);
+void metrics_value(MXS_METRICS *metrics, const char *name, const char *labels, double value);
+void metrics_int(MXS_METRICS *metrics, const char *name, const char *labels, int64_t value);
+void metrics_summary(MXS_METRICS *metrics, const char *name, const char *labels,
+                     ts_histogram_t *hist, double scale);
+void metrics_summary_read(MXS_METRICS *metrics, ts_histogram_t *hist, double scale,
+                          MXS_METRICS_SUMMARY *summary);
+void metrics_summary_write(MXS_METRICS *metrics, const char *name, const char *labels,
+                           const MXS_METRICS_SUMMARY *summary);
+void metrics_label(char *dest, size_t size, const char *name, const char *value);
+const char* metrics_type_str(metric_type_t type);
+
+#endif
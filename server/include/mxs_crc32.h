@@ -0,0 +1,35 @@
+#ifndef _MXS_CRC32_H
+#define _MXS_CRC32_H
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file mxs_crc32.h - CRC32 checksums
+ *
+ * The checksum is the same CRC-32 that zlib's crc32() calculates and that
+ * MySQL uses for binlog event checksums. The implementation is selected
+ * when the first checksum is calculated: processors with the PCLMULQDQ
+ * instruction use carry-less multiplication and others use a slice-by-16
+ * table lookup.
+ *
+ * The CRC32 instruction of SSE4.2 calculates CRC-32C which uses a different
+ * polynomial and cannot be used for these checksums.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint32_t mxs_crc32(uint32_t crc, const void *buf, size_t len);
+const char* mxs_crc32_impl();
+
+#endif
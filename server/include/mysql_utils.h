@@ -17,6 +17,8 @@
 #include <stdint.h>
 #include <mysql.h>
 #include <server.h>
+#include <buffer.h>
+#include <stdbool.h>
 
 /** Length-encoded integers */
 size_t leint_bytes(uint8_t* ptr);
@@ -27,6 +29,54 @@ uint64_t leint_consume(uint8_t ** c);
 char* lestr_consume_dup(uint8_t** c);
 char* lestr_consume(uint8_t** c, size_t *size);
 
+/** States of a MySQL reply */
+typedef enum
+{
+    MXS_REPLY_DONE,     /**< The reply is complete or no reply is expected */
+    MXS_REPLY_START,    /**< Waiting for the first packet of a reply */
+    MXS_REPLY_COLDEF,   /**< Reading column definitions */
+    MXS_REPLY_ROWS,     /**< Reading rows */
+    MXS_REPLY_PREPARE   /**< Reading the parameters and columns of a prepared statement */
+} mxs_reply_state_t;
+
+/**
+ * Tracks the progress of the reply to a single command. The packets of the
+ * reply are passed to mxs_mysql_reply_process in the order they are received.
+ */
+typedef struct
+{
+    mxs_reply_state_t state;      /**< Current state of the reply */
+    uint8_t           command;    /**< The command the reply is for */
+    bool              large;      /**< The previous packet was a maximum size packet */
+    int               n_eof;      /**< EOF packets left in a COM_STMT_PREPARE reply */
+    uint64_t          rows;       /**< Number of rows in the reply */
+    uint16_t          status;     /**< Server status of the last OK or EOF packet */
+    uint16_t          warnings;   /**< Warning count of the last OK or EOF packet */
+    uint64_t          insert_id;  /**< Last insert ID of the last OK packet */
+    uint16_t          error;      /**< Error code if the reply was an error */
+} mxs_mysql_reply_t;
+
+void mxs_mysql_reply_start(mxs_mysql_reply_t *reply, uint8_t command);
+bool mxs_mysql_reply_process(mxs_mysql_reply_t *reply, GWBUF *buffer);
+bool mxs_mysql_reply_is_complete(const mxs_mysql_reply_t *reply);
+bool mxs_mysql_command_has_reply(uint8_t command);
+
+/**
+ * Measures the latency of the queries sent to a backend connection, one query
+ * at a time, for the response time statistics of the server and the service.
+ */
+typedef struct
+{
+    mxs_mysql_reply_t reply;      /**< Progress of the reply to the latest query */
+    int64_t           sent;       /**< When the latest query was sent, 0 if no reply is tracked */
+    int64_t           first_byte; /**< When the first byte of the reply was received */
+} mxs_mysql_latency_t;
+
+struct service;
+
+void mxs_mysql_latency_start(mxs_mysql_latency_t *latency, GWBUF *query);
+void mxs_mysql_latency_track(mxs_mysql_latency_t *latency, GWBUF *reply,
+                             SERVER *server, struct service *service);
 
 MYSQL *mxs_mysql_real_connect(MYSQL *mysql, SERVER *server, const char *user, const char *passwd);
 
@@ -30,6 +30,7 @@
 #include <service.h>
 #include <session.h>
 #include <buffer.h>
+#include <metrics.h>
 #include <stdint.h>
 
 /**
@@ -57,6 +58,10 @@ typedef enum error_action
  *  clientReply     Called to reply to client the data from one or all backends
  *  errorReply      Called to reply to client errors with optional closeSession or make a request for
  *                  a new backend connection
+ *  getCapabilities Called to get the input type the router accepts
+ *  metrics         Optional, called to get the router statistics that are exported as metrics.
+ *                  Fills at most size values and returns the number of values filled. The values must
+ *                  be the same and in the same order for all instances of the router.
  *
  * @endverbatim
  *
@@ -78,6 +83,7 @@ typedef struct router_object
                            error_action_t action,
                            bool*          succp);
     int     (*getCapabilities)();
+    int     (*metrics)(ROUTER *instance, MXS_METRIC *metrics, int size);
 } ROUTER_OBJECT;
 
 /**
@@ -85,7 +91,7 @@ typedef struct router_object
  * must update these versions numbers in accordance with the rules in
  * modinfo.h.
  */
-#define ROUTER_VERSION  { 1, 0, 0 }
+#define ROUTER_VERSION  { 1, 1, 0 }
 
 /**
  * Router capability type. Indicates what kind of input router accepts.
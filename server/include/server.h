@@ -14,6 +14,8 @@
  */
 #include <dcb.h>
 #include <resultset.h>
+#include <statistics.h>
+#include <metrics.h>
 
 /**
  * @file service.h
@@ -68,8 +70,45 @@ typedef struct
     int n_current;     /**< Current connections */
     int n_current_ops; /**< Current active operations */
     int n_persistent;  /**< Current persistent pool */
+    int64_t n_pool_hits;   /**< Connections taken from the persistent pool */
+    int64_t n_pool_misses; /**< Connection requests the persistent pool couldn't serve */
+    ts_histogram_t *pool_wait;     /**< Time a reused connection waited for its reset
+                                    *   in microseconds */
+    ts_histogram_t *first_byte;    /**< Time to the first byte of a reply in microseconds */
+    ts_histogram_t *response_time; /**< Time to the last byte of a reply in microseconds */
+    int64_t response_time_avg;     /**< Exponentially weighted moving average of the
+                                    *   response time in microseconds */
+    int64_t response_time_updated; /**< When response_time_avg was last updated */
 } SERVER_STATS;
 
+/** The weight of the previous average when a new response time is added, as a power of two */
+#define SERVER_RESPONSE_TIME_SHIFT 3
+
+/** The average response time is halved every this many microseconds if it isn't updated */
+#define SERVER_RESPONSE_TIME_HALFLIFE 5000000
+
+/** Number of hash buckets in the persistent connection pool of a server */
+#define SERVER_POOL_BUCKETS 32
+
+/** How often the expired persistent connections are closed, in seconds */
+#define SERVER_POOL_CLEAN_FREQ 5
+
+/**
+ * The unused persistent connections of one user and protocol. The connections
+ * are kept in the order they were returned to the pool, the most recently
+ * returned one first, so that the connections that are reused stay warm and
+ * the rest expire.
+ */
+typedef struct server_pool
+{
+    uint64_t           hash;     /**< Hash of the user and the protocol */
+    char               *user;    /**< User of the connections */
+    char               *protocol; /**< Protocol of the connections */
+    DCB                *dcbs;    /**< The connections, linked with nextpersistent */
+    int                n_dcbs;   /**< Number of connections */
+    struct server_pool *next;    /**< Next pool in the same hash bucket */
+} SERVER_POOL;
+
 /**
  * The SERVER structure defines a backend server. Each server has a name
  * or IP address for the server, a port that the server listens on and
@@ -104,9 +143,12 @@ typedef struct server
     bool           master_err_is_logged; /*< If node failed, this indicates whether it is logged */
     bool           slave_configured; /**< Server is configured as a replication slave
                                       * TODO: Remove this for 2.1 */
-    DCB            *persistent;    /**< List of unused persistent connections to the server */
+    SERVER_POOL    *persistent[SERVER_POOL_BUCKETS]; /**< Unused persistent connections
+                                                     *   by user and protocol */
     SPINLOCK       persistlock;    /**< Lock for adjusting the persistent connections list */
     long           persistpoolmax; /**< Maximum size of persistent connections pool */
+    long           persistpoolmin; /**< Number of idle connections kept warm for each user */
+    int            persistwarming; /**< Connections being opened to warm up the pool */
     long           persistmaxtime; /**< Maximum number of seconds connection can live */
     int            persistmax;     /**< Maximum pool size actually achieved since startup */
     uint8_t        charset;        /**< Default server character set */
@@ -216,10 +258,21 @@ extern char *serverGetParameter(SERVER *, char *);
 extern void server_update(SERVER *, char *, char *, char *);
 extern void server_set_unique_name(SERVER *, char *);
 extern DCB  *server_get_persistent(SERVER *, char *, const char *);
+extern bool server_add_persistent(SERVER *server, DCB *dcb);
+extern bool server_persistent_wanted(SERVER *server, const char *user, const char *protocol);
+extern void server_persistent_clean(void *data);
+extern void server_add_pool_wait(SERVER *server, int64_t wait);
 extern void server_update_address(SERVER *, char *);
 extern void server_update_port(SERVER *,  unsigned short);
 extern RESULTSET *serverGetList();
 extern unsigned int server_map_status(char *str);
 extern bool server_set_version_string(SERVER* server, const char* string);
+extern void server_add_response_time(SERVER *server, int64_t first_byte, int64_t response_time);
+extern int64_t server_get_response_time_avg(SERVER *server, int64_t now);
+extern RESULTSET *serverGetLatencyList();
+extern void serverMetrics(MXS_METRICS *metrics);
+extern void dprintLatency(DCB *dcb, const char *title, ts_histogram_t *hist);
+extern void latency_add_columns(RESULTSET *set);
+extern void latency_set_row(RESULT_ROW *row, int column, ts_histogram_t *hist);
 
 #endif
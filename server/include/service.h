@@ -24,6 +24,7 @@
 #include <resultset.h>
 #include <maxconfig.h>
 #include <queuemanager.h>
+#include <digest.h>
 #include <openssl/crypto.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
@@ -67,6 +68,8 @@ typedef struct
     int    n_failed_starts; /**< Number of times this service has failed to start */
     int    n_sessions;      /**< Number of sessions created on service since start */
     int    n_current;       /**< Current number of sessions */
+    ts_histogram_t *first_byte;    /**< Time to the first byte of a reply in microseconds */
+    ts_histogram_t *response_time; /**< Time to the last byte of a reply in microseconds */
 } SERVICE_STATS;
 
 /**
@@ -154,6 +157,7 @@ typedef struct service
     struct service *next;              /**< The next service in the linked list */
     bool retry_start;                  /*< If starting of the service should be retried later */
     bool log_auth_warnings;            /*< Log authentication failures and warnings */
+    DIGEST_TABLE *digests;             /**< Statement digests, NULL if not collected */
 } SERVICE;
 
 typedef enum count_spec_t
@@ -219,6 +223,12 @@ extern void service_shutdown();
 extern int serviceSessionCountAll();
 extern RESULTSET *serviceGetList();
 extern RESULTSET *serviceGetListenerList();
+extern RESULTSET *serviceGetLatencyList();
+extern void serviceMetrics(MXS_METRICS *metrics);
+extern DIGEST_TABLE *serviceGetDigestTable(SERVICE *service, int max_digests);
+extern RESULTSET *serviceGetDigestList();
+extern void dprintAllDigests(DCB *dcb);
+extern void service_add_response_time(SERVICE *service, int64_t first_byte, int64_t response_time);
 extern bool service_all_services_have_listeners();
 
 #endif
@@ -16,6 +16,11 @@
 /**
  * @file statistics.h  - Lock-free statistics gathering
  *
+ * Each statistic has one 64-bit slot per worker thread. The slots are padded
+ * to the size of a cache line so that updates done by different threads never
+ * share a cache line. Only the owning thread writes to its slot and readers
+ * merge the values of all threads when the statistic is read.
+ *
  * @verbatim
  * Revision History
  *
@@ -24,7 +29,43 @@
  * @endverbatim
  */
 
+#include <stdint.h>
+#include <stdbool.h>
+
+/** The assumed size of a cache line in bytes */
+#define TS_STATS_CACHE_LINE 64
+
+/**
+ * The histograms are log-linear: values below TS_HISTOGRAM_SUB_BUCKETS are
+ * counted exactly and each following power of two range is divided into
+ * TS_HISTOGRAM_SUB_BUCKETS equally sized buckets. This gives a relative error
+ * of at most 1 / TS_HISTOGRAM_SUB_BUCKETS for every recorded value.
+ */
+#define TS_HISTOGRAM_SUB_BITS    5
+#define TS_HISTOGRAM_SUB_BUCKETS (1 << TS_HISTOGRAM_SUB_BITS)
+
+/**
+ * Values are tracked up to 2^TS_HISTOGRAM_MAX_BITS - 1, larger values are
+ * counted in the last bucket. With microsecond values this is about 19 hours.
+ */
+#define TS_HISTOGRAM_MAX_BITS    36
+#define TS_HISTOGRAM_BUCKETS     ((TS_HISTOGRAM_MAX_BITS - TS_HISTOGRAM_SUB_BITS + 1) * \
+                                  TS_HISTOGRAM_SUB_BUCKETS)
+
 typedef void* ts_stats_t;
+typedef struct ts_histogram ts_histogram_t;
+
+/**
+ * A merged view of a histogram, created with ts_histogram_merge
+ */
+typedef struct
+{
+    int64_t count;                          /**< Number of recorded values */
+    int64_t sum;                            /**< Sum of all recorded values */
+    int64_t min;                            /**< Smallest recorded value */
+    int64_t max;                            /**< Largest recorded value */
+    int64_t buckets[TS_HISTOGRAM_BUCKETS];  /**< Counts of values in each bucket */
+} ts_histogram_snapshot_t;
 
 /** stats_init should be called only once */
 void ts_stats_init();
@@ -34,11 +75,26 @@ void ts_stats_end();
 
 /** Every thread should call set_current_thread_id only once */
 void ts_stats_set_thread_id(int id);
+int ts_stats_get_thread_id();
+int ts_stats_thread_count();
 
 ts_stats_t ts_stats_alloc();
 void ts_stats_free(ts_stats_t stats);
-void ts_stats_add(ts_stats_t stats, int value);
-void ts_stats_set(ts_stats_t stats, int value);
-int ts_stats_sum(ts_stats_t stats);
+void ts_stats_add(ts_stats_t stats, int64_t value);
+void ts_stats_set(ts_stats_t stats, int64_t value);
+int64_t ts_stats_sum(ts_stats_t stats);
+
+ts_histogram_t* ts_histogram_alloc();
+void ts_histogram_free(ts_histogram_t *hist);
+void ts_histogram_record(ts_histogram_t *hist, int64_t value);
+void ts_histogram_record_lazy(ts_histogram_t **hist, int64_t value);
+void ts_histogram_merge(ts_histogram_t *hist, ts_histogram_snapshot_t *snapshot);
+int64_t ts_histogram_percentile(const ts_histogram_snapshot_t *snapshot, double percentile);
+int64_t ts_histogram_mean(const ts_histogram_snapshot_t *snapshot);
+int ts_histogram_bucket(int64_t value);
+int64_t ts_histogram_bucket_upper(int bucket);
+
+/** Monotonic time in microseconds, used for latency measurements */
+int64_t ts_stats_time_us();
 
 #endif
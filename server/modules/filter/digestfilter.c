@@ -0,0 +1,396 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file digestfilter.c - Statement digest statistics
+ * @verbatim
+ *
+ * The digest filter replaces the literals of each SQL statement with question
+ * marks and records the execution time, the number of returned rows and
+ * the errors of the statement into the digest table of the service. The
+ * table is shared by all sessions of the service and can be inspected with
+ * maxadmin and maxinfo.
+ * @endverbatim
+ */
+
+#include <stdio.h>
+#include <filter.h>
+#include <modinfo.h>
+#include <modutil.h>
+#include <mysql_utils.h>
+#include <service.h>
+#include <statistics.h>
+#include <skygw_utils.h>
+#include <log_manager.h>
+#include <string.h>
+
+MODULE_INFO info =
+{
+    MODULE_API_FILTER,
+    MODULE_BETA_RELEASE,
+    FILTER_VERSION,
+    "A statement digest statistics filter"
+};
+
+static char *version_str = "V1.0.0";
+
+/*
+ * The filter entry points
+ */
+static FILTER *createInstance(char **options, FILTER_PARAMETER **);
+static void *newSession(FILTER *instance, SESSION *session);
+static void closeSession(FILTER *instance, void *session);
+static void freeSession(FILTER *instance, void *session);
+static void setDownstream(FILTER *instance, void *fsession, DOWNSTREAM *downstream);
+static void setUpstream(FILTER *instance, void *fsession, UPSTREAM *upstream);
+static int routeQuery(FILTER *instance, void *fsession, GWBUF *queue);
+static int clientReply(FILTER *instance, void *fsession, GWBUF *queue);
+static void diagnostic(FILTER *instance, void *fsession, DCB *dcb);
+
+
+static FILTER_OBJECT MyObject =
+{
+    createInstance,
+    newSession,
+    closeSession,
+    freeSession,
+    setDownstream,
+    setUpstream,
+    routeQuery,
+    clientReply,
+    diagnostic,
+};
+
+/**
+ * The filter instance
+ */
+typedef struct
+{
+    int max_digests; /* Maximum number of digests in the table */
+    char *source;    /* The source of the client connection */
+    char *user;      /* A user name to filter on */
+} DIGEST_INSTANCE;
+
+/**
+ * The session structure for this filter
+ */
+typedef struct
+{
+    DOWNSTREAM down;
+    UPSTREAM up;
+    int active;
+    DIGEST_TABLE *table;       /* Digest table of the service */
+    char *current;             /* Canonical form of the statement being executed */
+    int64_t start;             /* When the statement was sent */
+    mxs_mysql_reply_t reply;   /* State of the reply to the current statement */
+} DIGEST_SESSION;
+
+/**
+ * Implementation of the mandatory version entry point
+ *
+ * @return version string of the module
+ */
+char *
+version()
+{
+    return version_str;
+}
+
+/**
+ * The module initialisation routine, called when the module
+ * is first loaded.
+ * @see function load_module in load_utils.c for explanation of lint
+ */
+/*lint -e14 */
+void
+ModuleInit()
+{
+}
+/*lint +e14 */
+
+/**
+ * The module entry point routine. It is this routine that
+ * must populate the structure that is referred to as the
+ * "module object", this is a structure with the set of
+ * external entry points for this module.
+ *
+ * @return The module object
+ */
+FILTER_OBJECT *
+GetModuleObject()
+{
+    return &MyObject;
+}
+
+/**
+ * Create an instance of the filter for a particular service
+ * within MaxScale.
+ *
+ * @param options   The options for this filter
+ * @param params    The array of name/value pair parameters for the filter
+ *
+ * @return The instance data for this new instance
+ */
+static FILTER *
+createInstance(char **options, FILTER_PARAMETER **params)
+{
+    DIGEST_INSTANCE *my_instance;
+
+    if ((my_instance = calloc(1, sizeof(DIGEST_INSTANCE))) != NULL)
+    {
+        my_instance->max_digests = DEFAULT_MAX_DIGESTS;
+        bool error = false;
+
+        for (int i = 0; params && params[i]; i++)
+        {
+            if (!strcmp(params[i]->name, "max_digests"))
+            {
+                my_instance->max_digests = atoi(params[i]->value);
+
+                if (my_instance->max_digests <= 0)
+                {
+                    MXS_ERROR("digestfilter: Invalid value for 'max_digests': %s",
+                              params[i]->value);
+                    error = true;
+                }
+            }
+            else if (!strcmp(params[i]->name, "source"))
+            {
+                my_instance->source = strdup(params[i]->value);
+            }
+            else if (!strcmp(params[i]->name, "user"))
+            {
+                my_instance->user = strdup(params[i]->value);
+            }
+            else if (!filter_standard_parameter(params[i]->name))
+            {
+                MXS_ERROR("digestfilter: Unexpected parameter '%s'.",
+                          params[i]->name);
+                error = true;
+            }
+        }
+
+        for (int i = 0; options && options[i]; i++)
+        {
+            MXS_ERROR("digestfilter: Unsupported option '%s'.", options[i]);
+            error = true;
+        }
+
+        if (error)
+        {
+            free(my_instance->source);
+            free(my_instance->user);
+            free(my_instance);
+            my_instance = NULL;
+        }
+    }
+    return (FILTER *) my_instance;
+}
+
+/**
+ * Associate a new session with this instance of the filter.
+ *
+ * @param instance  The filter instance data
+ * @param session   The session itself
+ * @return Session specific data for this session
+ */
+static void *
+newSession(FILTER *instance, SESSION *session)
+{
+    DIGEST_INSTANCE *my_instance = (DIGEST_INSTANCE *) instance;
+    DIGEST_SESSION *my_session;
+    char *remote, *user;
+
+    if ((my_session = calloc(1, sizeof(DIGEST_SESSION))) != NULL)
+    {
+        my_session->table = serviceGetDigestTable(session->service, my_instance->max_digests);
+        my_session->active = my_session->table != NULL;
+
+        if (my_instance->source && (remote = session_get_remote(session)) != NULL &&
+            strcmp(remote, my_instance->source))
+        {
+            my_session->active = 0;
+        }
+        if (my_instance->user && (user = session_getUser(session)) != NULL &&
+            strcmp(user, my_instance->user))
+        {
+            my_session->active = 0;
+        }
+    }
+
+    return my_session;
+}
+
+/**
+ * Close a session with the filter
+ *
+ * @param instance  The filter instance data
+ * @param session   The session being closed
+ */
+static void
+closeSession(FILTER *instance, void *session)
+{
+}
+
+/**
+ * Free the memory associated with the session
+ *
+ * @param instance  The filter instance
+ * @param session   The filter session
+ */
+static void
+freeSession(FILTER *instance, void *session)
+{
+    DIGEST_SESSION *my_session = (DIGEST_SESSION *) session;
+
+    free(my_session->current);
+    free(my_session);
+}
+
+/**
+ * Set the downstream filter or router to which queries will be
+ * passed from this filter.
+ *
+ * @param instance  The filter instance data
+ * @param session   The filter session
+ * @param downstream    The downstream filter or router.
+ */
+static void
+setDownstream(FILTER *instance, void *session, DOWNSTREAM *downstream)
+{
+    DIGEST_SESSION *my_session = (DIGEST_SESSION *) session;
+
+    my_session->down = *downstream;
+}
+
+/**
+ * Set the upstream filter or session to which results will be
+ * passed from this filter.
+ *
+ * @param instance  The filter instance data
+ * @param session   The filter session
+ * @param upstream  The upstream filter or session.
+ */
+static void
+setUpstream(FILTER *instance, void *session, UPSTREAM *upstream)
+{
+    DIGEST_SESSION *my_session = (DIGEST_SESSION *) session;
+
+    my_session->up = *upstream;
+}
+
+/**
+ * The routeQuery entry point. The canonical form of the statement is stored
+ * and the tracking of the reply is started.
+ *
+ * Only one statement is tracked at a time. If the reply to the tracked
+ * statement has not completed when the client sends the next command, the
+ * reply was lost, e.g. due to a backend failure, and the statement is
+ * discarded without recording it.
+ *
+ * @param instance  The filter instance data
+ * @param session   The filter session
+ * @param queue     The query data
+ */
+static int
+routeQuery(FILTER *instance, void *session, GWBUF *queue)
+{
+    DIGEST_SESSION *my_session = (DIGEST_SESSION *) session;
+
+    if (my_session->current)
+    {
+        free(my_session->current);
+        my_session->current = NULL;
+    }
+
+    if (my_session->active && modutil_is_SQL(queue))
+    {
+        if (queue->next != NULL)
+        {
+            queue = gwbuf_make_contiguous(queue);
+        }
+
+        if ((my_session->current = modutil_get_canonical(queue)) != NULL)
+        {
+            mxs_mysql_reply_start(&my_session->reply, MYSQL_COM_QUERY);
+            my_session->start = ts_stats_time_us();
+        }
+    }
+
+    /* Pass the query downstream */
+    return my_session->down.routeQuery(my_session->down.instance,
+                                       my_session->down.session, queue);
+}
+
+/**
+ * The clientReply entry point. When the whole reply to the current statement
+ * has been seen, the statement is recorded into the digest table.
+ *
+ * @param instance  The filter instance data
+ * @param session   The filter session
+ * @param reply     The reply data
+ */
+static int
+clientReply(FILTER *instance, void *session, GWBUF *reply)
+{
+    DIGEST_SESSION *my_session = (DIGEST_SESSION *) session;
+
+    if (my_session->current && mxs_mysql_reply_process(&my_session->reply, reply))
+    {
+        digest_table_record(my_session->table, my_session->current,
+                            ts_stats_time_us() - my_session->start,
+                            my_session->reply.rows, my_session->reply.error != 0);
+        free(my_session->current);
+        my_session->current = NULL;
+    }
+
+    /* Pass the result upstream */
+    return my_session->up.clientReply(my_session->up.instance,
+                                      my_session->up.session, reply);
+}
+
+/**
+ * Diagnostics routine
+ *
+ * If fsession is NULL then print diagnostics on the filter
+ * instance as a whole, otherwise print diagnostics for the
+ * particular session.
+ *
+ * @param   instance    The filter instance
+ * @param   fsession    Filter session, may be NULL
+ * @param   dcb     The DCB for diagnostic output
+ */
+static void
+diagnostic(FILTER *instance, void *fsession, DCB *dcb)
+{
+    DIGEST_INSTANCE *my_instance = (DIGEST_INSTANCE *) instance;
+    DIGEST_SESSION *my_session = (DIGEST_SESSION *) fsession;
+
+    dcb_printf(dcb, "\t\tMaximum number of digests  %d\n",
+               my_instance->max_digests);
+    if (my_instance->source)
+    {
+        dcb_printf(dcb, "\t\tLimit to connections from  %s\n",
+                   my_instance->source);
+    }
+    if (my_instance->user)
+    {
+        dcb_printf(dcb, "\t\tLimit to user              %s\n",
+                   my_instance->user);
+    }
+    if (my_session && my_session->current)
+    {
+        dcb_printf(dcb, "\t\tCurrent statement          %s\n",
+                   my_session->current);
+    }
+}
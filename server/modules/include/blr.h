@@ -37,6 +37,7 @@
 #include <dcb.h>
 #include <buffer.h>
 #include <pthread.h>
+#include <thread.h>
 #include <stdint.h>
 #include <memlog.h>
 #include <zlib.h>
@@ -139,6 +140,26 @@
 #define DEF_LONG_BURST          500
 #define DEF_BURST_SIZE          1024000 /* 1 Mb */
 
+/**
+ * Adaptive catchup bursts
+ * BLR_BURST_MIN_SIZE           The smallest burst in bytes
+ * BLR_BURST_TARGET_MS          A burst is what the slave drains in this time (milliseconds)
+ * BLR_BURST_MAX_TIME_MS        The longest time a burst may take (milliseconds)
+ */
+#define BLR_BURST_MIN_SIZE      16384
+#define BLR_BURST_TARGET_MS     100
+#define BLR_BURST_MAX_TIME_MS   20
+
+/**
+ * Default size of the binlog event cache
+ */
+#define DEF_CACHE_SIZE          16384000 /* 16 Mb */
+
+/**
+ * Default number of the most recent closed binlog files that are not compressed
+ */
+#define DEF_COMPRESS_KEEP       2
+
 /**
  * master reconnect backoff constants
  * BLR_MASTER_BACKOFF_TIME      The increments of the back off time (seconds)
@@ -251,38 +272,218 @@ typedef struct rep_header
 } REP_HEADER;
 
 /**
- * The binlog record structure. This contains the actual packet read from the binlog
- * file.
+ * The binlog record structure. This contains an event that was written to the
+ * binlog file.
  */
 typedef struct
 {
     unsigned long   position;       /*< binlog record position for this cache entry */
-    GWBUF           *pkt;           /*< The packet received from the master */
+    GWBUF           *pkt;           /*< The event, shared by all slaves */
     REP_HEADER      hdr;            /*< The packet header */
 } BLCACHE_RECORD;
 
 /**
- * The binlog cache. A cache exists for each file that hold cached bin log records.
- * Caches will be used for all files being read by more than 1 slave.
+ * The binlog cache. The most recent events written to the current binlog file
+ * are kept in a ring ordered by position, the oldest ones are dropped when the
+ * events take more than max_bytes. Slaves that read events near the end of
+ * the binlog get them from the cache instead of reading the file.
  */
 typedef struct
 {
-    BLCACHE_RECORD  **records;      /*< The actual binlog records */
-    int             current;        /*< The next record that will be inserted */
+    BLCACHE_RECORD  *records;       /*< The ring of binlog records */
+    int             first;          /*< The oldest record in the ring */
     int             cnt;            /*< The number of records in the cache */
+    int             size;           /*< The number of records the ring can hold */
+    unsigned long   bytes;          /*< Total size of the cached events */
+    unsigned long   max_bytes;      /*< Maximum total size of the cached events */
+    char            binlogname[BINLOG_FNAMELEN + 1]; /*< The file of the records */
     SPINLOCK        lock;           /*< The spinlock for the cache */
 } BLCACHE;
 
+/**
+ * A closed binlog file is compressed into a file with this suffix. The file
+ * starts with a BLR_COMPRESSED_HEADER which is followed by the file offsets
+ * of the blocks and the blocks themselves. Each block holds
+ * BLR_COMPRESS_BLOCK_SIZE bytes of the binlog file compressed with zlib,
+ * a block that does not get smaller is stored as it is.
+ */
+#define BLR_COMPRESSED_SUFFIX       ".blz"
+#define BLR_COMPRESSED_MAGIC        "BLRZIP01"
+#define BLR_COMPRESSED_MAGIC_LEN    8
+#define BLR_COMPRESS_BLOCK_SIZE     65536
+#define BLR_COMPRESS_LEVEL          Z_BEST_SPEED
+
+/**
+ * Number of uncompressed blocks cached for each open compressed file
+ */
+#define BLR_COMPRESS_CACHED_BLOCKS  4
+
+/**
+ * Seconds between the scans for binlog files to compress
+ */
+#define BLR_COMPRESS_INTERVAL       10
+
+/**
+ * The header of a compressed binlog file, stored as it is in memory
+ */
+typedef struct
+{
+    char            magic[BLR_COMPRESSED_MAGIC_LEN];
+    uint64_t        size;           /*< Size of the uncompressed binlog file */
+    uint32_t        block_size;     /*< Uncompressed size of a block */
+    uint32_t        n_blocks;       /*< Number of blocks */
+    uint32_t        crc;            /*< CRC32 of the block offsets */
+    uint32_t        unused;
+} BLR_COMPRESSED_HEADER;
+
+/**
+ * An uncompressed block of a compressed binlog file
+ */
+typedef struct
+{
+    long            block;          /*< Number of the block, -1 if not used */
+    unsigned long   used;           /*< When the block was last used */
+    uint8_t         *data;          /*< The uncompressed data */
+} BLR_CACHED_BLOCK;
+
+/**
+ * The block index and the block cache of an open compressed binlog file
+ */
+typedef struct
+{
+    BLR_COMPRESSED_HEADER hdr;      /*< The header of the file */
+    uint64_t        *offsets;       /*< Offsets of the blocks, n_blocks + 1 entries */
+    uint8_t         *cbuf;          /*< Buffer for reading a compressed block */
+    unsigned long   clock;          /*< Counter for the block usage */
+    pthread_mutex_t lock;           /*< Protects the buffer and the cached blocks */
+    BLR_CACHED_BLOCK blocks[BLR_COMPRESS_CACHED_BLOCKS]; /*< Recently read blocks */
+} BLFILE_BLOCKS;
+
 typedef struct blfile
 {
     char            binlogname[BINLOG_FNAMELEN + 1]; /*< Name of the binlog file */
     int             fd;                             /*< Actual file descriptor */
     int             refcnt;                         /*< Reference count for file */
-    BLCACHE         *cache;                         /*< Record cache for this file */
     SPINLOCK        lock;                           /*< The file lock */
+    BLFILE_BLOCKS   *blocks;                        /*< Blocks of a compressed file */
     struct blfile   *next;                          /*< Next file in list */
 } BLFILE;
 
+/**
+ * A part of a binlog file that is mapped into memory. The event at position
+ * pos of the file is at base + (pos - start).
+ */
+typedef struct
+{
+    void            *base;          /*< Start of the mapping */
+    size_t          size;           /*< Size of the mapping */
+    unsigned long   start;          /*< File position of the first mapped byte */
+    unsigned long   end;            /*< File position after the last mapped byte */
+} BLFILE_MAP;
+
+/**
+ * Maximum number of events sent from a mapped binlog file with one write
+ */
+#define BLR_MAPPED_EVENTS       256
+
+/**
+ * Returned instead of the number of sent events when the first mapped event
+ * has already been sent to the slave
+ */
+#define BLR_MAPPED_DUPLICATE    -2
+
+/**
+ * The GTID index file in the binlog directory
+ */
+#define BLR_GTID_INDEX_FILE         "gtid_index"
+#define BLR_GTID_INDEX_MAGIC_LEN    8
+#define BLR_GTID_INDEX_INITIAL      1024
+
+/**
+ * A transaction in the GTID index. The entries are stored in the index file
+ * as they are in memory.
+ */
+typedef struct
+{
+    uint32_t        domain;         /*< Replication domain of the GTID */
+    uint32_t        server_id;      /*< Server id of the GTID */
+    uint64_t        seq;            /*< Sequence number of the GTID */
+    uint32_t        file;           /*< Number of the binlog file */
+    uint32_t        start;          /*< Position of the GTID event */
+    uint32_t        end;            /*< Position after the transaction */
+    uint32_t        unused;
+} BLR_GTID_ENTRY;
+
+/** The state of the transaction being written to the binlog */
+typedef enum
+{
+    BLR_GTID_NONE,                  /*< No GTID seen */
+    BLR_GTID_TRX,                   /*< Transaction ends with XID or COMMIT */
+    BLR_GTID_STANDALONE             /*< Transaction of one statement */
+} blr_gtid_state_t;
+
+/**
+ * The GTID index, sorted by domain and sequence number
+ */
+typedef struct
+{
+    BLR_GTID_ENTRY  *entries;       /*< The indexed transactions */
+    int             count;          /*< Number of transactions */
+    int             size;           /*< Allocated entries */
+    BLR_GTID_ENTRY  pending;        /*< The transaction being written */
+    blr_gtid_state_t state;         /*< State of the pending transaction */
+    BLR_GTID_ENTRY  *queue;         /*< Ended transactions not yet visible or saved */
+    int             queued;         /*< Number of queued transactions */
+    int             queue_size;     /*< Allocated queue entries */
+    int             visible;        /*< Queued transactions added to the entries */
+    int             saved;          /*< Queued transactions written to the index file */
+    int             fd;             /*< The index file */
+    SPINLOCK        lock;           /*< Protects the entries */
+} BLR_GTID_INDEX;
+
+/**
+ * The binlog index is stored next to a binlog file with this suffix
+ */
+#define BLR_INDEX_SUFFIX            ".idx"
+#define BLR_INDEX_MAGIC             "BLRIDX01"
+#define BLR_INDEX_MAGIC_LEN         8
+
+/**
+ * Minimum amount of binlog data written between two binlog index checkpoints
+ */
+#define BLR_INDEX_INTERVAL          16384000
+
+/**
+ * The summary of a binlog file read with blr_read_events_all_events
+ */
+typedef struct
+{
+    uint64_t        n_events;       /*< Valid events, including the indexed ones */
+    uint64_t        n_transactions; /*< Complete transactions that were read */
+    bool            checksums;      /*< Whether the events have CRC32 checksums */
+    bool            bad_checksum;   /*< An event had a wrong checksum */
+} BLR_SCAN_RESULT;
+
+/**
+ * The binlog index records how far a binlog file is known to be valid. The
+ * check of the binlog at startup only reads the events after the position in
+ * the index. The index is stored in the file as it is in memory.
+ */
+typedef struct
+{
+    char            magic[BLR_INDEX_MAGIC_LEN]; /*< BLR_INDEX_MAGIC */
+    uint64_t        pos;            /*< End of the checked events, 0 if not known */
+    uint64_t        n_events;       /*< Number of events before pos */
+    uint64_t        last_pos;       /*< Position of the last event before pos */
+    uint64_t        fde_pos;        /*< Position of the format description event */
+    uint32_t        last_size;      /*< Size of the last event */
+    uint32_t        last_type;      /*< Type of the last event */
+    uint32_t        last_time;      /*< Timestamp of the last event */
+    uint32_t        fde_time;       /*< Timestamp of the format description event */
+    uint32_t        checksum;       /*< Whether the events have a CRC32 checksum */
+    uint32_t        crc;            /*< CRC32 of the fields above */
+} BLR_BINLOG_INDEX;
+
 /**
  * Slave statistics
  */
@@ -335,6 +536,7 @@ typedef struct router_slave
     char            binlogfile[BINLOG_FNAMELEN + 1];
     /*< Current binlog file for this slave */
     char            *uuid;          /*< Slave UUID */
+    char            *connect_state; /*< GTID state from @slave_connect_state */
 #ifdef BLFILE_IN_SLAVE
     BLFILE          *file;          /*< Currently open binlog file */
 #endif
@@ -356,6 +558,8 @@ typedef struct router_slave
     struct router_instance
         *router;        /*< Pointer to the owning router */
     struct router_slave *next;
+    struct router_slave *next_waiter; /*< Next slave waiting for new events */
+    bool            waiting;        /*< The slave is in the list of waiting slaves */
     SLAVE_STATS     stats;          /*< Slave statistics */
     time_t          connect_time;   /*< Connect time of slave */
     char            *warning_msg;   /*< Warning message */
@@ -367,6 +571,12 @@ typedef struct router_slave
     THREAD            lsi_sender_tid;  /*< Who sent */
     char              lsi_binlog_name[BINLOG_FNAMELEN + 1]; /*< Which binlog file */
     uint32_t          lsi_binlog_pos; /*< What position */
+    long            burst_budget;   /*< Bytes the next catchup burst may send */
+    int64_t         burst_start;    /*< Start of the previous burst in microseconds */
+    unsigned long   burst_sent;     /*< Bytes sent in the previous burst */
+    int             burst_start_writeq; /*< Write queue length before the previous burst */
+    int             burst_writeq;   /*< Write queue length after the previous burst */
+    unsigned long   drain_rate;     /*< Bytes per second the slave has consumed */
 #if defined(SS_DEBUG)
     skygw_chk_t     rses_chk_tail;
 #endif
@@ -386,6 +596,13 @@ typedef struct
     uint64_t        n_rotates;      /*< Number of binlog rotate events */
     uint64_t        n_cachehits;    /*< Number of hits on the binlog cache */
     uint64_t        n_cachemisses;  /*< Number of misses on the binlog cache */
+    uint64_t        n_binlog_writes;/*< Number of writes to the binlog files */
+    uint64_t        n_binlog_syncs; /*< Number of syncs of the binlog files */
+    uint64_t        n_compressed;   /*< Number of compressed binlog files */
+    uint64_t        n_compress_in;  /*< Bytes of binlog files compressed */
+    uint64_t        n_compress_out; /*< Size of the compressed binlog files */
+    uint64_t        n_block_reads;  /*< Blocks read from compressed files */
+    uint64_t        n_block_hits;   /*< Reads served from the cached blocks */
     int             n_registered;   /*< Number of registered slaves */
     int             n_masterstarts; /*< Number of times connection restarted */
     int             n_delayedreconnects;
@@ -453,6 +670,8 @@ typedef struct router_instance
     MASTER_RESPONSES        saved_master;   /*< Saved master responses */
     char                    *binlogdir;     /*< The directory with the binlog files */
     SPINLOCK                binlog_lock;    /*< Lock to control update of the binlog position */
+    ROUTER_SLAVE            *waiters;       /*< Up to date slaves waiting for new events */
+    SPINLOCK                waiters_lock;   /*< Protects waiters */
     int                     trx_safe;       /*< Detect and handle partial transactions */
     int                     pending_transaction; /*< Pending transaction */
     enum blr_event_state    master_event_state; /*< Packet read state */
@@ -485,6 +704,30 @@ typedef struct router_instance
     unsigned int      short_burst;  /*< Short burst for slave catchup */
     unsigned int      long_burst;   /*< Long burst for slave catchup */
     unsigned long     burst_size;   /*< Maximum size of burst to send */
+    bool              adaptive_burst; /*< Size the bursts by the slave drain rate */
+    unsigned long     cache_size;   /*< Maximum size of the binlog cache */
+    BLCACHE           *cache;       /*< Recent binlog events shared by the slaves */
+    BLR_GTID_INDEX    *gtid_index;  /*< GTIDs of the transactions in the binlogs */
+    BLR_BINLOG_INDEX  binlog_index; /*< Index of the current binlog file */
+    uint64_t          index_checkpoint; /*< Position of the last written index */
+    unsigned long     write_buffer_size; /*< Size of the binlog write buffer */
+    uint8_t           *write_buf;   /*< Events not yet written to the binlog file */
+    uint32_t          write_buf_len; /*< Number of bytes in the write buffer */
+    unsigned long     sync_interval; /*< Milliseconds between binlog syncs */
+    unsigned long     sync_bytes;   /*< Bytes written between binlog syncs */
+    unsigned long     sync_trx;     /*< Transactions between binlog syncs */
+    bool              sync_slaves;  /*< Only synced events are sent to the slaves */
+    unsigned long     unsynced_bytes; /*< Bytes written since the last sync */
+    unsigned long     unsynced_trx; /*< Transactions committed since the last sync */
+    unsigned long     last_sync;    /*< Heartbeat of the last sync */
+    bool              commit_pending; /*< Committed events not yet sent to the slaves */
+    uint64_t          commit_pos;   /*< The binlog position of the pending commit */
+    uint64_t          commit_event; /*< The safe event of the pending commit */
+    bool              compress_binlogs; /*< Compress the closed binlog files */
+    int               compress_keep; /*< Recent closed files left uncompressed */
+    THREAD            compress_thread; /*< The thread that compresses the files */
+    bool              compress_running; /*< The compression thread was started */
+    bool              compress_stop; /*< Tells the compression thread to exit */
     unsigned long     heartbeat;    /*< Configured heartbeat value */
     ROUTER_STATS      stats;        /*< Statistics for this router */
     int               active_logs;
@@ -602,28 +845,59 @@ static char *blrs_states[] =
 extern void blr_start_master(void *);
 extern void blr_master_response(ROUTER_INSTANCE *, GWBUF *);
 extern void blr_master_reconnect(ROUTER_INSTANCE *);
+extern void blr_notify_slaves(ROUTER_INSTANCE *);
+extern void blr_slave_wait_events(ROUTER_INSTANCE *, ROUTER_SLAVE *);
+extern void blr_slave_stop_waiting(ROUTER_INSTANCE *, ROUTER_SLAVE *);
 extern int blr_master_connected(ROUTER_INSTANCE *);
 
 extern int blr_slave_request(ROUTER_INSTANCE *, ROUTER_SLAVE *, GWBUF *);
 extern void blr_slave_rotate(ROUTER_INSTANCE *, ROUTER_SLAVE *, uint8_t *);
 extern int blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large);
 extern void blr_init_cache(ROUTER_INSTANCE *);
+extern void blr_free_cache(ROUTER_INSTANCE *);
+extern void blr_cache_add(ROUTER_INSTANCE *, REP_HEADER *, unsigned long, uint8_t *);
+extern GWBUF *blr_cache_get(ROUTER_INSTANCE *, char *, unsigned long, REP_HEADER *);
+extern void blr_cache_clear(ROUTER_INSTANCE *);
+extern void blr_gtid_index_init(ROUTER_INSTANCE *);
+extern void blr_gtid_index_free(ROUTER_INSTANCE *);
+extern void blr_gtid_index_event(ROUTER_INSTANCE *, REP_HEADER *, unsigned long, uint8_t *, uint32_t);
+extern void blr_gtid_index_visible(ROUTER_INSTANCE *, unsigned long);
+extern void blr_gtid_index_synced(ROUTER_INSTANCE *, unsigned long);
+extern void blr_gtid_index_truncate(ROUTER_INSTANCE *, unsigned long);
+extern bool blr_gtid_index_find(ROUTER_INSTANCE *, uint32_t, uint32_t, uint64_t, char *, uint32_t *);
+extern bool blr_gtid_index_first_file(ROUTER_INSTANCE *, char *);
+extern uint32_t blr_gtid_index_domain(ROUTER_INSTANCE *);
+extern int blr_gtid_index_count(ROUTER_INSTANCE *);
+extern void blr_gtid_index_prune(ROUTER_INSTANCE *);
 
 extern int  blr_file_init(ROUTER_INSTANCE *);
 extern int  blr_write_binlog_record(ROUTER_INSTANCE *, REP_HEADER *, uint32_t pos, uint8_t *);
 extern int  blr_file_rotate(ROUTER_INSTANCE *, char *, uint64_t);
-extern void blr_file_flush(ROUTER_INSTANCE *);
+extern bool blr_file_flush(ROUTER_INSTANCE *);
+extern bool blr_file_write_buffer(ROUTER_INSTANCE *);
+extern bool blr_file_commit(ROUTER_INSTANCE *, uint64_t, uint64_t);
 extern BLFILE *blr_open_binlog(ROUTER_INSTANCE *, char *);
 extern GWBUF *blr_read_binlog(ROUTER_INSTANCE *, BLFILE *, unsigned long, REP_HEADER *, char *);
 extern void blr_close_binlog(ROUTER_INSTANCE *, BLFILE *);
+extern bool blr_map_binlog(ROUTER_INSTANCE *, BLFILE *, unsigned long, unsigned long, BLFILE_MAP *);
+extern void blr_unmap_binlog(BLFILE_MAP *);
 extern unsigned long blr_file_size(BLFILE *);
+extern bool blr_compress_start(ROUTER_INSTANCE *);
+extern void blr_compress_stop(ROUTER_INSTANCE *);
+extern bool blr_compress_file(ROUTER_INSTANCE *, const char *);
+extern BLFILE_BLOCKS *blr_compressed_open(ROUTER_INSTANCE *, int, const char *);
+extern int blr_compressed_read(ROUTER_INSTANCE *, BLFILE_BLOCKS *, int, uint8_t *, size_t, unsigned long);
+extern void blr_compressed_free(BLFILE_BLOCKS *);
 extern int blr_statistics(ROUTER_INSTANCE *, ROUTER_SLAVE *, GWBUF *);
 extern int blr_ping(ROUTER_INSTANCE *, ROUTER_SLAVE *, GWBUF *);
 extern int blr_send_custom_error(DCB *, int, int, char *, char *, unsigned int);
 extern int blr_file_next_exists(ROUTER_INSTANCE *, ROUTER_SLAVE *);
 uint32_t extract_field(uint8_t *src, int bits);
 void blr_cache_read_master_data(ROUTER_INSTANCE *router);
-int blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug);
+int blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug, BLR_SCAN_RESULT *result);
+extern bool blr_index_load(ROUTER_INSTANCE *, BLR_BINLOG_INDEX *);
+extern bool blr_index_write(ROUTER_INSTANCE *, BLR_BINLOG_INDEX *);
+extern void blr_index_checkpoint(ROUTER_INSTANCE *);
 int blr_save_dbusers(const ROUTER_INSTANCE *router);
 char    *blr_get_event_description(ROUTER_INSTANCE *router, uint8_t event);
 void blr_file_append(ROUTER_INSTANCE *router, char *file);
@@ -287,6 +287,8 @@ typedef struct
     unsigned        long tid;                         /*< MySQL Thread ID, in
         * handshake */
     unsigned int    charset;                          /*< MySQL character set at connect time */
+    int64_t         reset_start;                      /*< When the reset of a pooled
+        * connection was sent, 0 if none is pending */
 #if defined(SS_DEBUG)
     skygw_chk_t     protocol_chk_tail;
 #endif
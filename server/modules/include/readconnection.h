@@ -26,6 +26,7 @@
  * @endverbatim
  */
 #include <dcb.h>
+#include <mysql_utils.h>
 
 /**
  * Internal structure used to define the set of backend servers we are routing
@@ -55,6 +56,9 @@ typedef struct router_client_session
     DCB *client_dcb; /**< Client DCB */
     struct router_client_session *next;
     int rses_capabilities; /*< input type, for example */
+    mxs_mysql_reply_t reply; /*< Progress of the reply to the tracked query */
+    int64_t sent; /*< When the tracked query was sent, 0 if none is tracked */
+    int64_t first_byte; /*< When the first byte of the reply was received */
 #if defined(SS_DEBUG)
     skygw_chk_t rses_chk_tail;
 #endif
@@ -26,6 +26,8 @@
 
 #include <dcb.h>
 #include <hashtable.h>
+#include <mysql_utils.h>
+#include <mysql_binlog.h>
 #include <math.h>
 
 #undef PREP_STMT_CACHING
@@ -116,12 +118,15 @@ typedef enum select_criteria
     LEAST_ROUTER_CONNECTIONS,   /*< connections established by this router */
     LEAST_BEHIND_MASTER,
     LEAST_CURRENT_OPERATIONS,
-    DEFAULT_CRITERIA   = LEAST_CURRENT_OPERATIONS,
-    LAST_CRITERIA               /*< not used except for an index */
+    ADAPTIVE_ROUTING,           /*< average response time and current operations */
+    LAST_CRITERIA,              /*< not used except for an index */
+    DEFAULT_CRITERIA   = LEAST_CURRENT_OPERATIONS
 } select_criteria_t;
 
 
 /** default values for rwsplit configuration parameters */
+#define CONFIG_CAUSAL_READS_TIMEOUT 10
+#define CONFIG_HEDGED_READS_PERCENTILE 95
 #define CONFIG_MAX_SLAVE_CONN 1
 #define CONFIG_MAX_SLAVE_RLAG -1 /*< not used */
 #define CONFIG_SQL_VARIABLES_IN TYPE_ALL
@@ -134,7 +139,9 @@ typedef enum select_criteria
         strncmp(s,"LEAST_ROUTER_CONNECTIONS", strlen("LEAST_ROUTER_CONNECTIONS")) == 0 ?        \
         LEAST_ROUTER_CONNECTIONS : (                                                            \
         strncmp(s,"LEAST_CURRENT_OPERATIONS", strlen("LEAST_CURRENT_OPERATIONS")) == 0 ?        \
-        LEAST_CURRENT_OPERATIONS : UNDEFINED_CRITERIA))))
+        LEAST_CURRENT_OPERATIONS : (                                                            \
+        strncmp(s,"ADAPTIVE_ROUTING", strlen("ADAPTIVE_ROUTING")) == 0 ?                        \
+        ADAPTIVE_ROUTING : UNDEFINED_CRITERIA)))))
 
 /**
  * Session variable command
@@ -152,6 +159,12 @@ typedef struct mysql_sescmd_st
                                    *  LOCAL_INFILE. Slave servers are compared to this
                                    *  when they return session command replies.*/
     int      position; /*< Position of this command */
+    char*              my_sescmd_key;  /*< The session state this command sets, a later
+                                        *  command with the same key supersedes this one.
+                                        *  NULL if the command can't be superseded. */
+    int                my_sescmd_size; /*< Memory used by the command */
+    uint32_t           my_sescmd_ps_id; /*< Router's ID of a prepared statement, 0 if
+                                         *  the command is not a COM_STMT_PREPARE */
 #if defined(SS_DEBUG)
     skygw_chk_t        my_sescmd_chk_tail;
 #endif
@@ -211,11 +224,67 @@ typedef struct backend_st
     int             backend_conn_count;  /*< Number of connections to the server */
     bool            be_valid; /*< Valid when belongs to the router's configuration */
     int             weight; /*< Desired weighting on the load. Expressed in .1% increments */
+    int64_t         backend_hedge_delay; /*< Delay before a read is hedged, 0 if unknown */
+    int64_t         backend_hedge_updated; /*< When backend_hedge_delay was calculated */
 #if defined(SS_DEBUG)
     skygw_chk_t     be_chk_tail;
 #endif
 } BACKEND;
 
+/**
+ * The backend servers of a router ordered by the slave selection criteria.
+ *
+ * The ranking is calculated from one consistent read of the server statistics
+ * and shared by all sessions of the router. A new ranking replaces the old one
+ * on the next housekeeper heartbeat or when the state or the load of a server
+ * changes.
+ * Users take a reference with router_get_ranking and release it with
+ * backend_ranking_release.
+ */
+typedef struct backend_ranking
+{
+    int               refcount;   /*< Number of users, freed when it drops to zero */
+    select_criteria_t criteria;   /*< The criteria used to order the servers */
+    long              heartbeat;  /*< Value of hkheartbeat when the ranking was made */
+    int               n_servers;  /*< Number of servers in the ranking */
+    int               *order;     /*< Indexes into the servers of the router, best first */
+    unsigned int      *status;    /*< Status of each server when the ranking was made */
+    int64_t           *load;      /*< Load of each server when the ranking was made */
+} BACKEND_RANKING;
+
+/**
+ * State of the causal read processing of a backend
+ */
+typedef enum
+{
+    CAUSAL_NONE,         /**< Nothing extra was sent to the backend */
+    CAUSAL_GTID_QUEUED,  /**< The GTID query follows the reply to the current query */
+    CAUSAL_GTID_READING, /**< Reading the reply to the GTID query */
+    CAUSAL_GTID_PASSING, /**< Passing a reply that precedes a queued GTID query */
+    CAUSAL_WAITING       /**< Waiting for the slave to reach the GTID of the session */
+} causal_state_t;
+
+/**
+ * A reply that the master sends after the reply to a GTID query that has
+ * not yet been read
+ */
+typedef struct
+{
+    uint8_t command; /**< The command the reply is for */
+    bool    gtid;    /**< The reply is followed by the reply to a GTID query */
+} causal_pending_t;
+
+/**
+ * State of a backend in a hedged read
+ */
+typedef enum
+{
+    HEDGE_NONE,      /**< No hedged read is active */
+    HEDGE_PRIMARY,   /**< The read was routed here, the first backend to reply wins */
+    HEDGE_SECONDARY, /**< The read was hedged here, the first backend to reply wins */
+    HEDGE_DISCARD    /**< The other backend replied first, the reply is discarded */
+} hedge_state_t;
+
 /**
  * Reference to BACKEND.
  *
@@ -234,6 +303,18 @@ typedef struct backend_ref_st
     GWBUF*          bref_pending_cmd; /**< For stmt which can't be routed due active sescmd execution */
     unsigned char   reply_cmd;  /**< The reply the backend server sent to a session command.
                                  * Used to detect slaves that fail to execute session command. */
+    mxs_mysql_latency_t bref_latency; /**< Latency of the latest query */
+    causal_state_t  bref_causal_state; /**< State of the causal read processing */
+    mxs_mysql_reply_t bref_causal_reply; /**< Progress of the reply that precedes or
+                                          * follows the client's query */
+    GWBUF*          bref_causal_buf; /**< The read waiting for the GTID */
+    causal_pending_t* bref_causal_pending; /**< Replies queued behind the current one */
+    int             bref_causal_n_pending; /**< Number of queued replies */
+    int             bref_causal_pending_size; /**< Allocated size of bref_causal_pending */
+    char            bref_causal_gtid[GTID_MAX_LEN + 1]; /**< GTID read from the current reply */
+    hedge_state_t   bref_hedge_state; /**< State of the hedged read */
+    struct backend_ref_st* bref_hedge_peer; /**< The other backend of the hedged read */
+    mxs_mysql_reply_t bref_hedge_reply; /**< Progress of the discarded reply */
 #if defined(SS_DEBUG)
     skygw_chk_t     bref_chk_tail;
 #endif
@@ -261,7 +342,24 @@ typedef struct rwsplit_config_st
                                                 * to master or all nodes */
     int               rw_max_sescmd_history_size; /**< Maximum amount of session commands to store */
     bool              rw_disable_sescmd_hist; /**< Disable session command history */
+    bool              rw_compact_sescmd_hist; /**< Remove superseded session commands
+                                               * from the history */
     bool              rw_master_reads; /**< Use master for reads */
+    bool              rw_lazy_connect; /**< Connect to slaves only when a read
+                                        * is routed to them */
+    bool              rw_multiplex; /**< Close the backend connections of idle
+                                     * sessions so that the connection pools of
+                                     * the servers can share them */
+    bool              rw_causal_reads; /**< Wait for the slave to catch up with
+                                        * the latest write of the session */
+    int               rw_causal_reads_timeout; /**< Seconds to wait before reading
+                                                * from the master instead */
+    bool              rw_read_only_trx; /**< Route READ ONLY transactions to slaves */
+    bool              rw_hedged_reads; /**< Send slow reads to a second slave */
+    bool              rw_ps_routing; /**< Route executions of prepared statements
+                                      * to slaves */
+    int               rw_hedged_reads_percentile; /**< Response time percentile of the
+                                                   * slave used as the hedging delay */
     bool              rw_strict_multi_stmt; /**< Force non-multistatement queries to be routed
                                              * to the master after a multistatement query. */
     enum failure_mode rw_master_failure_mode; /**< Master server failure handling mode.
@@ -290,6 +388,25 @@ typedef struct prep_stmt_st
 
 #endif /*< PREP_STMT_CACHING */
 
+/**
+ * A binary protocol prepared statement of a router session.
+ *
+ * The statement is prepared in all backends and each of them assigns its own
+ * ID to it. The client only sees the ID assigned by the router which is
+ * replaced with the ID of the backend whenever the statement is used.
+ */
+typedef struct rses_ps
+{
+    uint32_t       ps_id;           /*< The ID seen by the client */
+    uint32_t       ps_type;         /*< Query type of the prepared statement */
+    int            ps_n_params;     /*< Number of parameters, -1 until known */
+    uint32_t       *ps_backend_ids; /*< ID in each backend, 0 if not prepared there */
+    bool           *ps_types_sent;  /*< Backends that know the current parameter types */
+    uint8_t        *ps_param_types; /*< Parameter types of the latest execution */
+    backend_ref_t  *ps_exec_bref;   /*< Backend of the latest execution */
+    bool           ps_long_data;    /*< Parameter data was sent to the master */
+} rses_ps_t;
+
 /**
  * The client session structure used within this router.
  */
@@ -307,8 +424,24 @@ struct router_client_session
     rwsplit_config_t rses_config;    /*< copied config info from router instance */
     int              rses_nbackends;
     int              rses_nsescmd;  /*< Number of executed session commands */
+    int              rses_sescmd_count; /*< Number of session commands in the history */
+    int              rses_sescmd_bytes; /*< Memory used by the session command history */
+    char             rses_gtid[GTID_MAX_LEN + 1]; /*< GTID of the latest write, used by causal_reads */
     bool             rses_autocommit_enabled;
     bool             rses_transaction_active;
+    bool             rses_trx_read_only; /*< The open transaction is READ ONLY */
+    backend_ref_t    *rses_trx_target; /*< The slave used by the READ ONLY transaction */
+    backend_ref_t    *rses_hedge_bref; /*< The slave of a read that may be hedged */
+    GWBUF            *rses_hedge_query; /*< The read that may be hedged */
+    int64_t          rses_hedge_deadline; /*< When the read is sent to a second slave */
+    bool             rses_hedge_listed; /*< The session is in the list of the hedge thread */
+    struct router_client_session *rses_hedge_next; /*< Next session in the hedge list */
+    HASHTABLE        *rses_ps;       /*< Prepared statements by the ID seen by the client */
+    bool             rses_multiplex_pinned; /*< The session has state that can't be
+                                             *  restored on a new connection */
+    bool             rses_master_released; /*< The master connection was closed while
+                                            *  the session was idle */
+    uint32_t         rses_ps_next_id; /*< Latest ID given to a prepared statement */
     bool             rses_load_active; /*< If LOAD DATA LOCAL INFILE is being currently executed */
     bool             have_tmp_tables;
     uint64_t         rses_load_data_sent; /*< How much data has been sent */
@@ -335,6 +468,19 @@ typedef struct
     int     n_master;   /*< Number of stmts sent to master */
     int     n_slave;    /*< Number of stmts sent to slave */
     int     n_all;      /*< Number of stmts sent to all */
+    int     n_sescmd;   /*< Number of session commands in the histories of all sessions */
+    int64_t n_sescmd_bytes; /*< Memory used by the histories of all sessions */
+    int     n_sescmd_compacted; /*< Number of superseded session commands removed */
+    int     n_sescmd_hist_exceeded; /*< Sessions that exceeded max_sescmd_history */
+    int     n_lazy_connects; /*< Slave connections opened by the first read */
+    int     n_causal_reads; /*< Reads that waited for the GTID of the session */
+    int     n_causal_timeouts; /*< Causal reads routed to master after a timeout */
+    int     n_read_only_trx; /*< READ ONLY transactions routed to slaves */
+    int     n_hedged_reads; /*< Reads sent to a second slave */
+    int     n_hedge_wins; /*< Hedged reads where the second slave replied first */
+    int     n_ps_slave_exec; /*< Prepared statements executed on slaves */
+    int     n_multiplex_released; /*< Backend connections closed between transactions */
+    int     n_multiplex_acquired; /*< Master connections opened again by the next statement */
 } ROUTER_STATS;
 
 /**
@@ -352,6 +498,9 @@ typedef struct router_instance
     ROUTER_STATS            stats;       /*< Statistics for this router */
     struct router_instance* next;        /*< Next router on the list */
     bool                    available_slaves; /*< The router has some slaves avialable */
+    SPINLOCK                ranking_lock; /*< Protects the ranking pointer */
+    BACKEND_RANKING*        ranking;     /*< The current ranking of the servers */
+    int                     ranking_rebuild; /*< Non-zero while a new ranking is made */
 } ROUTER_INSTANCE;
 
 #define BACKEND_TYPE(b) (SERVER_IS_MASTER((b)->backend_server) ? BE_MASTER :    \
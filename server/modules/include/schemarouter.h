@@ -30,6 +30,7 @@
 #include <dcb.h>
 #include <hashtable.h>
 #include <mysql_client_server_protocol.h>
+#include <mysql_utils.h>
 #include <pcre2.h>
 /**
  * Bitmask values for the router session's initialization. These values are used
@@ -267,6 +268,7 @@ typedef struct backend_ref_st
     int             bref_num_result_wait; /*< Number of not yet received results */
     sescmd_cursor_t bref_sescmd_cur; /*< Session command cursor */
     GWBUF*          bref_pending_cmd; /*< For stmt which can't be routed due active sescmd execution */
+    mxs_mysql_latency_t bref_latency; /*< Latency of the latest query */
 #if defined(SS_DEBUG)
     skygw_chk_t     bref_chk_tail;
 #endif
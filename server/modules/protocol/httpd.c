@@ -38,6 +38,7 @@
 #include <modinfo.h>
 #include <log_manager.h>
 #include <resultset.h>
+#include <metrics.h>
 
 /* @see function load_module in load_utils.c for explanation of the following
  * lint directives.
@@ -65,7 +66,7 @@ static int httpd_accept(DCB *dcb);
 static int httpd_close(DCB *dcb);
 static int httpd_listen(DCB *dcb, char *config);
 static int httpd_get_line(int sock, char *buf, int size);
-static void httpd_send_headers(DCB *dcb, int final);
+static void httpd_send_headers(DCB *dcb, int final, const char *content_type);
 static char *httpd_default_auth();
 
 /**
@@ -253,7 +254,8 @@ static int httpd_read_event(DCB* dcb)
      */
 
     /* send all the basic headers and close with \r\n */
-    httpd_send_headers(dcb, 1);
+    httpd_send_headers(dcb, 1, strcmp(url, "/metrics") == 0 ?
+                       METRICS_CONTENT_TYPE : "application/json");
 
 #if 0
     /**
@@ -451,8 +453,12 @@ static int httpd_get_line(int sock, char *buf, int size)
 
 /**
  * HTTPD send basic headers with 200 OK
+ *
+ * @param dcb          Client DCB
+ * @param final        Whether to end the headers
+ * @param content_type Value of the Content-Type header
  */
-static void httpd_send_headers(DCB *dcb, int final)
+static void httpd_send_headers(DCB *dcb, int final, const char *content_type)
 {
     char date[64] = "";
     const char *fmt = "%a, %d %b %Y %H:%M:%S GMT";
@@ -464,8 +470,8 @@ static void httpd_send_headers(DCB *dcb, int final)
 
     dcb_printf(dcb,
                "HTTP/1.1 200 OK\r\nDate: %s\r\nServer: %s\r\nConnection: "
-               "close\r\nContent-Type: application/json\r\n",
-               date, HTTP_SERVER_STRING);
+               "close\r\nContent-Type: %s\r\n",
+               date, HTTP_SERVER_STRING, content_type);
 
     /* close the headers */
     if (final)
@@ -107,6 +107,7 @@ static int gw_send_change_user_to_backend(char          *dbname,
 static int gw_session(DCB *backend_dcb, void *data);
 #endif
 static bool gw_get_shared_session_auth_info(DCB* dcb, MYSQL_session* session);
+static int gw_backend_reset(DCB *dcb);
 
 static GWPROTOCOL MyObject = {
                               gw_read_backend_event, /* Read - EPOLLIN handler        */
@@ -121,7 +122,8 @@ static GWPROTOCOL MyObject = {
                               gw_change_user, /* Authentication                */
                               NULL, /* Session                       */
                               gw_backend_default_auth, /* Default authenticator */
-                              NULL  /**< Connection limit reached      */
+                              NULL, /**< Connection limit reached      */
+                              gw_backend_reset /* Reset a pooled connection    */
 };
 
 /*
@@ -901,6 +903,14 @@ gw_read_reply_or_error(DCB *dcb, MYSQL_session local_session)
                     break;
                 case 1:
                     backend_protocol->protocol_auth_state = MYSQL_IDLE;
+
+                    if (backend_protocol->reset_start)
+                    {
+                        /** A connection from the persistent pool was reset */
+                        server_add_pool_wait(dcb->server,
+                                             ts_stats_time_us() - backend_protocol->reset_start);
+                        backend_protocol->reset_start = 0;
+                    }
                     MXS_DEBUG("%lu [gw_read_backend_event] "
                           "gw_receive_backend_auth succeed. "
                           "dcb %p fd %d, user %s.",
@@ -960,7 +970,14 @@ gw_read_reply_or_error(DCB *dcb, MYSQL_session local_session)
                                    "Authentication with backend failed. "
                                    "Session will be closed.");
 
-            if (session->router_session)
+            if (dcb->flags & DCBF_PREWARM)
+            {
+                /** The router doesn't know about the connections that
+                 * warm up the persistent pool */
+                dcb->dcb_errhandle_called = true;
+                dcb_close(dcb);
+            }
+            else if (session->router_session)
             {
                 session->service->router->handleError(
                     session->service->router_instance,
@@ -996,6 +1013,15 @@ gw_read_reply_or_error(DCB *dcb, MYSQL_session local_session)
                   dcb->fd,
                   local_session.user);
 
+            if (dcb->flags & DCBF_PREWARM)
+            {
+                /** The connection was opened to warm up the persistent pool,
+                 * closing it adds it to the pool */
+                spinlock_release(&dcb->authlock);
+                dcb_close(dcb);
+                return 0;
+            }
+
             /* check the delay queue and flush the data */
             if (dcb->delayq)
             {
@@ -1373,6 +1399,13 @@ static int gw_error_backend_event(DCB *dcb)
     session_state_t ses_state;
 
     CHK_DCB(dcb);
+    if (dcb->flags & DCBF_PREWARM)
+    {
+        /** Not known by the router, see gw_read_reply_or_error */
+        dcb->dcb_errhandle_called = true;
+        dcb_close(dcb);
+        return 1;
+    }
     session = dcb->session;
     CHK_SESSION(session);
     if (SESSION_STATE_DUMMY == session->state)
@@ -1505,6 +1538,13 @@ static int gw_backend_hangup(DCB *dcb)
         dcb->dcb_errhandle_called = true;
         goto retblock;
     }
+    if (dcb->flags & DCBF_PREWARM)
+    {
+        /** Not known by the router, see gw_read_reply_or_error */
+        dcb->dcb_errhandle_called = true;
+        dcb_close(dcb);
+        goto retblock;
+    }
     session = dcb->session;
 
     if (session == NULL)
@@ -1742,6 +1782,47 @@ static int backend_write_delayqueue(DCB *dcb)
     return rc;
 }
 
+/**
+ * Reset a connection taken from the persistent pool
+ *
+ * A COM_CHANGE_USER with the credentials of the new session is sent to the
+ * backend. This clears the state left by the previous session, such as user
+ * variables, temporary tables and the default database. The reply is read
+ * like the reply to the authentication of a new connection and the queries
+ * of the new session wait in the delay queue until it has been received.
+ *
+ * @param dcb   The backend DCB taken from the pool
+ * @return 1 if the reset was sent, 0 if the connection can't be used
+ */
+static int gw_backend_reset(DCB *dcb)
+{
+    MySQLProtocol *backend_protocol = (MySQLProtocol *)dcb->protocol;
+    MYSQL_session mses;
+    GWBUF *buffer = NULL;
+    int rc = 0;
+
+    CHK_PROTOCOL(backend_protocol);
+
+    if (gw_get_shared_session_auth_info(dcb, &mses))
+    {
+        spinlock_acquire(&dcb->authlock);
+        if (backend_protocol->protocol_auth_state == MYSQL_IDLE &&
+            (buffer = gw_create_change_user_packet(&mses, backend_protocol)) != NULL)
+        {
+            backend_protocol->protocol_auth_state = MYSQL_AUTH_RECV;
+            backend_protocol->reset_start = ts_stats_time_us();
+            rc = 1;
+        }
+        spinlock_release(&dcb->authlock);
+
+        if (rc && dcb_write(dcb, buffer) == 0)
+        {
+            rc = 0;
+        }
+    }
+    return rc;
+}
+
 /**
  * This routine handles the COM_CHANGE_USER command
  *
@@ -81,6 +81,7 @@ static void clientReply(ROUTER *instance, void *router_session, GWBUF *queue,
 static void errorReply(ROUTER *instance, void *router_session, GWBUF *message,
                        DCB *backend_dcb, error_action_t action, bool *succp);
 static int getCapabilities();
+static int metrics(ROUTER *instance, MXS_METRIC *values, int size);
 extern int MaxScaleUptime();
 extern void avro_get_used_tables(AVRO_INSTANCE *router, DCB *dcb);
 void converter_func(void* data);
@@ -106,7 +107,8 @@ static ROUTER_OBJECT MyObject =
     diagnostics,
     clientReply,
     errorReply,
-    getCapabilities
+    getCapabilities,
+    metrics
 };
 
 static SPINLOCK instlock;
@@ -951,6 +953,39 @@ static int getCapabilities()
     return RCAP_TYPE_NO_RSESSION;
 }
 
+/**
+ * The metrics entry point, returns the router statistics
+ *
+ * @param instance  The router instance
+ * @param values    Where the values are stored
+ * @param size      Number of elements in @c values
+ * @return Number of values stored in @c values
+ */
+static int metrics(ROUTER *instance, MXS_METRIC *values, int size)
+{
+    AVRO_INSTANCE *router = (AVRO_INSTANCE *)instance;
+    MXS_METRIC router_values[] =
+    {
+        {"avro_clients", "Number of connected Avro clients",
+         METRIC_GAUGE, router->stats.n_clients},
+        {"avro_binlog_position", "Current position in the binlog file being converted",
+         METRIC_GAUGE, router->current_pos}
+    };
+    int n_values = sizeof(router_values) / sizeof(router_values[0]);
+
+    if (n_values > size)
+    {
+        n_values = size;
+    }
+
+    for (int i = 0; i < n_values; i++)
+    {
+        values[i] = router_values[i];
+    }
+
+    return n_values;
+}
+
 /**
  * The stats gathering function called from the housekeeper so that we
  * can get timed averages of binlog records shippped
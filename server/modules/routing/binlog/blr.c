@@ -98,12 +98,14 @@ static  void    errorReply(ROUTER  *instance,
                            bool    *succp);
 
 static  int getCapabilities();
+static  int metrics(ROUTER *instance, MXS_METRIC *values, int size);
 static int blr_handler_config(void *userdata, const char *section, const char *name, const char *value);
 static int blr_handle_config_item(const char *name, const char *value, ROUTER_INSTANCE *inst);
 static int blr_set_service_mysql_user(SERVICE *service);
 static int blr_load_dbusers(const ROUTER_INSTANCE *router);
 static int blr_check_binlog(ROUTER_INSTANCE *router);
-int blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug);
+static unsigned long blr_parse_size(char *value);
+int blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug, BLR_SCAN_RESULT *result);
 void blr_master_close(ROUTER_INSTANCE *);
 
 /** The module object definition */
@@ -117,7 +119,8 @@ static ROUTER_OBJECT MyObject =
     diagnostics,
     clientReply,
     errorReply,
-    getCapabilities
+    getCapabilities,
+    metrics
 };
 
 static void stats_func(void *);
@@ -240,6 +243,7 @@ createInstance(SERVICE *service, char **options)
     inst->files = NULL;
     spinlock_init(&inst->fileslock);
     spinlock_init(&inst->binlog_lock);
+    spinlock_init(&inst->waiters_lock);
 
     inst->binlog_fd = -1;
     inst->master_chksum = true;
@@ -255,6 +259,9 @@ createInstance(SERVICE *service, char **options)
     inst->short_burst = DEF_SHORT_BURST;
     inst->long_burst = DEF_LONG_BURST;
     inst->burst_size = DEF_BURST_SIZE;
+    inst->adaptive_burst = true;
+    inst->cache_size = DEF_CACHE_SIZE;
+    inst->compress_keep = DEF_COMPRESS_KEEP;
     inst->retry_backoff = 1;
     inst->binlogdir = NULL;
     inst->heartbeat = BLR_HEARTBEAT_DEFAULT_INTERVAL;
@@ -427,29 +434,55 @@ createInstance(SERVICE *service, char **options)
                 }
                 else if (strcmp(options[i], "burstsize") == 0)
                 {
-                    unsigned long size = atoi(value);
-                    char    *ptr = value;
-                    while (*ptr && isdigit(*ptr))
+                    inst->burst_size = blr_parse_size(value);
+                }
+                else if (strcmp(options[i], "adaptive_burst") == 0)
+                {
+                    inst->adaptive_burst = config_truth_value(value);
+                }
+                else if (strcmp(options[i], "cache_size") == 0)
+                {
+                    inst->cache_size = blr_parse_size(value);
+                }
+                else if (strcmp(options[i], "write_buffer") == 0)
+                {
+                    inst->write_buffer_size = blr_parse_size(value);
+                }
+                else if (strcmp(options[i], "sync_interval") == 0)
+                {
+                    inst->sync_interval = atoi(value);
+                }
+                else if (strcmp(options[i], "sync_bytes") == 0)
+                {
+                    inst->sync_bytes = blr_parse_size(value);
+                }
+                else if (strcmp(options[i], "sync_transactions") == 0)
+                {
+                    inst->sync_trx = atoi(value);
+                }
+                else if (strcmp(options[i], "sync_slaves") == 0)
+                {
+                    inst->sync_slaves = config_truth_value(value);
+                }
+                else if (strcmp(options[i], "compress_binlogs") == 0)
+                {
+                    inst->compress_binlogs = config_truth_value(value);
+                }
+                else if (strcmp(options[i], "compress_keep") == 0)
+                {
+                    int keep = atoi(value);
+
+                    if (keep < 1)
                     {
-                        ptr++;
+                        MXS_WARNING("Invalid compress_keep value %s, the most recent "
+                                    "closed binlog file is never compressed. "
+                                    "Setting it to default value %d.",
+                                    value, DEF_COMPRESS_KEEP);
                     }
-                    switch (*ptr)
+                    else
                     {
-                    case 'G':
-                    case 'g':
-                        size = size * 1024 * 1000 * 1000;
-                        break;
-                    case 'M':
-                    case 'm':
-                        size = size * 1024 * 1000;
-                        break;
-                    case 'K':
-                    case 'k':
-                        size = size * 1024;
-                        break;
+                        inst->compress_keep = keep;
                     }
-                    inst->burst_size = size;
-
                 }
                 else if (strcmp(options[i], "heartbeat") == 0)
                 {
@@ -686,12 +719,36 @@ createInstance(SERVICE *service, char **options)
      */
     blr_init_cache(inst);
 
+    /*
+     * Allocate the buffer that collects the events written to the binlog
+     */
+    if (inst->write_buffer_size > 0 &&
+        (inst->write_buf = malloc(inst->write_buffer_size)) == NULL)
+    {
+        MXS_ERROR("%s: Failed to allocate a binlog write buffer of %lu bytes, "
+                  "writing events directly to the binlog file.",
+                  service->name, inst->write_buffer_size);
+    }
+
+    /*
+     * Load the GTID index of the MariaDB 10 binlogs
+     */
+    blr_gtid_index_init(inst);
+
     /*
      * Add tasks for statistic computation
      */
     snprintf(task_name, BLRM_TASK_NAME_LEN, "%s stats", service->name);
     hktask_add(task_name, stats_func, inst, BLR_STATS_FREQ);
 
+    /*
+     * Start compressing the closed binlog files
+     */
+    if (inst->compress_binlogs)
+    {
+        blr_compress_start(inst);
+    }
+
     /* Log whether the transaction safety option value is on*/
     if (inst->trx_safe)
     {
@@ -744,9 +801,46 @@ free_instance(ROUTER_INSTANCE *instance)
     free(instance->set_master_hostname);
     free(instance->fileroot);
     free(instance->binlogdir);
+    free(instance->write_buf);
+    blr_compress_stop(instance);
+    blr_free_cache(instance);
+    blr_gtid_index_free(instance);
     free(instance);
 }
 
+/**
+ * Parse a size with an optional K, M or G suffix
+ *
+ * @param value The value of the option
+ * @return The size in bytes
+ */
+static unsigned long
+blr_parse_size(char *value)
+{
+    unsigned long size = atoi(value);
+    char    *ptr = value;
+    while (*ptr && isdigit(*ptr))
+    {
+        ptr++;
+    }
+    switch (*ptr)
+    {
+    case 'G':
+    case 'g':
+        size = size * 1024 * 1000 * 1000;
+        break;
+    case 'M':
+    case 'm':
+        size = size * 1024 * 1000;
+        break;
+    case 'K':
+    case 'k':
+        size = size * 1024;
+        break;
+    }
+    return size;
+}
+
 /**
  * Associate a new session with this instance of the router.
  *
@@ -788,6 +882,7 @@ newSession(ROUTER *instance, SESSION *session)
     slave->pthread = 0;
     slave->overrun = 0;
     slave->uuid = NULL;
+    slave->connect_state = NULL;
     slave->hostname = NULL;
     spinlock_init(&slave->catch_lock);
     slave->dcb = session->client_dcb;
@@ -860,6 +955,7 @@ static void freeSession(ROUTER* router_instance,
             ptr->next = slave->next;
         }
     }
+    blr_slave_stop_waiting(router, slave);
     spinlock_release(&router->lock);
 
     MXS_DEBUG("%lu [freeSession] Unlinked router_client_session %p from "
@@ -881,6 +977,7 @@ static void freeSession(ROUTER* router_instance,
     {
         free(slave->passwd);
     }
+    free(slave->connect_state);
     free(slave);
 }
 
@@ -1154,6 +1251,36 @@ diagnostics(ROUTER *router, DCB *dcb)
     dcb_printf(dcb, "\tAverage events per packet:                   %.1f\n",
                router_inst->stats.n_reads != 0 ?
                ((double)router_inst->stats.n_binlogs / router_inst->stats.n_reads) : 0);
+    if (router_inst->cache)
+    {
+        spinlock_acquire(&router_inst->cache->lock);
+        dcb_printf(dcb, "\tBinlog events in the cache:                  %d (%lu bytes)\n",
+                   router_inst->cache->cnt, router_inst->cache->bytes);
+        dcb_printf(dcb, "\tNumber of binlog cache hits:                 %lu\n",
+                   router_inst->stats.n_cachehits);
+        dcb_printf(dcb, "\tNumber of binlog cache misses:               %lu\n",
+                   router_inst->stats.n_cachemisses);
+        spinlock_release(&router_inst->cache->lock);
+    }
+    if (router_inst->gtid_index)
+    {
+        dcb_printf(dcb, "\tNumber of transactions in the GTID index:    %d\n",
+                   blr_gtid_index_count(router_inst));
+    }
+    dcb_printf(dcb, "\tNumber of writes to the binlog files:        %lu\n",
+               router_inst->stats.n_binlog_writes);
+    dcb_printf(dcb, "\tNumber of syncs of the binlog files:         %lu\n",
+               router_inst->stats.n_binlog_syncs);
+    if (router_inst->compress_binlogs)
+    {
+        dcb_printf(dcb, "\tNumber of compressed binlog files:           %lu (%lu to %lu bytes)\n",
+                   router_inst->stats.n_compressed, router_inst->stats.n_compress_in,
+                   router_inst->stats.n_compress_out);
+        dcb_printf(dcb, "\tBlocks read from compressed binlog files:    %lu\n",
+                   router_inst->stats.n_block_reads);
+        dcb_printf(dcb, "\tReads from cached compressed blocks:         %lu\n",
+                   router_inst->stats.n_block_hits);
+    }
 
     spinlock_acquire(&router_inst->lock);
     if (router_inst->stats.lastReply)
@@ -1337,6 +1464,15 @@ diagnostics(ROUTER *router, DCB *dcb)
             dcb_printf(dcb,
                        "\t\tNo. transitions to follow mode:          %u\n",
                        session->stats.n_bursts);
+            if (router_inst->adaptive_burst)
+            {
+                dcb_printf(dcb,
+                           "\t\tCatchup burst size:                      %ld\n",
+                           session->burst_budget);
+                dcb_printf(dcb,
+                           "\t\tSlave drain rate (bytes/sec):            %lu\n",
+                           session->drain_rate);
+            }
             if (router_inst->send_slave_heartbeat)
             {
                 dcb_printf(dcb,
@@ -1627,6 +1763,81 @@ static int getCapabilities()
     return (int)RCAP_TYPE_NO_RSESSION;
 }
 
+/**
+ * The metrics entry point, returns the router statistics
+ *
+ * @param instance  The router instance
+ * @param values    Where the values are stored
+ * @param size      Number of elements in @c values
+ * @return Number of values stored in @c values
+ */
+static int metrics(ROUTER *instance, MXS_METRIC *values, int size)
+{
+    ROUTER_INSTANCE *router = (ROUTER_INSTANCE *)instance;
+    MXS_METRIC router_values[] =
+    {
+        {"binlog_slaves", "Number of connected slave servers",
+         METRIC_GAUGE, router->stats.n_slaves},
+        {"binlog_master_connects_total", "Number of connections made to the master",
+         METRIC_COUNTER, router->stats.n_masterstarts},
+        {"binlog_delayed_reconnects_total", "Number of delayed reconnects to the master",
+         METRIC_COUNTER, router->stats.n_delayedreconnects},
+        {"binlog_events_total", "Binlog events received from the master",
+         METRIC_COUNTER, router->stats.n_binlogs},
+        {"binlog_event_errors_total", "Binlog events received in error",
+         METRIC_COUNTER, router->stats.n_binlog_errors},
+        {"binlog_fake_events_total", "Fake binlog events received",
+         METRIC_COUNTER, router->stats.n_fakeevents},
+        {"binlog_artificial_events_total", "Artificial binlog events received",
+         METRIC_COUNTER, router->stats.n_artificial},
+        {"binlog_bad_crc_total", "Binlog events with a bad CRC",
+         METRIC_COUNTER, router->stats.n_badcrc},
+        {"binlog_rotates_total", "Binlog rotate events received",
+         METRIC_COUNTER, router->stats.n_rotates},
+        {"binlog_heartbeats_total", "Heartbeat events received",
+         METRIC_COUNTER, router->stats.n_heartbeats},
+        {"binlog_packets_total", "Packets received from the master",
+         METRIC_COUNTER, router->stats.n_reads},
+        {"binlog_residual_packets_total", "Residual data packets received from the master",
+         METRIC_COUNTER, router->stats.n_residuals},
+        {"binlog_cache_hits_total", "Slave requests served from the cache",
+         METRIC_COUNTER, router->stats.n_cachehits},
+        {"binlog_cache_misses_total", "Slave requests not found in the cache",
+         METRIC_COUNTER, router->stats.n_cachemisses},
+        {"binlog_writes_total", "Writes to the binlog files",
+         METRIC_COUNTER, router->stats.n_binlog_writes},
+        {"binlog_syncs_total", "Syncs of the binlog files",
+         METRIC_COUNTER, router->stats.n_binlog_syncs},
+        {"binlog_compressed_files_total", "Closed binlog files that were compressed",
+         METRIC_COUNTER, router->stats.n_compressed},
+        {"binlog_compressed_input_bytes_total", "Size of the binlog files before compression",
+         METRIC_COUNTER, router->stats.n_compress_in},
+        {"binlog_compressed_output_bytes_total", "Size of the binlog files after compression",
+         METRIC_COUNTER, router->stats.n_compress_out},
+        {"binlog_compressed_block_reads_total", "Blocks read from compressed binlog files",
+         METRIC_COUNTER, router->stats.n_block_reads},
+        {"binlog_compressed_block_hits_total", "Reads served from cached compressed blocks",
+         METRIC_COUNTER, router->stats.n_block_hits},
+        {"binlog_position", "Current position in the binlog file",
+         METRIC_GAUGE, router->current_pos},
+        {"binlog_last_event_timestamp_seconds", "Time when the last event was received",
+         METRIC_GAUGE, router->stats.lastReply}
+    };
+    int n_values = sizeof(router_values) / sizeof(router_values[0]);
+
+    if (n_values > size)
+    {
+        n_values = size;
+    }
+
+    for (int i = 0; i < n_values; i++)
+    {
+        values[i] = router_values[i];
+    }
+
+    return n_values;
+}
+
 /**
  * The stats gathering function called from the housekeeper so that we
  * can get timed averages of binlog records shippped
@@ -2137,7 +2348,13 @@ static int blr_check_binlog(ROUTER_INSTANCE *router)
      * router->current_pos is the last event found.
      */
 
-    n = blr_read_events_all_events(router, 0, 0);
+    /* Only the events after the last binlog index checkpoint are read */
+    if (blr_index_load(router, &router->binlog_index))
+    {
+        router->index_checkpoint = router->binlog_index.pos;
+    }
+
+    n = blr_read_events_all_events(router, 0, 0, NULL);
 
     MXS_DEBUG("blr_read_events_all_events() ret = %i\n", n);
 
@@ -2166,6 +2383,7 @@ static int blr_check_binlog(ROUTER_INSTANCE *router)
     }
     else
     {
+        blr_index_checkpoint(router);
         return 1;
     }
 }
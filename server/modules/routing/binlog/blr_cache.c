@@ -48,14 +48,273 @@
 #include <log_manager.h>
 
 
+/** Number of records the ring holds when the first event is added */
+#define BLR_CACHE_INITIAL_RECORDS 1024
+
 /**
- * Initialise the cache for this instanceof the binlog router. As a side
- * effect also determine the binlog file to read and the position to read
- * from.
+ * Initialise the cache for this instance of the binlog router. The cache
+ * is not created if the cache_size option is set to zero.
  *
  * @param   router      The router instance
  */
 void
 blr_init_cache(ROUTER_INSTANCE *router)
 {
+    BLCACHE *cache;
+
+    if (router->cache_size == 0)
+    {
+        return;
+    }
+
+    if ((cache = (BLCACHE *)calloc(1, sizeof(BLCACHE))) == NULL)
+    {
+        MXS_ERROR("%s: Failed to allocate the binlog cache, "
+                  "the slaves read all events from the binlog files.",
+                  router->service->name);
+        return;
+    }
+
+    cache->max_bytes = router->cache_size;
+    spinlock_init(&cache->lock);
+    router->cache = cache;
+}
+
+/**
+ * Drop the oldest record of the cache. The caller must hold the cache lock.
+ *
+ * @param   cache       The binlog cache
+ */
+static void
+blr_cache_drop_first(BLCACHE *cache)
+{
+    BLCACHE_RECORD *record = &cache->records[cache->first];
+
+    cache->bytes -= record->hdr.event_size;
+    gwbuf_free(record->pkt);
+    record->pkt = NULL;
+    cache->first = (cache->first + 1) % cache->size;
+    cache->cnt--;
+}
+
+/**
+ * Drop all records of the cache. The caller must hold the cache lock.
+ *
+ * @param   cache       The binlog cache
+ */
+static void
+blr_cache_empty(BLCACHE *cache)
+{
+    while (cache->cnt > 0)
+    {
+        blr_cache_drop_first(cache);
+    }
+    cache->first = 0;
+    cache->bytes = 0;
+}
+
+/**
+ * Double the number of records the ring can hold. The caller must hold
+ * the cache lock.
+ *
+ * @param   cache       The binlog cache
+ * @return  True if the ring was grown
+ */
+static bool
+blr_cache_grow(BLCACHE *cache)
+{
+    int size = cache->size ? cache->size * 2 : BLR_CACHE_INITIAL_RECORDS;
+    BLCACHE_RECORD *records = (BLCACHE_RECORD *)calloc(size, sizeof(BLCACHE_RECORD));
+
+    if (records == NULL)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < cache->cnt; i++)
+    {
+        records[i] = cache->records[(cache->first + i) % cache->size];
+    }
+
+    free(cache->records);
+    cache->records = records;
+    cache->size = size;
+    cache->first = 0;
+    return true;
+}
+
+/**
+ * Free the cache of the binlog router
+ *
+ * @param   router      The router instance
+ */
+void
+blr_free_cache(ROUTER_INSTANCE *router)
+{
+    BLCACHE *cache = router->cache;
+
+    if (cache)
+    {
+        blr_cache_empty(cache);
+        free(cache->records);
+        free(cache);
+        router->cache = NULL;
+    }
+}
+
+/**
+ * Drop all events from the cache. Used when the content of the binlog
+ * file no longer matches the cached events.
+ *
+ * @param   router      The router instance
+ */
+void
+blr_cache_clear(ROUTER_INSTANCE *router)
+{
+    BLCACHE *cache = router->cache;
+
+    if (cache)
+    {
+        spinlock_acquire(&cache->lock);
+        blr_cache_empty(cache);
+        spinlock_release(&cache->lock);
+    }
+}
+
+/**
+ * Add an event that was written to the current binlog file to the cache.
+ *
+ * The cached events are always contiguous events of one file. If the event
+ * belongs to another file or does not follow the last cached event, the
+ * binlog has been rotated or truncated and the old events are dropped.
+ *
+ * @param   router      The router instance
+ * @param   hdr         The header of the event
+ * @param   pos         The position of the event in the binlog file
+ * @param   buf         The event, hdr->event_size bytes
+ */
+void
+blr_cache_add(ROUTER_INSTANCE *router, REP_HEADER *hdr, unsigned long pos, uint8_t *buf)
+{
+    BLCACHE *cache = router->cache;
+    GWBUF *pkt;
+
+    if (cache == NULL || hdr->event_size > cache->max_bytes)
+    {
+        return;
+    }
+
+    if ((pkt = gwbuf_alloc_and_load(hdr->event_size, buf)) == NULL)
+    {
+        return;
+    }
+
+    spinlock_acquire(&cache->lock);
+
+    if (cache->cnt > 0)
+    {
+        BLCACHE_RECORD *last = &cache->records[(cache->first + cache->cnt - 1) % cache->size];
+
+        if (strcmp(cache->binlogname, router->binlog_name) != 0 ||
+            pos != last->position + last->hdr.event_size)
+        {
+            blr_cache_empty(cache);
+        }
+    }
+
+    if (cache->cnt == 0)
+    {
+        strncpy(cache->binlogname, router->binlog_name, BINLOG_FNAMELEN);
+    }
+
+    while (cache->cnt > 0 && cache->bytes + hdr->event_size > cache->max_bytes)
+    {
+        blr_cache_drop_first(cache);
+    }
+
+    if (cache->cnt == cache->size && !blr_cache_grow(cache))
+    {
+        if (cache->cnt == 0)
+        {
+            spinlock_release(&cache->lock);
+            gwbuf_free(pkt);
+            return;
+        }
+        blr_cache_drop_first(cache);
+    }
+
+    BLCACHE_RECORD *record = &cache->records[(cache->first + cache->cnt) % cache->size];
+    record->position = pos;
+    record->pkt = pkt;
+    record->hdr = *hdr;
+    cache->bytes += hdr->event_size;
+    cache->cnt++;
+
+    spinlock_release(&cache->lock);
+}
+
+/**
+ * Get an event from the cache. The caller must have checked that the
+ * event can be sent to the slaves.
+ *
+ * @param   router      The router instance
+ * @param   binlogname  The binlog file of the event
+ * @param   pos         The position of the event
+ * @param   hdr         The header of the event is copied here
+ * @return  A clone of the cached event or NULL if the event is not cached
+ */
+GWBUF *
+blr_cache_get(ROUTER_INSTANCE *router, char *binlogname, unsigned long pos, REP_HEADER *hdr)
+{
+    BLCACHE *cache = router->cache;
+    GWBUF *rval = NULL;
+
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+
+    spinlock_acquire(&cache->lock);
+
+    if (cache->cnt > 0 && strcmp(cache->binlogname, binlogname) == 0)
+    {
+        int low = 0;
+        int high = cache->cnt - 1;
+
+        while (low <= high)
+        {
+            int mid = (low + high) / 2;
+            BLCACHE_RECORD *record = &cache->records[(cache->first + mid) % cache->size];
+
+            if (record->position < pos)
+            {
+                low = mid + 1;
+            }
+            else if (record->position > pos)
+            {
+                high = mid - 1;
+            }
+            else
+            {
+                if ((rval = gwbuf_clone(record->pkt)) != NULL)
+                {
+                    *hdr = record->hdr;
+                }
+                break;
+            }
+        }
+    }
+
+    if (rval)
+    {
+        router->stats.n_cachehits++;
+    }
+    else
+    {
+        router->stats.n_cachemisses++;
+    }
+
+    spinlock_release(&cache->lock);
+
+    return rval;
 }
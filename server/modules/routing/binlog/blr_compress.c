@@ -0,0 +1,529 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file blr_compress.c - Compression of the closed binlog files
+ *
+ * A thread of the router instance compresses the binlog files that are no
+ * longer written to. The compressed file replaces the original one and the
+ * slaves that read it get the events from blr_read_binlog as before, the
+ * blocks that hold the requested events are decompressed when they are read.
+ *
+ * The current binlog file and the compress_keep most recent closed files
+ * are never compressed. Slaves that are only a little behind the master
+ * read those files and the master may still truncate the previous file
+ * when it is changed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <service.h>
+#include <blr.h>
+#include <thread.h>
+#include <mxs_crc32.h>
+
+#include <skygw_types.h>
+#include <skygw_utils.h>
+#include <log_manager.h>
+
+/**
+ * Check whether the compression thread should exit
+ *
+ * @param router    The router instance
+ * @return True if the router is freed or MaxScale is shutting down
+ */
+static bool
+blr_compress_stopping(ROUTER_INSTANCE *router)
+{
+    return router->compress_stop || router->service->svc_do_shutdown;
+}
+
+/**
+ * Compress the closed binlog files that are old enough
+ *
+ * @param router    The router instance
+ */
+static void
+blr_compress_scan(ROUTER_INSTANCE *router)
+{
+    char current[BINLOG_FNAMELEN + 1];
+    char *sptr;
+    size_t root_len = strlen(router->fileroot);
+    DIR *dirp;
+    struct dirent *dp;
+    int current_no;
+
+    spinlock_acquire(&router->binlog_lock);
+    strcpy(current, router->binlog_name);
+    spinlock_release(&router->binlog_lock);
+
+    if (*current == '\0' || (sptr = strrchr(current, '.')) == NULL)
+    {
+        return;
+    }
+
+    current_no = atoi(sptr + 1);
+
+    if ((dirp = opendir(router->binlogdir)) == NULL)
+    {
+        return;
+    }
+
+    while (!blr_compress_stopping(router) && (dp = readdir(dirp)) != NULL)
+    {
+        const char *num = dp->d_name + root_len + 1;
+
+        /** Only the binlog files themselves, not the compressed or index files */
+        if (strncmp(dp->d_name, router->fileroot, root_len) == 0 &&
+            dp->d_name[root_len] == '.' && *num &&
+            strspn(num, "0123456789") == strlen(num) &&
+            atoi(num) < current_no - router->compress_keep)
+        {
+            blr_compress_file(router, dp->d_name);
+        }
+    }
+
+    closedir(dirp);
+}
+
+/**
+ * The thread that compresses the closed binlog files. The thread exits when
+ * blr_compress_stop is called or when MaxScale is shut down.
+ *
+ * @param data      The router instance
+ */
+static void
+blr_compress_thread(void *data)
+{
+    ROUTER_INSTANCE *router = (ROUTER_INSTANCE *)data;
+
+    while (!blr_compress_stopping(router))
+    {
+        blr_compress_scan(router);
+
+        /** Sleep in short steps so that the thread notices the shutdown */
+        for (int i = 0; i < BLR_COMPRESS_INTERVAL * 10 && !blr_compress_stopping(router); i++)
+        {
+            thread_millisleep(100);
+        }
+    }
+}
+
+/**
+ * Start the thread that compresses the closed binlog files
+ *
+ * @param router    The router instance
+ * @return True if the thread was started
+ */
+bool
+blr_compress_start(ROUTER_INSTANCE *router)
+{
+    if (thread_start(&router->compress_thread, blr_compress_thread, router) == NULL)
+    {
+        MXS_ERROR("%s: Failed to start the binlog compression thread, "
+                  "binlog files will not be compressed.",
+                  router->service->name);
+        return false;
+    }
+
+    router->compress_running = true;
+    return true;
+}
+
+/**
+ * Stop the thread that compresses the closed binlog files and wait for it
+ * to exit. A file that is being compressed is finished first.
+ *
+ * @param router    The router instance
+ */
+void
+blr_compress_stop(ROUTER_INSTANCE *router)
+{
+    if (router->compress_running)
+    {
+        router->compress_stop = true;
+        thread_wait(router->compress_thread);
+        router->compress_running = false;
+    }
+}
+
+/**
+ * Write the compressed blocks, the block index and the header of a
+ * compressed binlog file
+ *
+ * @param fd        The binlog file
+ * @param zfd       The compressed file
+ * @param hdr       The header of the compressed file, the CRC is set here
+ * @param path      Path of the compressed file, used in the error messages
+ * @return Size of the compressed file or 0 on error
+ */
+static uint64_t
+blr_compress_write(int fd, int zfd, BLR_COMPRESSED_HEADER *hdr, const char *path)
+{
+    char err_msg[STRERROR_BUFLEN];
+    size_t index_len = (hdr->n_blocks + 1) * sizeof(uint64_t);
+    uint64_t *offsets = malloc(index_len);
+    uint8_t *in = malloc(hdr->block_size);
+    uint8_t *out = malloc(compressBound(hdr->block_size));
+    uint64_t off = sizeof(*hdr) + index_len;
+
+    if (offsets == NULL || in == NULL || out == NULL)
+    {
+        MXS_ERROR("Failed to allocate memory for compressing %s.", path);
+        off = 0;
+    }
+
+    for (uint32_t i = 0; off && i < hdr->n_blocks; i++)
+    {
+        size_t len = MIN(hdr->block_size, hdr->size - (uint64_t)i * hdr->block_size);
+        uLongf zlen = compressBound(hdr->block_size);
+        uint8_t *data = out;
+
+        if (pread(fd, in, len, (uint64_t)i * hdr->block_size) != (ssize_t)len)
+        {
+            MXS_ERROR("Failed to read block %u of the binlog file for %s.", i, path);
+            off = 0;
+            break;
+        }
+
+        /** Blocks that do not get smaller are stored as they are */
+        if (compress2(out, &zlen, in, len, BLR_COMPRESS_LEVEL) != Z_OK || zlen >= len)
+        {
+            data = in;
+            zlen = len;
+        }
+
+        if (pwrite(zfd, data, zlen, off) != (ssize_t)zlen)
+        {
+            MXS_ERROR("Failed to write compressed binlog file %s: %s",
+                      path, strerror_r(errno, err_msg, sizeof(err_msg)));
+            off = 0;
+            break;
+        }
+
+        offsets[i] = off;
+        off += zlen;
+    }
+
+    if (off)
+    {
+        offsets[hdr->n_blocks] = off;
+        hdr->crc = mxs_crc32(0, offsets, index_len);
+
+        if (pwrite(zfd, hdr, sizeof(*hdr), 0) != sizeof(*hdr) ||
+            pwrite(zfd, offsets, index_len, sizeof(*hdr)) != (ssize_t)index_len ||
+            fdatasync(zfd) != 0)
+        {
+            MXS_ERROR("Failed to write compressed binlog file %s: %s",
+                      path, strerror_r(errno, err_msg, sizeof(err_msg)));
+            off = 0;
+        }
+    }
+
+    free(offsets);
+    free(in);
+    free(out);
+    return off;
+}
+
+/**
+ * Compress a closed binlog file
+ *
+ * The compressed file is written with a temporary name and renamed when it
+ * is complete. The original file is removed only after the rename has been
+ * synced to disk so one of the two files always exists. Slaves that have
+ * the original file open keep reading it until they close it.
+ *
+ * @param router    The router instance
+ * @param binlog    The name of the binlog file
+ * @return True if the file was compressed
+ */
+bool
+blr_compress_file(ROUTER_INSTANCE *router, const char *binlog)
+{
+    char path[PATH_MAX + 1];
+    char zpath[PATH_MAX + 1];
+    char tmppath[PATH_MAX + 1];
+    char err_msg[STRERROR_BUFLEN];
+    BLR_COMPRESSED_HEADER hdr;
+    struct stat statb;
+    uint64_t size = 0;
+    int fd, zfd, dirfd;
+
+    snprintf(path, PATH_MAX, "%s/%s", router->binlogdir, binlog);
+    snprintf(zpath, PATH_MAX, "%s" BLR_COMPRESSED_SUFFIX, path);
+    snprintf(tmppath, PATH_MAX, "%s.tmp", zpath);
+
+    if ((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &statb) != 0)
+    {
+        MXS_ERROR("Failed to open binlog file %s for compression: %s",
+                  path, strerror_r(errno, err_msg, sizeof(err_msg)));
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        return false;
+    }
+
+    if ((zfd = open(tmppath, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1)
+    {
+        MXS_ERROR("Failed to create compressed binlog file %s: %s",
+                  tmppath, strerror_r(errno, err_msg, sizeof(err_msg)));
+        close(fd);
+        return false;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, BLR_COMPRESSED_MAGIC, BLR_COMPRESSED_MAGIC_LEN);
+    hdr.size = statb.st_size;
+    hdr.block_size = BLR_COMPRESS_BLOCK_SIZE;
+    hdr.n_blocks = (hdr.size + hdr.block_size - 1) / hdr.block_size;
+
+    size = blr_compress_write(fd, zfd, &hdr, tmppath);
+    close(zfd);
+    close(fd);
+
+    if (size && rename(tmppath, zpath) != 0)
+    {
+        MXS_ERROR("Failed to rename compressed binlog file %s: %s",
+                  tmppath, strerror_r(errno, err_msg, sizeof(err_msg)));
+        size = 0;
+    }
+
+    if (size == 0)
+    {
+        unlink(tmppath);
+        return false;
+    }
+
+    if ((dirfd = open(router->binlogdir, O_RDONLY)) != -1)
+    {
+        fsync(dirfd);
+        close(dirfd);
+    }
+
+    unlink(path);
+    router->stats.n_compressed++;
+    router->stats.n_compress_in += hdr.size;
+    router->stats.n_compress_out += size;
+
+    MXS_NOTICE("Compressed binlog file %s from %lu to %lu bytes.",
+               binlog, (unsigned long)hdr.size, (unsigned long)size);
+
+    return true;
+}
+
+/**
+ * Read the block index of a compressed binlog file
+ *
+ * @param router    The router instance
+ * @param fd        The compressed file
+ * @param path      Path of the file, used in the error messages
+ * @return The block index or NULL if the file is not a valid compressed file
+ */
+BLFILE_BLOCKS *
+blr_compressed_open(ROUTER_INSTANCE *router, int fd, const char *path)
+{
+    BLFILE_BLOCKS *blocks = calloc(1, sizeof(BLFILE_BLOCKS));
+    size_t index_len;
+
+    if (blocks == NULL)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_init(&blocks->lock, NULL);
+
+    if (pread(fd, &blocks->hdr, sizeof(blocks->hdr), 0) != sizeof(blocks->hdr) ||
+        memcmp(blocks->hdr.magic, BLR_COMPRESSED_MAGIC, BLR_COMPRESSED_MAGIC_LEN) != 0 ||
+        blocks->hdr.block_size == 0 ||
+        blocks->hdr.n_blocks != (blocks->hdr.size + blocks->hdr.block_size - 1) / blocks->hdr.block_size)
+    {
+        MXS_ERROR("Compressed binlog file %s has an invalid header.", path);
+        blr_compressed_free(blocks);
+        return NULL;
+    }
+
+    index_len = (blocks->hdr.n_blocks + 1) * sizeof(uint64_t);
+    blocks->offsets = malloc(index_len);
+    blocks->cbuf = malloc(compressBound(blocks->hdr.block_size));
+
+    if (blocks->offsets == NULL || blocks->cbuf == NULL ||
+        pread(fd, blocks->offsets, index_len, sizeof(blocks->hdr)) != (ssize_t)index_len ||
+        mxs_crc32(0, blocks->offsets, index_len) != blocks->hdr.crc)
+    {
+        MXS_ERROR("Failed to read the block index of compressed binlog file %s.", path);
+        blr_compressed_free(blocks);
+        return NULL;
+    }
+
+    for (int i = 0; i < BLR_COMPRESS_CACHED_BLOCKS; i++)
+    {
+        blocks->blocks[i].block = -1;
+    }
+
+    return blocks;
+}
+
+/**
+ * Find a block in the cache of a compressed file, reading and uncompressing
+ * it into the least recently used slot if it is not cached
+ *
+ * @param router    The router instance
+ * @param blocks    The compressed file
+ * @param fd        File descriptor of the compressed file
+ * @param block     The block number
+ * @return The cached block or NULL if it could not be read
+ */
+static BLR_CACHED_BLOCK *
+blr_compressed_block(ROUTER_INSTANCE *router, BLFILE_BLOCKS *blocks, int fd, long block)
+{
+    BLR_CACHED_BLOCK *slot = &blocks->blocks[0];
+
+    for (int i = 0; i < BLR_COMPRESS_CACHED_BLOCKS; i++)
+    {
+        if (blocks->blocks[i].block == block)
+        {
+            blocks->blocks[i].used = ++blocks->clock;
+            router->stats.n_block_hits++;
+            return &blocks->blocks[i];
+        }
+        if (blocks->blocks[i].used < slot->used)
+        {
+            slot = &blocks->blocks[i];
+        }
+    }
+
+    uint64_t start = blocks->offsets[block];
+    uint64_t zlen = blocks->offsets[block + 1] - start;
+    uLongf len = MIN(blocks->hdr.block_size,
+                     blocks->hdr.size - (uint64_t)block * blocks->hdr.block_size);
+
+    uLongf destlen = len;
+    ssize_t n;
+
+    if (zlen > compressBound(blocks->hdr.block_size))
+    {
+        errno = EIO;
+        return NULL;
+    }
+    if (slot->data == NULL && (slot->data = malloc(blocks->hdr.block_size)) == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    slot->block = -1;
+
+    /** A block that did not get smaller when compressed is stored as it is */
+    n = pread(fd, zlen == len ? slot->data : blocks->cbuf, zlen, start);
+
+    if (n != (ssize_t)zlen)
+    {
+        if (n >= 0)
+        {
+            errno = EIO;
+        }
+        return NULL;
+    }
+    if (zlen != len && (uncompress(slot->data, &destlen, blocks->cbuf, zlen) != Z_OK ||
+                        destlen != len))
+    {
+        errno = EIO;
+        return NULL;
+    }
+
+    slot->block = block;
+    slot->used = ++blocks->clock;
+    router->stats.n_block_reads++;
+    return slot;
+}
+
+/**
+ * Read data from a compressed binlog file
+ *
+ * The cached blocks are shared by all slaves that read the file. They are
+ * protected by a mutex instead of the spinlock of the file as a block may
+ * have to be read and uncompressed while the lock is held.
+ *
+ * @param router    The router instance
+ * @param blocks    The compressed file
+ * @param fd        File descriptor of the compressed file
+ * @param buf       Where the data is stored
+ * @param len       Number of bytes to read
+ * @param pos       Position in the uncompressed binlog file
+ * @return Number of bytes read, less than len at the end of the file, or -1
+ *         with errno set if the file could not be read
+ */
+int
+blr_compressed_read(ROUTER_INSTANCE *router, BLFILE_BLOCKS *blocks, int fd,
+                    uint8_t *buf, size_t len, unsigned long pos)
+{
+    size_t n = 0;
+    bool ok = true;
+
+    pthread_mutex_lock(&blocks->lock);
+
+    while (n < len && pos < blocks->hdr.size)
+    {
+        long block = pos / blocks->hdr.block_size;
+        size_t offset = pos % blocks->hdr.block_size;
+        BLR_CACHED_BLOCK *cached = blr_compressed_block(router, blocks, fd, block);
+
+        if (cached == NULL)
+        {
+            ok = false;
+            break;
+        }
+
+        size_t avail = MIN(blocks->hdr.block_size,
+                           blocks->hdr.size - (uint64_t)block * blocks->hdr.block_size) - offset;
+        size_t count = MIN(avail, len - n);
+
+        memcpy(buf + n, cached->data + offset, count);
+        n += count;
+        pos += count;
+    }
+
+    pthread_mutex_unlock(&blocks->lock);
+
+    return ok ? (int)n : -1;
+}
+
+/**
+ * Free the block index and the cached blocks of a compressed file
+ *
+ * @param blocks    The compressed file or NULL
+ */
+void
+blr_compressed_free(BLFILE_BLOCKS *blocks)
+{
+    if (blocks)
+    {
+        for (int i = 0; i < BLR_COMPRESS_CACHED_BLOCKS; i++)
+        {
+            free(blocks->blocks[i].data);
+        }
+
+        free(blocks->offsets);
+        free(blocks->cbuf);
+        pthread_mutex_destroy(&blocks->lock);
+        free(blocks);
+    }
+}
@@ -39,10 +39,12 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <errno.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <dirent.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -58,6 +60,7 @@
 #include <skygw_types.h>
 #include <skygw_utils.h>
 #include <log_manager.h>
+#include <mxs_crc32.h>
 
 static int  blr_file_create(ROUTER_INSTANCE *router, char *file);
 static void blr_log_header(int priority, char *msg, uint8_t *ptr);
@@ -67,6 +70,10 @@ int blr_file_new_binlog(ROUTER_INSTANCE *router, char *file);
 int blr_file_write_master_config(ROUTER_INSTANCE *router, char *error);
 extern uint32_t extract_field(uint8_t *src, int bits);
 static void blr_format_event_size(double *event_size, char *label);
+static void blr_index_event(ROUTER_INSTANCE *router, REP_HEADER *hdr);
+static void blr_index_path(ROUTER_INSTANCE *router, char *path);
+static bool blr_file_write(ROUTER_INSTANCE *router, uint8_t *buf, uint32_t size, uint64_t pos);
+static bool blr_file_sync(ROUTER_INSTANCE *router);
 extern int MaxScaleUptime();
 
 typedef struct binlog_event_desc
@@ -80,6 +87,21 @@ static void blr_print_binlog_details(ROUTER_INSTANCE *router,
                                      BINLOG_EVENT_DESC first_event_time,
                                      BINLOG_EVENT_DESC last_event_time);
 
+/** Size of the reads when a whole binlog file is read */
+#define BLR_SCAN_READ_SIZE (4 * 1024 * 1024)
+
+/**
+ * A buffer for reading a whole binlog file sequentially
+ */
+typedef struct
+{
+    int             fd;             /*< The binlog file */
+    uint8_t         *buf;           /*< Data read from the file */
+    size_t          size;           /*< Size of the buffer */
+    uint64_t        start;          /*< File position of the first byte in the buffer */
+    size_t          len;            /*< Number of bytes in the buffer */
+} BLR_SCAN_BUFFER;
+
 /**
  * Initialise the binlog file for this instance. MaxScale will look
  * for all the binlogs that it has on local disk, determine the next
@@ -237,6 +259,11 @@ blr_file_create(ROUTER_INSTANCE *router, char *file)
     {
         if (blr_file_add_magic(fd))
         {
+            /* The previous binlog file is complete before the slaves move on */
+            if (blr_file_write_buffer(router) && router->unsynced_bytes > 0)
+            {
+                blr_file_sync(router);
+            }
             close(router->binlog_fd);
             spinlock_acquire(&router->binlog_lock);
             strncpy(router->binlog_name, file, BINLOG_FNAMELEN);
@@ -245,8 +272,19 @@ blr_file_create(ROUTER_INSTANCE *router, char *file)
             router->binlog_position = BINLOG_MAGIC_SIZE;
             router->current_safe_event = BINLOG_MAGIC_SIZE;
             router->last_written = BINLOG_MAGIC_SIZE;
+            router->commit_pending = false;
             spinlock_release(&router->binlog_lock);
 
+            /* The slaves can now read all of the previous binlog file */
+            blr_gtid_index_visible(router, BINLOG_MAGIC_SIZE);
+
+            /* The index of a new binlog file starts after the magic number */
+            memset(&router->binlog_index, 0, sizeof(router->binlog_index));
+            router->binlog_index.pos = BINLOG_MAGIC_SIZE;
+            router->index_checkpoint = BINLOG_MAGIC_SIZE;
+            blr_index_path(router, path);
+            unlink(path);
+
             created = 1;
         }
         else
@@ -294,10 +332,13 @@ blr_file_append(ROUTER_INSTANCE *router, char *file)
         return;
     }
     fsync(fd);
+    blr_file_write_buffer(router);
     close(router->binlog_fd);
     spinlock_acquire(&router->binlog_lock);
     memmove(router->binlog_name, file, BINLOG_FNAMELEN);
     router->current_pos = lseek(fd, 0L, SEEK_END);
+    router->last_written = router->current_pos;
+    router->commit_pending = false;
     if (router->current_pos < 4)
     {
         if (router->current_pos == 0)
@@ -330,25 +371,26 @@ blr_file_append(ROUTER_INSTANCE *router, char *file)
 }
 
 /**
- * Write a binlog entry to disk.
+ * Write data to the current binlog file. If the write fails the binlog file
+ * is truncated to the last committed position and the buffered events are
+ * dropped. The positions of the router are moved back to the truncated
+ * position so that the events are requested again from the master.
  *
- * @param router The router instance
- * @param buf    The binlog record
- * @param len    The length of the binlog record
- * @return       Return the number of bytes written
+ * @param router    The router instance
+ * @param buf       The data to write
+ * @param size      The size of the data
+ * @param pos       The position where the data is written
+ * @return True if all of the data was written
  */
-int
-blr_write_binlog_record(ROUTER_INSTANCE *router, REP_HEADER *hdr, uint32_t size, uint8_t *buf)
+static bool
+blr_file_write(ROUTER_INSTANCE *router, uint8_t *buf, uint32_t size, uint64_t pos)
 {
-    int n;
-
-    if ((n = pwrite(router->binlog_fd, buf, size,
-                    router->last_written)) != size)
+    if (pwrite(router->binlog_fd, buf, size, pos) != size)
     {
         char err_msg[STRERROR_BUFLEN];
         MXS_ERROR("%s: Failed to write binlog record at %lu of %s, %s. "
                   "Truncating to previous record.",
-                  router->service->name, router->last_written,
+                  router->service->name, pos,
                   router->binlog_name,
                   strerror_r(errno, err_msg, sizeof(err_msg)));
         /* Remove any partial event that was written */
@@ -359,25 +401,425 @@ blr_write_binlog_record(ROUTER_INSTANCE *router, REP_HEADER *hdr, uint32_t size,
                       router->binlog_name,
                       strerror_r(errno, err_msg, sizeof(err_msg)));
         }
+        blr_cache_clear(router);
+        blr_gtid_index_truncate(router, router->binlog_position);
+        router->binlog_index.pos = 0;
+        router->write_buf_len = 0;
+
+        spinlock_acquire(&router->binlog_lock);
+        router->last_written = router->binlog_position;
+        router->current_pos = router->binlog_position;
+        router->commit_pending = false;
+        /* The events of an open transaction were truncated as well */
+        router->pending_transaction = 0;
+        spinlock_release(&router->binlog_lock);
+        return false;
+    }
+
+    router->stats.n_binlog_writes++;
+    router->unsynced_bytes += size;
+    return true;
+}
+
+/**
+ * Write the events in the write buffer to the current binlog file.
+ *
+ * @param router    The router instance
+ * @return True if the buffer is empty or all of it was written
+ */
+bool
+blr_file_write_buffer(ROUTER_INSTANCE *router)
+{
+    uint32_t len = router->write_buf_len;
+
+    if (len == 0)
+    {
+        return true;
+    }
+
+    router->write_buf_len = 0;
+    return blr_file_write(router, router->write_buf, len, router->last_written - len);
+}
+
+/**
+ * Write a binlog entry to disk.
+ *
+ * If the router has a write buffer, the entry is added to the buffer and
+ * consecutive entries are written to the binlog file with one write. The
+ * buffer is written when it is full, before a new binlog file is opened and
+ * by blr_file_flush.
+ *
+ * @param router The router instance
+ * @param buf    The binlog record
+ * @param len    The length of the binlog record
+ * @return       Return the number of bytes written
+ */
+int
+blr_write_binlog_record(ROUTER_INSTANCE *router, REP_HEADER *hdr, uint32_t size, uint8_t *buf)
+{
+    if (router->write_buf && size <= router->write_buffer_size)
+    {
+        if (router->write_buf_len + size > router->write_buffer_size &&
+            !blr_file_write_buffer(router))
+        {
+            return 0;
+        }
+        memcpy(router->write_buf + router->write_buf_len, buf, size);
+        router->write_buf_len += size;
+    }
+    else if (!blr_file_write_buffer(router) ||
+             !blr_file_write(router, buf, size, router->last_written))
+    {
         return 0;
     }
+
+    /* Events that arrived in one piece are shared with the slaves */
+    if (size == hdr->event_size)
+    {
+        blr_cache_add(router, hdr, router->last_written, buf);
+    }
+    /* The first part of an event has what the GTID index needs */
+    if (router->last_written + hdr->event_size == hdr->next_pos)
+    {
+        blr_gtid_index_event(router, hdr, router->last_written, buf, size);
+    }
+    /* The last part of an event completes it */
+    if (router->last_written + size == hdr->next_pos)
+    {
+        blr_index_event(router, hdr);
+    }
+
     spinlock_acquire(&router->binlog_lock);
     router->current_pos = hdr->next_pos;
     router->last_written += size;
     router->last_event_pos = hdr->next_pos - hdr->event_size;
     spinlock_release(&router->binlog_lock);
-    return n;
+    return size;
+}
+
+/**
+ * Sync the current binlog file to disk.
+ *
+ * @param router    The router instance
+ * @return True if the file was synced
+ */
+static bool
+blr_file_sync(ROUTER_INSTANCE *router)
+{
+    if (fdatasync(router->binlog_fd) != 0)
+    {
+        char err_msg[STRERROR_BUFLEN];
+        MXS_ERROR("%s: Failed to sync binlog file %s, %s.",
+                  router->service->name, router->binlog_name,
+                  strerror_r(errno, err_msg, sizeof(err_msg)));
+        return false;
+    }
+
+    router->stats.n_binlog_syncs++;
+    router->unsynced_bytes = 0;
+    router->unsynced_trx = 0;
+    router->last_sync = hkheartbeat;
+    blr_gtid_index_synced(router, router->last_written - router->write_buf_len);
+    return true;
+}
+
+/**
+ * Check whether the binlog file should be synced. If no sync interval is
+ * configured, every write is synced.
+ *
+ * @param router    The router instance
+ * @return True if the binlog file should be synced
+ */
+static bool
+blr_file_sync_due(ROUTER_INSTANCE *router)
+{
+    if (router->sync_slaves ||
+        (router->sync_interval == 0 && router->sync_bytes == 0 && router->sync_trx == 0))
+    {
+        return true;
+    }
+
+    return (router->sync_interval > 0 &&
+            (hkheartbeat - router->last_sync) * 100 >= router->sync_interval) ||
+           (router->sync_bytes > 0 && router->unsynced_bytes >= router->sync_bytes) ||
+           (router->sync_trx > 0 && router->unsynced_trx >= router->sync_trx);
+}
+
+/**
+ * Commit the events up to a position of the current binlog file. The position
+ * is visible to the slaves right away only if all the events have been written
+ * and, when sync_slaves is set, synced. Otherwise it becomes visible in
+ * blr_file_flush.
+ *
+ * Must be called with router->binlog_lock held.
+ *
+ * @param router        The router instance
+ * @param pos           The new binlog position
+ * @param safe_event    The new current safe event
+ * @return True if the position is visible to the slaves
+ */
+bool
+blr_file_commit(ROUTER_INSTANCE *router, uint64_t pos, uint64_t safe_event)
+{
+    if (pos != (router->commit_pending ? router->commit_pos : router->binlog_position))
+    {
+        router->unsynced_trx++;
+    }
+
+    if (router->write_buf_len == 0 && (!router->sync_slaves || router->unsynced_bytes == 0))
+    {
+        router->binlog_position = pos;
+        router->current_safe_event = safe_event;
+        router->commit_pending = false;
+        blr_gtid_index_visible(router, pos);
+        return true;
+    }
+
+    router->commit_pos = pos;
+    router->commit_event = safe_event;
+    router->commit_pending = true;
+    return false;
 }
 
 /**
- * Flush the content of the binlog file to disk.
+ * Write the buffered events to the binlog file, sync it according to the
+ * sync policy and make the committed events visible to the slaves.
  *
  * @param   router  The binlog router
+ * @return  False if the events could not be written, or synced when
+ *          sync_slaves is set
  */
-void
+bool
 blr_file_flush(ROUTER_INSTANCE *router)
 {
-    fsync(router->binlog_fd);
+    if (!blr_file_write_buffer(router))
+    {
+        return false;
+    }
+
+    if (router->unsynced_bytes > 0 && blr_file_sync_due(router) &&
+        !blr_file_sync(router) && router->sync_slaves)
+    {
+        return false;
+    }
+
+    if (router->commit_pending && (!router->sync_slaves || router->unsynced_bytes == 0))
+    {
+        spinlock_acquire(&router->binlog_lock);
+        router->binlog_position = router->commit_pos;
+        router->current_safe_event = router->commit_event;
+        router->commit_pending = false;
+        spinlock_release(&router->binlog_lock);
+
+        blr_gtid_index_visible(router, router->binlog_position);
+        blr_notify_slaves(router);
+        blr_index_checkpoint(router);
+    }
+
+    return true;
+}
+
+/**
+ * Get the path of the binlog index of the current binlog file
+ *
+ * @param router    The router instance
+ * @param path      Buffer of PATH_MAX + 1 bytes for the path
+ */
+static void
+blr_index_path(ROUTER_INSTANCE *router, char *path)
+{
+    snprintf(path, PATH_MAX, "%s/%s" BLR_INDEX_SUFFIX, router->binlogdir, router->binlog_name);
+}
+
+/**
+ * Calculate the CRC32 of a binlog index
+ *
+ * @param index     The binlog index
+ * @return The CRC32 of the index without the crc field
+ */
+static uint32_t
+blr_index_crc(BLR_BINLOG_INDEX *index)
+{
+    return mxs_crc32(0, index, offsetof(BLR_BINLOG_INDEX, crc));
+}
+
+/**
+ * Add a complete event written to the current binlog file to the binlog
+ * index. The index becomes unknown if the event does not follow the
+ * previous one.
+ *
+ * @param router    The router instance
+ * @param hdr       The header of the event
+ */
+static void
+blr_index_event(ROUTER_INSTANCE *router, REP_HEADER *hdr)
+{
+    BLR_BINLOG_INDEX *index = &router->binlog_index;
+
+    if (index->pos == 0 || index->pos + hdr->event_size != hdr->next_pos)
+    {
+        index->pos = 0;
+        return;
+    }
+
+    if (hdr->event_type == FORMAT_DESCRIPTION_EVENT)
+    {
+        index->fde_pos = index->pos;
+        index->fde_time = hdr->timestamp;
+        index->checksum = router->master_chksum;
+    }
+
+    index->last_pos = index->pos;
+    index->last_size = hdr->event_size;
+    index->last_type = hdr->event_type;
+    index->last_time = hdr->timestamp;
+    index->n_events++;
+    index->pos = hdr->next_pos;
+}
+
+/**
+ * Write the binlog index of the current binlog file. The index is written
+ * into a temporary file which then replaces the previous index.
+ *
+ * @param router    The router instance
+ * @param index     The binlog index
+ * @return True if the index was written
+ */
+bool
+blr_index_write(ROUTER_INSTANCE *router, BLR_BINLOG_INDEX *index)
+{
+    char path[PATH_MAX + 1] = "";
+    char tmp_path[PATH_MAX + 1] = "";
+    char err_msg[STRERROR_BUFLEN];
+    bool rval = false;
+    int fd;
+    int dirfd;
+
+    memcpy(index->magic, BLR_INDEX_MAGIC, BLR_INDEX_MAGIC_LEN);
+    index->crc = blr_index_crc(index);
+
+    blr_index_path(router, path);
+    snprintf(tmp_path, PATH_MAX, "%s.tmp", path);
+
+    if ((fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1)
+    {
+        MXS_ERROR("Failed to create binlog index %s, %s.",
+                  tmp_path, strerror_r(errno, err_msg, sizeof(err_msg)));
+        return false;
+    }
+
+    /* The index must be on disk before it replaces the old one */
+    if (write(fd, index, sizeof(*index)) == sizeof(*index) && fsync(fd) == 0)
+    {
+        rval = true;
+    }
+    else
+    {
+        MXS_ERROR("Failed to write binlog index %s, %s.",
+                  tmp_path, strerror_r(errno, err_msg, sizeof(err_msg)));
+    }
+
+    close(fd);
+
+    if (rval && rename(tmp_path, path) != 0)
+    {
+        MXS_ERROR("Failed to rename binlog index %s to %s, %s.",
+                  tmp_path, path, strerror_r(errno, err_msg, sizeof(err_msg)));
+        rval = false;
+    }
+
+    if (!rval)
+    {
+        unlink(tmp_path);
+    }
+    else if ((dirfd = open(router->binlogdir, O_RDONLY)) != -1)
+    {
+        fsync(dirfd);
+        close(dirfd);
+    }
+
+    return rval;
+}
+
+/**
+ * Read the binlog index of the current binlog file. The index is only used
+ * if the last event it covers is found in the binlog file.
+ *
+ * @param router    The router instance
+ * @param index     Where the binlog index is stored, cleared if no valid
+ *                  index was found
+ * @return True if a valid index was found
+ */
+bool
+blr_index_load(ROUTER_INSTANCE *router, BLR_BINLOG_INDEX *index)
+{
+    char path[PATH_MAX + 1] = "";
+    uint8_t hdbuf[BINLOG_EVENT_HDR_LEN];
+    struct stat statb;
+    bool rval = false;
+    int fd;
+
+    blr_index_path(router, path);
+
+    if ((fd = open(path, O_RDONLY)) == -1)
+    {
+        memset(index, 0, sizeof(*index));
+        return false;
+    }
+
+    if (read(fd, index, sizeof(*index)) != sizeof(*index) ||
+        memcmp(index->magic, BLR_INDEX_MAGIC, BLR_INDEX_MAGIC_LEN) != 0 ||
+        index->crc != blr_index_crc(index))
+    {
+        MXS_WARNING("Binlog index %s is corrupted, ignoring it.", path);
+    }
+    else if (index->n_events == 0 || fstat(router->binlog_fd, &statb) != 0 ||
+             (uint64_t)statb.st_size < index->pos ||
+             pread(router->binlog_fd, hdbuf, BINLOG_EVENT_HDR_LEN,
+                   index->last_pos) != BINLOG_EVENT_HDR_LEN ||
+             hdbuf[4] != index->last_type ||
+             extract_field(&hdbuf[9], 32) != index->last_size ||
+             EXTRACT32(&hdbuf[13]) != index->pos)
+    {
+        MXS_WARNING("Binlog index %s does not match binlog file %s, ignoring it.",
+                    path, router->binlog_name);
+    }
+    else
+    {
+        rval = true;
+    }
+
+    close(fd);
+
+    if (!rval)
+    {
+        memset(index, 0, sizeof(*index));
+    }
+
+    return rval;
+}
+
+/**
+ * Write the binlog index if enough events have been committed since the
+ * previous checkpoint. The index is only written when all the events in the
+ * binlog file belong to committed transactions. Without transaction safety
+ * the router does not know where the transactions end so no index is written.
+ *
+ * @param router    The router instance
+ */
+void
+blr_index_checkpoint(ROUTER_INSTANCE *router)
+{
+    BLR_BINLOG_INDEX *index = &router->binlog_index;
+
+    if (router->trx_safe && index->pos > BINLOG_MAGIC_SIZE &&
+        index->pos == router->binlog_position &&
+        index->pos >= router->index_checkpoint + BLR_INDEX_INTERVAL)
+    {
+        /* A failed write is retried at the next checkpoint */
+        blr_index_write(router, index);
+        router->index_checkpoint = index->pos;
+    }
 }
 
 /**
@@ -414,14 +856,27 @@ blr_open_binlog(ROUTER_INSTANCE *router, char *binlog)
     }
     strncpy(file->binlogname, binlog, BINLOG_FNAMELEN);
     file->refcnt = 1;
-    file->cache = 0;
     spinlock_init(&file->lock);
 
     strncpy(path, router->binlogdir, PATH_MAX);
     strncat(path, "/", PATH_MAX - strlen(path));
     strncat(path, binlog, PATH_MAX - strlen(path));
 
-    if ((file->fd = open(path, O_RDONLY, 0666)) == -1)
+    if ((file->fd = open(path, O_RDONLY, 0666)) == -1 && errno == ENOENT)
+    {
+        /* The file may have been compressed */
+        char zpath[PATH_MAX + 1];
+        snprintf(zpath, PATH_MAX, "%s" BLR_COMPRESSED_SUFFIX, path);
+
+        if ((file->fd = open(zpath, O_RDONLY)) != -1 &&
+            (file->blocks = blr_compressed_open(router, file->fd, zpath)) == NULL)
+        {
+            close(file->fd);
+            file->fd = -1;
+        }
+    }
+
+    if (file->fd == -1)
     {
         MXS_ERROR("Failed to open binlog file %s", path);
         free(file);
@@ -436,6 +891,29 @@ blr_open_binlog(ROUTER_INSTANCE *router, char *binlog)
     return file;
 }
 
+/**
+ * Read data from a binlog file opened with blr_open_binlog
+ *
+ * Compressed files are read through the blocks cached for the file.
+ *
+ * @param router    The router instance
+ * @param file      The binlog file
+ * @param buf       Where the data is stored
+ * @param len       Number of bytes to read
+ * @param pos       Position in the binlog file
+ * @return Number of bytes read or -1 on error
+ */
+static int
+blr_file_pread(ROUTER_INSTANCE *router, BLFILE *file, uint8_t *buf, size_t len, unsigned long pos)
+{
+    if (file->blocks == NULL)
+    {
+        return pread(file->fd, buf, len, pos);
+    }
+
+    return blr_compressed_read(router, file->blocks, file->fd, buf, len, pos);
+}
+
 /**
  * Read a replication event into a GWBUF structure.
  *
@@ -469,7 +947,11 @@ blr_read_binlog(ROUTER_INSTANCE *router, BLFILE *file, unsigned long pos, REP_HE
     }
 
     spinlock_acquire(&file->lock);
-    if (fstat(file->fd, &statb) == 0)
+    if (file->blocks)
+    {
+        filelen = file->blocks->hdr.size;
+    }
+    else if (fstat(file->fd, &statb) == 0)
     {
         filelen = statb.st_size;
     }
@@ -542,8 +1024,15 @@ blr_read_binlog(ROUTER_INSTANCE *router, BLFILE *file, unsigned long pos, REP_HE
     spinlock_release(&file->lock);
     spinlock_release(&router->binlog_lock);
 
+    /* Recent events are read from the cache shared by all slaves */
+    if ((result = blr_cache_get(router, file->binlogname, pos, hdr)) != NULL)
+    {
+        hdr->ok = SLAVE_POS_READ_OK;
+        return result;
+    }
+
     /* Read the header information from the file */
-    if ((n = pread(file->fd, hdbuf, BINLOG_EVENT_HDR_LEN, pos)) != BINLOG_EVENT_HDR_LEN)
+    if ((n = blr_file_pread(router, file, hdbuf, BINLOG_EVENT_HDR_LEN, pos)) != BINLOG_EVENT_HDR_LEN)
     {
         switch (n)
         {
@@ -627,7 +1116,7 @@ blr_read_binlog(ROUTER_INSTANCE *router, BLFILE *file, unsigned long pos, REP_HE
                   pos, file->binlogname, filelen, router->binlog_position,
                   router->binlog_name);
 
-        if ((n = pread(file->fd, hdbuf, BINLOG_EVENT_HDR_LEN, pos)) != BINLOG_EVENT_HDR_LEN)
+        if ((n = blr_file_pread(router, file, hdbuf, BINLOG_EVENT_HDR_LEN, pos)) != BINLOG_EVENT_HDR_LEN)
         {
             switch (n)
             {
@@ -694,8 +1183,8 @@ blr_read_binlog(ROUTER_INSTANCE *router, BLFILE *file, unsigned long pos, REP_HE
 
     memcpy(data, hdbuf, BINLOG_EVENT_HDR_LEN);  // Copy the header in
 
-    if ((n = pread(file->fd, &data[BINLOG_EVENT_HDR_LEN], hdr->event_size - BINLOG_EVENT_HDR_LEN,
-                   pos + BINLOG_EVENT_HDR_LEN))
+    if ((n = blr_file_pread(router, file, &data[BINLOG_EVENT_HDR_LEN],
+                            hdr->event_size - BINLOG_EVENT_HDR_LEN, pos + BINLOG_EVENT_HDR_LEN))
         != hdr->event_size - BINLOG_EVENT_HDR_LEN)  // Read the balance
     {
         if (n == -1)
@@ -778,10 +1267,72 @@ blr_close_binlog(ROUTER_INSTANCE *router, BLFILE *file)
     {
         close(file->fd);
         file->fd = -1;
+        blr_compressed_free(file->blocks);
         free(file);
     }
 }
 
+/**
+ * Map a part of a binlog file that is no longer written to. The current
+ * binlog file is never mapped as the master may still append to it or
+ * truncate it. Compressed files are not mapped either.
+ *
+ * @param router    The router instance
+ * @param file      The binlog file
+ * @param pos       The first position that is needed
+ * @param len       The number of bytes needed from pos onwards
+ * @param map       The mapping is stored here
+ * @return True if the file was mapped, false if it must be read with
+ *         blr_read_binlog
+ */
+bool
+blr_map_binlog(ROUTER_INSTANCE *router, BLFILE *file, unsigned long pos,
+               unsigned long len, BLFILE_MAP *map)
+{
+    struct stat statb;
+    unsigned long pagesize = sysconf(_SC_PAGESIZE);
+    bool current;
+
+    spinlock_acquire(&router->binlog_lock);
+    current = strcmp(router->binlog_name, file->binlogname) == 0;
+    spinlock_release(&router->binlog_lock);
+
+    if (current || file->blocks || file->fd == -1 || fstat(file->fd, &statb) != 0 ||
+        pos >= (unsigned long)statb.st_size)
+    {
+        return false;
+    }
+
+    map->start = pos - pos % pagesize;
+    map->end = MIN(pos + len, (unsigned long)statb.st_size);
+    map->size = map->end - map->start;
+    map->base = mmap(NULL, map->size, PROT_READ, MAP_SHARED, file->fd, map->start);
+
+    if (map->base == MAP_FAILED)
+    {
+        char err_msg[STRERROR_BUFLEN];
+        MXS_DEBUG("%s: Failed to map binlog file '%s' at %lu, %s.",
+                  router->service->name, file->binlogname, pos,
+                  strerror_r(errno, err_msg, sizeof(err_msg)));
+        return false;
+    }
+
+    madvise(map->base, map->size, MADV_SEQUENTIAL);
+    return true;
+}
+
+/**
+ * Unmap a part of a binlog file mapped with blr_map_binlog
+ *
+ * @param map       The mapping
+ */
+void
+blr_unmap_binlog(BLFILE_MAP *map)
+{
+    munmap(map->base, map->size);
+    map->base = NULL;
+}
+
 /**
  * Log the event header of  binlog event
  *
@@ -815,6 +1366,10 @@ blr_file_size(BLFILE *file)
 {
     struct stat statb;
 
+    if (file->blocks)
+    {
+        return file->blocks->hdr.size;
+    }
     if (fstat(file->fd, &statb) == 0)
     {
         return statb.st_size;
@@ -925,29 +1480,103 @@ blr_file_next_exists(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
     sprintf(bigbuf, "%s/%s", router->binlogdir, buf);
     if (access(bigbuf, R_OK) == -1)
     {
-        return 0;
+        strcat(bigbuf, BLR_COMPRESSED_SUFFIX);
+        if (access(bigbuf, R_OK) == -1)
+        {
+            return 0;
+        }
     }
     return 1;
 }
 
 /**
- * Read all replication events from a binlog file.
+ * Get data from a binlog file that is read sequentially
  *
- * Routine detects errors and pending transactions
+ * The file is read BLR_SCAN_READ_SIZE bytes at a time and the kernel is
+ * asked to read the following part of the file in the background. The
+ * returned data is valid until the next call.
+ *
+ * @param scan  The scan buffer
+ * @param pos   Position of the data in the file
+ * @param len   Number of bytes needed
+ * @param n     Set to the number of bytes available at pos, -1 on error
+ * @return Pointer to the data or NULL if len bytes could not be read
+ */
+static uint8_t *
+blr_scan_read(BLR_SCAN_BUFFER *scan, uint64_t pos, size_t len, int *n)
+{
+    if (pos < scan->start || pos + len > scan->start + scan->len)
+    {
+        size_t size = MAX(len, BLR_SCAN_READ_SIZE);
+        ssize_t rc;
+
+        if (size > scan->size)
+        {
+            uint8_t *buf = realloc(scan->buf, size);
+
+            if (buf == NULL)
+            {
+                errno = ENOMEM;
+                *n = -1;
+                return NULL;
+            }
+
+            scan->buf = buf;
+            scan->size = size;
+        }
+
+        scan->start = pos;
+        scan->len = 0;
+
+        while ((rc = pread(scan->fd, scan->buf + scan->len, size - scan->len,
+                           pos + scan->len)) > 0)
+        {
+            scan->len += rc;
+
+            if (scan->len >= len)
+            {
+                break;
+            }
+        }
+
+        if (rc == -1)
+        {
+            scan->len = 0;
+            *n = -1;
+            return NULL;
+        }
+
+        posix_fadvise(scan->fd, pos + scan->len, BLR_SCAN_READ_SIZE, POSIX_FADV_WILLNEED);
+    }
+
+    if (pos + len > scan->start + scan->len)
+    {
+        *n = scan->start + scan->len - pos;
+        return NULL;
+    }
+
+    *n = len;
+    return scan->buf + (pos - scan->start);
+}
+
+/**
+ * Read all replication events from a binlog file, see blr_read_events_all_events
  *
  * @param router  The router instance
+ * @param scan    The buffer used for reading the file
  * @param fix     Whether to fix or not errors
  * @param debug   Whether to enable or not the debug for events
+ * @param result  The summary of the file is updated here
  * @return        0 on success, >0 on failure
  */
-int
-blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug)
+static int
+blr_scan_events(ROUTER_INSTANCE *router, BLR_SCAN_BUFFER *scan, int fix, int debug,
+                BLR_SCAN_RESULT *result)
 {
     unsigned long filelen = 0;
     struct stat statb;
-    uint8_t hdbuf[BINLOG_EVENT_HDR_LEN];
+    uint8_t *hdbuf;
     uint8_t *data;
-    GWBUF *result;
     unsigned long long pos = 4;
     unsigned long long last_known_commit = 4;
 
@@ -973,10 +1602,12 @@ blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug)
     BINLOG_EVENT_DESC last_event;
     BINLOG_EVENT_DESC fde_event;
     int fde_seen = 0;
+    BLR_BINLOG_INDEX index = router->binlog_index;
 
     memset(&first_event, '\0', sizeof(first_event));
     memset(&last_event, '\0', sizeof(last_event));
     memset(&fde_event, '\0', sizeof(fde_event));
+    memset(&router->binlog_index, '\0', sizeof(router->binlog_index));
 
     if (router->binlog_fd == -1)
     {
@@ -994,11 +1625,39 @@ blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug)
     router->binlog_position = 4;
     router->current_safe_event = 4;
 
+    if (index.pos > 4 && index.pos <= filelen)
+    {
+        /* The events before the indexed position have already been checked */
+        pos = index.pos;
+        last_known_commit = index.pos;
+        found_chksum = index.checksum;
+
+        fde_event.event_time = (unsigned long)index.fde_time;
+        fde_event.event_type = FORMAT_DESCRIPTION_EVENT;
+        fde_event.event_pos = index.fde_pos;
+
+        last_event.event_time = (unsigned long)index.last_time;
+        last_event.event_type = index.last_type;
+        last_event.event_pos = index.last_pos;
+
+        MXS_NOTICE("Binlog file %s is valid up to position %llu according to its index, "
+                   "%lu events. Checking the events after it.",
+                   router->binlog_name, pos, (unsigned long)index.n_events);
+    }
+    else
+    {
+        memset(&index, '\0', sizeof(index));
+        index.pos = 4;
+    }
+
+    result->n_events = index.n_events;
+    result->checksums = found_chksum;
+
     while (1)
     {
 
         /* Read the header information from the file */
-        if ((n = pread(router->binlog_fd, hdbuf, BINLOG_EVENT_HDR_LEN, pos)) != BINLOG_EVENT_HDR_LEN)
+        if ((hdbuf = blr_scan_read(scan, pos, BINLOG_EVENT_HDR_LEN, &n)) == NULL)
         {
             switch (n)
             {
@@ -1100,6 +1759,11 @@ blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug)
                 router->current_pos = pos;
                 router->pending_transaction = 1;
 
+                if (n == 0)
+                {
+                    router->binlog_index = index;
+                }
+
                 MXS_ERROR("Binlog '%s' ends at position %lu and has an incomplete transaction at %lu. ",
                           router->binlog_name, router->current_pos, router->binlog_position);
 
@@ -1135,6 +1799,7 @@ blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug)
                     router->binlog_position = pos;
                     router->current_safe_event = pos;
                     router->current_pos = pos;
+                    router->binlog_index = index;
 
                     return 0;
                 }
@@ -1229,43 +1894,8 @@ blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug)
             return 1;
         }
 
-        /* Allocate a GWBUF for the event */
-        if ((result = gwbuf_alloc(hdr.event_size)) == NULL)
-        {
-            MXS_ERROR("Failed to allocate memory for binlog entry, "
-                      "size %d at %llu.",
-                      hdr.event_size, pos);
-
-            router->binlog_position = last_known_commit;
-            router->current_safe_event = last_known_commit;
-            router->current_pos = pos;
-
-            MXS_WARNING("an error has been found. "
-                        "Setting safe pos to %lu, current pos %lu",
-                        router->binlog_position, router->current_pos);
-
-            if (fix)
-            {
-                if (ftruncate(router->binlog_fd, router->binlog_position) == 0)
-                {
-                    MXS_NOTICE("Binlog file %s has been truncated at %lu",
-                               router->binlog_name,
-                               router->binlog_position);
-                    fsync(router->binlog_fd);
-                }
-            }
-
-            return 1;
-        }
-
-        /* Copy the header in the buffer */
-        data = GWBUF_DATA(result);
-        memcpy(data, hdbuf, BINLOG_EVENT_HDR_LEN);// Copy the header in
-
-        /* Read event data */
-        if ((n = pread(router->binlog_fd, &data[BINLOG_EVENT_HDR_LEN],
-                       hdr.event_size - BINLOG_EVENT_HDR_LEN,
-                       pos + BINLOG_EVENT_HDR_LEN)) != hdr.event_size - BINLOG_EVENT_HDR_LEN)
+        /* Read the whole event, the header is read again from the buffer */
+        if ((data = blr_scan_read(scan, pos, hdr.event_size, &n)) == NULL)
         {
             if (n == -1)
             {
@@ -1281,7 +1911,7 @@ blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug)
                 MXS_ERROR("Short read when reading the event at %llu in %s. "
                           "Expected %d bytes got %d bytes.",
                           pos, router->binlog_name,
-                          hdr.event_size - BINLOG_EVENT_HDR_LEN, n);
+                          hdr.event_size - BINLOG_EVENT_HDR_LEN, n - BINLOG_EVENT_HDR_LEN);
 
                 if (filelen > 0 && filelen - pos < hdr.event_size)
                 {
@@ -1291,8 +1921,6 @@ blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug)
                 }
             }
 
-            gwbuf_free(result);
-
             router->binlog_position = last_known_commit;
             router->current_safe_event = last_known_commit;
             router->current_pos = pos;
@@ -1416,6 +2044,44 @@ blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug)
                 {
                     found_chksum = 0;
                 }
+                result->checksums = found_chksum;
+            }
+        }
+
+        /* verify the event checksum, the FDE above tells if events have one */
+        if (found_chksum && hdr.event_size >= BINLOG_EVENT_HDR_LEN + MYSQL_CHECKSUM_LEN)
+        {
+            uint32_t event_crc = EXTRACT32(data + hdr.event_size - MYSQL_CHECKSUM_LEN);
+            uint32_t computed_crc = mxs_crc32(0, data, hdr.event_size - MYSQL_CHECKSUM_LEN);
+
+            if (event_crc != computed_crc)
+            {
+                MXS_ERROR("Checksum mismatch in event 0x%x at %llu in %s. "
+                          "Expected 0x%x, calculated 0x%x.",
+                          hdr.event_type, pos, router->binlog_name,
+                          event_crc, computed_crc);
+
+                result->bad_checksum = true;
+
+                router->binlog_position = last_known_commit;
+                router->current_safe_event = last_known_commit;
+                router->current_pos = pos;
+
+                MXS_WARNING("an error has been found. "
+                            "Setting safe pos to %lu, current pos %lu",
+                            router->binlog_position, router->current_pos);
+                if (fix)
+                {
+                    if (ftruncate(router->binlog_fd, router->binlog_position) == 0)
+                    {
+                        MXS_NOTICE("Binlog file %s has been truncated at %lu",
+                                   router->binlog_name,
+                                   router->binlog_position);
+                        fsync(router->binlog_fd);
+                    }
+                }
+
+                return 1;
             }
         }
 
@@ -1481,8 +2147,6 @@ blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug)
                                   pos, domainid, hdr.serverid,
                                   n_sequence, last_known_commit);
 
-                        gwbuf_free(result);
-
                         break;
                     }
                     else
@@ -1538,7 +2202,6 @@ blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug)
                               pos, last_known_commit);
 
                         free(statement_sql);
-                        gwbuf_free(result);
 
                         break;
                     }
@@ -1575,7 +2238,6 @@ blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug)
             else
             {
                 MXS_ERROR("Unable to allocate memory for statement SQL in blr_file.c ");
-                gwbuf_free(result);
                 break;
             }
 
@@ -1614,10 +2276,9 @@ blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug)
             }
 
             n_transactions++;
+            result->n_transactions++;
         }
 
-        gwbuf_free(result);
-
         /* pos and next_pos sanity checks */
         if (hdr.next_pos > 0 && hdr.next_pos < pos)
         {
@@ -1693,6 +2354,21 @@ blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug)
                 }
             }
 
+            /* Add the event to the index of the file */
+            if (hdr.event_type == FORMAT_DESCRIPTION_EVENT)
+            {
+                index.fde_pos = pos;
+                index.fde_time = hdr.timestamp;
+                index.checksum = found_chksum;
+            }
+            index.last_pos = pos;
+            index.last_size = hdr.event_size;
+            index.last_type = hdr.event_type;
+            index.last_time = hdr.timestamp;
+            index.n_events++;
+            index.pos = hdr.next_pos;
+            result->n_events = index.n_events;
+
             pos = hdr.next_pos;
         }
         else
@@ -1732,6 +2408,48 @@ blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug)
     }
 }
 
+/**
+ * Read all replication events from a binlog file.
+ *
+ * Routine detects errors and pending transactions
+ *
+ * If router->binlog_index holds a valid binlog index, only the events after
+ * the position in the index are read. When the end of the file is reached
+ * router->binlog_index is set to the index of the whole file, otherwise it
+ * is cleared.
+ *
+ * The file is read with large sequential reads, this is used both by the
+ * check of the binlog at startup and by maxbinlogcheck.
+ *
+ * @param router  The router instance
+ * @param fix     Whether to fix or not errors
+ * @param debug   Whether to enable or not the debug for events
+ * @param result  If not NULL, the summary of the file is stored here
+ * @return        0 on success, >0 on failure
+ */
+int
+blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug, BLR_SCAN_RESULT *result)
+{
+    BLR_SCAN_BUFFER scan;
+    BLR_SCAN_RESULT summary;
+    int rc;
+
+    memset(&scan, 0, sizeof(scan));
+    memset(&summary, 0, sizeof(summary));
+    scan.fd = router->binlog_fd;
+
+    posix_fadvise(router->binlog_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    rc = blr_scan_events(router, &scan, fix, debug, &summary);
+    free(scan.buf);
+
+    if (result)
+    {
+        *result = summary;
+    }
+
+    return rc;
+}
+
 /**
  * Format a number to G, M, k, or B size
  *
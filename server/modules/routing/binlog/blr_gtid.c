@@ -0,0 +1,800 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file blr_gtid.c - binlog router GTID index
+ *
+ * The GTID index maps the MariaDB 10 GTIDs of the transactions in the binlog
+ * files to the binlog file and the position after the end of the transaction.
+ * It allows MariaDB 10 slaves that connect with @slave_connect_state to be
+ * started from the right position without scanning the binlog files.
+ *
+ * The index is built as the events are written to the binlog files and kept
+ * in memory sorted by GTID. A transaction is added to the in-memory index
+ * only once the slaves can read all of it from the binlog file, and it is
+ * appended to the index file in the binlog directory only once the binlog
+ * file has been synced up to the end of the transaction. This way the index
+ * never points past the data that the slaves can read or that survives a
+ * crash.
+ *
+ * The transactions of binlog files that have been removed are dropped from
+ * the index when it is loaded and whenever the master rotates to a new file,
+ * so the index only grows with the binlog files that are kept.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <blr.h>
+#include <spinlock.h>
+#include <skygw_types.h>
+#include <skygw_utils.h>
+#include <log_manager.h>
+
+/** Magic bytes at the start of the index file */
+static const char gtid_index_magic[BLR_GTID_INDEX_MAGIC_LEN] = "BLRGTID1";
+
+/**
+ * Compare two GTIDs
+ *
+ * @param a     The first GTID
+ * @param b     The second GTID
+ * @return Negative, zero or positive like strcmp
+ */
+static int
+blr_gtid_cmp(const BLR_GTID_ENTRY *a, const BLR_GTID_ENTRY *b)
+{
+    if (a->domain != b->domain)
+    {
+        return a->domain < b->domain ? -1 : 1;
+    }
+    if (a->seq != b->seq)
+    {
+        return a->seq < b->seq ? -1 : 1;
+    }
+    if (a->server_id != b->server_id)
+    {
+        return a->server_id < b->server_id ? -1 : 1;
+    }
+    return 0;
+}
+
+/**
+ * Find the first entry that is not smaller than a GTID
+ *
+ * @param index The GTID index
+ * @param gtid  The GTID to look for
+ * @return Offset of the entry, index->count if all entries are smaller
+ */
+static int
+blr_gtid_lower_bound(BLR_GTID_INDEX *index, const BLR_GTID_ENTRY *gtid)
+{
+    int low = 0;
+    int high = index->count;
+
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+
+        if (blr_gtid_cmp(&index->entries[mid], gtid) < 0)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+/**
+ * Add an entry to the in-memory index. GTIDs normally grow so the entry
+ * is usually appended to the end. The caller must hold the index lock.
+ *
+ * @param index The GTID index
+ * @param entry The new entry
+ * @return True if the entry was added
+ */
+static bool
+blr_gtid_insert(BLR_GTID_INDEX *index, const BLR_GTID_ENTRY *entry)
+{
+    int i;
+
+    if (index->count == index->size)
+    {
+        int size = index->size ? index->size * 2 : BLR_GTID_INDEX_INITIAL;
+        BLR_GTID_ENTRY *entries = realloc(index->entries, size * sizeof(BLR_GTID_ENTRY));
+
+        if (entries == NULL)
+        {
+            return false;
+        }
+
+        index->entries = entries;
+        index->size = size;
+    }
+
+    if (index->count == 0 || blr_gtid_cmp(&index->entries[index->count - 1], entry) < 0)
+    {
+        i = index->count;
+    }
+    else
+    {
+        i = blr_gtid_lower_bound(index, entry);
+
+        if (i < index->count && blr_gtid_cmp(&index->entries[i], entry) == 0)
+        {
+            /** The transaction was written again, e.g. after a master reconnect */
+            index->entries[i] = *entry;
+            return true;
+        }
+
+        memmove(&index->entries[i + 1], &index->entries[i],
+                (index->count - i) * sizeof(BLR_GTID_ENTRY));
+    }
+
+    index->entries[i] = *entry;
+    index->count++;
+    return true;
+}
+
+/**
+ * Load the index file of the router and open it for appending
+ *
+ * @param router    The router instance
+ * @param index     The GTID index
+ * @param path      Path to the index file
+ * @return True if the file could be opened
+ */
+static bool
+blr_gtid_index_load(ROUTER_INSTANCE *router, BLR_GTID_INDEX *index, const char *path)
+{
+    char magic[BLR_GTID_INDEX_MAGIC_LEN];
+    BLR_GTID_ENTRY entry;
+    off_t valid = BLR_GTID_INDEX_MAGIC_LEN;
+    bool loaded = true;
+    int fd;
+
+    if ((fd = open(path, O_RDWR | O_CREAT, 0660)) == -1)
+    {
+        char err_msg[STRERROR_BUFLEN];
+        MXS_ERROR("%s: Failed to open GTID index file '%s', %s.",
+                  router->service->name, path,
+                  strerror_r(errno, err_msg, sizeof(err_msg)));
+        return false;
+    }
+
+    if (read(fd, magic, sizeof(magic)) != sizeof(magic) ||
+        memcmp(magic, gtid_index_magic, sizeof(magic)) != 0)
+    {
+        /** A new or unusable file, start a new index */
+        if (ftruncate(fd, 0) != 0 ||
+            pwrite(fd, gtid_index_magic, sizeof(gtid_index_magic), 0) != sizeof(gtid_index_magic))
+        {
+            char err_msg[STRERROR_BUFLEN];
+            MXS_ERROR("%s: Failed to initialise GTID index file '%s', %s.",
+                      router->service->name, path,
+                      strerror_r(errno, err_msg, sizeof(err_msg)));
+            close(fd);
+            return false;
+        }
+    }
+    else
+    {
+        while (read(fd, &entry, sizeof(entry)) == sizeof(entry))
+        {
+            if (!blr_gtid_insert(index, &entry))
+            {
+                MXS_ERROR("%s: Failed to allocate memory for the GTID index, "
+                          "the transactions after %d are not used.",
+                          router->service->name, index->count);
+                loaded = false;
+                break;
+            }
+            valid += sizeof(entry);
+            index->pending.domain = entry.domain;
+        }
+
+        /** Drop a partially written entry but keep the ones that did not fit in memory */
+        if (loaded && ftruncate(fd, valid) != 0)
+        {
+            char err_msg[STRERROR_BUFLEN];
+            MXS_ERROR("%s: Failed to truncate GTID index file '%s', %s.",
+                      router->service->name, path,
+                      strerror_r(errno, err_msg, sizeof(err_msg)));
+        }
+    }
+
+    lseek(fd, 0, SEEK_END);
+    index->fd = fd;
+    return true;
+}
+
+/**
+ * Check whether a binlog file, or its compressed version, exists
+ *
+ * @param router    The router instance
+ * @param file      The number of the binlog file
+ * @return True if the file exists
+ */
+static bool
+blr_gtid_file_exists(ROUTER_INSTANCE *router, uint32_t file)
+{
+    char path[PATH_MAX + 1];
+    int len = snprintf(path, PATH_MAX, "%s/" BINLOG_NAMEFMT, router->binlogdir,
+                       router->fileroot, (int)file);
+
+    if (access(path, F_OK) == 0)
+    {
+        return true;
+    }
+
+    snprintf(path + len, PATH_MAX - len, "%s", BLR_COMPRESSED_SUFFIX);
+    return access(path, F_OK) == 0;
+}
+
+/**
+ * Write the whole index to a new index file that replaces the old one.
+ * Only the thread that writes the binlog files may call this.
+ *
+ * The queued transactions that are already in the old index file but not yet
+ * in the in-memory entries are written as well.
+ *
+ * @param router    The router instance
+ * @param index     The GTID index
+ * @return True if the index file was replaced
+ */
+static bool
+blr_gtid_index_rewrite(ROUTER_INSTANCE *router, BLR_GTID_INDEX *index)
+{
+    char path[PATH_MAX + 1];
+    char tmp_path[PATH_MAX + 1];
+    size_t len = index->count * sizeof(BLR_GTID_ENTRY);
+    int unseen = index->saved > index->visible ? index->saved - index->visible : 0;
+    size_t unseen_len = unseen * sizeof(BLR_GTID_ENTRY);
+    int fd;
+    int dirfd;
+
+    snprintf(path, PATH_MAX, "%s/%s", router->binlogdir, BLR_GTID_INDEX_FILE);
+    snprintf(tmp_path, PATH_MAX, "%s.tmp", path);
+
+    if ((fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0660)) == -1 ||
+        write(fd, gtid_index_magic, sizeof(gtid_index_magic)) != sizeof(gtid_index_magic) ||
+        write(fd, index->entries, len) != (ssize_t)len ||
+        write(fd, index->queue + index->visible, unseen_len) != (ssize_t)unseen_len ||
+        fsync(fd) != 0 ||
+        rename(tmp_path, path) != 0)
+    {
+        char err_msg[STRERROR_BUFLEN];
+        MXS_ERROR("%s: Failed to write GTID index file '%s', %s.",
+                  router->service->name, tmp_path,
+                  strerror_r(errno, err_msg, sizeof(err_msg)));
+        if (fd != -1)
+        {
+            close(fd);
+            unlink(tmp_path);
+        }
+        return false;
+    }
+
+    /** Make the rename durable before the old file is forgotten */
+    if ((dirfd = open(router->binlogdir, O_RDONLY)) != -1)
+    {
+        fsync(dirfd);
+        close(dirfd);
+    }
+
+    if (index->fd != -1)
+    {
+        close(index->fd);
+    }
+    index->fd = fd;
+    return true;
+}
+
+/**
+ * Drop the transactions of the binlog files that have been removed
+ *
+ * Binlog files are removed from the oldest one, so the transactions of the
+ * files older than the oldest existing file are dropped. The index file is
+ * rewritten if any transactions were dropped.
+ *
+ * @param router    The router instance
+ */
+void
+blr_gtid_index_prune(ROUTER_INSTANCE *router)
+{
+    BLR_GTID_INDEX *index = router->gtid_index;
+    char *suffix = strrchr(router->binlog_name, '.');
+    uint32_t current = suffix ? atoi(suffix + 1) : 0;
+    uint32_t oldest = UINT32_MAX;
+    int count = 0;
+
+    if (index == NULL || index->count == 0)
+    {
+        return;
+    }
+
+    /** Only the thread that writes the binlogs modifies the entries */
+    for (int i = 0; i < index->count; i++)
+    {
+        if (index->entries[i].file < oldest)
+        {
+            oldest = index->entries[i].file;
+        }
+    }
+
+    while (oldest < current && !blr_gtid_file_exists(router, oldest))
+    {
+        oldest++;
+    }
+
+    spinlock_acquire(&index->lock);
+    for (int i = 0; i < index->count; i++)
+    {
+        if (index->entries[i].file >= oldest)
+        {
+            index->entries[count++] = index->entries[i];
+        }
+    }
+    int removed = index->count - count;
+    index->count = count;
+    spinlock_release(&index->lock);
+
+    if (removed > 0)
+    {
+        MXS_NOTICE("%s: Removed %d transactions of deleted binlog files from the GTID index.",
+                   router->service->name, removed);
+        blr_gtid_index_rewrite(router, index);
+    }
+}
+
+/**
+ * Initialise the GTID index of the router. The index is only used with
+ * MariaDB 10 masters.
+ *
+ * @param router    The router instance
+ */
+void
+blr_gtid_index_init(ROUTER_INSTANCE *router)
+{
+    char path[PATH_MAX + 1];
+    BLR_GTID_INDEX *index;
+
+    if (!router->mariadb10_compat || router->binlogdir == NULL)
+    {
+        return;
+    }
+
+    if ((index = calloc(1, sizeof(BLR_GTID_INDEX))) == NULL)
+    {
+        MXS_ERROR("%s: Failed to allocate the GTID index.", router->service->name);
+        return;
+    }
+
+    spinlock_init(&index->lock);
+    index->fd = -1;
+    snprintf(path, PATH_MAX, "%s/%s", router->binlogdir, BLR_GTID_INDEX_FILE);
+
+    if (!blr_gtid_index_load(router, index, path))
+    {
+        free(index->entries);
+        free(index);
+        return;
+    }
+
+    MXS_NOTICE("%s: Loaded %d transactions from the GTID index '%s'.",
+               router->service->name, index->count, path);
+    router->gtid_index = index;
+
+    blr_gtid_index_prune(router);
+}
+
+/**
+ * Free the GTID index of the router
+ *
+ * @param router    The router instance
+ */
+void
+blr_gtid_index_free(ROUTER_INSTANCE *router)
+{
+    BLR_GTID_INDEX *index = router->gtid_index;
+
+    if (index)
+    {
+        if (index->fd != -1)
+        {
+            close(index->fd);
+        }
+        free(index->entries);
+        free(index->queue);
+        free(index);
+        router->gtid_index = NULL;
+    }
+}
+
+/**
+ * Queue the transaction that has just ended. It is added to the index once
+ * the binlog file has been written and synced up to its end.
+ *
+ * @param router    The router instance
+ * @param index     The GTID index
+ * @param end       Position after the last event of the transaction
+ */
+static void
+blr_gtid_index_commit(ROUTER_INSTANCE *router, BLR_GTID_INDEX *index, unsigned long end)
+{
+    BLR_GTID_ENTRY entry = index->pending;
+
+    entry.end = end;
+    index->state = BLR_GTID_NONE;
+
+    if (index->queued == index->queue_size)
+    {
+        int size = index->queue_size ? index->queue_size * 2 : BLR_GTID_INDEX_INITIAL;
+        BLR_GTID_ENTRY *queue = realloc(index->queue, size * sizeof(BLR_GTID_ENTRY));
+
+        if (queue == NULL)
+        {
+            MXS_ERROR("%s: Failed to allocate memory for GTID %u-%u-%lu in the GTID index.",
+                      router->service->name, entry.domain, entry.server_id,
+                      (unsigned long)entry.seq);
+            return;
+        }
+
+        index->queue = queue;
+        index->queue_size = size;
+    }
+
+    index->queue[index->queued++] = entry;
+}
+
+/**
+ * Check whether a queued transaction ends before a position of the current
+ * binlog file. The transactions of older binlog files always do.
+ *
+ * @param router    The router instance
+ * @param entry     The queued transaction
+ * @param pos       Position in the current binlog file
+ * @return True if the transaction ends at or before @c pos
+ */
+static bool
+blr_gtid_index_before(ROUTER_INSTANCE *router, const BLR_GTID_ENTRY *entry, unsigned long pos)
+{
+    char *suffix = strrchr(router->binlog_name, '.');
+    uint32_t current = suffix ? atoi(suffix + 1) : 0;
+
+    return entry->file < current || entry->end <= pos;
+}
+
+/**
+ * Remove the queued transactions that are both in the entries and in the
+ * index file
+ *
+ * @param index     The GTID index
+ */
+static void
+blr_gtid_index_trim(BLR_GTID_INDEX *index)
+{
+    int done = index->visible < index->saved ? index->visible : index->saved;
+
+    if (done > 0)
+    {
+        memmove(index->queue, index->queue + done,
+                (index->queued - done) * sizeof(BLR_GTID_ENTRY));
+        index->queued -= done;
+        index->visible -= done;
+        index->saved -= done;
+    }
+}
+
+/**
+ * Add the queued transactions that the slaves can now read to the index.
+ * Called when the binlog position visible to the slaves advances.
+ *
+ * @param router    The router instance
+ * @param pos       The binlog position visible to the slaves
+ */
+void
+blr_gtid_index_visible(ROUTER_INSTANCE *router, unsigned long pos)
+{
+    BLR_GTID_INDEX *index = router->gtid_index;
+
+    if (index == NULL || index->visible == index->queued)
+    {
+        return;
+    }
+
+    spinlock_acquire(&index->lock);
+    while (index->visible < index->queued &&
+           blr_gtid_index_before(router, &index->queue[index->visible], pos))
+    {
+        BLR_GTID_ENTRY *entry = &index->queue[index->visible++];
+
+        if (!blr_gtid_insert(index, entry))
+        {
+            MXS_ERROR("%s: Failed to allocate memory for GTID %u-%u-%lu in the GTID index.",
+                      router->service->name, entry->domain, entry->server_id,
+                      (unsigned long)entry->seq);
+        }
+    }
+    spinlock_release(&index->lock);
+
+    blr_gtid_index_trim(index);
+}
+
+/**
+ * Append the queued transactions that have been synced to disk to the index
+ * file. Called after the binlog file has been synced.
+ *
+ * @param router    The router instance
+ * @param pos       The position up to which the binlog file is synced
+ */
+void
+blr_gtid_index_synced(ROUTER_INSTANCE *router, unsigned long pos)
+{
+    BLR_GTID_INDEX *index = router->gtid_index;
+    int n = 0;
+
+    if (index == NULL)
+    {
+        return;
+    }
+
+    while (index->saved + n < index->queued &&
+           blr_gtid_index_before(router, &index->queue[index->saved + n], pos))
+    {
+        n++;
+    }
+
+    if (n > 0)
+    {
+        ssize_t len = n * sizeof(BLR_GTID_ENTRY);
+
+        if (write(index->fd, index->queue + index->saved, len) != len)
+        {
+            char err_msg[STRERROR_BUFLEN];
+            MXS_ERROR("%s: Failed to write %d transactions to the GTID index file, %s.",
+                      router->service->name, n,
+                      strerror_r(errno, err_msg, sizeof(err_msg)));
+        }
+
+        index->saved += n;
+        blr_gtid_index_trim(index);
+    }
+}
+
+/**
+ * Drop the queued transactions that were removed from the current binlog
+ * file when it was truncated after a failed write
+ *
+ * @param router    The router instance
+ * @param pos       The new end of the current binlog file
+ */
+void
+blr_gtid_index_truncate(ROUTER_INSTANCE *router, unsigned long pos)
+{
+    BLR_GTID_INDEX *index = router->gtid_index;
+
+    if (index == NULL)
+    {
+        return;
+    }
+
+    /** The transaction being written lost some of its events */
+    index->state = BLR_GTID_NONE;
+
+    while (index->queued > index->visible && index->queued > index->saved &&
+           !blr_gtid_index_before(router, &index->queue[index->queued - 1], pos))
+    {
+        index->queued--;
+    }
+}
+
+/**
+ * Update the index with an event that was written to the current binlog file.
+ *
+ * A transaction starts with a GTID event and ends with a XID event or a
+ * COMMIT statement. Statements that are not transactional are followed
+ * by only one event.
+ *
+ * An event that does not fit in one packet is passed to this function once
+ * with the data of its first packet.
+ *
+ * @param router    The router instance
+ * @param hdr       The header of the event
+ * @param pos       The position of the event in the binlog file
+ * @param buf       The start of the event
+ * @param len       Length of @c buf, at most hdr->event_size bytes
+ */
+void
+blr_gtid_index_event(ROUTER_INSTANCE *router, REP_HEADER *hdr, unsigned long pos,
+                     uint8_t *buf, uint32_t len)
+{
+    BLR_GTID_INDEX *index = router->gtid_index;
+    unsigned long end = pos + hdr->event_size;
+
+    if (index == NULL)
+    {
+        return;
+    }
+
+    switch (hdr->event_type)
+    {
+    case MARIADB10_GTID_EVENT:
+        if (len >= BINLOG_EVENT_HDR_LEN + 8 + 4 + 1)
+        {
+            char *suffix = strrchr(router->binlog_name, '.');
+            uint8_t flags = buf[BINLOG_EVENT_HDR_LEN + 8 + 4];
+
+            index->pending.seq = extract_field(buf + BINLOG_EVENT_HDR_LEN, 32) |
+                                 (uint64_t)extract_field(buf + BINLOG_EVENT_HDR_LEN + 4, 32) << 32;
+            index->pending.domain = extract_field(buf + BINLOG_EVENT_HDR_LEN + 8, 32);
+            index->pending.server_id = hdr->serverid;
+            index->pending.file = suffix ? atoi(suffix + 1) : 0;
+            index->pending.start = pos;
+            index->state = (flags & (MARIADB_FL_DDL | MARIADB_FL_STANDALONE)) ?
+                           BLR_GTID_STANDALONE : BLR_GTID_TRX;
+        }
+        break;
+
+    case ROTATE_EVENT:
+        index->state = BLR_GTID_NONE;
+        blr_gtid_index_prune(router);
+        break;
+
+    case XID_EVENT:
+        if (index->state != BLR_GTID_NONE)
+        {
+            blr_gtid_index_commit(router, index, end);
+        }
+        break;
+
+    case QUERY_EVENT:
+        if (index->state == BLR_GTID_STANDALONE)
+        {
+            blr_gtid_index_commit(router, index, end);
+        }
+        else if (index->state == BLR_GTID_TRX && len >= BINLOG_EVENT_HDR_LEN + 4 + 4 + 1 + 2 + 2)
+        {
+            /* Skip thread id, execution time, database length and error code */
+            uint8_t *ptr = buf + BINLOG_EVENT_HDR_LEN + 4 + 4;
+            int db_name_len = ptr[0];
+            int var_block_len = extract_field(ptr + 1 + 2, 16);
+            unsigned long offset = BINLOG_EVENT_HDR_LEN + 4 + 4 + 1 + 2 + 2 +
+                                   var_block_len + db_name_len + 1;
+
+            /* COMMIT in non transactional storage engines */
+            if (offset + 6 <= len && strncmp((char *)buf + offset, "COMMIT", 6) == 0)
+            {
+                blr_gtid_index_commit(router, index, end);
+            }
+        }
+        break;
+
+    default:
+        if (index->state == BLR_GTID_STANDALONE)
+        {
+            blr_gtid_index_commit(router, index, end);
+        }
+        break;
+    }
+}
+
+/**
+ * Find the position where a slave continues replication after a transaction
+ *
+ * @param router    The router instance
+ * @param domain    Domain of the GTID
+ * @param server_id Server id of the GTID
+ * @param seq       Sequence number of the GTID
+ * @param binlog    The name of the binlog file is stored here,
+ *                  BINLOG_FNAMELEN + 1 bytes
+ * @param pos       The position in the binlog file is stored here
+ * @return True if the GTID was found
+ */
+bool
+blr_gtid_index_find(ROUTER_INSTANCE *router, uint32_t domain, uint32_t server_id,
+                    uint64_t seq, char *binlog, uint32_t *pos)
+{
+    BLR_GTID_INDEX *index = router->gtid_index;
+    BLR_GTID_ENTRY key = {.domain = domain, .server_id = server_id, .seq = seq};
+    bool rval = false;
+
+    if (index == NULL)
+    {
+        return false;
+    }
+
+    spinlock_acquire(&index->lock);
+    int i = blr_gtid_lower_bound(index, &key);
+
+    if (i < index->count && blr_gtid_cmp(&index->entries[i], &key) == 0)
+    {
+        snprintf(binlog, BINLOG_FNAMELEN + 1, BINLOG_NAMEFMT, router->fileroot,
+                 (int)index->entries[i].file);
+        *pos = index->entries[i].end;
+        rval = true;
+    }
+    spinlock_release(&index->lock);
+
+    return rval;
+}
+
+/**
+ * Find the oldest binlog file that has transactions in the index
+ *
+ * @param router    The router instance
+ * @param binlog    The name of the binlog file is stored here,
+ *                  BINLOG_FNAMELEN + 1 bytes
+ * @return True if the index has transactions
+ */
+bool
+blr_gtid_index_first_file(ROUTER_INSTANCE *router, char *binlog)
+{
+    BLR_GTID_INDEX *index = router->gtid_index;
+    uint32_t file = 0;
+    bool rval = false;
+
+    if (index == NULL)
+    {
+        return false;
+    }
+
+    spinlock_acquire(&index->lock);
+    for (int i = 0; i < index->count; i++)
+    {
+        if (!rval || index->entries[i].file < file)
+        {
+            file = index->entries[i].file;
+            rval = true;
+        }
+    }
+    spinlock_release(&index->lock);
+
+    if (rval)
+    {
+        snprintf(binlog, BINLOG_FNAMELEN + 1, BINLOG_NAMEFMT, router->fileroot, (int)file);
+    }
+
+    return rval;
+}
+
+/**
+ * Get the domain of the latest GTID written to the binlog
+ *
+ * @param router    The router instance
+ * @return The domain or 0 if no GTIDs have been seen
+ */
+uint32_t
+blr_gtid_index_domain(ROUTER_INSTANCE *router)
+{
+    return router->gtid_index ? router->gtid_index->pending.domain : 0;
+}
+
+/**
+ * Get the number of transactions in the index
+ *
+ * @param router    The router instance
+ * @return The number of transactions
+ */
+int
+blr_gtid_index_count(ROUTER_INSTANCE *router)
+{
+    return router->gtid_index ? router->gtid_index->count : 0;
+}
@@ -63,6 +63,7 @@
 #include <spinlock.h>
 #include <housekeeper.h>
 #include <buffer.h>
+#include <mxs_crc32.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -84,8 +85,6 @@ static GWBUF *blr_make_binlog_dump(ROUTER_INSTANCE *router);
 void encode_value(unsigned char *data, unsigned int value, int len);
 void blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt);
 static int  blr_rotate_event(ROUTER_INSTANCE *router, uint8_t *pkt, REP_HEADER *hdr);
-void blr_distribute_binlog_record(ROUTER_INSTANCE *router, REP_HEADER *hdr, uint8_t *ptr,
-                                  blr_thread_role_t role);
 static void *CreateMySQLAuthData(char *username, char *password, char *database);
 void blr_extract_header(uint8_t *pkt, REP_HEADER *hdr);
 static void blr_log_packet(int priority, char *msg, uint8_t *ptr, int len);
@@ -1057,7 +1056,7 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
                     }
 
                     /** Prepare the checksum variables for this event */
-                    router->stored_checksum = crc32(0L, NULL, 0);
+                    router->stored_checksum = 0;
                     router->checksum_size = hdr.event_size - MYSQL_CHECKSUM_LEN;
                     router->partial_checksum_bytes = 0;
                 }
@@ -1129,7 +1128,7 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
                     {
                         uint32_t size = (len - extra_bytes) < router->checksum_size ?
                             len - extra_bytes : router->checksum_size;
-                        router->stored_checksum = crc32(router->stored_checksum,
+                        router->stored_checksum = mxs_crc32(router->stored_checksum,
                                                         ptr + offset,
                                                         size);
                         router->checksum_size -= size;
@@ -1179,7 +1178,7 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
 
                 if (router->checksum_size > 0)
                 {
-                    router->stored_checksum = crc32(router->stored_checksum,
+                    router->stored_checksum = mxs_crc32(router->stored_checksum,
                                                     ptr + offset,
                                                     size);
                     router->checksum_size -= size;
@@ -1232,8 +1231,7 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
                 if (router->trx_safe == 0 || (router->trx_safe && router->pending_transaction == 0))
                 {
                     /* no pending transaction: set current_pos to binlog_position */
-                    router->binlog_position = router->current_pos;
-                    router->current_safe_event = router->current_pos;
+                    blr_file_commit(router, router->current_pos, router->current_pos);
                 }
                 spinlock_release(&router->binlog_lock);
 
@@ -1485,36 +1483,16 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
 
                         if (router->trx_safe == 0 || (router->trx_safe && router->pending_transaction == 0))
                         {
-                            router->binlog_position = router->current_pos;
-                            router->current_safe_event = router->last_event_pos;
+                            bool committed = blr_file_commit(router, router->current_pos,
+                                                             router->last_event_pos);
 
                             spinlock_release(&router->binlog_lock);
 
-                            if (router->master_event_state == BLR_EVENT_COMPLETE)
+                            /* The slaves read the new event themselves */
+                            if (committed)
                             {
-                                /** Read the complete event from the disk */
-                                GWBUF *record = blr_read_events_from_pos(router,
-                                                                         router->last_event_pos,
-                                                                         &hdr, hdr.next_pos);
-                                if (record)
-                                {
-                                    uint8_t *data = GWBUF_DATA(record);
-                                    blr_distribute_binlog_record(router, &hdr, data,
-                                                                 BLR_THREAD_ROLE_MASTER_LARGE_NOTRX);
-                                    gwbuf_free(record);
-                                }
-                                else
-                                {
-                                    MXS_ERROR("Failed to read event at position"
-                                              "%lu with a size of %u bytes.",
-                                              router->last_event_pos, hdr.event_size);
-                                }
-                            }
-                            else
-                            {
-                                /* Now distribute events */
-                                blr_distribute_binlog_record(router, &hdr, ptr,
-                                                             BLR_THREAD_ROLE_MASTER_NOTRX);
+                                blr_notify_slaves(router);
+                                blr_index_checkpoint(router);
                             }
                         }
                         else
@@ -1525,10 +1503,12 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
                              * 1) read current binlog starting
                              *  from router->binlog_position
                              *
-                             * 2) distribute read event
+                             * 2) check the events and advance
+                             *    router->current_safe_event
                              *
                              * 3) set router->binlog_position to
-                             *    router->current_pos
+                             *    router->current_pos and wake up
+                             *    the slaves
                              *
                              */
 
@@ -1537,12 +1517,25 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
                                 unsigned long long pos;
                                 unsigned long long end_pos;
                                 GWBUF *record;
-                                uint8_t *raw_data;
                                 REP_HEADER new_hdr;
 
+                                spinlock_release(&router->binlog_lock);
+
+                                /* The events are read back from the binlog file */
+                                if (!blr_file_flush(router))
+                                {
+                                    while ((pkt = gwbuf_consume(pkt, GWBUF_LENGTH(pkt))) != NULL)
+                                    {
+                                        ;
+                                    }
+                                    blr_master_close(router);
+                                    blr_master_delayed_connect(router);
+                                    return;
+                                }
+
+                                spinlock_acquire(&router->binlog_lock);
                                 pos = router->binlog_position;
                                 end_pos = router->current_pos;
-
                                 spinlock_release(&router->binlog_lock);
 
                                 while ((record = blr_read_events_from_pos(router,
@@ -1550,16 +1543,10 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
                                                                           &new_hdr,
                                                                           end_pos)) != NULL)
                                 {
-                                    raw_data = GWBUF_DATA(record);
-
-                                    /* distribute event */
-                                    blr_distribute_binlog_record(router, &new_hdr, raw_data,
-                                                                 BLR_THREAD_ROLE_MASTER_TRX);
-
                                     spinlock_acquire(&router->binlog_lock);
 
                                     /** The current safe position is only updated
-                                    * if it points to the event we just distributed. */
+                                    * if it points to the event we just read. */
                                     if (router->current_safe_event == pos)
                                     {
                                         router->current_safe_event = new_hdr.next_pos;
@@ -1568,7 +1555,7 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
                                     {
                                         MXS_ERROR("Current safe event (%lu) does"
                                                   " not point at the event we "
-                                                  "just sent (%llu) from binlog file %s. "
+                                                  "just read (%llu) from binlog file %s. "
                                                   "Last commit at %lu, last write at %lu.",
                                                   router->current_safe_event, pos,
                                                   router->binlog_name, router->last_safe_pos,
@@ -1624,10 +1611,18 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
                                 /* update binlog_position and set pending to 0 */
                                 spinlock_acquire(&router->binlog_lock);
 
-                                router->binlog_position = router->current_pos;
+                                bool committed = blr_file_commit(router, router->current_pos,
+                                                                 router->current_safe_event);
                                 router->pending_transaction = 0;
 
                                 spinlock_release(&router->binlog_lock);
+
+                                /* The slaves read the committed transaction themselves */
+                                if (committed)
+                                {
+                                    blr_notify_slaves(router);
+                                    blr_index_checkpoint(router);
+                                }
                             }
                             else
                             {
@@ -1716,7 +1711,13 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
     {
         ss_dassert(pkt_length == 0);
     }
-    blr_file_flush(router);
+
+    /* All the events received in one read are written and synced together */
+    if (!blr_file_flush(router))
+    {
+        blr_master_close(router);
+        blr_master_delayed_connect(router);
+    }
 }
 
 /**
@@ -1827,260 +1828,97 @@ CreateMySQLAuthData(char *username, char *password, char *database)
     return auth_info;
 }
 
-/** Actions that can be taken when an event is being distributed to the slaves*/
-typedef enum
-{
-    SLAVE_SEND_EVENT, /*< Send the event to the slave */
-    SLAVE_FORCE_CATCHUP, /*< Force the slave into catchup mode */
-    SLAVE_EVENT_ALREADY_SENT /*< The slave already has the event, don't send it */
-} slave_event_action_t;
-
 /**
- * Distribute the binlog record we have just received to all the registered slaves.
+ * Wake up the slaves after new events have become available in the binlog.
+ *
+ * The master thread does not send the events itself. An idle slave is
+ * woken up with a fake write event and its own thread reads the new events
+ * from the binlog cache or the binlog file in blr_slave_catchup. A slave that
+ * is busy sending events checks the binlog position before it goes idle and
+ * picks up the new events on its own. A slow slave can therefore never
+ * delay the master or the other slaves.
+ *
+ * Only the slaves that went idle at the previous binlog position are in the
+ * list of waiting slaves, so the work done here does not grow with the number
+ * of slaves that are busy catching up.
  *
  * @param   router      The router instance
- * @param   hdr     The replication event header
- * @param   ptr     The raw replication event data
  */
 void
-blr_distribute_binlog_record(ROUTER_INSTANCE *router, REP_HEADER *hdr, uint8_t *ptr,
-                             blr_thread_role_t role)
+blr_notify_slaves(ROUTER_INSTANCE *router)
 {
     ROUTER_SLAVE *slave;
-    int action;
-    unsigned int cstate;
 
+    if (router->waiters == NULL)
+    {
+        return;
+    }
+
+    /* The router lock keeps the slaves from being freed */
     spinlock_acquire(&router->lock);
-    slave = router->slaves;
+    spinlock_acquire(&router->waiters_lock);
+    slave = router->waiters;
+    router->waiters = NULL;
+    spinlock_release(&router->waiters_lock);
+
     while (slave)
     {
+        ROUTER_SLAVE *next;
+        bool wakeup = false;
+
+        /* Once the flag is cleared the slave may wait again */
+        spinlock_acquire(&router->waiters_lock);
+        next = slave->next_waiter;
+        slave->next_waiter = NULL;
+        slave->waiting = false;
+        spinlock_release(&router->waiters_lock);
+
         if (slave->state != BLRS_DUMPING)
         {
-            slave = slave->next;
+            slave = next;
             continue;
         }
+
         spinlock_acquire(&slave->catch_lock);
-        if ((slave->cstate & (CS_UPTODATE | CS_BUSY)) == CS_UPTODATE)
-        {
-            /*
-             * This slave is reporting it is to date with the binlog of the
-             * master running on this slave.
-             * It has no thread running currently that is sending binlog
-             * events.
-             */
-            action = 1;
-            slave->cstate |= CS_BUSY;
-        }
-        else if ((slave->cstate & (CS_UPTODATE | CS_BUSY)) == (CS_UPTODATE | CS_BUSY))
+        if (slave->cstate & CS_BUSY)
         {
-            /*
-             * The slave is up to date with the binlog and a process is
-             * running on this slave to send binlog events.
-             */
-            slave->overrun = 1;
-            action = 2;
+            /* A thread is sending events to the slave */
+            slave->stats.n_actions[1]++;
         }
-        else if ((slave->cstate & CS_UPTODATE) == 0)
+        else if (slave->cstate & CS_EXPECTCB)
         {
-            /* Slave is in catchup mode */
-            action = 3;
+            /* The slave has already been woken up */
+            slave->stats.n_actions[2]++;
         }
         else
         {
-            MXS_ERROR("slave->cstate does not contain a meaningful state %d", slave->cstate);
-            action = 0;
-        }
-        slave->stats.n_actions[action - 1]++;
-        spinlock_release(&slave->catch_lock);
-
-        if (action == 1)
-        {
-            spinlock_acquire(&router->binlog_lock);
-
-            slave_event_action_t slave_action = SLAVE_FORCE_CATCHUP;
-            const bool same_file = strcmp(slave->binlogfile, router->binlog_name) == 0;
-            const bool rotate = hdr->event_type == ROTATE_EVENT &&
-                strcmp(slave->binlogfile, router->prevbinlog) == 0;
-
-            if (router->trx_safe && (same_file || rotate) &&
-                slave->binlog_pos == router->current_safe_event)
-            {
-                /** Slave needs the current event being distributed */
-                slave_action = SLAVE_SEND_EVENT;
-            }
-            else if (!router->trx_safe && (same_file || rotate) &&
-                     slave->binlog_pos == router->last_event_pos)
-            {
-                /** Transaction safety is off */
-                slave_action = SLAVE_SEND_EVENT;
-            }
-            else if (same_file)
-            {
-                if (slave->binlog_pos == hdr->next_pos)
-                {
-                    /*
-                     * Slave has already read record from file, no
-                     * need to distrbute this event
-                     */
-                    slave_action = SLAVE_EVENT_ALREADY_SENT;
-                }
-                else if ((slave->binlog_pos > hdr->next_pos - hdr->event_size))
-                {
-                    /*
-                     * The slave is ahead of the master, this should never
-                     * happen. Force the slave to catchup mode in order to
-                     * try to resolve the issue.
-                     */
-                    MXS_ERROR("Slave %s:%d server ID %d is ahead of expected position %s@%u. "
-                              "Expected position %d", slave->dcb->remote,
-                              ntohs((slave->dcb->ipv4).sin_port), slave->serverid,
-                              slave->binlogfile, slave->binlog_pos,
-                              hdr->next_pos - hdr->event_size);
-                }
-                /* If none of the above conditions were met, a slave in catchup
-                 * mode transitioned into up-to-date mode while we were
-                 * distributing events. The slave needs to be forced into
-                 * catchup mode since it isn't up to date anymore. */
-            }
-            else if (rotate)
+            /* The slave is idle, either up to date or waiting for events */
+            if (slave->cstate & CS_UPTODATE)
             {
-                /** Slave is more than one binlog file behind */
-                MXS_WARNING("Slave %s:%d server ID %d is behind more than one binlog file "
-                          "from the master. Slave is using '%s' with position %d "
-                          "when master binlog file is '%s'.", slave->dcb->remote,
-                          ntohs((slave->dcb->ipv4).sin_port), slave->serverid,
-                          slave->binlogfile, slave->binlog_pos, router->binlog_name);
-            }
-            else
-            {
-                /** Slave is lagging behind */
-                MXS_WARNING("Slave %s:%d server ID %d is using binlog file '%s' with "
-                          "position %d. Master binlog file is '%s' at position %lu "
-                          "with last safe event at %lu.", slave->dcb->remote,
-                          ntohs((slave->dcb->ipv4).sin_port), slave->serverid,
-                          slave->binlogfile, slave->binlog_pos, router->binlog_name,
-                          router->current_pos, router->current_safe_event);
-            }
-
-            spinlock_release(&router->binlog_lock);
-
-            /*
-             * If slave_action is SLAVE_FORCE_CATCHUP then
-             * the slave is not at the position it should be. Force it into
-             * catchup mode rather than send this event.
-             */
-
-            switch (slave_action)
-            {
-                char binlog_name[BINLOG_FNAMELEN + 1];
-                uint32_t binlog_pos;
-
-            case SLAVE_SEND_EVENT:
-                /*
-                 * The slave should be up to date, check that the binlog
-                 * position matches the event we have to distribute or
-                 * this is a rotate event. Send the event directly from
-                 * memory to the slave.
-                 */
-                slave->lastEventTimestamp = hdr->timestamp;
-                slave->lastEventReceived = hdr->event_type;
-
-                /* set lastReply */
-                if (router->send_slave_heartbeat)
-                {
-                    slave->lastReply = time(0);
-                }
-
-                strcpy(binlog_name, slave->binlogfile);
-                binlog_pos = slave->binlog_pos;
-
-                if (hdr->event_type == ROTATE_EVENT)
-                {
-                    blr_slave_rotate(router, slave, ptr);
-                }
-
-                if (blr_send_event(role, binlog_name, binlog_pos, slave, hdr, ptr))
-                {
-                    spinlock_acquire(&slave->catch_lock);
-                    if (hdr->event_type != ROTATE_EVENT)
-                    {
-                        slave->binlog_pos = hdr->next_pos;
-                    }
-                    if (slave->overrun)
-                    {
-                        slave->stats.n_overrun++;
-                        slave->overrun = 0;
-                        poll_fake_write_event(slave->dcb);
-                    }
-                    else
-                    {
-                        slave->cstate &= ~CS_BUSY;
-                    }
-                    spinlock_release(&slave->catch_lock);
-                }
-                else
-                {
-                    MXS_WARNING("Slave %s:%i, server-id %d, binlog '%s, position %u: "
-                                "Master-thread could not send event to slave, closing connection.",
-                                slave->dcb->remote,
-                                ntohs((slave->dcb->ipv4).sin_port),
-                                slave->serverid,
-                                binlog_name,
-                                binlog_pos);
-                    slave->state = BLRS_ERRORED;
-                    dcb_close(slave->dcb);
-                }
-                break;
-
-            case SLAVE_EVENT_ALREADY_SENT:
-                spinlock_acquire(&slave->catch_lock);
-                slave->cstate &= ~CS_BUSY;
-                spinlock_release(&slave->catch_lock);
-                break;
-
-            case SLAVE_FORCE_CATCHUP:
-                spinlock_acquire(&slave->catch_lock);
-                cstate = slave->cstate;
-                slave->cstate &= ~(CS_UPTODATE | CS_BUSY);
-                slave->cstate |= CS_EXPECTCB;
-                spinlock_release(&slave->catch_lock);
-                if ((cstate & CS_UPTODATE) == CS_UPTODATE)
-                {
 #ifdef STATE_CHANGE_LOGGING_ENABLED
-                    MXS_NOTICE("%s: Slave %s:%d, server-id %d transition from "
-                               "up-to-date to catch-up in blr_distribute_binlog_record, "
-                               "binlog file '%s', position %lu.",
-                               router->service->name,
-                               slave->dcb->remote,
-                               ntohs((slave->dcb->ipv4).sin_port),
-                               slave->serverid,
-                               slave->binlogfile, (unsigned long)slave->binlog_pos);
+                MXS_NOTICE("%s: Slave %s:%d, server-id %d transition from "
+                           "up-to-date to catch-up in blr_notify_slaves, "
+                           "binlog file '%s', position %lu.",
+                           router->service->name,
+                           slave->dcb->remote,
+                           ntohs((slave->dcb->ipv4).sin_port),
+                           slave->serverid,
+                           slave->binlogfile, (unsigned long)slave->binlog_pos);
 #endif
-                }
-                poll_fake_write_event(slave->dcb);
-                break;
             }
+            slave->cstate &= ~CS_UPTODATE;
+            slave->cstate |= CS_EXPECTCB;
+            slave->stats.n_actions[0]++;
+            wakeup = true;
         }
-        else if (action == 3)
+        spinlock_release(&slave->catch_lock);
+
+        if (wakeup)
         {
-            /* Slave is not up to date
-             * Check if it is either expecting a callback or
-             * is busy processing a callback
-             */
-            spinlock_acquire(&slave->catch_lock);
-            if ((slave->cstate & (CS_EXPECTCB | CS_BUSY)) == 0)
-            {
-                slave->cstate |= CS_EXPECTCB;
-                spinlock_release(&slave->catch_lock);
-                poll_fake_write_event(slave->dcb);
-            }
-            else
-            {
-                spinlock_release(&slave->catch_lock);
-            }
+            poll_fake_write_event(slave->dcb);
         }
 
-        slave = slave->next;
+        slave = next;
     }
     spinlock_release(&router->lock);
 }
@@ -2596,6 +2434,12 @@ blr_write_data_into_binlog(ROUTER_INSTANCE *router, uint32_t data_len, uint8_t *
 {
     int n;
 
+    /* The buffered events precede this data in the binlog file */
+    if (!blr_file_write_buffer(router))
+    {
+        return 0;
+    }
+
     if ((n = pwrite(router->binlog_fd, buf, data_len,
                     router->last_written)) != data_len)
     {
@@ -2614,9 +2458,12 @@ blr_write_data_into_binlog(ROUTER_INSTANCE *router, uint32_t data_len, uint8_t *
                       router->binlog_name,
                       strerror_r(errno, err_msg, sizeof(err_msg)));
         }
+        router->binlog_index.pos = 0;
         return 0;
     }
     router->last_written += data_len;
+    router->unsynced_bytes += data_len;
+    router->stats.n_binlog_writes++;
     return n;
 }
 
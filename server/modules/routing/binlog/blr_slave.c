@@ -78,11 +78,13 @@
 #include <spinlock.h>
 #include <housekeeper.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <skygw_types.h>
 #include <skygw_utils.h>
 #include <log_manager.h>
 #include <version.h>
-#include <zlib.h>
+#include <mxs_crc32.h>
+#include <statistics.h>
 
 static char* get_next_token(char *str, const char* delim, char **saveptr);
 extern int load_mysql_users(SERVICE *service);
@@ -103,6 +105,9 @@ int blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large);
 uint8_t *blr_build_header(GWBUF *pkt, REP_HEADER *hdr);
 int blr_slave_callback(DCB *dcb, DCB_REASON reason, void *data);
 static int blr_slave_fake_rotate(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, BLFILE** filep);
+static int blr_slave_send_mapped(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, BLFILE *file,
+                                 int *burst, long *burst_size);
+static bool blr_slave_gtid_position(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, char *errmsg);
 static void blr_slave_send_fde(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave);
 static int blr_slave_send_maxscale_version(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave);
 static int blr_slave_send_server_id(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave);
@@ -409,6 +414,15 @@ blr_slave_query(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, GWBUF *queue)
             free(query_text);
             return blr_slave_replay(router, slave, router->saved_master.gtid_mode);
         }
+        else if (strcasecmp(word, "@@GLOBAL.gtid_domain_id") == 0)
+        {
+            char domain[40];
+
+            free(query_text);
+            snprintf(domain, sizeof(domain), "%u", blr_gtid_index_domain(router));
+            return blr_slave_send_var_value(router, slave, "@@GLOBAL.gtid_domain_id",
+                                            domain, BLR_TYPE_INT);
+        }
         else if (strcasecmp(word, "1") == 0)
         {
             free(query_text);
@@ -750,6 +764,31 @@ blr_slave_query(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, GWBUF *queue)
                 return blr_slave_send_ok(router, slave);
             }
         }
+        else if (strcasecmp(word, "@slave_connect_state") == 0)
+        {
+            /* The GTID state is a quoted list that can contain separators */
+            char *start = strchr(brkb, '\'');
+            char *end = start ? strchr(start + 1, '\'') : NULL;
+
+            if (end == NULL)
+            {
+                free(query_text);
+                blr_slave_send_error(router, slave, "Malformed @slave_connect_state");
+                return 1;
+            }
+
+            free(slave->connect_state);
+            slave->connect_state = strndup(start + 1, end - start - 1);
+
+            free(query_text);
+            return blr_slave_send_ok(router, slave);
+        }
+        else if (strcasecmp(word, "@slave_gtid_strict_mode") == 0 ||
+                 strcasecmp(word, "@slave_gtid_ignore_duplicates") == 0)
+        {
+            free(query_text);
+            return blr_slave_send_ok(router, slave);
+        }
         else if (strcasecmp(word, "@master_binlog_checksum") == 0)
         {
             word = strtok_r(NULL, sep, &brkb);
@@ -1964,6 +2003,38 @@ blr_slave_binlog_dump(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, GWBUF *queue
     strncpy(slave->binlogfile, (char *)ptr, binlognamelen);
     slave->binlogfile[binlognamelen] = 0;
 
+    /* A MariaDB 10 slave that uses GTIDs starts after its last transaction */
+    if (slave->connect_state)
+    {
+        char errmsg[BINLOG_ERROR_MSG_LEN + 1];
+
+        if (!blr_slave_gtid_position(router, slave, errmsg))
+        {
+            MXS_ERROR("%s: Slave %s:%i, server-id %d, blr_slave_binlog_dump failure: %s",
+                      router->service->name,
+                      slave->dcb->remote,
+                      ntohs((slave->dcb->ipv4).sin_port),
+                      slave->serverid,
+                      errmsg);
+
+            blr_send_custom_error(slave->dcb, 1, 0, errmsg, "HY000", 1236);
+            dcb_close(slave->dcb);
+            return 1;
+        }
+
+        binlognamelen = strlen(slave->binlogfile);
+
+        MXS_NOTICE("%s: Slave %s:%i, server-id %d, GTID state '%s' starts from "
+                   "binlog file %s at position %lu",
+                   router->service->name,
+                   slave->dcb->remote,
+                   ntohs((slave->dcb->ipv4).sin_port),
+                   slave->serverid,
+                   slave->connect_state,
+                   slave->binlogfile,
+                   (unsigned long)slave->binlog_pos);
+    }
+
     if (router->trx_safe)
     {
         /**
@@ -2049,8 +2120,7 @@ blr_slave_binlog_dump(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, GWBUF *queue
          * include the length, sequence number and ok byte that makes up the first
          * 5 bytes of the message. We also do not include the 4 byte checksum itself.
          */
-        chksum = crc32(0L, NULL, 0);
-        chksum = crc32(chksum, GWBUF_DATA(resp) + 5, hdr.event_size - 4);
+        chksum = mxs_crc32(0, GWBUF_DATA(resp) + 5, hdr.event_size - 4);
         encode_value(ptr, chksum, 32);
     }
 
@@ -2088,8 +2158,17 @@ blr_slave_binlog_dump(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, GWBUF *queue
                slave->serverid,
                slave->binlogfile, (unsigned long)slave->binlog_pos);
 
-    if (slave->binlog_pos != router->binlog_position ||
-        strcmp(slave->binlogfile, router->binlog_name) != 0)
+    spinlock_acquire(&router->binlog_lock);
+    bool uptodate = slave->binlog_pos == router->binlog_position &&
+                    strcmp(slave->binlogfile, router->binlog_name) == 0;
+
+    if (uptodate)
+    {
+        blr_slave_wait_events(router, slave);
+    }
+    spinlock_release(&router->binlog_lock);
+
+    if (!uptodate)
     {
         spinlock_acquire(&slave->catch_lock);
         slave->cstate &= ~CS_UPTODATE;
@@ -2100,6 +2179,144 @@ blr_slave_binlog_dump(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, GWBUF *queue
     return rval;
 }
 
+/**
+ * Add a slave to the slaves that blr_notify_slaves wakes up when new events
+ * become available. Must be called with router->binlog_lock held after
+ * checking that the slave has read all of the binlog, so that the slave
+ * can't miss the next notification.
+ *
+ * @param router    The router instance
+ * @param slave     The slave
+ */
+void
+blr_slave_wait_events(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
+{
+    spinlock_acquire(&router->waiters_lock);
+    if (!slave->waiting)
+    {
+        slave->waiting = true;
+        slave->next_waiter = router->waiters;
+        router->waiters = slave;
+    }
+    spinlock_release(&router->waiters_lock);
+}
+
+/**
+ * Remove a slave from the slaves waiting for new events. Must be called with
+ * router->lock held.
+ *
+ * @param router    The router instance
+ * @param slave     The slave
+ */
+void
+blr_slave_stop_waiting(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
+{
+    spinlock_acquire(&router->waiters_lock);
+    if (slave->waiting)
+    {
+        ROUTER_SLAVE **ptr = &router->waiters;
+
+        while (*ptr && *ptr != slave)
+        {
+            ptr = &(*ptr)->next_waiter;
+        }
+
+        if (*ptr)
+        {
+            *ptr = slave->next_waiter;
+        }
+
+        slave->waiting = false;
+        slave->next_waiter = NULL;
+    }
+    spinlock_release(&router->waiters_lock);
+}
+
+/**
+ * Find the binlog file and position of a slave that connected with a GTID
+ * state. The state has one GTID for each replication domain. An empty state
+ * starts from the oldest binlog file in the GTID index.
+ *
+ * The slave is started from one position so the GTIDs of all the domains
+ * must lead to the same position.
+ *
+ * @param   router      The router instance
+ * @param   slave       The slave, the binlog file and position are set
+ * @param   errmsg      The error message, BINLOG_ERROR_MSG_LEN + 1 bytes
+ * @return  True if the position was found
+ */
+static bool
+blr_slave_gtid_position(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, char *errmsg)
+{
+    char binlog[BINLOG_FNAMELEN + 1] = "";
+    char gtid_binlog[BINLOG_FNAMELEN + 1];
+    uint32_t pos = 4;
+    uint32_t gtid_pos;
+    char *state, *gtid, *brkb;
+    bool rval = true;
+    bool found = false;
+
+    if (router->gtid_index == NULL)
+    {
+        snprintf(errmsg, BINLOG_ERROR_MSG_LEN,
+                 "GTID positioning needs the mariadb10-compatibility option");
+        return false;
+    }
+
+    if ((state = strdup(slave->connect_state)) == NULL)
+    {
+        snprintf(errmsg, BINLOG_ERROR_MSG_LEN, "Failed to allocate memory");
+        return false;
+    }
+
+    for (gtid = strtok_r(state, ", ", &brkb); rval && gtid; gtid = strtok_r(NULL, ", ", &brkb))
+    {
+        unsigned int domain, server_id;
+        unsigned long long seq;
+
+        if (sscanf(gtid, "%u-%u-%llu", &domain, &server_id, &seq) != 3)
+        {
+            snprintf(errmsg, BINLOG_ERROR_MSG_LEN, "Invalid GTID '%s' in @slave_connect_state", gtid);
+            rval = false;
+        }
+        else if (!blr_gtid_index_find(router, domain, server_id, seq, gtid_binlog, &gtid_pos))
+        {
+            snprintf(errmsg, BINLOG_ERROR_MSG_LEN, "Connecting slave requested to start from "
+                     "GTID %u-%u-%llu, which is not in the master's binlog", domain, server_id, seq);
+            rval = false;
+        }
+        else if (found && (strcmp(binlog, gtid_binlog) != 0 || pos != gtid_pos))
+        {
+            snprintf(errmsg, BINLOG_ERROR_MSG_LEN, "The replication domains of the GTID state '%s' "
+                     "are at different binlog positions", slave->connect_state);
+            rval = false;
+        }
+        else
+        {
+            strcpy(binlog, gtid_binlog);
+            pos = gtid_pos;
+            found = true;
+        }
+    }
+
+    free(state);
+
+    if (rval && !found && !blr_gtid_index_first_file(router, binlog))
+    {
+        spinlock_acquire(&router->binlog_lock);
+        strcpy(binlog, router->binlog_name);
+        spinlock_release(&router->binlog_lock);
+    }
+
+    if (rval)
+    {
+        strcpy(slave->binlogfile, binlog);
+        slave->binlog_pos = pos;
+    }
+
+    return rval;
+}
+
 /**
  * Encode a value into a number of bits in a MySQL packet
  *
@@ -2152,6 +2369,190 @@ blr_build_header(GWBUF  *pkt, REP_HEADER *hdr)
     return ptr;
 }
 
+/**
+ * Send a run of events to a slave directly from a mapped binlog file.
+ *
+ * Slaves that are far behind read binlog files that are no longer written
+ * to. The events of such a file are sent with one vectored write that
+ * interleaves the MySQL packet headers with the events in the mapped file,
+ * without reading the events into buffers first.
+ *
+ * The run stops at the first event that is not fully mapped, does not fit
+ * into a single packet, fails the sanity checks or is a rotate event. The
+ * remaining events are sent with blr_read_binlog as usual.
+ *
+ * @param   router      The binlog router
+ * @param   slave       The slave that is behind
+ * @param   file        The binlog file the slave reads
+ * @param   burst       The number of events left in the burst, updated
+ * @param   burst_size  The number of bytes left in the burst, updated
+ * @return  The number of events sent, -1 if the write failed or
+ *          BLR_MAPPED_DUPLICATE if the first event was already sent
+ */
+static int
+blr_slave_send_mapped(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, BLFILE *file,
+                      int *burst, long *burst_size)
+{
+    struct iovec iov[BLR_MAPPED_EVENTS * 2];
+    uint8_t headers[BLR_MAPPED_EVENTS][MYSQL_HEADER_LEN + 1];
+    BLFILE_MAP map;
+    unsigned long pos = slave->binlog_pos;
+    unsigned long last_pos = pos;
+    unsigned long bytes = 0;
+    uint8_t *last_event = NULL;
+    int n = 0;
+
+    if (*burst <= 0 || *burst_size <= 0 ||
+        !blr_map_binlog(router, file, pos, *burst_size, &map))
+    {
+        return 0;
+    }
+
+    while (n < BLR_MAPPED_EVENTS && n < *burst && (long)bytes < *burst_size &&
+           pos + BINLOG_EVENT_HDR_LEN <= map.end)
+    {
+        uint8_t *event = (uint8_t*)map.base + (pos - map.start);
+        uint8_t event_type = event[4];
+        uint32_t event_size = extract_field(&event[9], 32);
+        uint32_t next_pos = EXTRACT32(&event[13]);
+
+        if (event_type == ROTATE_EVENT ||
+            event_type > (router->mariadb10_compat ? MAX_EVENT_TYPE_MARIADB10 : MAX_EVENT_TYPE) ||
+            event_size < BINLOG_EVENT_HDR_LEN || pos + event_size > map.end ||
+            next_pos != pos + event_size || event_size + 1 >= MYSQL_PACKET_LENGTH_MAX)
+        {
+            break;
+        }
+
+        encode_value(headers[n], event_size + 1, 24);
+        headers[n][3] = slave->seqno + n;
+        headers[n][4] = 0; // OK byte
+
+        iov[n * 2].iov_base = headers[n];
+        iov[n * 2].iov_len = MYSQL_HEADER_LEN + 1;
+        iov[n * 2 + 1].iov_base = event;
+        iov[n * 2 + 1].iov_len = event_size;
+
+        bytes += event_size;
+        last_event = event;
+        last_pos = pos;
+        pos = next_pos;
+        n++;
+    }
+
+    if (n > 0)
+    {
+        if (strcmp(slave->lsi_binlog_name, slave->binlogfile) == 0 &&
+            slave->lsi_binlog_pos == slave->binlog_pos)
+        {
+            MXS_ERROR("Slave %s:%i, server-id %d, binlog '%s', position %u: "
+                      "the event has already been sent by thread %lu in the role of %s.",
+                      slave->dcb->remote,
+                      ntohs((slave->dcb->ipv4).sin_port),
+                      slave->serverid,
+                      slave->binlogfile,
+                      slave->binlog_pos,
+                      slave->lsi_sender_tid,
+                      ROLETOSTR(slave->lsi_sender_role));
+            blr_unmap_binlog(&map);
+            return BLR_MAPPED_DUPLICATE;
+        }
+
+        if (!dcb_writev(slave->dcb, iov, n * 2))
+        {
+            blr_unmap_binlog(&map);
+            return -1;
+        }
+
+        slave->seqno += n;
+        slave->binlog_pos = pos;
+        slave->lastEventTimestamp = extract_field(last_event, 32);
+        slave->lastEventReceived = last_event[4];
+        slave->stats.n_events += n;
+        slave->stats.n_bytes += bytes + n * (MYSQL_HEADER_LEN + 1);
+        strcpy(slave->lsi_binlog_name, slave->binlogfile);
+        slave->lsi_binlog_pos = last_pos;
+        slave->lsi_sender_role = BLR_THREAD_ROLE_SLAVE;
+        slave->lsi_sender_tid = thread_self();
+        *burst -= n;
+        *burst_size -= bytes;
+
+        if (router->send_slave_heartbeat)
+        {
+            slave->lastReply = time(0);
+        }
+    }
+
+    blr_unmap_binlog(&map);
+    return n;
+}
+
+/**
+ * Calculate the number of bytes the next catchup burst of a slave may send
+ *
+ * The rate at which the slave consumed the previous burst is measured from
+ * the start of the previous burst to the start of this one: the bytes that
+ * were queued when the previous burst started plus the bytes it sent, minus
+ * the bytes that are still queued. If the previous
+ * burst left no more than the low water mark in the write queue of the DCB,
+ * the socket took all of it and the burst is doubled. Otherwise the burst is
+ * what the slave drains in BLR_BURST_TARGET_MS. A slow slave then gets short
+ * bursts that do not fill the memory with queued events and a fast slave
+ * soon sends bursts of burstsize bytes.
+ *
+ * @param router    The binlog router
+ * @param slave     The slave that is behind
+ * @param now       Current time from ts_stats_time_us
+ * @return          The number of bytes the burst may send
+ */
+static long
+blr_slave_burst_size(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, int64_t now)
+{
+    long max_size = router->burst_size;
+    long size = slave->burst_budget;
+
+    if (!router->adaptive_burst)
+    {
+        return max_size;
+    }
+
+    if (slave->burst_start && now > slave->burst_start)
+    {
+        long drained = slave->burst_start_writeq + slave->burst_sent - slave->dcb->writeqlen;
+
+        if (drained > 0)
+        {
+            unsigned long rate = (unsigned long)drained * 1000000 / (now - slave->burst_start);
+            slave->drain_rate = slave->drain_rate ? (slave->drain_rate * 3 + rate) / 4 : rate;
+        }
+
+        if (slave->burst_writeq <= (int)router->low_water)
+        {
+            size *= 2;
+        }
+        else
+        {
+            size = slave->drain_rate * BLR_BURST_TARGET_MS / 1000;
+        }
+    }
+
+    if (size < BLR_BURST_MIN_SIZE)
+    {
+        size = BLR_BURST_MIN_SIZE;
+    }
+
+    if (size > max_size)
+    {
+        size = max_size;
+    }
+
+    slave->burst_budget = size;
+    slave->burst_start = now;
+    slave->burst_start_writeq = slave->dcb->writeqlen;
+
+    return size;
+}
+
 /**
  * We have a registered slave that is behind the current leading edge of the
  * binlog. We must replay the log entries to bring this node up to speed.
@@ -2173,6 +2574,12 @@ blr_build_header(GWBUF  *pkt, REP_HEADER *hdr)
  * queue. This ensures that the slave callback for processing DCB write drain
  * will be called and future catchup requests will be handled on another thread.
  *
+ * With adaptive_burst the size of the burst follows the rate at which the
+ * slave consumes the events, see blr_slave_burst_size. A burst also ends
+ * after BLR_BURST_MAX_TIME_MS so that a slave never keeps a worker thread for
+ * long: the fake EPOLLOUT event puts it behind the other slaves and clients
+ * waiting in the poll queue.
+ *
  * @param   router      The binlog router
  * @param   slave       The slave that is behind
  * @param   large       Send a long or short burst of events
@@ -2181,7 +2588,7 @@ blr_build_header(GWBUF  *pkt, REP_HEADER *hdr)
 int
 blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large)
 {
-    GWBUF *record;
+    GWBUF *record = NULL;
     REP_HEADER hdr;
     int rval = 1, burst;
     int rotating = 0;
@@ -2199,8 +2606,6 @@ blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large)
         burst = router->short_burst;
     }
 
-    burst_size = router->burst_size;
-
     int do_return;
 
     spinlock_acquire(&router->binlog_lock);
@@ -2276,8 +2681,41 @@ blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large)
     slave->file = file;
 #endif
     int events_before = slave->stats.n_events;
+    unsigned long bytes_before = slave->stats.n_bytes;
+    int64_t burst_start = ts_stats_time_us();
+
+    burst_size = blr_slave_burst_size(router, slave, burst_start);
+
+    /* Closed binlog files are sent straight from the mapped file */
+    int mapped = blr_slave_send_mapped(router, slave, file, &burst, &burst_size);
+
+    if (mapped == BLR_MAPPED_DUPLICATE)
+    {
+        /* Nothing was sent, end the burst and continue from the next one */
+        burst = 0;
+    }
+    else if (mapped < 0)
+    {
+        MXS_WARNING("Slave %s:%i, server-id %d, binlog '%s, position %u: "
+                    "Slave-thread could not send events to slave, closing connection.",
+                    slave->dcb->remote,
+                    ntohs((slave->dcb->ipv4).sin_port),
+                    slave->serverid,
+                    slave->binlogfile,
+                    slave->binlog_pos);
+#ifndef BLFILE_IN_SLAVE
+        blr_close_binlog(router, file);
+#endif
+        slave->state = BLRS_ERRORED;
+        dcb_close(slave->dcb);
+        return 0;
+    }
+
+    hdr.ok = SLAVE_POS_READ_OK;
 
     while (burst-- && burst_size > 0 &&
+           (!router->adaptive_burst ||
+            ts_stats_time_us() - burst_start < BLR_BURST_MAX_TIME_MS * 1000) &&
            (record = blr_read_binlog(router, file, slave->binlog_pos, &hdr, read_errmsg)) != NULL)
     {
         char binlog_name[BINLOG_FNAMELEN + 1];
@@ -2347,6 +2785,8 @@ blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large)
             {
                 slave->binlog_pos = hdr.next_pos;
             }
+            slave->lastEventTimestamp = hdr.timestamp;
+            slave->lastEventReceived = hdr.event_type;
             slave->stats.n_events++;
             burst_size -= hdr.event_size;
         }
@@ -2456,6 +2896,9 @@ blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large)
                        read_errmsg);
         }
     }
+    slave->burst_sent = slave->stats.n_bytes - bytes_before;
+    slave->burst_writeq = slave->dcb->writeqlen;
+
     spinlock_acquire(&slave->catch_lock);
     slave->cstate &= ~CS_BUSY;
     spinlock_release(&slave->catch_lock);
@@ -2507,10 +2950,15 @@ blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large)
         }
         else
         {
+            /* The next commit wakes the slave up */
+            blr_slave_wait_events(router, slave);
+
             if ((slave->cstate & CS_UPTODATE) == 0)
             {
                 slave->stats.n_upd++;
                 slave->cstate |= CS_UPTODATE;
+                /* The time spent up to date says nothing about the drain rate */
+                slave->burst_start = 0;
                 spinlock_release(&slave->catch_lock);
                 spinlock_release(&router->binlog_lock);
                 state_change = 1;
@@ -2785,8 +3233,7 @@ blr_slave_fake_rotate(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, BLFILE** fil
          * include the length, sequence number and ok byte that makes up the first
          * 5 bytes of the message. We also do not include the 4 byte checksum itself.
          */
-        chksum = crc32(0L, NULL, 0);
-        chksum = crc32(chksum, GWBUF_DATA(resp) + 5, hdr.event_size - 4);
+        chksum = mxs_crc32(0, GWBUF_DATA(resp) + 5, hdr.event_size - 4);
         encode_value(ptr, chksum, 32);
     }
 
@@ -2853,8 +3300,7 @@ blr_slave_send_fde(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
      * and write it into the header
      */
     ptr = GWBUF_DATA(record) + hdr.event_size - 4;
-    chksum = crc32(0L, NULL, 0);
-    chksum = crc32(chksum, GWBUF_DATA(record), hdr.event_size - 4);
+    chksum = mxs_crc32(0, GWBUF_DATA(record), hdr.event_size - 4);
     encode_value(ptr, chksum, 32);
 
     slave->dcb->func.write(slave->dcb, head);
@@ -5430,8 +5876,7 @@ blr_slave_send_heartbeat(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
     /* Add the CRC32 */
     if (!slave->nocrc)
     {
-        chksum = crc32(0L, NULL, 0);
-        chksum = crc32(chksum, GWBUF_DATA(resp) + 5, hdr.event_size - 4);
+        chksum = mxs_crc32(0, GWBUF_DATA(resp) + 5, hdr.event_size - 4);
         encode_value(ptr, chksum, 32);
     }
 
@@ -17,6 +17,11 @@
  * This utility checks a MySQL 5.6 and MariaDB 10.0.X binlog file and reports
  * any found error or an incomplete transaction.
  * It suggests the pos the file should be trucatetd at.
+ * It can also build the binlog index of the file or check that the existing
+ * binlog index matches the file.
+ *
+ * Several binlog files, or directories of binlog files, can be checked in
+ * parallel and the results can be printed as a machine-readable report.
  *
  * @verbatim
  * Revision History
@@ -56,14 +61,38 @@
 #include <ini.h>
 #include <sys/stat.h>
 #include <getopt.h>
+#include <dirent.h>
+#include <thread.h>
 
 #include <version.h>
+#include <mxs_crc32.h>
 #include <gwdirs.h>
 
-extern int blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug);
+extern int blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug,
+                                      BLR_SCAN_RESULT *result);
 extern uint32_t extract_field(uint8_t *src, int bits);
 static void printVersion(const char *progname);
 static void printUsage(const char *progname);
+static bool index_matches(BLR_BINLOG_INDEX *a, BLR_BINLOG_INDEX *b);
+
+/** The maximum number of parallel checks */
+#define BINLOG_CHECK_MAX_JOBS 64
+
+/**
+ * The check of one binlog file
+ */
+typedef struct
+{
+    char            path[PATH_MAX + 1]; /*< Path of the binlog file */
+    int             ret;                /*< Return code of the event scan, -1 if not read */
+    bool            pending;            /*< The file ends with an incomplete transaction */
+    bool            fixed;              /*< The file was truncated */
+    bool            index_error;        /*< Building or checking the index failed */
+    unsigned long   size;               /*< Size of the file before the check */
+    unsigned long   safe_pos;           /*< Position the file is valid up to */
+    unsigned long   end_pos;            /*< Position the scan ended at */
+    BLR_SCAN_RESULT scan;               /*< Summary of the events */
+} BINLOG_CHECK;
 
 static struct option long_options[] =
 {
@@ -71,11 +100,26 @@ static struct option long_options[] =
     {"version",   no_argument,        0,  'V'},
     {"fix",   no_argument,        0,  'f'},
     {"mariadb10", no_argument,        0,  'M'},
+    {"index", no_argument,        0,  'i'},
+    {"check-index", no_argument,        0,  'c'},
+    {"jobs",  required_argument,  0,  'j'},
+    {"report", no_argument,       0,  'R'},
     {"help",  no_argument,        0,  '?'},
     {0, 0, 0, 0}
 };
 
-char *binlog_check_version = "1.1.0";
+char *binlog_check_version = "1.3.0";
+
+static int debug_out = 0;
+static int fix_file = 0;
+static int mariadb10_compat = 0;
+static int build_index = 0;
+static int check_index = 0;
+
+/** The files to check, the workers take them in order */
+static BINLOG_CHECK *checks = NULL;
+static int n_checks = 0;
+static int next_check = 0;
 
 int
 maxscale_uptime()
@@ -83,69 +127,30 @@ maxscale_uptime()
     return 1;
 }
 
-int main(int argc, char **argv)
+/**
+ * Check one binlog file
+ *
+ * @param check The file to check, the results are stored here
+ */
+static void
+check_binlog(BINLOG_CHECK *check)
 {
     ROUTER_INSTANCE *inst;
-    int fd;
-    int ret;
+    char *path = check->path;
     char *ptr;
-    char path[PATH_MAX + 1] = "";
-    unsigned long filelen = 0;
-    struct  stat statb;
-    char c;
-    int option_index = 0;
-    int num_args = 0;
-    int debug_out = 0;
-    int fix_file = 0;
-    int mariadb10_compat = 0;
-
-    while ((c = getopt_long(argc, argv, "dVfM?", long_options, &option_index)) >= 0)
-    {
-        switch (c)
-        {
-        case 'd':
-            debug_out = 1;
-            break;
-        case 'V':
-            printVersion(*argv);
-            exit(EXIT_SUCCESS);
-            break;
-        case 'f':
-            fix_file = 1;
-            break;
-        case 'M':
-            mariadb10_compat = 1;
-            break;
-        case '?':
-            printUsage(*argv);
-            exit(optopt ? EXIT_FAILURE : EXIT_SUCCESS);
-        }
-    }
+    char dir[PATH_MAX + 1] = "";
+    struct stat statb;
+    BLR_BINLOG_INDEX index;
+    int fd;
 
-    num_args = optind;
-
-    mxs_log_init(NULL, NULL, MXS_LOG_TARGET_DEFAULT);
-    mxs_log_set_augmentation(0);
-    mxs_log_set_priority_enabled(LOG_DEBUG, debug_out);
+    check->ret = -1;
 
     if ((inst = calloc(1, sizeof(ROUTER_INSTANCE))) == NULL)
     {
         MXS_ERROR("Memory allocation failed for ROUTER_INSTANCE");
-
-        mxs_log_flush_sync();
-        mxs_log_finish();
-
-        return 1;
+        return;
     }
 
-    if (argv[num_args] == NULL)
-    {
-        printf("ERROR: No binlog file was specified\n");
-        exit(EXIT_FAILURE);
-    }
-
-    strncpy(path, argv[num_args], PATH_MAX);
-
     if (fix_file)
     {
         fd = open(path, O_RDWR, 0666);
@@ -159,13 +164,8 @@ int main(int argc, char **argv)
     {
         MXS_ERROR("Failed to open binlog file %s: %s",
                   path, strerror(errno));
-
-        mxs_log_flush_sync();
-        mxs_log_finish();
-
         free(inst);
-
-        return 1;
+        return;
     }
 
     inst->binlog_fd = fd;
@@ -179,36 +179,442 @@ int main(int argc, char **argv)
     if (ptr)
     {
         strncpy(inst->binlog_name, ptr + 1, BINLOG_FNAMELEN);
+        strncpy(dir, path, ptr - path);
     }
     else
     {
         strncpy(inst->binlog_name, path, BINLOG_FNAMELEN);
+        strcpy(dir, ".");
     }
 
-    MXS_NOTICE("maxbinlogcheck %s", binlog_check_version);
+    /* The binlog index is stored next to the binlog file */
+    inst->binlogdir = dir;
 
     if (fstat(inst->binlog_fd, &statb) == 0)
     {
-        filelen = statb.st_size;
+        check->size = statb.st_size;
     }
 
-    MXS_NOTICE("Checking %s (%s), size %lu bytes", path, inst->binlog_name, filelen);
+    MXS_NOTICE("Checking %s (%s), size %lu bytes", path, inst->binlog_name, check->size);
+
+    bool compare_index = check_index;
+
+    if (compare_index && !blr_index_load(inst, &index))
+    {
+        MXS_ERROR("No valid binlog index found for %s", path);
+        check->index_error = true;
+        compare_index = false;
+    }
 
     /* read binary log */
-    ret = blr_read_events_all_events(inst, fix_file, debug_out);
+    check->ret = blr_read_events_all_events(inst, fix_file, debug_out, &check->scan);
+    check->pending = inst->pending_transaction;
+    check->safe_pos = inst->binlog_position;
+    check->end_pos = inst->current_pos;
+
+    if (fix_file && fstat(inst->binlog_fd, &statb) == 0)
+    {
+        check->fixed = (unsigned long)statb.st_size < check->size;
+    }
+
+    if (build_index)
+    {
+        /* The index can only end where no transaction is open */
+        if (check->ret == 0 && inst->binlog_index.pos > 4 &&
+            inst->binlog_index.pos == inst->binlog_position)
+        {
+            if (blr_index_write(inst, &inst->binlog_index))
+            {
+                MXS_NOTICE("Binlog index of %s written, valid up to position %lu",
+                           path, (unsigned long)inst->binlog_index.pos);
+            }
+            else
+            {
+                check->index_error = true;
+            }
+        }
+        else
+        {
+            MXS_ERROR("Binlog index of %s not written, the binlog file has errors "
+                      "or an incomplete transaction", path);
+            check->index_error = true;
+        }
+    }
+
+    if (compare_index)
+    {
+        /* Reading the file from the indexed position must give the same result */
+        BLR_BINLOG_INDEX full_index = inst->binlog_index;
+
+        inst->binlog_index = index;
+        blr_read_events_all_events(inst, 0, debug_out, NULL);
+
+        if (index_matches(&full_index, &inst->binlog_index))
+        {
+            MXS_NOTICE("Binlog index of %s matches the binlog file, valid up to position %lu",
+                       path, (unsigned long)index.pos);
+        }
+        else
+        {
+            MXS_ERROR("Binlog index of %s does not match the binlog file", path);
+            check->index_error = true;
+        }
+    }
 
     close(inst->binlog_fd);
 
-    mxs_log_flush_sync();
+    MXS_NOTICE("Check retcode: %i, Binlog Pos = %lu", check->ret, check->safe_pos);
+
+    free(inst);
+}
+
+/**
+ * The worker thread, checks files until all of them are done
+ *
+ * @param data Unused
+ */
+static void
+check_worker(void *data)
+{
+    int i;
+
+    while ((i = atomic_add(&next_check, 1)) < n_checks)
+    {
+        check_binlog(&checks[i]);
+    }
+}
+
+/**
+ * Add a binlog file to the files to check
+ *
+ * @param path Path of the file
+ * @return True on success
+ */
+static bool
+add_check(const char *path)
+{
+    BINLOG_CHECK *tmp = realloc(checks, (n_checks + 1) * sizeof(BINLOG_CHECK));
+
+    if (tmp == NULL)
+    {
+        MXS_ERROR("Memory allocation failed for the binlog file %s", path);
+        return false;
+    }
+
+    checks = tmp;
+    memset(&checks[n_checks], 0, sizeof(BINLOG_CHECK));
+    strncpy(checks[n_checks].path, path, PATH_MAX);
+    n_checks++;
+
+    return true;
+}
 
-    MXS_NOTICE("Check retcode: %i, Binlog Pos = %lu", ret, inst->binlog_position);
+/**
+ * Check if a file name is a binlog file name, e.g. mysql-bin.000001
+ *
+ * @param name The file name
+ * @return True if the name ends with a dot and a sequence number
+ */
+static bool
+is_binlog_name(const char *name)
+{
+    const char *ptr = strrchr(name, '.');
+
+    if (ptr == NULL || ptr == name || *(ptr + 1) == '\0')
+    {
+        return false;
+    }
+
+    while (*++ptr)
+    {
+        if (!isdigit(*ptr))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static int
+compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/**
+ * Add the binlog files of a directory in sequence order
+ *
+ * @param dirname The directory
+ * @return True on success
+ */
+static bool
+add_directory(const char *dirname)
+{
+    DIR *dirp;
+    struct dirent *dp;
+    char **names = NULL;
+    int n_names = 0;
+    bool rval = true;
+
+    if ((dirp = opendir(dirname)) == NULL)
+    {
+        MXS_ERROR("Failed to open directory %s: %s", dirname, strerror(errno));
+        return false;
+    }
+
+    while ((dp = readdir(dirp)) != NULL)
+    {
+        if (is_binlog_name(dp->d_name))
+        {
+            char **tmp = realloc(names, (n_names + 1) * sizeof(char *));
+
+            if (tmp == NULL || (tmp[n_names] = strdup(dp->d_name)) == NULL)
+            {
+                names = tmp ? tmp : names;
+                rval = false;
+                break;
+            }
+
+            names = tmp;
+            n_names++;
+        }
+    }
+
+    closedir(dirp);
+
+    qsort(names, n_names, sizeof(char *), compare_names);
+
+    for (int i = 0; i < n_names; i++)
+    {
+        if (rval)
+        {
+            char path[PATH_MAX + 1];
+            snprintf(path, sizeof(path), "%s/%s", dirname, names[i]);
+            rval = add_check(path);
+        }
+
+        free(names[i]);
+    }
+
+    free(names);
+
+    if (rval && n_names == 0)
+    {
+        MXS_WARNING("No binlog files found in %s", dirname);
+    }
+
+    return rval;
+}
+
+/**
+ * Print a string as a JSON string
+ *
+ * @param str The string
+ */
+static void
+print_json_string(const char *str)
+{
+    putchar('"');
+
+    for (; *str; str++)
+    {
+        if (*str == '"' || *str == '\\')
+        {
+            printf("\\%c", *str);
+        }
+        else if ((unsigned char)*str < 0x20)
+        {
+            printf("\\u%04x", (unsigned char)*str);
+        }
+        else
+        {
+            putchar(*str);
+        }
+    }
+
+    putchar('"');
+}
+
+/**
+ * Print the result of a check as one line of JSON
+ *
+ * @param check The checked file
+ */
+static void
+print_report(BINLOG_CHECK *check)
+{
+    const char *status;
+
+    if (check->ret != 0)
+    {
+        status = "error";
+    }
+    else if (check->pending)
+    {
+        status = "open_transaction";
+    }
+    else
+    {
+        status = "ok";
+    }
+
+    printf("{\"file\": ");
+    print_json_string(check->path);
+    printf(", \"size\": %lu, \"status\": \"%s\", \"safe_pos\": %lu, \"end_pos\": %lu, "
+           "\"events\": %lu, \"transactions\": %lu, \"checksums\": %s, "
+           "\"bad_checksum\": %s, \"fixed\": %s, \"index_error\": %s}\n",
+           check->size, status, check->safe_pos, check->end_pos,
+           (unsigned long)check->scan.n_events,
+           (unsigned long)check->scan.n_transactions,
+           check->scan.checksums ? "true" : "false",
+           check->scan.bad_checksum ? "true" : "false",
+           check->fixed ? "true" : "false",
+           check->index_error ? "true" : "false");
+}
+
+int main(int argc, char **argv)
+{
+    char c;
+    int option_index = 0;
+    int num_args = 0;
+    int n_jobs = 1;
+    int report = 0;
+    int rval = 0;
+    struct stat statb;
+    THREAD threads[BINLOG_CHECK_MAX_JOBS];
+
+    while ((c = getopt_long(argc, argv, "dVfMicj:R?", long_options, &option_index)) >= 0)
+    {
+        switch (c)
+        {
+        case 'd':
+            debug_out = 1;
+            break;
+        case 'V':
+            printVersion(*argv);
+            exit(EXIT_SUCCESS);
+            break;
+        case 'f':
+            fix_file = 1;
+            break;
+        case 'M':
+            mariadb10_compat = 1;
+            break;
+        case 'i':
+            build_index = 1;
+            break;
+        case 'c':
+            check_index = 1;
+            break;
+        case 'j':
+            n_jobs = atoi(optarg);
+            if (n_jobs < 1 || n_jobs > BINLOG_CHECK_MAX_JOBS)
+            {
+                printf("ERROR: The number of jobs must be between 1 and %d\n",
+                       BINLOG_CHECK_MAX_JOBS);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'R':
+            report = 1;
+            break;
+        case '?':
+            printUsage(*argv);
+            exit(optopt ? EXIT_FAILURE : EXIT_SUCCESS);
+        }
+    }
+
+    num_args = optind;
+
+    if (argv[num_args] == NULL)
+    {
+        printf("ERROR: No binlog file was specified\n");
+        exit(EXIT_FAILURE);
+    }
+
+    mxs_log_init(NULL, NULL, MXS_LOG_TARGET_DEFAULT);
+    mxs_log_set_augmentation(0);
+    mxs_log_set_priority_enabled(LOG_DEBUG, debug_out);
+
+    MXS_NOTICE("maxbinlogcheck %s, %s CRC32", binlog_check_version, mxs_crc32_impl());
+
+    for (int i = num_args; i < argc && rval == 0; i++)
+    {
+        if (stat(argv[i], &statb) == 0 && S_ISDIR(statb.st_mode))
+        {
+            rval = add_directory(argv[i]) ? 0 : 1;
+        }
+        else
+        {
+            rval = add_check(argv[i]) ? 0 : 1;
+        }
+    }
+
+    if (n_jobs > n_checks)
+    {
+        n_jobs = n_checks;
+    }
+
+    if (rval == 0 && n_jobs > 1)
+    {
+        for (int i = 0; i < n_jobs; i++)
+        {
+            thread_start(&threads[i], check_worker, NULL);
+        }
+
+        for (int i = 0; i < n_jobs; i++)
+        {
+            thread_wait(threads[i]);
+        }
+    }
+    else if (rval == 0)
+    {
+        check_worker(NULL);
+    }
 
     mxs_log_flush_sync();
+
+    for (int i = 0; i < n_checks; i++)
+    {
+        if (report)
+        {
+            print_report(&checks[i]);
+        }
+
+        /* Failing to open a file or to build or check the index is an error */
+        if (checks[i].ret == -1 || checks[i].index_error)
+        {
+            rval = 1;
+        }
+    }
+
     mxs_log_finish();
 
-    free(inst);
+    free(checks);
+
+    return rval;
+}
 
-    return 0;
+/**
+ * Compare the events covered by two binlog indexes
+ *
+ * @param a First index
+ * @param b Second index
+ * @return True if both indexes describe the same events
+ */
+static bool
+index_matches(BLR_BINLOG_INDEX *a, BLR_BINLOG_INDEX *b)
+{
+    return a->pos == b->pos &&
+           a->n_events == b->n_events &&
+           a->last_pos == b->last_pos &&
+           a->last_size == b->last_size &&
+           a->last_type == b->last_type &&
+           a->last_time == b->last_time &&
+           a->fde_pos == b->fde_pos &&
+           a->fde_time == b->fde_time &&
+           a->checksum == b->checksum;
 }
 
 /**
@@ -229,10 +635,15 @@ printUsage(const char *progname)
     printVersion(progname);
 
     printf("The MaxScale binlog check utility.\n\n");
-    printf("Usage: %s [-f] [-d] [-v] [<binlog file>]\n\n", progname);
+    printf("Usage: %s [-f] [-d] [-M] [-i] [-c] [-j N] [-R] [-V] <binlog file|directory> ...\n\n",
+           progname);
     printf("  -f|--fix		Fix binlog file, require write permissions (truncate)\n");
     printf("  -d|--debug		Print debug messages\n");
     printf("  -M|--mariadb10	MariaDB 10 binlog compatibility\n");
+    printf("  -i|--index		Build the binlog index of the file\n");
+    printf("  -c|--check-index	Check that the binlog index matches the file\n");
+    printf("  -j|--jobs N		Check N files in parallel\n");
+    printf("  -R|--report		Print a JSON report line for each file\n");
     printf("  -V|--version          print version information and exit\n");
     printf("  -?|--help             Print this help text\n");
 }
@@ -53,6 +53,36 @@ static void printUsage(const char *progname);
 extern int blr_test_parse_change_master_command(char *input, char *error_string, CHANGE_MASTER_OPTIONS *config);
 extern char *blr_test_set_master_logfile(ROUTER_INSTANCE *router, char *filename, char *error);
 extern int blr_test_handle_change_master(ROUTER_INSTANCE* router, char *command, char *error);
+extern void encode_value(unsigned char *data, unsigned int value, int len);
+
+/**
+ * Add a MariaDB 10 GTID event or a XID event to the GTID index
+ *
+ * @param inst  The router instance
+ * @param type  MARIADB10_GTID_EVENT or XID_EVENT
+ * @param seq   Sequence number of the GTID event
+ * @param pos   Position of the event in the current binlog file
+ * @return Position after the event
+ */
+static unsigned long
+add_gtid_event(ROUTER_INSTANCE *inst, uint8_t type, uint64_t seq, unsigned long pos)
+{
+	uint8_t buf[BINLOG_EVENT_HDR_LEN + 8 + 4 + 1] = "";
+	REP_HEADER hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.event_type = type;
+	hdr.serverid = 1;
+	hdr.event_size = type == XID_EVENT ? BINLOG_EVENT_HDR_LEN + 8 : sizeof(buf);
+	hdr.next_pos = pos + hdr.event_size;
+
+	/* Sequence number and domain 0, no flags */
+	encode_value(buf + BINLOG_EVENT_HDR_LEN, seq & 0xffffffff, 32);
+	encode_value(buf + BINLOG_EVENT_HDR_LEN + 4, seq >> 32, 32);
+
+	blr_gtid_index_event(inst, &hdr, pos, buf, hdr.event_size);
+	return hdr.next_pos;
+}
 
 static struct option long_options[] = {
   {"debug",     no_argument,            0,      'd'},
@@ -569,6 +599,188 @@ int main(int argc, char **argv) {
 		return 1;
 	}
 
+	tests++;
+
+	printf("--------- Binlog compression tests ---------\n");
+	/**
+	 * Test 24: compress a closed binlog file and read it back
+	 *
+	 * Expected: the data read from the compressed file matches the original
+	 */
+	{
+		char dir[] = "/tmp/testbinlog.XXXXXX";
+		char path[PATH_MAX + 1];
+		int size = BLR_COMPRESS_BLOCK_SIZE * 3 + 1234;
+		uint8_t *data = malloc(size);
+		uint8_t *buf = malloc(size);
+		BLFILE *file;
+		FILE *fp;
+
+		for (int i = 0; i < size; i++) {
+			/* Partly compressible, partly random data */
+			data[i] = i < BLR_COMPRESS_BLOCK_SIZE * 2 ? i % 61 : random();
+		}
+
+		if (mkdtemp(dir) == NULL) {
+			printf("Test %d: failed to create directory %s\n", tests, dir);
+			return 1;
+		}
+
+		inst->binlogdir = dir;
+		strcpy(inst->binlog_name, "file.000002");
+		snprintf(path, PATH_MAX, "%s/file.000001", dir);
+
+		if ((fp = fopen(path, "w")) == NULL || fwrite(data, 1, size, fp) != (size_t)size || fclose(fp) != 0) {
+			printf("Test %d: failed to write binlog file %s\n", tests, path);
+			return 1;
+		}
+
+		if (!blr_compress_file(inst, "file.000001") || access(path, F_OK) == 0) {
+			printf("Test %d: compressing binlog file %s FAILED\n", tests, path);
+			return 1;
+		}
+
+		if ((file = blr_open_binlog(inst, "file.000001")) == NULL || file->blocks == NULL ||
+		    blr_file_size(file) != size) {
+			printf("Test %d: opening compressed binlog file FAILED\n", tests);
+			return 1;
+		}
+
+		/* Reads that cross block boundaries and go past the end of the file */
+		if (blr_compressed_read(inst, file->blocks, file->fd, buf, size, 0) != size ||
+		    memcmp(buf, data, size) != 0 ||
+		    blr_compressed_read(inst, file->blocks, file->fd, buf, 1000,
+		                        BLR_COMPRESS_BLOCK_SIZE - 500) != 1000 ||
+		    memcmp(buf, data + BLR_COMPRESS_BLOCK_SIZE - 500, 1000) != 0 ||
+		    blr_compressed_read(inst, file->blocks, file->fd, buf, 1000, size - 200) != 200 ||
+		    memcmp(buf, data + size - 200, 200) != 0) {
+			printf("Test %d: reading compressed binlog file FAILED\n", tests);
+			return 1;
+		}
+
+		printf("Test %d PASSED, compressed binlog file read back\n", tests);
+
+		blr_close_binlog(inst, file);
+		strcat(path, BLR_COMPRESSED_SUFFIX);
+		unlink(path);
+		rmdir(dir);
+		inst->binlogdir = NULL;
+		free(data);
+		free(buf);
+	}
+
+	tests++;
+
+	printf("--------- GTID index tests ---------\n");
+	/**
+	 * Test 25: find transactions in the GTID index and prune the index
+	 * when a binlog file is removed
+	 *
+	 * Expected: the position after the transaction is found, the
+	 * transactions of the removed file are dropped from the index and
+	 * the index file
+	 */
+	{
+		char dir[] = "/tmp/testbinlog.XXXXXX";
+		char path[PATH_MAX + 1];
+		char binlog[BINLOG_FNAMELEN + 1];
+		uint32_t pos = 0;
+		unsigned long end1, end2, end3;
+		FILE *fp;
+
+		if (mkdtemp(dir) == NULL) {
+			printf("Test %d: failed to create directory %s\n", tests, dir);
+			return 1;
+		}
+
+		inst->binlogdir = dir;
+		inst->mariadb10_compat = 1;
+		strcpy(inst->fileroot, "file");
+
+		for (int i = 1; i <= 2; i++) {
+			snprintf(path, PATH_MAX, "%s/file.%06d", dir, i);
+			if ((fp = fopen(path, "w")) == NULL || fclose(fp) != 0) {
+				printf("Test %d: failed to create binlog file %s\n", tests, path);
+				return 1;
+			}
+		}
+
+		strcpy(inst->binlog_name, "file.000001");
+		blr_gtid_index_init(inst);
+
+		if (inst->gtid_index == NULL) {
+			printf("Test %d: creating the GTID index FAILED\n", tests);
+			return 1;
+		}
+
+		end1 = add_gtid_event(inst, XID_EVENT, 0, add_gtid_event(inst, MARIADB10_GTID_EVENT, 10, 4));
+		end2 = add_gtid_event(inst, XID_EVENT, 0, add_gtid_event(inst, MARIADB10_GTID_EVENT, 11, end1));
+
+		/* Transactions are indexed only once the slaves can read them */
+		if (blr_gtid_index_count(inst) != 0) {
+			printf("Test %d: indexing a transaction before it was committed FAILED\n", tests);
+			return 1;
+		}
+
+		blr_gtid_index_visible(inst, end1);
+		blr_gtid_index_synced(inst, end2);
+
+		if (blr_gtid_index_count(inst) != 1 ||
+		    blr_gtid_index_find(inst, 0, 1, 11, binlog, &pos)) {
+			printf("Test %d: indexing the committed transactions FAILED\n", tests);
+			return 1;
+		}
+
+		strcpy(inst->binlog_name, "file.000002");
+		end3 = add_gtid_event(inst, XID_EVENT, 0, add_gtid_event(inst, MARIADB10_GTID_EVENT, 12, 4));
+		blr_gtid_index_visible(inst, end3);
+		blr_gtid_index_synced(inst, end3);
+
+		if (blr_gtid_index_count(inst) != 3 ||
+		    !blr_gtid_index_find(inst, 0, 1, 11, binlog, &pos) ||
+		    strcmp(binlog, "file.000001") != 0 || pos != end2 ||
+		    !blr_gtid_index_find(inst, 0, 1, 12, binlog, &pos) ||
+		    strcmp(binlog, "file.000002") != 0 || pos != end3 ||
+		    blr_gtid_index_find(inst, 0, 1, 13, binlog, &pos) ||
+		    blr_gtid_index_find(inst, 0, 2, 11, binlog, &pos) ||
+		    blr_gtid_index_find(inst, 1, 1, 11, binlog, &pos)) {
+			printf("Test %d: finding GTIDs in the GTID index FAILED\n", tests);
+			return 1;
+		}
+
+		snprintf(path, PATH_MAX, "%s/file.000001", dir);
+		unlink(path);
+		blr_gtid_index_prune(inst);
+
+		if (blr_gtid_index_count(inst) != 1 ||
+		    blr_gtid_index_find(inst, 0, 1, 10, binlog, &pos) ||
+		    !blr_gtid_index_find(inst, 0, 1, 12, binlog, &pos) || pos != end3) {
+			printf("Test %d: pruning the GTID index FAILED\n", tests);
+			return 1;
+		}
+
+		/* The pruned index is what is loaded at startup */
+		blr_gtid_index_free(inst);
+		blr_gtid_index_init(inst);
+
+		if (blr_gtid_index_count(inst) != 1 ||
+		    !blr_gtid_index_find(inst, 0, 1, 12, binlog, &pos) || pos != end3) {
+			printf("Test %d: loading the pruned GTID index FAILED\n", tests);
+			return 1;
+		}
+
+		printf("Test %d PASSED, GTIDs found in the GTID index\n", tests);
+
+		blr_gtid_index_free(inst);
+		snprintf(path, PATH_MAX, "%s/file.000002", dir);
+		unlink(path);
+		snprintf(path, PATH_MAX, "%s/%s", dir, BLR_GTID_INDEX_FILE);
+		unlink(path);
+		rmdir(dir);
+		inst->binlogdir = NULL;
+		inst->mariadb10_compat = 0;
+	}
+
 	mxs_log_flush_sync();
 	mxs_log_finish();
 
@@ -126,6 +126,10 @@ struct subcommand showoptions[] = {
       "Show statistics and user names for a service's user table.\n"
       "\t\tExample : show dbusers <ptr of 'User's data' from services list>|<service name>",
       {ARG_TYPE_DBUSERS, 0, 0} },
+    { "digests", 0, dprintAllDigests,
+      "Show the statement digests of all services",
+      "Show the statement digests of all services",
+      {0, 0, 0} },
     { "epoll", 0, dprintPollStats,
       "Show the poll statistics",
       "Show the poll statistics",
@@ -46,6 +46,7 @@
 #include <skygw_utils.h>
 #include <log_manager.h>
 #include <resultset.h>
+#include <metrics.h>
 #include <version.h>
 #include <resultset.h>
 #include <secrets.h>
@@ -697,9 +698,34 @@ static struct uri_table {
 	{ "/variables", maxinfo_variables },
 	{ "/status", maxinfo_status },
 	{ "/event/times", eventTimesGetList },
+	{ "/servers/latency", serverGetLatencyList },
+	{ "/services/latency", serviceGetLatencyList },
+	{ "/digests", serviceGetDigestList },
 	{ NULL, NULL }
 };
 
+/**
+ * Send all metrics in the Prometheus text exposition format
+ *
+ * The output is written in blocks as it is generated.
+ *
+ * @param dcb	The client DCB
+ */
+static void
+maxinfo_send_metrics(DCB *dcb)
+{
+MXS_METRICS	*metrics;
+
+	if ((metrics = metrics_alloc(dcb)) == NULL)
+	{
+		return;
+	}
+	poll_metrics(metrics);
+	serverMetrics(metrics);
+	serviceMetrics(metrics);
+	metrics_free(metrics);
+}
+
 /**
  * We have data from the client, this is a HTTP URL
  *
@@ -716,6 +742,10 @@ int		i;
 RESULTSET	*set;
 
 	uri = (char *)GWBUF_DATA(queue);
+	if (strcmp(uri, "/metrics") == 0)
+	{
+		maxinfo_send_metrics(session->dcb);
+	}
 	for (i = 0; supported_uri[i].uri; i++)
 	{
 		if (strcmp(uri, supported_uri[i].uri) == 0)
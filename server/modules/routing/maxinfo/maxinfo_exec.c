@@ -201,6 +201,66 @@ exec_show_servers(DCB *dcb, MAXINFO_TREE *tree)
     resultset_free(set);
 }
 
+/**
+ * Fetch the response time percentiles of the servers and stream as a result set
+ *
+ * @param dcb   DCB to which to stream result set
+ * @param tree  Potential like clause (currently unused)
+ */
+static void
+exec_show_serverLatency(DCB *dcb, MAXINFO_TREE *tree)
+{
+    RESULTSET   *set;
+
+    if ((set = serverGetLatencyList()) == NULL)
+    {
+        return;
+    }
+
+    resultset_stream_mysql(set, dcb);
+    resultset_free(set);
+}
+
+/**
+ * Fetch the response time percentiles of the services and stream as a result set
+ *
+ * @param dcb   DCB to which to stream result set
+ * @param tree  Potential like clause (currently unused)
+ */
+static void
+exec_show_serviceLatency(DCB *dcb, MAXINFO_TREE *tree)
+{
+    RESULTSET   *set;
+
+    if ((set = serviceGetLatencyList()) == NULL)
+    {
+        return;
+    }
+
+    resultset_stream_mysql(set, dcb);
+    resultset_free(set);
+}
+
+/**
+ * Fetch the statement digests of the services and stream as a result set
+ *
+ * @param dcb   DCB to which to stream result set
+ * @param tree  Potential like clause (currently unused)
+ */
+static void
+exec_show_digests(DCB *dcb, MAXINFO_TREE *tree)
+{
+    RESULTSET   *set;
+
+    if ((set = serviceGetDigestList()) == NULL)
+    {
+        return;
+    }
+
+    resultset_stream_mysql(set, dcb);
+    resultset_free(set);
+}
+
 /**
  * Fetch the list of modules and stream as a result set
  *
@@ -280,6 +340,9 @@ static struct
     { "modules", exec_show_modules },
     { "monitors", exec_show_monitors },
     { "eventTimes", exec_show_eventTimes },
+    { "serverLatency", exec_show_serverLatency },
+    { "serviceLatency", exec_show_serviceLatency },
+    { "digests", exec_show_digests },
     { NULL, NULL }
 };
 
@@ -995,7 +1058,7 @@ maxinfo_zombie_dcbs()
 /**
  * Interface to poll stats for reads
  */
-static int
+static int64_t
 maxinfo_read_events()
 {
     return poll_get_stat(POLL_STAT_READ);
@@ -1004,7 +1067,7 @@ maxinfo_read_events()
 /**
  * Interface to poll stats for writes
  */
-static int
+static int64_t
 maxinfo_write_events()
 {
     return poll_get_stat(POLL_STAT_WRITE);
@@ -1013,7 +1076,7 @@ maxinfo_write_events()
 /**
  * Interface to poll stats for errors
  */
-static int
+static int64_t
 maxinfo_error_events()
 {
     return poll_get_stat(POLL_STAT_ERROR);
@@ -1022,7 +1085,7 @@ maxinfo_error_events()
 /**
  * Interface to poll stats for hangup
  */
-static int
+static int64_t
 maxinfo_hangup_events()
 {
     return poll_get_stat(POLL_STAT_HANGUP);
@@ -1031,7 +1094,7 @@ maxinfo_hangup_events()
 /**
  * Interface to poll stats for accepts
  */
-static int
+static int64_t
 maxinfo_accept_events()
 {
     return poll_get_stat(POLL_STAT_ACCEPT);
@@ -1040,7 +1103,7 @@ maxinfo_accept_events()
 /**
  * Interface to poll stats for event queue length
  */
-static int
+static int64_t
 maxinfo_event_queue_length()
 {
     return poll_get_stat(POLL_STAT_EVQ_LEN);
@@ -1049,7 +1112,7 @@ maxinfo_event_queue_length()
 /**
  * Interface to poll stats for event pending queue length
  */
-static int
+static int64_t
 maxinfo_event_pending_queue_length()
 {
     return poll_get_stat(POLL_STAT_EVQ_PENDING);
@@ -1058,7 +1121,7 @@ maxinfo_event_pending_queue_length()
 /**
  * Interface to poll stats for max event queue length
  */
-static int
+static int64_t
 maxinfo_max_event_queue_length()
 {
     return poll_get_stat(POLL_STAT_EVQ_MAX);
@@ -1067,7 +1130,7 @@ maxinfo_max_event_queue_length()
 /**
  * Interface to poll stats for max queue time
  */
-static int
+static int64_t
 maxinfo_max_event_queue_time()
 {
     return poll_get_stat(POLL_STAT_MAX_QTIME);
@@ -1076,7 +1139,7 @@ maxinfo_max_event_queue_time()
 /**
  * Interface to poll stats for max event execution time
  */
-static int
+static int64_t
 maxinfo_max_event_exec_time()
 {
     return poll_get_stat(POLL_STAT_MAX_EXECTIME);
@@ -751,6 +751,16 @@ routeQuery(ROUTER *instance, void *router_session, GWBUF *queue)
     if (!rses_is_closed)
     {
         backend_dcb = router_cli_ses->backend_dcb;
+
+        /** Measure the latency of one query at a time */
+        if (backend_dcb && router_cli_ses->sent == 0 &&
+            mysql_command != MYSQL_COM_CHANGE_USER &&
+            mxs_mysql_command_has_reply(mysql_command))
+        {
+            mxs_mysql_reply_start(&router_cli_ses->reply, mysql_command);
+            router_cli_ses->sent = ts_stats_time_us();
+            router_cli_ses->first_byte = 0;
+        }
         /** unlock */
         rses_end_locked_router_action(router_cli_ses);
     }
@@ -862,7 +872,43 @@ diagnostics(ROUTER *router, DCB *dcb)
 static void
 clientReply(ROUTER *instance, void *router_session, GWBUF *queue, DCB *backend_dcb)
 {
+    ROUTER_INSTANCE *inst = (ROUTER_INSTANCE *) instance;
+    ROUTER_CLIENT_SES *router_cli_ses = (ROUTER_CLIENT_SES *) router_session;
+
     ss_dassert(backend_dcb->session->client_dcb != NULL);
+
+    if (router_cli_ses->sent)
+    {
+        int64_t now = ts_stats_time_us();
+        int64_t sent = 0;
+        int64_t first_byte = 0;
+
+        spinlock_acquire(&router_cli_ses->rses_lock);
+
+        if (router_cli_ses->sent)
+        {
+            if (router_cli_ses->first_byte == 0)
+            {
+                router_cli_ses->first_byte = now;
+            }
+
+            if (mxs_mysql_reply_process(&router_cli_ses->reply, queue))
+            {
+                sent = router_cli_ses->sent;
+                first_byte = router_cli_ses->first_byte - sent;
+                router_cli_ses->sent = 0;
+            }
+        }
+
+        spinlock_release(&router_cli_ses->rses_lock);
+
+        if (sent)
+        {
+            server_add_response_time(router_cli_ses->backend->server, first_byte, now - sent);
+            service_add_response_time(inst->service, first_byte, now - sent);
+        }
+    }
+
     SESSION_ROUTE_REPLY(backend_dcb->session, queue);
 }
 
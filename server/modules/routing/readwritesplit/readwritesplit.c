@@ -16,9 +16,18 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
 
 #include <router.h>
 #include <readwritesplit.h>
+#include <atomic.h>
+#include <random_jkiss.h>
+#include <statistics.h>
+#include <thread.h>
+#include <housekeeper.h>
 
 #include <mysql.h>
 #include <skygw_utils.h>
@@ -136,6 +145,8 @@ int bref_cmp_behind_master(const void *bref1, const void *bref2);
 
 int bref_cmp_current_load(const void *bref1, const void *bref2);
 
+int bref_cmp_response_time(const void *bref1, const void *bref2);
+
 /**
  * The order of functions _must_ match with the order the select criteria are
  * listed in select_criteria_t definition in readwritesplit.h
@@ -146,7 +157,8 @@ int (*criteria_cmpfun[LAST_CRITERIA])(const void *, const void *) =
     bref_cmp_global_conn,
     bref_cmp_router_conn,
     bref_cmp_behind_master,
-    bref_cmp_current_load
+    bref_cmp_current_load,
+    bref_cmp_response_time
 };
 
 static bool select_connect_backend_servers(backend_ref_t **p_master_ref,
@@ -161,6 +173,49 @@ static bool select_connect_backend_servers(backend_ref_t **p_master_ref,
 static bool get_dcb(DCB **dcb, ROUTER_CLIENT_SES *rses, backend_type_t btype,
                     char *name, int max_rlag);
 
+static backend_ref_t *get_adaptive_slave(ROUTER_CLIENT_SES *rses,
+                                         backend_ref_t *master_bref,
+                                         int max_rlag);
+
+static bool rses_connect_lazy_slave(ROUTER_CLIENT_SES *rses, int max_rlag);
+static bool rses_multiplex_idle(ROUTER_CLIENT_SES *rses);
+static bool multiplex_query_has_state(GWBUF *querybuf);
+static void rses_multiplex_release(ROUTER_CLIENT_SES *rses);
+static void rses_multiplex_acquire(ROUTER_CLIENT_SES *rses);
+static bool get_read_only_trx_dcb(DCB **p_dcb, ROUTER_CLIENT_SES *rses, int max_rlag);
+
+static void hedge_thread_start();
+static void rses_hedge_read(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *querybuf);
+static void rses_hedge_unlist(ROUTER_CLIENT_SES *rses);
+static void bref_hedge_won(ROUTER_CLIENT_SES *rses, backend_ref_t *bref);
+static GWBUF *bref_discard_hedged_reply(backend_ref_t *bref, GWBUF *writebuf);
+
+static bool bref_write_causal_read(ROUTER_CLIENT_SES *rses, backend_ref_t *bref,
+                                   GWBUF *querybuf);
+static void bref_queue_gtid_query(ROUTER_CLIENT_SES *rses, backend_ref_t *bref,
+                                  uint8_t command);
+static void bref_causal_passthrough(backend_ref_t *bref, uint8_t command);
+static GWBUF *bref_process_causal_reply(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
+                                        backend_ref_t *bref, GWBUF *writebuf);
+
+static int rses_ps_hashfn(void *key);
+static int rses_ps_cmpfn(void *key1, void *key2);
+static void *rses_ps_free(void *data);
+static uint32_t rses_ps_create(ROUTER_CLIENT_SES *rses, qc_query_type_t qtype);
+static rses_ps_t *rses_ps_get(ROUTER_CLIENT_SES *rses, GWBUF *querybuf);
+static backend_ref_t *rses_ps_target(ROUTER_CLIENT_SES *rses, rses_ps_t *ps,
+                                     mysql_server_cmd_t packet_type);
+static void rses_ps_close(ROUTER_CLIENT_SES *rses, rses_ps_t *ps);
+static void rses_ps_prepare_reply(ROUTER_CLIENT_SES *rses, backend_ref_t *bref,
+                                  uint32_t ps_id, GWBUF *reply);
+static void rses_ps_bref_closed(ROUTER_CLIENT_SES *rses, backend_ref_t *bref);
+static GWBUF *bref_ps_rewrite(ROUTER_CLIENT_SES *rses, backend_ref_t *bref,
+                              rses_ps_t *ps, GWBUF *querybuf);
+static GWBUF *bref_ps_rewrite_pending(ROUTER_CLIENT_SES *rses, backend_ref_t *bref,
+                                      GWBUF *pending);
+static backend_ref_t *rses_ps_backend(ROUTER_CLIENT_SES *rses, rses_ps_t *ps,
+                                      backend_ref_t *bref);
+
 static bool rwsplit_process_router_options(ROUTER_INSTANCE *router,
                                            char **options);
 
@@ -188,8 +243,13 @@ static void mysql_sescmd_done(mysql_sescmd_t *sescmd);
 static mysql_sescmd_t *mysql_sescmd_init(rses_property_t *rses_prop,
                                          GWBUF *sescmd_buf,
                                          unsigned char packet_type,
+                                         char *key,
                                          ROUTER_CLIENT_SES *rses);
 
+static char *sescmd_get_key(GWBUF *buf, unsigned char packet_type);
+
+static void rses_compact_sescmd_history(ROUTER_CLIENT_SES *rses, const char *key);
+
 static rses_property_t *mysql_sescmd_get_property(mysql_sescmd_t *scmd);
 
 static rses_property_t *rses_property_init(rses_property_type_t prop_type);
@@ -228,7 +288,7 @@ static void tracelog_routed_query(ROUTER_CLIENT_SES *rses, char *funcname,
 static bool route_session_write(ROUTER_CLIENT_SES *router_client_ses,
                                 GWBUF *querybuf, ROUTER_INSTANCE *inst,
                                 unsigned char packet_type,
-                                qc_query_type_t qtype);
+                                qc_query_type_t qtype, uint32_t ps_id);
 
 static void refreshInstance(ROUTER_INSTANCE *router, CONFIG_PARAMETER *param);
 
@@ -253,6 +313,31 @@ static bool have_enough_servers(ROUTER_CLIENT_SES **rses, const int nsrv,
 static SPINLOCK instlock;
 static ROUTER_INSTANCE *instances;
 
+/** Size of the prepared statement table of a session */
+#define RSES_PS_HASHSIZE      32
+
+/** The hedge thread sends the hedged reads once their delay has passed */
+#define HEDGE_TICK_MS         1
+/** How often the hedge thread checks for shutdown when there is nothing to hedge */
+#define HEDGE_IDLE_MS         100
+/** The smallest hedging delay, the resolution of the hedge thread */
+#define HEDGE_MIN_DELAY       1000
+/** How many response times a server must have before its reads are hedged */
+#define HEDGE_MIN_SAMPLES     100
+/** How often the hedging delay of a server is calculated */
+#define HEDGE_DELAY_REFRESH   1000000
+
+static SPINLOCK hedge_lock;
+static ROUTER_CLIENT_SES *hedge_list; /*< Sessions with a read that may be hedged */
+static bool hedge_thread_running;
+static pthread_mutex_t hedge_idle_lock; /*< Protects the idle wait of the hedge thread */
+static pthread_cond_t hedge_idle_cond; /*< Signaled when the hedge list stops being empty */
+static THREAD hedge_thr;
+
+static BACKEND_RANKING *router_get_ranking(ROUTER_INSTANCE *router,
+                                           select_criteria_t criteria);
+static void backend_ranking_release(BACKEND_RANKING *ranking);
+
 static int hashkeyfun(void *key);
 static int hashcmpfun(void *, void *);
 static bool check_for_multi_stmt(ROUTER_CLIENT_SES *rses, GWBUF *buf,
@@ -315,6 +400,11 @@ void ModuleInit()
     MXS_NOTICE("Initializing statemend-based read/write split router module.");
     spinlock_init(&instlock);
     instances = NULL;
+    spinlock_init(&hedge_lock);
+    hedge_list = NULL;
+    hedge_thread_running = false;
+    pthread_mutex_init(&hedge_idle_lock, NULL);
+    pthread_cond_init(&hedge_idle_cond, NULL);
 }
 
 /**
@@ -484,6 +574,7 @@ static inline void free_rwsplit_instance(ROUTER_INSTANCE *router)
             }
         }
         free(router->servers);
+        backend_ranking_release(router->ranking);
         free(router);
     }
 }
@@ -511,6 +602,7 @@ static ROUTER *createInstance(SERVICE *service, char **options)
     }
     router->service = service;
     spinlock_init(&router->lock);
+    spinlock_init(&router->ranking_lock);
 
     /** Calculate number of servers */
     sref = service->dbref;
@@ -640,6 +732,12 @@ static ROUTER *createInstance(SERVICE *service, char **options)
     /** Enable strict multistatement handling by default */
     router->rwsplit_config.rw_strict_multi_stmt = true;
 
+    /** Superseded session commands are removed from the history by default */
+    router->rwsplit_config.rw_compact_sescmd_hist = true;
+
+    router->rwsplit_config.rw_causal_reads_timeout = CONFIG_CAUSAL_READS_TIMEOUT;
+    router->rwsplit_config.rw_hedged_reads_percentile = CONFIG_HEDGED_READS_PERCENTILE;
+
     /** By default, the client connection is closed immediately when a master
      * failure is detected */
     router->rwsplit_config.rw_master_failure_mode = RW_FAIL_INSTANTLY;
@@ -651,6 +749,31 @@ static ROUTER *createInstance(SERVICE *service, char **options)
         return NULL;
     }
 
+    if (router->rwsplit_config.rw_hedged_reads)
+    {
+        hedge_thread_start();
+    }
+
+    /** Released slaves are connected again by the next read */
+    if (router->rwsplit_config.rw_multiplex)
+    {
+        for (int i = 0; router->servers[i]; i++)
+        {
+            SERVER *server = router->servers[i]->backend_server;
+
+            if (server->persistpoolmax <= 0)
+            {
+                MXS_ERROR("Service '%s' uses 'connection_multiplexing' but server '%s' "
+                          "has no connection pool. Set 'persistpoolmax' for the server.",
+                          service->name, server->unique_name);
+                free_rwsplit_instance(router);
+                return NULL;
+            }
+        }
+
+        router->rwsplit_config.rw_lazy_connect = true;
+    }
+
     /** These options cancel each other out */
     if (router->rwsplit_config.rw_disable_sescmd_hist &&
         router->rwsplit_config.rw_max_sescmd_history_size > 0)
@@ -862,6 +985,20 @@ static void *newSession(ROUTER *router_inst, SESSION *session)
     client_rses->rses_backend_ref = backend_ref;
     client_rses->rses_nbackends = router_nservers; /*< # of backend servers */
 
+    if (client_rses->rses_config.rw_ps_routing)
+    {
+        if ((client_rses->rses_ps = hashtable_alloc(RSES_PS_HASHSIZE, rses_ps_hashfn,
+                                                    rses_ps_cmpfn)) != NULL)
+        {
+            hashtable_memory_fns(client_rses->rses_ps, NULL, NULL, NULL, rses_ps_free);
+        }
+        else
+        {
+            /** Prepared statements are executed on the master */
+            client_rses->rses_config.rw_ps_routing = false;
+        }
+    }
+
     if (client_rses->rses_config.rw_max_slave_conn_percent)
     {
         int n_conn = 0;
@@ -989,6 +1126,9 @@ static void closeSession(ROUTER *instance, void *router_session)
                 }
             }
         }
+        /** The hedge thread must not see the session after it is freed */
+        rses_hedge_unlist(router_cli_ses);
+
         /** Unlock */
         rses_end_locked_router_action(router_cli_ses);
     }
@@ -1049,6 +1189,19 @@ static void freeSession(ROUTER *router_instance, void *router_client_session)
             p = q;
         }
     }
+    for (i = 0; i < router_cli_ses->rses_nbackends; i++)
+    {
+        gwbuf_free(router_cli_ses->rses_backend_ref[i].bref_causal_buf);
+        free(router_cli_ses->rses_backend_ref[i].bref_causal_pending);
+    }
+
+    gwbuf_free(router_cli_ses->rses_hedge_query);
+
+    if (router_cli_ses->rses_ps)
+    {
+        hashtable_free(router_cli_ses->rses_ps);
+    }
+
     /*
      * We are no longer in the linked list, free
      * all the memory and other resources associated
@@ -1091,6 +1244,27 @@ static void close_failed_bref(backend_ref_t *bref, bool fatal)
         gwbuf_free(bref->bref_pending_cmd);
         bref->bref_pending_cmd = NULL;
     }
+
+    if (bref->bref_causal_buf)
+    {
+        gwbuf_free(bref->bref_causal_buf);
+        bref->bref_causal_buf = NULL;
+    }
+
+    bref->bref_causal_state = CAUSAL_NONE;
+    bref->bref_causal_n_pending = 0;
+
+    /** The other backend of a hedged read now answers alone */
+    if (bref->bref_hedge_peer)
+    {
+        bref->bref_hedge_peer->bref_hedge_peer = NULL;
+        bref->bref_hedge_peer = NULL;
+    }
+
+    bref->bref_hedge_state = HEDGE_NONE;
+
+    /** A new connection must prepare the statements again */
+    rses_ps_bref_closed(bref->bref_sescmd_cur.scmd_cur_rses, bref);
 }
 
 /**
@@ -1169,6 +1343,19 @@ static bool get_dcb(DCB **p_dcb, ROUTER_CLIENT_SES *rses, backend_type_t btype,
     {
         backend_ref_t *candidate_bref = NULL;
 
+        if (rses->rses_config.rw_lazy_connect)
+        {
+            rses_connect_lazy_slave(rses, max_rlag);
+        }
+
+        if (rses->rses_config.rw_slave_select_criteria == ADAPTIVE_ROUTING &&
+            (candidate_bref = get_adaptive_slave(rses, master_bref, max_rlag)) != NULL)
+        {
+            *p_dcb = candidate_bref->bref_dcb;
+            succp = true;
+            goto return_succp;
+        }
+
         for (i = 0; i < rses->rses_nbackends; i++)
         {
             BACKEND *b = (&backend_ref[i])->bref_backend;
@@ -1302,6 +1489,98 @@ return_succp:
     return succp;
 }
 
+/**
+ * Check whether a backend can be used for reads with the adaptive routing
+ *
+ * @param rses        Router client session
+ * @param bref        Backend to check
+ * @param master_bref The master of the session
+ * @param max_rlag    Maximum allowed replication lag
+ *
+ * @return True if reads can be routed to the backend
+ */
+static bool bref_valid_for_adaptive_read(ROUTER_CLIENT_SES *rses, backend_ref_t *bref,
+                                         backend_ref_t *master_bref, int max_rlag)
+{
+    SERVER *srv = bref->bref_backend->backend_server;
+    SERVER server;
+    server.status = srv->status;
+
+    if (!BREF_IS_IN_USE(bref))
+    {
+        return false;
+    }
+    else if (SERVER_IS_MASTER(&server))
+    {
+        return bref == master_bref && rses->rses_config.rw_master_reads;
+    }
+
+    return SERVER_IS_SLAVE(&server) &&
+           (max_rlag == MAX_RLAG_UNDEFINED ||
+            (srv->rlag != MAX_RLAG_NOT_AVAILABLE && srv->rlag <= max_rlag));
+}
+
+/**
+ * Select a slave with the power of two random choices
+ *
+ * Two of the usable backends are picked at random and the one with the lower
+ * response time score is used. Always picking the best backend would make all
+ * sessions pile onto the same server until its statistics catch up, picking
+ * between two random ones spreads the load while still avoiding slow servers.
+ *
+ * @param rses        Router client session
+ * @param master_bref The master of the session
+ * @param max_rlag    Maximum allowed replication lag
+ *
+ * @return The selected backend or NULL if no backend can be used
+ */
+static backend_ref_t *get_adaptive_slave(ROUTER_CLIENT_SES *rses,
+                                         backend_ref_t *master_bref,
+                                         int max_rlag)
+{
+    backend_ref_t *backend_ref = rses->rses_backend_ref;
+    int n_valid = 0;
+
+    for (int i = 0; i < rses->rses_nbackends; i++)
+    {
+        if (bref_valid_for_adaptive_read(rses, &backend_ref[i], master_bref, max_rlag))
+        {
+            n_valid++;
+        }
+    }
+
+    if (n_valid == 0)
+    {
+        return NULL;
+    }
+
+    int first = random_jkiss() % n_valid;
+    int second = first;
+
+    if (n_valid > 1)
+    {
+        /** Pick a different backend for the second choice */
+        second = (first + 1 + random_jkiss() % (n_valid - 1)) % n_valid;
+    }
+
+    backend_ref_t *candidate = NULL;
+
+    for (int i = 0, n = 0; i < rses->rses_nbackends; i++)
+    {
+        if (bref_valid_for_adaptive_read(rses, &backend_ref[i], master_bref, max_rlag))
+        {
+            if (n == first || n == second)
+            {
+                candidate = check_candidate_bref(candidate, &backend_ref[i],
+                                                 ADAPTIVE_ROUTING);
+            }
+            n++;
+        }
+    }
+
+    return candidate;
+}
+
 /**
  * Find out which of the two backend servers has smaller value for select
  * criteria property.
@@ -1981,6 +2260,11 @@ static bool route_single_stmt(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
     bool succp = false;
     int rlag_max = MAX_RLAG_UNDEFINED;
     backend_type_t btype; /*< target backend type */
+    bool end_read_only_trx = false;
+    rses_ps_t *ps = NULL;
+    uint32_t ps_id = 0;
+    backend_ref_t *ps_bref = NULL;
+    GWBUF *ps_buf = NULL;
 
     ss_dassert(querybuf->next == NULL); // The buffer must be contiguous.
     ss_dassert(!GWBUF_IS_TYPE_UNDEFINED(querybuf));
@@ -2055,6 +2339,46 @@ static bool route_single_stmt(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
             goto retblock;
         }
 
+        /**
+         * A prepared statement is prepared in all backends and its executions
+         * are routed like the statement itself would be.
+         */
+        if (rses->rses_ps && packet_type == MYSQL_COM_STMT_PREPARE)
+        {
+            ps_id = rses_ps_create(rses, qtype);
+        }
+        else if (rses->rses_ps && (ps = rses_ps_get(rses, querybuf)) != NULL)
+        {
+            if (packet_type == MYSQL_COM_STMT_CLOSE)
+            {
+                rses_ps_close(rses, ps);
+                rses_end_locked_router_action(rses);
+                succp = true;
+                goto retblock;
+            }
+
+            ps_bref = rses_ps_target(rses, ps, packet_type);
+
+            if (packet_type == MYSQL_COM_STMT_EXECUTE && ps_bref == NULL)
+            {
+                qtype = (ps->ps_type & ~QUERY_TYPE_PREPARE_STMT) | QUERY_TYPE_EXEC_STMT;
+            }
+        }
+
+        if (rses->rses_config.rw_multiplex &&
+            ((packet_type == MYSQL_COM_STMT_PREPARE && rses->rses_ps == NULL) ||
+             QUERY_IS_TYPE(qtype, QUERY_TYPE_PREPARE_NAMED_STMT)))
+        {
+            /** The statement only exists in the connection it was prepared in */
+            rses->rses_multiplex_pinned = true;
+        }
+
+        if (rses->rses_config.rw_multiplex && !rses->rses_multiplex_pinned &&
+            packet_type == MYSQL_COM_QUERY && multiplex_query_has_state(querybuf))
+        {
+            rses->rses_multiplex_pinned = true;
+        }
+
         /** Check for multi-statement queries. If no master server is available
          * and a multi-statement is issued, an error is returned to the client
          * when the query is routed.
@@ -2121,6 +2445,19 @@ static bool route_single_stmt(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
                  QUERY_IS_TYPE(qtype, QUERY_TYPE_BEGIN_TRX))
         {
             rses->rses_transaction_active = true;
+
+            /**
+             * A READ ONLY transaction is routed to a slave. If the GTID of
+             * the latest write isn't known yet, the master is used instead.
+             */
+            if (rses->rses_config.rw_read_only_trx &&
+                QUERY_IS_TYPE(qtype, QUERY_TYPE_READONLY) &&
+                (!rses->rses_config.rw_causal_reads || rses->rses_master_ref == NULL ||
+                 rses->rses_master_ref->bref_causal_state == CAUSAL_NONE))
+            {
+                rses->rses_trx_read_only = true;
+                rses->rses_trx_target = NULL;
+            }
         }
         /**
          * Explicit COMMIT and ROLLBACK, implicit COMMIT.
@@ -2130,6 +2467,9 @@ static bool route_single_stmt(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
              QUERY_IS_TYPE(qtype, QUERY_TYPE_ROLLBACK)))
         {
             rses->rses_transaction_active = false;
+
+            /** The COMMIT still goes to the slave of the transaction */
+            end_read_only_trx = rses->rses_trx_read_only;
         }
         else if (!rses->rses_autocommit_enabled &&
                  QUERY_IS_TYPE(qtype, QUERY_TYPE_ENABLE_AUTOCOMMIT))
@@ -2183,6 +2523,34 @@ static bool route_single_stmt(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
          */
         route_target = get_route_target(rses, qtype, querybuf->hint);
 
+        if (route_target == TARGET_SLAVE && rses->rses_config.rw_causal_reads &&
+            rses->rses_master_ref && rses->rses_master_ref->bref_causal_state != CAUSAL_NONE)
+        {
+            /** The GTID of the latest write isn't known yet */
+            route_target = TARGET_MASTER;
+        }
+
+        if (rses->rses_trx_read_only && !TARGET_IS_ALL(route_target))
+        {
+            /** All statements of a READ ONLY transaction go to the same slave */
+            route_target = TARGET_SLAVE;
+        }
+
+        if (ps_id)
+        {
+            route_target = TARGET_ALL;
+        }
+        else if (ps_bref)
+        {
+            /** The command needs the state of an earlier command */
+            route_target = ps_bref == rses->rses_master_ref ? TARGET_MASTER : TARGET_SLAVE;
+        }
+        else if (ps && TARGET_IS_ALL(route_target))
+        {
+            /** Statements that modify the session state are executed on the master */
+            route_target = TARGET_MASTER;
+        }
+
         if (TARGET_IS_ALL(route_target))
         {
             /** Multiple, conflicting routing target. Return error */
@@ -2243,12 +2611,17 @@ static bool route_single_stmt(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
              * Router locking is done inside the function.
              */
             succp = route_session_write(rses, gwbuf_clone(querybuf), inst,
-                                        packet_type, qtype);
+                                        packet_type, qtype, ps_id);
 
             if (succp)
             {
                 atomic_add(&inst->stats.n_all, 1);
             }
+            else if (ps_id && rses_begin_locked_router_action(rses))
+            {
+                hashtable_delete(rses->rses_ps, (void *)(uintptr_t)ps_id);
+                rses_end_locked_router_action(rses);
+            }
             goto retblock;
         }
     }
@@ -2269,6 +2642,13 @@ static bool route_single_stmt(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
         goto retblock;
     }
 
+    /** Reads don't need the master of an idle session */
+    if (!TARGET_IS_SLAVE(route_target) || TARGET_IS_NAMED_SERVER(route_target) ||
+        TARGET_IS_RLAG_MAX(route_target))
+    {
+        rses_multiplex_acquire(rses);
+    }
+
     DCB *master_dcb = rses->rses_master_ref ? rses->rses_master_ref->bref_dcb : NULL;
 
     /**
@@ -2354,7 +2734,26 @@ static bool route_single_stmt(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
         /**
          * Search suitable backend server, get DCB in target_dcb
          */
-        succp = get_dcb(&target_dcb, rses, BE_SLAVE, NULL, rlag_max);
+        if (ps_bref)
+        {
+            target_dcb = ps_bref->bref_dcb;
+            succp = BREF_IS_IN_USE(ps_bref);
+        }
+        else if (rses->rses_trx_read_only)
+        {
+            succp = get_read_only_trx_dcb(&target_dcb, rses, rlag_max);
+        }
+        else
+        {
+            succp = get_dcb(&target_dcb, rses, BE_SLAVE, NULL, rlag_max);
+
+            if (!succp && rses->rses_master_released)
+            {
+                /** No slave could be connected, the master may accept the read */
+                rses_multiplex_acquire(rses);
+                succp = get_dcb(&target_dcb, rses, BE_SLAVE, NULL, rlag_max);
+            }
+        }
 
         if (succp)
         {
@@ -2411,6 +2810,21 @@ static bool route_single_stmt(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
         sescmd_cursor_t *scur;
 
         bref = get_bref_from_dcb(rses, target_dcb);
+
+        if (ps)
+        {
+            if ((bref = rses_ps_backend(rses, ps, bref)) == NULL)
+            {
+                MXS_ERROR("Prepared statement %u is not prepared in any of the "
+                          "backends it can be routed to.", ps->ps_id);
+                rses_end_locked_router_action(rses);
+                succp = false;
+                goto retblock;
+            }
+
+            target_dcb = bref->bref_dcb;
+        }
+
         scur = &bref->bref_sescmd_cur;
 
         ss_dassert(target_dcb != NULL);
@@ -2421,16 +2835,43 @@ static bool route_single_stmt(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
                  bref->bref_backend->backend_server->port);
         /**
          * Store current stmt if execution of previous session command
-         * hasn't completed yet.
+         * hasn't completed yet. The commands of a prepared statement also
+         * wait in the master until the ID of the statement is known. The
+         * ID is replaced when the command is sent.
          */
-        if (sescmd_cursor_is_active(scur) && bref != rses->rses_master_ref)
+        if (sescmd_cursor_is_active(scur) &&
+            (bref != rses->rses_master_ref ||
+             (ps && ps->ps_backend_ids[bref - rses->rses_backend_ref] == 0)))
         {
             bref->bref_pending_cmd = gwbuf_append(bref->bref_pending_cmd, gwbuf_clone(querybuf));
+
+            if (ps && packet_type == MYSQL_COM_STMT_EXECUTE)
+            {
+                ps->ps_exec_bref = bref;
+            }
+
             rses_end_locked_router_action(rses);
             goto retblock;
         }
 
-        if ((ret = target_dcb->func.write(target_dcb, gwbuf_clone(querybuf))) == 1)
+        if (ps && (ps_buf = bref_ps_rewrite(rses, bref, ps, querybuf)) != NULL)
+        {
+            querybuf = ps_buf;
+        }
+
+        if (rses->rses_config.rw_causal_reads && rses->rses_gtid[0] &&
+            bref != rses->rses_master_ref &&
+            (!rses->rses_transaction_active || QUERY_IS_TYPE(qtype, QUERY_TYPE_BEGIN_TRX)))
+        {
+            /** The read is sent once the slave has reached the GTID */
+            ret = bref_write_causal_read(rses, bref, querybuf);
+        }
+        else
+        {
+            ret = target_dcb->func.write(target_dcb, gwbuf_clone(querybuf));
+        }
+
+        if (ret == 1)
         {
             backend_ref_t *bref;
 
@@ -2441,6 +2882,43 @@ static bool route_single_stmt(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
             bref = get_bref_from_dcb(rses, target_dcb);
             bref_set_state(bref, BREF_QUERY_ACTIVE);
             bref_set_state(bref, BREF_WAITING_RESULT);
+
+            if (bref->bref_causal_state != CAUSAL_WAITING)
+            {
+                mxs_mysql_latency_start(&bref->bref_latency, querybuf);
+            }
+
+            if (ps && packet_type == MYSQL_COM_STMT_EXECUTE)
+            {
+                ps->ps_exec_bref = bref;
+
+                if (bref != rses->rses_master_ref)
+                {
+                    atomic_add(&inst->stats.n_ps_slave_exec, 1);
+                }
+            }
+
+            if (rses->rses_config.rw_hedged_reads && TARGET_IS_SLAVE(route_target) &&
+                packet_type == MYSQL_COM_QUERY && !rses->rses_transaction_active &&
+                bref != rses->rses_master_ref && bref->bref_causal_state == CAUSAL_NONE)
+            {
+                rses_hedge_read(rses, bref, querybuf);
+            }
+
+            /**
+             * Writes that are not part of an open transaction change the
+             * GTID that the following reads must wait for.
+             */
+            if (rses->rses_config.rw_causal_reads && bref == rses->rses_master_ref &&
+                !rses->rses_transaction_active && !QUERY_IS_TYPE(qtype, QUERY_TYPE_READ) &&
+                (packet_type == MYSQL_COM_QUERY || packet_type == MYSQL_COM_STMT_EXECUTE))
+            {
+                bref_queue_gtid_query(rses, bref, packet_type);
+            }
+            else if (!rses->rses_load_active && packet_type != MYSQL_COM_UNDEFINED)
+            {
+                bref_causal_passthrough(bref, packet_type);
+            }
         }
         else
         {
@@ -2451,6 +2929,11 @@ static bool route_single_stmt(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
     rses_end_locked_router_action(rses);
 
 retblock :
+    if (end_read_only_trx)
+    {
+        rses->rses_trx_read_only = false;
+        rses->rses_trx_target = NULL;
+    }
 #if defined(SS_DEBUG2)
     {
         char *canonical_query_str;
@@ -2464,6 +2947,10 @@ retblock :
         }
     }
 #endif
+    if (ps_buf)
+    {
+        gwbuf_free(ps_buf);
+    }
     return succp;
 }
 
@@ -2576,6 +3063,32 @@ static void diagnostic(ROUTER *instance, DCB *dcb)
                router->stats.n_slave, slave_pct);
     dcb_printf(dcb, "\tNumber of queries forwarded to all:   	%d (%.2f%%)\n",
                router->stats.n_all, all_pct);
+    dcb_printf(dcb, "\tSession commands in history:          	%d\n",
+               router->stats.n_sescmd);
+    dcb_printf(dcb, "\tMemory used by session command history:	%" PRId64 " bytes\n",
+               router->stats.n_sescmd_bytes);
+    dcb_printf(dcb, "\tSuperseded session commands removed:  	%d\n",
+               router->stats.n_sescmd_compacted);
+    dcb_printf(dcb, "\tSessions exceeding max_sescmd_history:	%d\n",
+               router->stats.n_sescmd_hist_exceeded);
+    dcb_printf(dcb, "\tSlave connections opened on demand:    	%d\n",
+               router->stats.n_lazy_connects);
+    dcb_printf(dcb, "\tReads that waited for the session GTID:	%d\n",
+               router->stats.n_causal_reads);
+    dcb_printf(dcb, "\tCausal reads routed to master:        	%d\n",
+               router->stats.n_causal_timeouts);
+    dcb_printf(dcb, "\tREAD ONLY transactions on slaves:     	%d\n",
+               router->stats.n_read_only_trx);
+    dcb_printf(dcb, "\tReads hedged to a second slave:       	%d\n",
+               router->stats.n_hedged_reads);
+    dcb_printf(dcb, "\tHedged reads answered by second slave:	%d\n",
+               router->stats.n_hedge_wins);
+    dcb_printf(dcb, "\tPrepared statements executed on slaves:	%d\n",
+               router->stats.n_ps_slave_exec);
+    dcb_printf(dcb, "\tBackend connections released when idle:	%d\n",
+               router->stats.n_multiplex_released);
+    dcb_printf(dcb, "\tMaster connections reacquired:         	%d\n",
+               router->stats.n_multiplex_acquired);
 
     if ((weightby = serviceGetWeightingParameter(router->service)) != NULL)
     {
@@ -2669,6 +3182,30 @@ static void clientReply(ROUTER *instance, void *router_session, GWBUF *writebuf,
 
     CHK_BACKEND_REF(bref);
     scur = &bref->bref_sescmd_cur;
+
+    if (bref->bref_hedge_state == HEDGE_DISCARD)
+    {
+        /** The other backend of the hedged read replied first */
+        if ((writebuf = bref_discard_hedged_reply(bref, writebuf)) == NULL)
+        {
+            rses_end_locked_router_action(router_cli_ses);
+            goto lock_failed;
+        }
+    }
+    else if (bref->bref_hedge_state != HEDGE_NONE)
+    {
+        bref_hedge_won(router_cli_ses, bref);
+    }
+
+    if (bref->bref_causal_state != CAUSAL_NONE &&
+        (writebuf = bref_process_causal_reply(router_inst, router_cli_ses,
+                                              bref, writebuf)) == NULL)
+    {
+        /** The whole reply was consumed by the router */
+        rses_end_locked_router_action(router_cli_ses);
+        goto lock_failed;
+    }
+
     /**
      * Active cursor means that reply is from session command
      * execution.
@@ -2730,11 +3267,17 @@ static void clientReply(ROUTER *instance, void *router_session, GWBUF *writebuf,
      * Clear BREF_QUERY_ACTIVE flag and decrease waiter counter.
      * This applies for queries  other than session commands.
      */
-    else if (BREF_IS_QUERY_ACTIVE(bref))
+    else
     {
-        bref_clear_state(bref, BREF_QUERY_ACTIVE);
-        /** Set response status as replied */
-        bref_clear_state(bref, BREF_WAITING_RESULT);
+        mxs_mysql_latency_track(&bref->bref_latency, writebuf, bref->bref_backend->backend_server,
+                                router_inst->service);
+
+        if (BREF_IS_QUERY_ACTIVE(bref))
+        {
+            bref_clear_state(bref, BREF_QUERY_ACTIVE);
+            /** Set response status as replied */
+            bref_clear_state(bref, BREF_WAITING_RESULT);
+        }
     }
 
     if (writebuf != NULL && client_dcb != NULL)
@@ -2775,8 +3318,23 @@ static void clientReply(ROUTER *instance, void *router_session, GWBUF *writebuf,
 
         CHK_GWBUF(bref->bref_pending_cmd);
 
-        if ((ret = bref->bref_dcb->func.write(bref->bref_dcb,
-                       gwbuf_clone(bref->bref_pending_cmd))) == 1)
+        if (router_cli_ses->rses_ps)
+        {
+            bref->bref_pending_cmd = bref_ps_rewrite_pending(router_cli_ses, bref,
+                                                             bref->bref_pending_cmd);
+        }
+
+        if (router_cli_ses->rses_config.rw_causal_reads && router_cli_ses->rses_gtid[0] &&
+            bref != router_cli_ses->rses_master_ref)
+        {
+            ret = bref_write_causal_read(router_cli_ses, bref, bref->bref_pending_cmd);
+        }
+        else
+        {
+            ret = bref->bref_dcb->func.write(bref->bref_dcb, gwbuf_clone(bref->bref_pending_cmd));
+        }
+
+        if (ret == 1)
         {
             ROUTER_INSTANCE* inst = (ROUTER_INSTANCE *)instance;
             atomic_add(&inst->stats.n_queries, 1);
@@ -2785,6 +3343,13 @@ static void clientReply(ROUTER *instance, void *router_session, GWBUF *writebuf,
              */
             bref_set_state(bref, BREF_QUERY_ACTIVE);
             bref_set_state(bref, BREF_WAITING_RESULT);
+
+            if (bref->bref_causal_state != CAUSAL_WAITING)
+            {
+                mxs_mysql_latency_start(&bref->bref_latency, bref->bref_pending_cmd);
+            }
+
+            bref_causal_passthrough(bref, MYSQL_GET_COMMAND((uint8_t *)GWBUF_DATA(bref->bref_pending_cmd)));
         }
         else
         {
@@ -2803,6 +3368,12 @@ static void clientReply(ROUTER *instance, void *router_session, GWBUF *writebuf,
         gwbuf_free(bref->bref_pending_cmd);
         bref->bref_pending_cmd = NULL;
     }
+
+    if (rses_multiplex_idle(router_cli_ses))
+    {
+        /** Let other sessions use the connections until the next statement */
+        rses_multiplex_release(router_cli_ses);
+    }
     /** Unlock router session */
     rses_end_locked_router_action(router_cli_ses);
 
@@ -2894,15 +3465,61 @@ int bref_cmp_current_load(const void *bref1, const void *bref2)
            ((1000 * s2->stats.n_current_ops) - b2->weight);
 }
 
-static void bref_clear_state(backend_ref_t *bref, bref_state_t state)
+/**
+ * Calculate the adaptive routing score of a backend
+ *
+ * The score is the expected time it takes for the server to respond: the
+ * average response time multiplied by the number of operations that are
+ * waiting for it, scaled by the weight of the server.
+ *
+ * @param b   The backend
+ * @param now Current time from ts_stats_time_us
+ * @return The score, smaller is better
+ */
+static int64_t bref_response_time_score(BACKEND *b, int64_t now)
 {
-    if (bref == NULL)
+    SERVER *srv = b->backend_server;
+    int64_t avg = server_get_response_time_avg(srv, now);
+
+    return (avg + 1) * (srv->stats.n_current_ops + 1) * 1000 / b->weight;
+}
+
+/** Compare the response time scores of backend servers */
+int bref_cmp_response_time(const void *bref1, const void *bref2)
+{
+    BACKEND *b1 = ((backend_ref_t *)bref1)->bref_backend;
+    BACKEND *b2 = ((backend_ref_t *)bref2)->bref_backend;
+
+    if (b1->weight == 0 && b2->weight == 0)
     {
-        MXS_ERROR("[%s] Error: NULL parameter.", __FUNCTION__);
-        return;
+        return b1->backend_server->stats.n_current_ops -
+               b2->backend_server->stats.n_current_ops;
     }
-
-    if ((state & BREF_WAITING_RESULT) && (bref->bref_state & BREF_WAITING_RESULT))
+    else if (b1->weight == 0)
+    {
+        return 1;
+    }
+    else if (b2->weight == 0)
+    {
+        return -1;
+    }
+
+    int64_t now = ts_stats_time_us();
+    int64_t score1 = bref_response_time_score(b1, now);
+    int64_t score2 = bref_response_time_score(b2, now);
+
+    return score1 < score2 ? -1 : (score1 > score2 ? 1 : 0);
+}
+
+static void bref_clear_state(backend_ref_t *bref, bref_state_t state)
+{
+    if (bref == NULL)
+    {
+        MXS_ERROR("[%s] Error: NULL parameter.", __FUNCTION__);
+        return;
+    }
+
+    if ((state & BREF_WAITING_RESULT) && (bref->bref_state & BREF_WAITING_RESULT))
     {
         int prev1;
         int prev2;
@@ -2931,6 +3548,376 @@ static void bref_clear_state(backend_ref_t *bref, bref_state_t state)
     bref->bref_state &= ~state;
 }
 
+/**
+ * Split the packets of one reply from the front of a buffer
+ *
+ * @param reply     Progress of the reply
+ * @param buffer    Buffer with complete packets, the packets that do not belong
+ *                  to the reply are left here
+ * @param value     If not NULL, the first column of the first row is copied here
+ * @param size      Size of @c value
+ * @return The packets of the reply that were in the buffer
+ */
+static GWBUF *causal_split_reply(mxs_mysql_reply_t *reply, GWBUF **buffer,
+                                 char *value, size_t size)
+{
+    GWBUF *head = NULL;
+    GWBUF *packet;
+
+    while (!mxs_mysql_reply_is_complete(reply) &&
+           (packet = modutil_get_next_MySQL_packet(buffer)) != NULL)
+    {
+        uint64_t rows = reply->rows;
+        mxs_mysql_reply_process(reply, packet);
+
+        if (value && rows == 0 && reply->rows == 1)
+        {
+            /** A length-encoded string shorter than 251 bytes, NULL is 0xfb */
+            uint8_t *data = GWBUF_DATA(packet) + MYSQL_HEADER_LEN;
+            size_t len = GWBUF_LENGTH(packet) - MYSQL_HEADER_LEN;
+
+            if (len > 0 && data[0] < 0xfb && data[0] < len && data[0] < size)
+            {
+                memcpy(value, data + 1, data[0]);
+                value[data[0]] = '\0';
+            }
+        }
+
+        head = gwbuf_append(head, packet);
+    }
+
+    return head;
+}
+
+/**
+ * Check that a GTID can be safely embedded into a query
+ *
+ * @param gtid The GTID
+ * @return True if the GTID only consists of numbers, dashes and commas
+ */
+static bool causal_gtid_is_valid(const char *gtid)
+{
+    if (*gtid == '\0')
+    {
+        return false;
+    }
+
+    for (const char *ptr = gtid; *ptr; ptr++)
+    {
+        if (!isdigit(*ptr) && *ptr != '-' && *ptr != ',')
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Queue a reply that the master sends after the reply to a GTID query that
+ * has not yet been read
+ *
+ * @param bref    The master
+ * @param command The command the reply is for
+ * @param gtid    Whether the reply is followed by the reply to a GTID query
+ * @return True if the reply was queued
+ */
+static bool bref_causal_push(backend_ref_t *bref, uint8_t command, bool gtid)
+{
+    if (bref->bref_causal_n_pending == bref->bref_causal_pending_size)
+    {
+        int size = bref->bref_causal_pending_size ? bref->bref_causal_pending_size * 2 : 4;
+        causal_pending_t *pending = realloc(bref->bref_causal_pending, size * sizeof(*pending));
+
+        if (pending == NULL)
+        {
+            return false;
+        }
+
+        bref->bref_causal_pending = pending;
+        bref->bref_causal_pending_size = size;
+    }
+
+    bref->bref_causal_pending[bref->bref_causal_n_pending].command = command;
+    bref->bref_causal_pending[bref->bref_causal_n_pending].gtid = gtid;
+    bref->bref_causal_n_pending++;
+
+    return true;
+}
+
+/**
+ * Start processing the next queued reply of the master
+ *
+ * @param bref The master
+ */
+static void bref_causal_next(backend_ref_t *bref)
+{
+    if (bref->bref_causal_n_pending > 0)
+    {
+        causal_pending_t next = bref->bref_causal_pending[0];
+
+        bref->bref_causal_n_pending--;
+        memmove(bref->bref_causal_pending, bref->bref_causal_pending + 1,
+                bref->bref_causal_n_pending * sizeof(causal_pending_t));
+        mxs_mysql_reply_start(&bref->bref_causal_reply, next.command);
+        bref->bref_causal_state = next.gtid ? CAUSAL_GTID_QUEUED : CAUSAL_GTID_PASSING;
+    }
+    else
+    {
+        bref->bref_causal_state = CAUSAL_NONE;
+    }
+}
+
+/**
+ * Track a command that was sent to the master while the reply to a GTID
+ * query is still pending so that its reply is not taken for the reply
+ * to a write
+ *
+ * @param bref    The backend the command was sent to
+ * @param command The command
+ */
+static void bref_causal_passthrough(backend_ref_t *bref, uint8_t command)
+{
+    if ((bref->bref_causal_state == CAUSAL_GTID_QUEUED ||
+         bref->bref_causal_state == CAUSAL_GTID_READING ||
+         bref->bref_causal_state == CAUSAL_GTID_PASSING) &&
+        mxs_mysql_command_has_reply(command) &&
+        !bref_causal_push(bref, command, false))
+    {
+        MXS_ERROR("Failed to allocate memory for tracking the replies of %s:%d.",
+                  bref->bref_backend->backend_server->name,
+                  bref->bref_backend->backend_server->port);
+    }
+}
+
+/**
+ * Send the query that reads the GTID of a write after the write itself
+ *
+ * The reply to the GTID query is removed from the replies of the master
+ * in bref_process_causal_reply. If earlier GTID queries are still pending,
+ * the write and its GTID query are queued behind them so that every write
+ * updates the GTID of the session.
+ *
+ * @param rses    Router client session
+ * @param bref    The master
+ * @param command The command of the write that was sent to the master
+ */
+static void bref_queue_gtid_query(ROUTER_CLIENT_SES *rses, backend_ref_t *bref,
+                                  uint8_t command)
+{
+    bool pending = bref->bref_causal_state != CAUSAL_NONE;
+
+    if (pending && !bref_causal_push(bref, command, true))
+    {
+        MXS_ERROR("Failed to allocate memory for tracking the replies of %s:%d.",
+                  bref->bref_backend->backend_server->name,
+                  bref->bref_backend->backend_server->port);
+        return;
+    }
+
+    GWBUF *query = modutil_create_query("SELECT @@last_gtid");
+
+    if (query && bref->bref_dcb->func.write(bref->bref_dcb, query) == 1)
+    {
+        if (!pending)
+        {
+            mxs_mysql_reply_start(&bref->bref_causal_reply, command);
+            bref->bref_causal_state = CAUSAL_GTID_QUEUED;
+        }
+    }
+    else
+    {
+        MXS_ERROR("Failed to send the GTID query to %s:%d.",
+                  bref->bref_backend->backend_server->name,
+                  bref->bref_backend->backend_server->port);
+
+        if (pending)
+        {
+            /** The reply to the write is still queued behind the others */
+            bref->bref_causal_pending[bref->bref_causal_n_pending - 1].gtid = false;
+        }
+    }
+}
+
+/**
+ * Send a read to a slave once it has replicated the latest write of the session
+ *
+ * A MASTER_GTID_WAIT is sent first and the read is stored until the reply
+ * to it arrives. The wait is wrapped into a statement that fails if the wait
+ * times out.
+ *
+ * @param rses     Router client session
+ * @param bref     The slave
+ * @param querybuf The read
+ * @return True if the wait was sent
+ */
+static bool bref_write_causal_read(ROUTER_CLIENT_SES *rses, backend_ref_t *bref,
+                                   GWBUF *querybuf)
+{
+    char sql[GTID_MAX_LEN + 256];
+    snprintf(sql, sizeof(sql), "SET @maxscale_causal_read = (SELECT CASE WHEN "
+             "MASTER_GTID_WAIT('%s', %d) = 0 THEN 1 ELSE "
+             "(SELECT 1 FROM INFORMATION_SCHEMA.ENGINES) END)",
+             rses->rses_gtid, rses->rses_config.rw_causal_reads_timeout);
+
+    GWBUF *query = modutil_create_query(sql);
+
+    if (query && bref->bref_dcb->func.write(bref->bref_dcb, query) == 1)
+    {
+        bref->bref_causal_buf = gwbuf_clone(querybuf);
+        mxs_mysql_reply_start(&bref->bref_causal_reply, MYSQL_COM_QUERY);
+        bref->bref_causal_state = CAUSAL_WAITING;
+        atomic_add(&rses->router->stats.n_causal_reads, 1);
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * Send a read whose GTID wait has completed
+ *
+ * If the slave didn't reach the GTID in time, the read is sent to the master.
+ *
+ * @param rses Router client session
+ * @param bref The slave that processed the wait
+ * @param read The read
+ */
+static void bref_route_causal_read(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *read)
+{
+    backend_ref_t *target = bref;
+
+    if (bref->bref_causal_reply.error)
+    {
+        backend_ref_t *master = rses->rses_master_ref;
+
+        if (bref->bref_causal_reply.error != ER_SUBQUERY_NO_1_ROW)
+        {
+            MXS_WARNING("Waiting for GTID '%s' on %s:%d failed with error %u, "
+                        "disabling causal reads for the session.", rses->rses_gtid,
+                        bref->bref_backend->backend_server->name,
+                        bref->bref_backend->backend_server->port,
+                        bref->bref_causal_reply.error);
+            rses->rses_config.rw_causal_reads = false;
+        }
+
+        atomic_add(&rses->router->stats.n_causal_timeouts, 1);
+
+        if (master && BREF_IS_IN_USE(master) &&
+            SERVER_IS_MASTER(master->bref_backend->backend_server))
+        {
+            target = master;
+            bref_clear_state(bref, BREF_QUERY_ACTIVE);
+            bref_clear_state(bref, BREF_WAITING_RESULT);
+            bref_set_state(master, BREF_QUERY_ACTIVE);
+            bref_set_state(master, BREF_WAITING_RESULT);
+        }
+        else
+        {
+            MXS_INFO("Slave %s:%d didn't reach GTID '%s' and no master is available, "
+                     "reading from the slave.", bref->bref_backend->backend_server->name,
+                     bref->bref_backend->backend_server->port, rses->rses_gtid);
+        }
+    }
+
+    if (target->bref_dcb->func.write(target->bref_dcb, gwbuf_clone(read)) == 1)
+    {
+        mxs_mysql_latency_start(&target->bref_latency, read);
+    }
+    else
+    {
+        MXS_ERROR("Failed to route causal read to %s:%d.",
+                  target->bref_backend->backend_server->name,
+                  target->bref_backend->backend_server->port);
+    }
+}
+
+/**
+ * Remove the replies to the queries added by causal_reads from the replies
+ * of a backend
+ *
+ * @param inst     Router instance
+ * @param rses     Router client session
+ * @param bref     Backend reference the reply came from
+ * @param writebuf Complete packets from the backend
+ * @return The packets that belong to the client or NULL if there are none
+ */
+static GWBUF *bref_process_causal_reply(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
+                                        backend_ref_t *bref, GWBUF *writebuf)
+{
+    GWBUF *head = NULL;
+
+    if (bref->bref_causal_state == CAUSAL_WAITING)
+    {
+        gwbuf_free(causal_split_reply(&bref->bref_causal_reply, &writebuf, NULL, 0));
+
+        if (mxs_mysql_reply_is_complete(&bref->bref_causal_reply))
+        {
+            GWBUF *read = bref->bref_causal_buf;
+            bref->bref_causal_buf = NULL;
+            bref->bref_causal_state = CAUSAL_NONE;
+            bref_route_causal_read(rses, bref, read);
+            gwbuf_free(read);
+        }
+
+        return writebuf;
+    }
+
+    while (writebuf && bref->bref_causal_state != CAUSAL_NONE)
+    {
+        if (bref->bref_causal_state == CAUSAL_GTID_READING)
+        {
+            gwbuf_free(causal_split_reply(&bref->bref_causal_reply, &writebuf,
+                                          bref->bref_causal_gtid,
+                                          sizeof(bref->bref_causal_gtid)));
+
+            if (mxs_mysql_reply_is_complete(&bref->bref_causal_reply))
+            {
+                if (bref->bref_causal_reply.error)
+                {
+                    MXS_WARNING("Failed to read the GTID of a write from %s:%d, error %u. "
+                                "Disabling causal reads for the session.",
+                                bref->bref_backend->backend_server->name,
+                                bref->bref_backend->backend_server->port,
+                                bref->bref_causal_reply.error);
+                    rses->rses_config.rw_causal_reads = false;
+                }
+                else if (causal_gtid_is_valid(bref->bref_causal_gtid))
+                {
+                    strcpy(rses->rses_gtid, bref->bref_causal_gtid);
+                }
+
+                bref_causal_next(bref);
+            }
+        }
+        else
+        {
+            /**
+             * The reply to a write, which is followed by the reply to its
+             * GTID query, or a reply that precedes a queued GTID query
+             */
+            head = gwbuf_append(head, causal_split_reply(&bref->bref_causal_reply,
+                                                         &writebuf, NULL, 0));
+
+            if (mxs_mysql_reply_is_complete(&bref->bref_causal_reply))
+            {
+                if (bref->bref_causal_state == CAUSAL_GTID_QUEUED)
+                {
+                    mxs_mysql_reply_start(&bref->bref_causal_reply, MYSQL_COM_QUERY);
+                    bref->bref_causal_gtid[0] = '\0';
+                    bref->bref_causal_state = CAUSAL_GTID_READING;
+                }
+                else
+                {
+                    bref_causal_next(bref);
+                }
+            }
+        }
+    }
+
+    return gwbuf_append(head, writebuf);
+}
+
 static void bref_set_state(backend_ref_t *bref, bref_state_t state)
 {
     if (bref == NULL)
@@ -2999,6 +3986,7 @@ bool connect_server(backend_ref_t *bref, SESSION *session, bool execute_history)
             dcb_add_callback(bref->bref_dcb, DCB_REASON_NOT_RESPONDING,
                              &router_handle_state_switch, (void *) bref);
             bref->bref_state = 0;
+            bref->bref_latency.sent = 0;
             bref_set_state(bref, BREF_IN_USE);
             atomic_add(&bref->bref_backend->backend_conn_count, 1);
             rval = true;
@@ -3038,7 +4026,8 @@ void log_server_connections(select_criteria_t select_criteria,
     if (select_criteria == LEAST_GLOBAL_CONNECTIONS ||
         select_criteria == LEAST_ROUTER_CONNECTIONS ||
         select_criteria == LEAST_BEHIND_MASTER ||
-        select_criteria == LEAST_CURRENT_OPERATIONS)
+        select_criteria == LEAST_CURRENT_OPERATIONS ||
+        select_criteria == ADAPTIVE_ROUTING)
     {
         MXS_INFO("Servers and %s connection counts:",
                  select_criteria == LEAST_GLOBAL_CONNECTIONS ? "all MaxScale"
@@ -3069,6 +4058,14 @@ void log_server_connections(select_criteria_t select_criteria,
                              STRSRVSTATUS(b->backend_server));
                     break;
 
+                case ADAPTIVE_ROUTING:
+                    MXS_INFO("average response time : %" PRId64 " us, current operations : %d in \t%s:%d %s",
+                             server_get_response_time_avg(b->backend_server, ts_stats_time_us()),
+                             b->backend_server->stats.n_current_ops,
+                             b->backend_server->name, b->backend_server->port,
+                             STRSRVSTATUS(b->backend_server));
+                    break;
+
                 case LEAST_BEHIND_MASTER:
                     MXS_INFO("replication lag : %d in \t%s:%d %s",
                              b->backend_server->rlag, b->backend_server->name,
@@ -3108,79 +4105,362 @@ static bool bref_valid_for_slave(const backend_ref_t *bref, const SERVER *master
 }
 
 /**
- * @brief Find the best slave candidate
+ * @brief Calculate the rank of a backend according to a selection criteria
  *
- * This function iterates through @c bref and tries to find the best backend
- * reference that is not in use. @c cmpfun will be called to compare the backends.
+ * The scores order the backends the same way as the comparison functions
+ * in criteria_cmpfun. Servers without a weight are ranked after all
+ * weighted servers.
  *
- * @param bref Backend reference
- * @param n Size of @c bref
- * @param master The master server
- * @param cmpfun qsort() compatible comparison function
- * @return The best slave backend reference or NULL if no candidates could be found
+ * @param b        The backend
+ * @param criteria The slave selection criteria
+ * @param now      Current time from ts_stats_time_us
+ * @return The score, smaller is better
  */
-backend_ref_t* get_slave_candidate(backend_ref_t *bref, int n, const SERVER *master,
-                                   int (*cmpfun)(const void *, const void *))
+static int64_t backend_rank_score(BACKEND *b, select_criteria_t criteria, int64_t now)
 {
-    backend_ref_t *candidate = NULL;
+    SERVER *srv = b->backend_server;
+    const int64_t unweighted = INT64_C(1) << 62;
 
-    for (int i = 0; i < n; i++)
+    switch (criteria)
     {
-        if (!BREF_IS_IN_USE(&bref[i]) &&
-            bref_valid_for_connect(&bref[i]) &&
-            bref_valid_for_slave(&bref[i], master))
-        {
-            if (candidate)
-            {
-                if (cmpfun(candidate, &bref[i]) > 0)
-                {
-                    candidate = &bref[i];
-                }
-            }
-            else
-            {
-                candidate = &bref[i];
-            }
-        }
-    }
+        case LEAST_BEHIND_MASTER:
+            return srv->rlag;
 
-    return candidate;
+        case LEAST_GLOBAL_CONNECTIONS:
+            return b->weight == 0 ? unweighted + srv->stats.n_current :
+                   (1000 + 1000 * srv->stats.n_current) / b->weight;
+
+        case LEAST_ROUTER_CONNECTIONS:
+            return b->weight == 0 ? unweighted + srv->stats.n_current :
+                   (1000 + 1000 * b->backend_conn_count) / b->weight;
+
+        case ADAPTIVE_ROUTING:
+            return b->weight == 0 ? unweighted + srv->stats.n_current_ops :
+                   bref_response_time_score(b, now);
+
+        case LEAST_CURRENT_OPERATIONS:
+        default:
+            return b->weight == 0 ? unweighted + srv->stats.n_current :
+                   (1000 * srv->stats.n_current_ops) - b->weight;
+    }
 }
 
 /**
- * @brief Search suitable backend servers from those of router instance
+ * @brief Get the load of a backend that affects its rank
  *
- * It is assumed that there is only one master among servers of a router instance.
- * As a result, the first master found is chosen. There will possibly be more
- * backend references than connected backends because only those in correct state
- * are connected to.
+ * Connecting a session to a server changes its load, so a ranking made
+ * before the connection must not be used for the next session.
  *
- * @param p_master_ref Pointer to location where master's backend reference is to  be stored
- * @param backend_ref Pointer to backend server reference object array
- * @param router_nservers Number of backend server pointers pointed to by @p backend_ref
- * @param max_nslaves Upper limit for the number of slaves
- * @param max_slave_rlag Maximum allowed replication lag for any slave
- * @param select_criteria Slave selection criteria
- * @param session Client session
- * @param router Router instance
- * @return true, if at least one master and one slave was found.
+ * @param b        The backend
+ * @param criteria The slave selection criteria
+ * @return The load of the backend
  */
-static bool select_connect_backend_servers(backend_ref_t **p_master_ref,
-                                           backend_ref_t *backend_ref,
-                                           int router_nservers, int max_nslaves,
-                                           int max_slave_rlag,
-                                           select_criteria_t select_criteria,
-                                           SESSION *session,
-                                           ROUTER_INSTANCE *router,
-                                           bool active_session)
+static int64_t backend_rank_load(BACKEND *b, select_criteria_t criteria)
 {
-    if (p_master_ref == NULL || backend_ref == NULL)
-    {
-        MXS_ERROR("Master reference (%p) or backend reference (%p) is NULL.",
-                  p_master_ref, backend_ref);
-        ss_dassert(false);
-        return false;
-    }
+    /** The response time averages only change between heartbeats */
+    return criteria == ADAPTIVE_ROUTING ? b->backend_server->stats.n_current_ops :
+           backend_rank_score(b, criteria, 0);
+}
+
+/** A server and its score, used when a ranking is created */
+typedef struct
+{
+    int64_t score;
+    int     index;
+} rank_entry_t;
+
+static int rank_entry_cmp(const void *a, const void *b)
+{
+    const rank_entry_t *e1 = (const rank_entry_t *)a;
+    const rank_entry_t *e2 = (const rank_entry_t *)b;
+
+    if (e1->score != e2->score)
+    {
+        return e1->score < e2->score ? -1 : 1;
+    }
+
+    return e1->index - e2->index;
+}
+
+/**
+ * @brief Create a ranking of the servers of a router
+ *
+ * @param router   Router instance
+ * @param criteria The slave selection criteria
+ * @return New ranking with one reference or NULL if memory allocation failed
+ */
+static BACKEND_RANKING *backend_ranking_create(ROUTER_INSTANCE *router,
+                                               select_criteria_t criteria)
+{
+    int n = router_get_servercount(router);
+    BACKEND_RANKING *ranking = malloc(sizeof(BACKEND_RANKING));
+    rank_entry_t *entries = malloc(sizeof(rank_entry_t) * (n + 1));
+    int *order = malloc(sizeof(int) * (n + 1));
+    unsigned int *status = malloc(sizeof(unsigned int) * (n + 1));
+    int64_t *load = malloc(sizeof(int64_t) * (n + 1));
+
+    if (ranking == NULL || entries == NULL || order == NULL || status == NULL || load == NULL)
+    {
+        free(ranking);
+        free(entries);
+        free(order);
+        free(status);
+        free(load);
+        return NULL;
+    }
+
+    int64_t now = ts_stats_time_us();
+
+    for (int i = 0; i < n; i++)
+    {
+        status[i] = router->servers[i]->backend_server->status;
+        load[i] = backend_rank_load(router->servers[i], criteria);
+        entries[i].score = backend_rank_score(router->servers[i], criteria, now);
+        entries[i].index = i;
+    }
+
+    qsort(entries, n, sizeof(rank_entry_t), rank_entry_cmp);
+
+    for (int i = 0; i < n; i++)
+    {
+        order[i] = entries[i].index;
+    }
+
+    free(entries);
+    ranking->refcount = 1;
+    ranking->criteria = criteria;
+    ranking->heartbeat = hkheartbeat;
+    ranking->n_servers = n;
+    ranking->order = order;
+    ranking->status = status;
+    ranking->load = load;
+
+    return ranking;
+}
+
+/**
+ * @brief Release a reference to a ranking
+ *
+ * @param ranking Ranking to release, may be NULL
+ */
+static void backend_ranking_release(BACKEND_RANKING *ranking)
+{
+    if (ranking && atomic_add(&ranking->refcount, -1) == 1)
+    {
+        free(ranking->order);
+        free(ranking->status);
+        free(ranking->load);
+        free(ranking);
+    }
+}
+
+/**
+ * @brief Check whether a ranking must be replaced
+ *
+ * The scores of the servers are refreshed on every housekeeper heartbeat and
+ * the order is recalculated at once if the state or the load of a server
+ * changes. This keeps a burst of new sessions from all picking the server
+ * that was the best one before the burst.
+ *
+ * @param router   Router instance
+ * @param ranking  The current ranking
+ * @param criteria The slave selection criteria
+ * @return True if a new ranking should be created
+ */
+static bool backend_ranking_is_stale(ROUTER_INSTANCE *router, BACKEND_RANKING *ranking,
+                                     select_criteria_t criteria)
+{
+    if (ranking->criteria != criteria || ranking->heartbeat != hkheartbeat)
+    {
+        return true;
+    }
+
+    for (int i = 0; i < ranking->n_servers; i++)
+    {
+        if (router->servers[i]->backend_server->status != ranking->status[i] ||
+            backend_rank_load(router->servers[i], criteria) != ranking->load[i])
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Take a reference to the current ranking of a router
+ *
+ * @param router Router instance
+ * @return A reference to the current ranking or NULL if there is none
+ */
+static BACKEND_RANKING *router_ranking_acquire(ROUTER_INSTANCE *router)
+{
+    spinlock_acquire(&router->ranking_lock);
+    BACKEND_RANKING *ranking = router->ranking;
+
+    if (ranking)
+    {
+        atomic_add(&ranking->refcount, 1);
+    }
+
+    spinlock_release(&router->ranking_lock);
+
+    return ranking;
+}
+
+/**
+ * @brief Get the current ranking of the servers of a router
+ *
+ * A stale ranking is replaced by the first session that notices it. Sessions
+ * that find the ranking stale while another session is making a new one get
+ * no ranking and compare the current statistics of the servers instead.
+ *
+ * @param router   Router instance
+ * @param criteria The slave selection criteria
+ * @return A reference to the ranking or NULL if none is available. The
+ *         reference must be released with backend_ranking_release.
+ */
+static BACKEND_RANKING *router_get_ranking(ROUTER_INSTANCE *router,
+                                           select_criteria_t criteria)
+{
+    BACKEND_RANKING *ranking = router_ranking_acquire(router);
+
+    if (ranking == NULL || backend_ranking_is_stale(router, ranking, criteria))
+    {
+        BACKEND_RANKING *fresh = NULL;
+
+        if (atomic_add(&router->ranking_rebuild, 1) == 0 &&
+            (fresh = backend_ranking_create(router, criteria)))
+        {
+            /** One reference for the router and one for the caller */
+            fresh->refcount = 2;
+
+            spinlock_acquire(&router->ranking_lock);
+            BACKEND_RANKING *old = router->ranking;
+            router->ranking = fresh;
+            spinlock_release(&router->ranking_lock);
+
+            backend_ranking_release(old);
+        }
+
+        atomic_add(&router->ranking_rebuild, -1);
+        backend_ranking_release(ranking);
+        ranking = fresh;
+    }
+
+    return ranking;
+}
+
+/**
+ * @brief Check whether a backend reference can be connected to as a slave
+ *
+ * @param bref     Backend reference
+ * @param master   The master server
+ * @param max_rlag Maximum allowed replication lag
+ * @return True if the backend is not in use and is a valid slave
+ */
+static bool bref_is_slave_candidate(const backend_ref_t *bref, const SERVER *master,
+                                    int max_rlag)
+{
+    SERVER *serv = bref->bref_backend->backend_server;
+
+    return !BREF_IS_IN_USE(bref) &&
+        bref_valid_for_connect(bref) &&
+        bref_valid_for_slave(bref, master) &&
+        (max_rlag == MAX_RLAG_UNDEFINED ||
+         (serv->rlag != MAX_RLAG_NOT_AVAILABLE && serv->rlag <= max_rlag));
+}
+
+/**
+ * @brief Find the best slave candidate
+ *
+ * The first backend reference in the order of @c ranking that is not in use
+ * is returned. The servers of @c bref must be in the same order as the servers
+ * of the router. If no ranking is available, all references are compared with
+ * @c cmpfun.
+ *
+ * @param bref Backend reference
+ * @param n Size of @c bref
+ * @param master The master server
+ * @param cmpfun qsort() compatible comparison function
+ * @param ranking The ranking of the servers or NULL
+ * @param max_rlag Maximum allowed replication lag
+ * @return The best slave backend reference or NULL if no candidates could be found
+ */
+backend_ref_t* get_slave_candidate(backend_ref_t *bref, int n, const SERVER *master,
+                                   int (*cmpfun)(const void *, const void *),
+                                   BACKEND_RANKING *ranking, int max_rlag)
+{
+    backend_ref_t *candidate = NULL;
+
+    if (ranking && ranking->n_servers == n)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            if (bref_is_slave_candidate(&bref[ranking->order[i]], master, max_rlag))
+            {
+                return &bref[ranking->order[i]];
+            }
+        }
+
+        return NULL;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        if (bref_is_slave_candidate(&bref[i], master, max_rlag))
+        {
+            if (candidate)
+            {
+                if (cmpfun(candidate, &bref[i]) > 0)
+                {
+                    candidate = &bref[i];
+                }
+            }
+            else
+            {
+                candidate = &bref[i];
+            }
+        }
+    }
+
+    return candidate;
+}
+
+/**
+ * @brief Search suitable backend servers from those of router instance
+ *
+ * It is assumed that there is only one master among servers of a router instance.
+ * As a result, the first master found is chosen. There will possibly be more
+ * backend references than connected backends because only those in correct state
+ * are connected to.
+ *
+ * @param p_master_ref Pointer to location where master's backend reference is to  be stored
+ * @param backend_ref Pointer to backend server reference object array
+ * @param router_nservers Number of backend server pointers pointed to by @p backend_ref
+ * @param max_nslaves Upper limit for the number of slaves
+ * @param max_slave_rlag Maximum allowed replication lag for any slave
+ * @param select_criteria Slave selection criteria
+ * @param session Client session
+ * @param router Router instance
+ * @return true, if at least one master and one slave was found.
+ */
+static bool select_connect_backend_servers(backend_ref_t **p_master_ref,
+                                           backend_ref_t *backend_ref,
+                                           int router_nservers, int max_nslaves,
+                                           int max_slave_rlag,
+                                           select_criteria_t select_criteria,
+                                           SESSION *session,
+                                           ROUTER_INSTANCE *router,
+                                           bool active_session)
+{
+    if (p_master_ref == NULL || backend_ref == NULL)
+    {
+        MXS_ERROR("Master reference (%p) or backend reference (%p) is NULL.",
+                  p_master_ref, backend_ref);
+        ss_dassert(false);
+        return false;
+    }
 
     /* get the root Master */
     BACKEND *master_backend = get_root_master(backend_ref, router_nservers);
@@ -3205,6 +4485,14 @@ static bool select_connect_backend_servers(backend_ref_t **p_master_ref,
      */
     bool master_connected = active_session || *p_master_ref != NULL;
 
+    /**
+     * With lazy connections, slaves are connected when the first read is
+     * routed to them. The session command history is needed to bring their
+     * session state up to date so without it the slaves are connected now.
+     */
+    bool lazy_slaves = router->rwsplit_config.rw_lazy_connect &&
+                       !router->rwsplit_config.rw_disable_sescmd_hist;
+
     /** Check slave selection criteria and set compare function */
     int (*p)(const void *, const void *) = criteria_cmpfun[select_criteria];
     ss_dassert(p);
@@ -3263,7 +4551,15 @@ static bool select_connect_backend_servers(backend_ref_t **p_master_ref,
                   "a maximum of %d connected slaves.", slaves_found, max_nslaves);
     }
 
-    backend_ref_t *bref = get_slave_candidate(backend_ref, router_nservers, master_host, p);
+    BACKEND_RANKING *ranking = router_get_ranking(router, select_criteria);
+    backend_ref_t *bref = get_slave_candidate(backend_ref, router_nservers, master_host,
+                                              p, ranking, MAX_RLAG_UNDEFINED);
+
+    if (lazy_slaves && *p_master_ref && BREF_IS_IN_USE(*p_master_ref))
+    {
+        /** Slaves are connected by rses_connect_lazy_slave */
+        bref = NULL;
+    }
 
     /** Connect to all possible slaves */
     while (bref && slaves_connected < max_nslaves)
@@ -3278,9 +4574,12 @@ static bool select_connect_backend_servers(backend_ref_t **p_master_ref,
             bref_set_state(bref, BREF_FATAL_FAILURE);
         }
 
-        bref = get_slave_candidate(backend_ref, router_nservers, master_host, p);
+        bref = get_slave_candidate(backend_ref, router_nservers, master_host,
+                                   p, ranking, MAX_RLAG_UNDEFINED);
     }
 
+    backend_ranking_release(ranking);
+
     /**
      * Successful cases
      */
@@ -3309,195 +4608,1689 @@ static bool select_connect_backend_servers(backend_ref_t **p_master_ref,
             } /* for */
         }
     }
-        /** Failure cases */
-    else
+        /** Failure cases */
+    else
+    {
+        MXS_ERROR("Couldn't establish required amount of slave connections for "
+                  "router session. Would need between %d and %d slaves but only have %d.",
+                  min_nslaves, max_nslaves, slaves_connected);
+
+        /** Clean up connections */
+        for (int i = 0; i < router_nservers; i++)
+        {
+            if (BREF_IS_IN_USE((&backend_ref[i])))
+            {
+                ss_dassert(backend_ref[i].bref_backend->backend_conn_count > 0);
+
+                close_failed_bref(&backend_ref[i], true);
+
+                /** Decrease backend's connection counter. */
+                atomic_add(&backend_ref[i].bref_backend->backend_conn_count, -1);
+                RW_CHK_DCB(&backend_ref[i], backend_ref[i].bref_dcb);
+                dcb_close(backend_ref[i].bref_dcb);
+                RW_CLOSE_BREF(&backend_ref[i]);
+            }
+        }
+    }
+
+    return succp;
+}
+
+/**
+ * @brief Connect a slave when the first read is routed to one
+ *
+ * A slave is only connected if the session has no slave that could be used
+ * for reads and the session isn't already using the maximum number of slaves.
+ * The session command history is executed on the new connection and the
+ * read is queued until the slave has replied to all of the session commands.
+ *
+ * @param rses     Router client session
+ * @param max_rlag Maximum allowed replication lag
+ * @return True if a new slave was connected
+ */
+static bool rses_connect_lazy_slave(ROUTER_CLIENT_SES *rses, int max_rlag)
+{
+    if (rses->rses_config.rw_disable_sescmd_hist)
+    {
+        /** The session state of a new connection can't be restored */
+        return false;
+    }
+
+    backend_ref_t *backend_ref = rses->rses_backend_ref;
+    backend_ref_t *master_bref = rses->rses_master_ref;
+    SERVER *master_host = master_bref ? master_bref->bref_backend->backend_server : NULL;
+    int max_nslaves = rses_get_max_slavecount(rses, rses->rses_nbackends);
+    int slaves_connected = 0;
+
+    for (int i = 0; i < rses->rses_nbackends; i++)
+    {
+        SERVER *serv = backend_ref[i].bref_backend->backend_server;
+
+        if (BREF_IS_IN_USE(&backend_ref[i]) && bref_valid_for_slave(&backend_ref[i], master_host))
+        {
+            if (max_rlag == MAX_RLAG_UNDEFINED ||
+                (serv->rlag != MAX_RLAG_NOT_AVAILABLE && serv->rlag <= max_rlag))
+            {
+                /** A usable slave is already connected */
+                return false;
+            }
+            slaves_connected++;
+        }
+    }
+
+    if (slaves_connected >= max_nslaves)
+    {
+        return false;
+    }
+
+    select_criteria_t criteria = rses->rses_config.rw_slave_select_criteria;
+    int (*p)(const void *, const void *) = criteria_cmpfun[criteria];
+    SESSION *session = rses->client_dcb->session;
+    BACKEND_RANKING *ranking = router_get_ranking(rses->router, criteria);
+    backend_ref_t *candidate;
+    bool rval = false;
+
+    while (!rval && (candidate = get_slave_candidate(backend_ref, rses->rses_nbackends,
+                                                     master_host, p, ranking, max_rlag)))
+    {
+        if (connect_server(candidate, session, true))
+        {
+            atomic_add(&rses->router->stats.n_lazy_connects, 1);
+            MXS_INFO("Connected to slave %s:%d on demand",
+                     candidate->bref_backend->backend_server->name,
+                     candidate->bref_backend->backend_server->port);
+            rval = true;
+        }
+        else
+        {
+            /** Failed to connect, mark server as failed */
+            bref_set_state(candidate, BREF_FATAL_FAILURE);
+        }
+    }
+
+    backend_ranking_release(ranking);
+    return rval;
+}
+
+/**
+ * Words of SQL statements that create or read session state which the session
+ * command history can't restore on a new connection
+ */
+static const char *multiplex_state_words[] =
+{
+    "LAST_INSERT_ID",
+    "ROW_COUNT",
+    "FOUND_ROWS",
+    "GET_LOCK",
+    "WARNINGS",
+    "ERRORS",
+    "WARNING_COUNT",
+    "ERROR_COUNT",
+    "TEMPORARY",
+    NULL
+};
+
+/**
+ * @brief Check whether a query uses session state that multiplexing would lose
+ *
+ * The check is a plain text search so it also matches identifiers that contain
+ * the words. That only keeps the connections of the session open.
+ *
+ * @param querybuf A COM_QUERY packet
+ * @return True if the session must keep its connections
+ */
+static bool multiplex_query_has_state(GWBUF *querybuf)
+{
+    char *sql = modutil_get_SQL(querybuf);
+    bool rval = false;
+
+    if (sql == NULL)
+    {
+        /** Be safe if the query can't be inspected */
+        return true;
+    }
+
+    for (int i = 0; multiplex_state_words[i] && !rval; i++)
+    {
+        rval = strcasestr(sql, multiplex_state_words[i]) != NULL;
+    }
+
+    free(sql);
+
+    return rval;
+}
+
+/**
+ * @brief Check whether the backend connections of a session can be closed
+ *
+ * The connections can be closed between transactions if the session state
+ * can be restored on a new connection by executing the session command
+ * history. State that isn't in the history, like temporary tables and
+ * prepared statements, keeps the connections open. A session that has
+ * generated an auto-increment value keeps its connections for good as
+ * LAST_INSERT_ID() could be read at any time. Warnings of the previous
+ * statement keep the connections until the next statement.
+ *
+ * Router session must be locked.
+ *
+ * @param rses Router client session
+ * @return True if no backend has anything in progress for the session
+ */
+static bool rses_multiplex_idle(ROUTER_CLIENT_SES *rses)
+{
+    if (rses->rses_config.rw_multiplex && !rses->rses_multiplex_pinned)
+    {
+        for (int i = 0; i < rses->rses_nbackends; i++)
+        {
+            backend_ref_t *bref = &rses->rses_backend_ref[i];
+
+            if (BREF_IS_IN_USE(bref) && bref->bref_latency.reply.insert_id != 0)
+            {
+                rses->rses_multiplex_pinned = true;
+            }
+        }
+    }
+
+    if (!rses->rses_config.rw_multiplex || rses->rses_config.rw_disable_sescmd_hist ||
+        rses->rses_multiplex_pinned || rses->rses_transaction_active ||
+        !rses->rses_autocommit_enabled || rses->rses_trx_read_only ||
+        rses->rses_load_active || rses->have_tmp_tables || rses->forced_node ||
+        rses->rses_hedge_bref || (rses->rses_ps && hashtable_size(rses->rses_ps) > 0))
+    {
+        return false;
+    }
+
+    for (int i = 0; i < rses->rses_nbackends; i++)
+    {
+        backend_ref_t *bref = &rses->rses_backend_ref[i];
+
+        if (BREF_IS_IN_USE(bref) &&
+            (BREF_IS_WAITING_RESULT(bref) || sescmd_cursor_is_active(&bref->bref_sescmd_cur) ||
+             bref->bref_pending_cmd || bref->bref_causal_state != CAUSAL_NONE ||
+             bref->bref_hedge_state != HEDGE_NONE ||
+             !mxs_mysql_reply_is_complete(&bref->bref_latency.reply) ||
+             bref->bref_latency.reply.warnings > 0 ||
+             (bref->bref_latency.reply.status & SERVER_STATUS_IN_TRANS)))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Close the backend connections of an idle session
+ *
+ * The connections go to the connection pools of the servers if the servers
+ * have one. The master is connected again by the next statement and the
+ * slaves by the next read.
+ *
+ * Router session must be locked.
+ *
+ * @param rses Router client session
+ */
+static void rses_multiplex_release(ROUTER_CLIENT_SES *rses)
+{
+    for (int i = 0; i < rses->rses_nbackends; i++)
+    {
+        backend_ref_t *bref = &rses->rses_backend_ref[i];
+
+        if (BREF_IS_IN_USE(bref))
+        {
+            if (bref == rses->rses_master_ref)
+            {
+                rses->rses_master_released = true;
+            }
+
+            close_failed_bref(bref, false);
+            atomic_add(&bref->bref_backend->backend_conn_count, -1);
+            atomic_add(&rses->router->stats.n_multiplex_released, 1);
+            RW_CHK_DCB(bref, bref->bref_dcb);
+            dcb_close(bref->bref_dcb);
+            RW_CLOSE_BREF(bref);
+        }
+    }
+}
+
+/**
+ * @brief Connect the master again after the session was idle
+ *
+ * The session command history is executed on the new connection before the
+ * statement that needs the master.
+ *
+ * Router session must be locked.
+ *
+ * @param rses Router client session
+ */
+static void rses_multiplex_acquire(ROUTER_CLIENT_SES *rses)
+{
+    backend_ref_t *master = rses->rses_master_ref;
+
+    if (!rses->rses_master_released)
+    {
+        return;
+    }
+
+    rses->rses_master_released = false;
+
+    if (master && !BREF_IS_IN_USE(master) && bref_valid_for_connect(master) &&
+        SERVER_IS_MASTER(master->bref_backend->backend_server))
+    {
+        if (connect_server(master, rses->client_dcb->session, true))
+        {
+            atomic_add(&rses->router->stats.n_multiplex_acquired, 1);
+        }
+        else
+        {
+            /** Failed to connect, mark server as failed */
+            bref_set_state(master, BREF_FATAL_FAILURE);
+        }
+    }
+}
+
+/**
+ * @brief Get the slave of a READ ONLY transaction
+ *
+ * The first statement of the transaction picks a slave and the rest of the
+ * transaction is routed to it. If the slave is lost in the middle of the
+ * transaction, the statement fails as the transaction can't be moved.
+ *
+ * @param p_dcb    Where the DCB is stored
+ * @param rses     Router client session
+ * @param max_rlag Maximum allowed replication lag
+ * @return True if a DCB was found
+ */
+static bool get_read_only_trx_dcb(DCB **p_dcb, ROUTER_CLIENT_SES *rses, int max_rlag)
+{
+    backend_ref_t *bref = rses->rses_trx_target;
+
+    if (bref)
+    {
+        if (BREF_IS_IN_USE(bref) && bref->bref_dcb)
+        {
+            *p_dcb = bref->bref_dcb;
+            return true;
+        }
+
+        MXS_ERROR("Server '%s' used by a READ ONLY transaction is no longer available.",
+                  bref->bref_backend->backend_server->unique_name);
+        return false;
+    }
+
+    if (get_dcb(p_dcb, rses, BE_SLAVE, NULL, max_rlag) &&
+        (bref = get_bref_from_dcb(rses, *p_dcb)) != NULL)
+    {
+        rses->rses_trx_target = bref;
+        atomic_add(&rses->router->stats.n_read_only_trx, 1);
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Get the delay after which a read routed to a backend is hedged
+ *
+ * The delay is the configured percentile of the response times of the server.
+ * It is calculated at most once every HEDGE_DELAY_REFRESH microseconds.
+ *
+ * @param backend    The backend
+ * @param percentile The response time percentile
+ * @return The delay in microseconds, 0 if the server has too few response times
+ */
+static int64_t backend_get_hedge_delay(BACKEND *backend, int percentile)
+{
+    int64_t now = ts_stats_time_us();
+
+    if (now - backend->backend_hedge_updated > HEDGE_DELAY_REFRESH)
+    {
+        ts_histogram_snapshot_t *snapshot = malloc(sizeof(ts_histogram_snapshot_t));
+
+        if (snapshot)
+        {
+            int64_t delay = 0;
+
+            /** Concurrent updates only calculate the same value twice */
+            backend->backend_hedge_updated = now;
+            ts_histogram_merge(backend->backend_server->stats.response_time, snapshot);
+
+            if (snapshot->count >= HEDGE_MIN_SAMPLES)
+            {
+                delay = ts_histogram_percentile(snapshot, percentile);
+
+                if (delay < HEDGE_MIN_DELAY)
+                {
+                    delay = HEDGE_MIN_DELAY;
+                }
+            }
+
+            backend->backend_hedge_delay = delay;
+            free(snapshot);
+        }
+    }
+
+    return backend->backend_hedge_delay;
+}
+
+/**
+ * @brief Prepare the hedging of a read that was routed to a slave
+ *
+ * The session is added to the list of the hedge thread. If the slave hasn't
+ * started to reply when the delay expires, the read is sent to a second slave.
+ * The caller must hold the router session lock.
+ *
+ * @param rses     Router client session
+ * @param bref     The slave the read was routed to
+ * @param querybuf The read
+ */
+static void rses_hedge_read(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *querybuf)
+{
+    int64_t delay = backend_get_hedge_delay(bref->bref_backend,
+                                            rses->rses_config.rw_hedged_reads_percentile);
+
+    if (delay == 0 || rses->rses_hedge_bref || bref->bref_hedge_state != HEDGE_NONE)
+    {
+        return;
+    }
+
+    GWBUF *query = gwbuf_clone(querybuf);
+
+    if (query == NULL)
+    {
+        return;
+    }
+
+    gwbuf_free(rses->rses_hedge_query);
+    rses->rses_hedge_query = query;
+    rses->rses_hedge_bref = bref;
+    rses->rses_hedge_deadline = ts_stats_time_us() + delay;
+    bref->bref_hedge_state = HEDGE_PRIMARY;
+    bref->bref_hedge_peer = NULL;
+
+    spinlock_acquire(&hedge_lock);
+
+    bool wake = hedge_list == NULL;
+
+    if (!rses->rses_hedge_listed)
+    {
+        rses->rses_hedge_next = hedge_list;
+        hedge_list = rses;
+        rses->rses_hedge_listed = true;
+    }
+
+    spinlock_release(&hedge_lock);
+
+    if (wake)
+    {
+        pthread_mutex_lock(&hedge_idle_lock);
+        pthread_cond_signal(&hedge_idle_cond);
+        pthread_mutex_unlock(&hedge_idle_lock);
+    }
+}
+
+/**
+ * @brief Remove a session from the list of the hedge thread
+ *
+ * @param rses Router client session
+ */
+static void rses_hedge_unlist(ROUTER_CLIENT_SES *rses)
+{
+    spinlock_acquire(&hedge_lock);
+
+    if (rses->rses_hedge_listed)
+    {
+        ROUTER_CLIENT_SES **prev = &hedge_list;
+
+        while (*prev != rses)
+        {
+            prev = &(*prev)->rses_hedge_next;
+        }
+
+        *prev = rses->rses_hedge_next;
+        rses->rses_hedge_listed = false;
+    }
+
+    spinlock_release(&hedge_lock);
+}
+
+/**
+ * @brief Find the slave a read is hedged to
+ *
+ * Only idle slaves that have no session commands, causal reads or hedged
+ * reads in progress are used.
+ *
+ * @param rses    Router client session
+ * @param primary The slave the read was originally routed to
+ * @return The best slave according to the slave selection criteria or NULL
+ */
+static backend_ref_t *get_hedge_slave(ROUTER_CLIENT_SES *rses, backend_ref_t *primary)
+{
+    backend_ref_t *master_bref = rses->rses_master_ref;
+    SERVER *master_host = master_bref ? master_bref->bref_backend->backend_server : NULL;
+    int max_rlag = rses_get_max_replication_lag(rses);
+    int (*p)(const void *, const void *) = criteria_cmpfun[rses->rses_config.rw_slave_select_criteria];
+    backend_ref_t *candidate = NULL;
+
+    for (int i = 0; i < rses->rses_nbackends; i++)
+    {
+        backend_ref_t *bref = &rses->rses_backend_ref[i];
+        SERVER *serv = bref->bref_backend->backend_server;
+
+        if (bref != primary && BREF_IS_IN_USE(bref) && bref->bref_dcb &&
+            !BREF_IS_WAITING_RESULT(bref) &&
+            !sescmd_cursor_is_active(&bref->bref_sescmd_cur) &&
+            bref->bref_pending_cmd == NULL &&
+            bref->bref_causal_state == CAUSAL_NONE &&
+            bref->bref_hedge_state == HEDGE_NONE &&
+            bref_valid_for_slave(bref, master_host) &&
+            (max_rlag == MAX_RLAG_UNDEFINED ||
+             (serv->rlag != MAX_RLAG_NOT_AVAILABLE && serv->rlag <= max_rlag)) &&
+            (candidate == NULL || p(candidate, bref) > 0))
+        {
+            candidate = bref;
+        }
+    }
+
+    return candidate;
+}
+
+/**
+ * @brief Send a read to a second slave
+ *
+ * The caller must hold the router session lock.
+ *
+ * @param rses Router client session
+ */
+static void rses_send_hedge(ROUTER_CLIENT_SES *rses)
+{
+    backend_ref_t *primary = rses->rses_hedge_bref;
+    GWBUF *query = rses->rses_hedge_query;
+    backend_ref_t *bref;
+
+    rses->rses_hedge_bref = NULL;
+    rses->rses_hedge_query = NULL;
+
+    if (primary->bref_hedge_state == HEDGE_PRIMARY && BREF_IS_IN_USE(primary) &&
+        (bref = get_hedge_slave(rses, primary)) != NULL &&
+        bref->bref_dcb->func.write(bref->bref_dcb, gwbuf_clone(query)) == 1)
+    {
+        bref_set_state(bref, BREF_QUERY_ACTIVE);
+        bref_set_state(bref, BREF_WAITING_RESULT);
+        mxs_mysql_latency_start(&bref->bref_latency, query);
+        bref->bref_hedge_state = HEDGE_SECONDARY;
+        bref->bref_hedge_peer = primary;
+        primary->bref_hedge_peer = bref;
+        atomic_add(&rses->router->stats.n_hedged_reads, 1);
+
+        MXS_INFO("Read routed to %s:%d was hedged to %s:%d",
+                 primary->bref_backend->backend_server->name,
+                 primary->bref_backend->backend_server->port,
+                 bref->bref_backend->backend_server->name,
+                 bref->bref_backend->backend_server->port);
+    }
+
+    gwbuf_free(query);
+}
+
+/**
+ * Check whether MaxScale is shutting down
+ *
+ * @return True if the service of any instance is being shut down
+ */
+static bool hedge_thread_stopping()
+{
+    bool stopping = false;
+
+    spinlock_acquire(&instlock);
+
+    for (ROUTER_INSTANCE *inst = instances; inst && !stopping; inst = inst->next)
+    {
+        stopping = inst->service->svc_do_shutdown;
+    }
+
+    spinlock_release(&instlock);
+
+    return stopping;
+}
+
+/**
+ * Wait until a read is added to the hedge list if the list is empty
+ *
+ * The wait is bounded so that the thread notices shutdown.
+ *
+ * @return True if the list was empty
+ */
+static bool hedge_thread_idle()
+{
+    pthread_mutex_lock(&hedge_idle_lock);
+    spinlock_acquire(&hedge_lock);
+    bool idle = hedge_list == NULL;
+    spinlock_release(&hedge_lock);
+
+    if (idle)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += HEDGE_IDLE_MS * 1000000L;
+        ts.tv_sec += ts.tv_nsec / 1000000000L;
+        ts.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&hedge_idle_cond, &hedge_idle_lock, &ts);
+    }
+
+    pthread_mutex_unlock(&hedge_idle_lock);
+
+    return idle;
+}
+
+/**
+ * @brief The thread that sends the hedged reads
+ *
+ * The thread only ticks while there are reads that may be hedged and exits
+ * when MaxScale is shut down. The session lock is only tried so that the
+ * hedge lock can be taken while holding a session lock. Sessions that are
+ * busy are checked on the next tick.
+ *
+ * @param data Unused
+ */
+static void hedge_thread_main(void *data)
+{
+    while (!hedge_thread_stopping())
+    {
+        if (hedge_thread_idle())
+        {
+            continue;
+        }
+
+        thread_millisleep(HEDGE_TICK_MS);
+
+        int64_t now = ts_stats_time_us();
+        spinlock_acquire(&hedge_lock);
+        ROUTER_CLIENT_SES **prev = &hedge_list;
+
+        while (*prev)
+        {
+            ROUTER_CLIENT_SES *rses = *prev;
+            bool done = false;
+
+            if (spinlock_acquire_nowait(&rses->rses_lock))
+            {
+                if (rses->rses_closed || rses->rses_hedge_bref == NULL)
+                {
+                    done = true;
+                }
+                else if (rses->rses_hedge_deadline <= now)
+                {
+                    rses_send_hedge(rses);
+                    done = true;
+                }
+
+                spinlock_release(&rses->rses_lock);
+            }
+
+            if (done)
+            {
+                *prev = rses->rses_hedge_next;
+                rses->rses_hedge_listed = false;
+            }
+            else
+            {
+                prev = &rses->rses_hedge_next;
+            }
+        }
+
+        spinlock_release(&hedge_lock);
+    }
+
+    spinlock_acquire(&hedge_lock);
+    hedge_thread_running = false;
+    spinlock_release(&hedge_lock);
+}
+
+/**
+ * Start the hedge thread if it isn't already running
+ */
+static void hedge_thread_start()
+{
+    spinlock_acquire(&hedge_lock);
+
+    if (!hedge_thread_running)
+    {
+        if (thread_start(&hedge_thr, hedge_thread_main, NULL) != NULL)
+        {
+            hedge_thread_running = true;
+        }
+        else
+        {
+            MXS_ERROR("Failed to start the hedge thread, reads will not be hedged.");
+        }
+    }
+
+    spinlock_release(&hedge_lock);
+}
+
+/**
+ * @brief The first reply of a hedged read arrived from a backend
+ *
+ * The reply of the other backend is discarded. If the read hasn't been
+ * hedged yet, it will not be.
+ *
+ * @param rses Router client session
+ * @param bref The backend that replied first
+ */
+static void bref_hedge_won(ROUTER_CLIENT_SES *rses, backend_ref_t *bref)
+{
+    backend_ref_t *peer = bref->bref_hedge_peer;
+
+    if (bref->bref_hedge_state == HEDGE_SECONDARY)
+    {
+        atomic_add(&rses->router->stats.n_hedge_wins, 1);
+    }
+
+    bref->bref_hedge_state = HEDGE_NONE;
+    bref->bref_hedge_peer = NULL;
+
+    if (rses->rses_hedge_bref == bref)
+    {
+        rses->rses_hedge_bref = NULL;
+        gwbuf_free(rses->rses_hedge_query);
+        rses->rses_hedge_query = NULL;
+    }
+
+    if (peer)
+    {
+        /** The reply of the peer is not tracked but its result set is read
+         * to the end before the backend is used again */
+        peer->bref_hedge_peer = NULL;
+        peer->bref_hedge_state = HEDGE_DISCARD;
+        peer->bref_latency.sent = 0;
+        mxs_mysql_reply_start(&peer->bref_hedge_reply, MYSQL_COM_QUERY);
+
+        if (BREF_IS_QUERY_ACTIVE(peer))
+        {
+            bref_clear_state(peer, BREF_QUERY_ACTIVE);
+            bref_clear_state(peer, BREF_WAITING_RESULT);
+        }
+    }
+}
+
+/**
+ * @brief Discard the reply of the backend that lost a hedged read
+ *
+ * @param bref     The backend
+ * @param writebuf Complete packets from the backend
+ * @return The packets that follow the discarded reply or NULL
+ */
+static GWBUF *bref_discard_hedged_reply(backend_ref_t *bref, GWBUF *writebuf)
+{
+    GWBUF *discarded = causal_split_reply(&bref->bref_hedge_reply, &writebuf, NULL, 0);
+
+    gwbuf_free(discarded);
+
+    if (mxs_mysql_reply_is_complete(&bref->bref_hedge_reply))
+    {
+        bref->bref_hedge_state = HEDGE_NONE;
+    }
+
+    return writebuf;
+}
+
+/**
+ * Create a generic router session property strcture.
+ */
+static rses_property_t *rses_property_init(rses_property_type_t prop_type)
+{
+    rses_property_t *prop;
+
+    prop = (rses_property_t *)calloc(1, sizeof(rses_property_t));
+    if (prop == NULL)
+    {
+        MXS_ERROR("Error: Malloc returned NULL. (%s:%d)", __FILE__, __LINE__);
+        return NULL;
+    }
+    prop->rses_prop_type = prop_type;
+#if defined(SS_DEBUG)
+    prop->rses_prop_chk_top = CHK_NUM_ROUTER_PROPERTY;
+    prop->rses_prop_chk_tail = CHK_NUM_ROUTER_PROPERTY;
+#endif
+
+    CHK_RSES_PROP(prop);
+    return prop;
+}
+
+/**
+ * Property is freed at the end of router client session.
+ */
+static void rses_property_done(rses_property_t *prop)
+{
+    if (prop == NULL)
+    {
+        MXS_ERROR("[%s] Error: NULL parameter.", __FUNCTION__);
+        return;
+    }
+    CHK_RSES_PROP(prop);
+
+    switch (prop->rses_prop_type)
+    {
+        case RSES_PROP_TYPE_SESCMD:
+            if (prop->rses_prop_rsession)
+            {
+                ROUTER_CLIENT_SES *rses = prop->rses_prop_rsession;
+                int size = prop->rses_prop_data.sescmd.my_sescmd_size;
+
+                rses->rses_sescmd_count--;
+                rses->rses_sescmd_bytes -= size;
+                atomic_add(&rses->router->stats.n_sescmd, -1);
+                atomic_add_int64(&rses->router->stats.n_sescmd_bytes, -size);
+            }
+            mysql_sescmd_done(&prop->rses_prop_data.sescmd);
+            break;
+
+        case RSES_PROP_TYPE_TMPTABLES:
+            hashtable_free(prop->rses_prop_data.temp_tables);
+            break;
+
+        default:
+            MXS_DEBUG("%lu [rses_property_done] Unknown property type %d "
+                      "in property %p", pthread_self(), prop->rses_prop_type, prop);
+
+            ss_dassert(false);
+            break;
+    }
+    free(prop);
+}
+
+/**
+ * Add property to the router_client_ses structure's rses_properties
+ * array. The slot is determined by the type of property.
+ * In each slot there is a list of properties of similar type.
+ *
+ * Router client session must be locked.
+ */
+static int rses_property_add(ROUTER_CLIENT_SES *rses, rses_property_t *prop)
+{
+    if (rses == NULL)
+    {
+        MXS_ERROR("Router client session is NULL. (%s:%d)", __FILE__, __LINE__);
+        return -1;
+    }
+    if (prop == NULL)
+    {
+        MXS_ERROR("Router client session property is NULL. (%s:%d)", __FILE__, __LINE__);
+        return -1;
+    }
+    rses_property_t *p;
+
+    CHK_CLIENT_RSES(rses);
+    CHK_RSES_PROP(prop);
+    ss_dassert(SPINLOCK_IS_LOCKED(&rses->rses_lock));
+
+    prop->rses_prop_rsession = rses;
+    p = rses->rses_properties[prop->rses_prop_type];
+
+    if (prop->rses_prop_type == RSES_PROP_TYPE_SESCMD)
+    {
+        int size = prop->rses_prop_data.sescmd.my_sescmd_size;
+
+        rses->rses_sescmd_count++;
+        rses->rses_sescmd_bytes += size;
+        atomic_add(&rses->router->stats.n_sescmd, 1);
+        atomic_add_int64(&rses->router->stats.n_sescmd_bytes, size);
+    }
+
+    if (p == NULL)
+    {
+        rses->rses_properties[prop->rses_prop_type] = prop;
+    }
+    else
+    {
+        while (p->rses_prop_next != NULL)
+        {
+            p = p->rses_prop_next;
+        }
+        p->rses_prop_next = prop;
+    }
+    return 0;
+}
+
+/**
+ * Router session must be locked.
+ * Return session command pointer if succeed, NULL if failed.
+ */
+static mysql_sescmd_t *rses_property_get_sescmd(rses_property_t *prop)
+{
+    mysql_sescmd_t *sescmd;
+
+    if (prop == NULL)
+    {
+        MXS_ERROR("[%s] Error: NULL parameter.", __FUNCTION__);
+        return NULL;
+    }
+
+    CHK_RSES_PROP(prop);
+    ss_dassert(prop->rses_prop_rsession == NULL ||
+               SPINLOCK_IS_LOCKED(&prop->rses_prop_rsession->rses_lock));
+
+    sescmd = &prop->rses_prop_data.sescmd;
+
+    if (sescmd != NULL)
+    {
+        CHK_MYSQL_SESCMD(sescmd);
+    }
+    return sescmd;
+}
+
+/**
+ * Create session command property.
+ *
+ * @param key The key returned by sescmd_get_key, the command takes ownership of it
+ */
+static mysql_sescmd_t *mysql_sescmd_init(rses_property_t *rses_prop,
+                                         GWBUF *sescmd_buf,
+                                         unsigned char packet_type,
+                                         char *key,
+                                         ROUTER_CLIENT_SES *rses)
+{
+    mysql_sescmd_t *sescmd;
+
+    CHK_RSES_PROP(rses_prop);
+    /** Can't call rses_property_get_sescmd with uninitialized sescmd */
+    sescmd = &rses_prop->rses_prop_data.sescmd;
+    sescmd->my_sescmd_prop = rses_prop; /*< reference to owning property */
+#if defined(SS_DEBUG)
+    sescmd->my_sescmd_chk_top = CHK_NUM_MY_SESCMD;
+    sescmd->my_sescmd_chk_tail = CHK_NUM_MY_SESCMD;
+#endif
+    /** Set session command buffer */
+    sescmd->my_sescmd_buf = sescmd_buf;
+    sescmd->my_sescmd_packet_type = packet_type;
+    sescmd->position = atomic_add(&rses->pos_generator, 1);
+    sescmd->my_sescmd_key = key;
+    sescmd->my_sescmd_size = sizeof(rses_property_t) + sizeof(GWBUF) +
+        gwbuf_length(sescmd_buf) + (key ? strlen(key) + 1 : 0);
+
+    return sescmd;
+}
+
+static void mysql_sescmd_done(mysql_sescmd_t *sescmd)
+{
+    if (sescmd == NULL)
+    {
+        MXS_ERROR("[%s] Error: NULL parameter.", __FUNCTION__);
+        return;
+    }
+    CHK_RSES_PROP(sescmd->my_sescmd_prop);
+    gwbuf_free(sescmd->my_sescmd_buf);
+    free(sescmd->my_sescmd_key);
+    memset(sescmd, 0, sizeof(mysql_sescmd_t));
+}
+
+/**
+ * Skip a keyword at the start of a statement.
+ *
+ * @param ptr  Pointer to the current position, moved past the keyword and the
+ *             whitespace after it if the keyword matches
+ * @param end  End of the statement
+ * @param word The keyword in lower case
+ * @return True if the keyword was found
+ */
+static bool sescmd_skip_word(const char **ptr, const char *end, const char *word)
+{
+    size_t len = strlen(word);
+    const char *p = *ptr;
+
+    if ((size_t)(end - p) < len || strncasecmp(p, word, len) != 0 ||
+        (p + len < end && (isalnum(p[len]) || p[len] == '_')))
+    {
+        return false;
+    }
+
+    for (p += len; p < end && isspace(*p); p++)
+    {
+        ;
+    }
+
+    *ptr = p;
+    return true;
+}
+
+/**
+ * Find out which part of the session state a session command sets.
+ *
+ * A session command with a key only sets the session state identified by the
+ * key and the value it sets doesn't depend on the earlier state. This means
+ * that a later command with the same key makes the earlier one unnecessary
+ * when the history is replayed on a new slave. Currently default database
+ * changes and assignments of single variables are recognized, for example
+ * <code>USE test</code> and <code>SET @@session.sql_mode='ANSI'</code>.
+ * Assignments whose value refers to variables are not given a key as the
+ * value could depend on the earlier commands.
+ *
+ * @param buf         Buffer with the session command
+ * @param packet_type The command byte of the packet
+ * @return The key of the command or NULL if the command can't be superseded
+ */
+static char *sescmd_get_key(GWBUF *buf, unsigned char packet_type)
+{
+    char *sql;
+    int len;
+
+    if (packet_type == MYSQL_COM_INIT_DB)
+    {
+        return strdup("use");
+    }
+
+    if (packet_type != MYSQL_COM_QUERY || !modutil_extract_SQL(buf, &sql, &len))
+    {
+        return NULL;
+    }
+
+    const char *ptr = sql;
+    const char *end = sql + len;
+
+    while (ptr < end && isspace(*ptr))
+    {
+        ptr++;
+    }
+
+    /** A trailing semicolon doesn't change the statement */
+    while (end > ptr && (isspace(end[-1]) || end[-1] == ';'))
+    {
+        end--;
+    }
+
+    if (sescmd_skip_word(&ptr, end, "use"))
+    {
+        return ptr < end && memchr(ptr, ';', end - ptr) == NULL ? strdup("use") : NULL;
+    }
+
+    if (!sescmd_skip_word(&ptr, end, "set") || sescmd_skip_word(&ptr, end, "global"))
+    {
+        return NULL;
+    }
+
+    if (!sescmd_skip_word(&ptr, end, "session"))
+    {
+        sescmd_skip_word(&ptr, end, "local");
+    }
+
+    char name[MYSQL_DATABASE_MAXLEN + 2];
+    int n = 0;
+
+    if (end - ptr > 2 && ptr[0] == '@' && ptr[1] == '@')
+    {
+        /** @@var, @@session.var and @@local.var are the same variable */
+        ptr += 2;
+
+        if (end - ptr > 7 && strncasecmp(ptr, "global.", 7) == 0)
+        {
+            return NULL;
+        }
+        else if (end - ptr > 8 && strncasecmp(ptr, "session.", 8) == 0)
+        {
+            ptr += 8;
+        }
+        else if (end - ptr > 6 && strncasecmp(ptr, "local.", 6) == 0)
+        {
+            ptr += 6;
+        }
+    }
+    else if (ptr < end && *ptr == '@')
+    {
+        /** User variables have a namespace of their own */
+        name[n++] = *ptr++;
+    }
+
+    while (ptr < end && (isalnum(*ptr) || *ptr == '_' || *ptr == '$') && n < (int)sizeof(name) - 1)
+    {
+        name[n++] = tolower(*ptr++);
+    }
+    name[n] = '\0';
+
+    while (ptr < end && isspace(*ptr))
+    {
+        ptr++;
+    }
+
+    if (n == 0 || (n == 1 && name[0] == '@') || ptr == end ||
+        ((isalnum(*ptr) || *ptr == '_' || *ptr == '.') && strcmp(name, "names") != 0))
+    {
+        /** Not a simple assignment, e.g. SET TRANSACTION or SET CHARACTER SET */
+        return NULL;
+    }
+
+    if (strcmp(name, "password") == 0)
+    {
+        return NULL;
+    }
+    else if (strcmp(name, "names") == 0)
+    {
+        /** SET NAMES charset [COLLATE collation] */
+        if (*ptr == '=')
+        {
+            return NULL;
+        }
+    }
+    else if (*ptr == '=')
+    {
+        ptr++;
+    }
+    else if (end - ptr >= 2 && ptr[0] == ':' && ptr[1] == '=')
+    {
+        ptr += 2;
+    }
+    else
+    {
+        return NULL;
+    }
+
+    /**
+     * The value must be a single value that doesn't refer to variables. Commas
+     * and semicolons would mean more assignments or statements.
+     */
+    char quote = '\0';
+
+    for (const char *p = ptr; p < end; p++)
+    {
+        if (quote)
+        {
+            if (*p == '\\' && p + 1 < end)
+            {
+                p++;
+            }
+            else if (*p == quote)
+            {
+                quote = '\0';
+            }
+        }
+        else if (*p == '\'' || *p == '"' || *p == '`')
+        {
+            quote = *p;
+        }
+        else if (*p == '@' || *p == ',' || *p == ';')
+        {
+            return NULL;
+        }
+    }
+
+    if (quote)
+    {
+        return NULL;
+    }
+
+    char *key = malloc(n + 5);
+
+    if (key)
+    {
+        sprintf(key, "set %s", name);
+    }
+
+    return key;
+}
+
+/**
+ * Check if all backends in use have executed a session command and their
+ * cursors no longer refer to it.
+ *
+ * Router session must be locked.
+ *
+ * @param rses The router session
+ * @param prop The session command
+ * @return True if the session command can be removed from the history
+ */
+static bool sescmd_is_executed(ROUTER_CLIENT_SES *rses, rses_property_t *prop)
+{
+    mysql_sescmd_t *scmd = &prop->rses_prop_data.sescmd;
+
+    if (!scmd->my_sescmd_is_replied)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < rses->rses_nbackends; i++)
+    {
+        backend_ref_t *bref = &rses->rses_backend_ref[i];
+        sescmd_cursor_t *scur = &bref->bref_sescmd_cur;
+
+        if (BREF_IS_IN_USE(bref) &&
+            (scur->position < scmd->position ||
+             scur->scmd_cur_ptr_property == &prop->rses_prop_next ||
+             *scur->scmd_cur_ptr_property == prop))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Remove the session commands superseded by a new command from the history.
+ *
+ * Only commands that all backends in use have executed are removed. The
+ * cursors of the backends that are not in use are reset before they are
+ * used again. A command without a key could depend on the state set by the
+ * earlier commands so nothing before it is removed.
+ *
+ * Router session must be locked.
+ *
+ * @param rses The router session
+ * @param key  The key of the new session command
+ */
+static void rses_compact_sescmd_history(ROUTER_CLIENT_SES *rses, const char *key)
+{
+    rses_property_t **pprop = &rses->rses_properties[RSES_PROP_TYPE_SESCMD];
+
+    for (rses_property_t *prop = *pprop; prop; prop = prop->rses_prop_next)
+    {
+        if (prop->rses_prop_data.sescmd.my_sescmd_key == NULL)
+        {
+            pprop = &prop->rses_prop_next;
+        }
+    }
+
+    while (*pprop)
+    {
+        rses_property_t *prop = *pprop;
+        mysql_sescmd_t *scmd = &prop->rses_prop_data.sescmd;
+
+        if (scmd->my_sescmd_key && strcmp(scmd->my_sescmd_key, key) == 0 &&
+            sescmd_is_executed(rses, prop))
+        {
+            *pprop = prop->rses_prop_next;
+            rses_property_done(prop);
+            atomic_add(&rses->router->stats.n_sescmd_compacted, 1);
+        }
+        else
+        {
+            pprop = &prop->rses_prop_next;
+        }
+    }
+}
+
+static int rses_ps_hashfn(void *key)
+{
+    return (int)((uintptr_t)key & 0x7fffffff);
+}
+
+static int rses_ps_cmpfn(void *key1, void *key2)
+{
+    return key1 != key2;
+}
+
+static void *rses_ps_free(void *data)
+{
+    rses_ps_t *ps = (rses_ps_t *)data;
+
+    free(ps->ps_backend_ids);
+    free(ps->ps_types_sent);
+    free(ps->ps_param_types);
+    free(ps);
+    return NULL;
+}
+
+/**
+ * Register a new prepared statement.
+ *
+ * Router session must be locked.
+ *
+ * @param rses  The router session
+ * @param qtype Query type of the prepared statement
+ * @return The ID given to the statement or 0 if memory allocation failed
+ */
+static uint32_t rses_ps_create(ROUTER_CLIENT_SES *rses, qc_query_type_t qtype)
+{
+    rses_ps_t *ps = calloc(1, sizeof(rses_ps_t));
+
+    if (ps == NULL ||
+        (ps->ps_backend_ids = calloc(rses->rses_nbackends, sizeof(uint32_t))) == NULL ||
+        (ps->ps_types_sent = calloc(rses->rses_nbackends, sizeof(bool))) == NULL)
+    {
+        MXS_ERROR("Memory allocation failed when registering a prepared statement.");
+        if (ps)
+        {
+            rses_ps_free(ps);
+        }
+        return 0;
+    }
+
+    /** Zero is never used as an ID */
+    if (++rses->rses_ps_next_id == 0)
+    {
+        rses->rses_ps_next_id = 1;
+    }
+
+    ps->ps_id = rses->rses_ps_next_id;
+    ps->ps_type = qtype;
+    ps->ps_n_params = -1;
+
+    if (!hashtable_add(rses->rses_ps, (void *)(uintptr_t)ps->ps_id, ps))
+    {
+        rses_ps_free(ps);
+        return 0;
+    }
+
+    return ps->ps_id;
+}
+
+/**
+ * Find the prepared statement a binary protocol command refers to.
+ *
+ * Router session must be locked.
+ *
+ * @param rses     The router session
+ * @param querybuf A COM_STMT_EXECUTE, COM_STMT_FETCH, COM_STMT_RESET,
+ *                 COM_STMT_SEND_LONG_DATA or COM_STMT_CLOSE packet
+ * @return The prepared statement or NULL if the ID is not known
+ */
+static rses_ps_t *rses_ps_get(ROUTER_CLIENT_SES *rses, GWBUF *querybuf)
+{
+    uint8_t *data = GWBUF_DATA(querybuf);
+
+    if (GWBUF_LENGTH(querybuf) < MYSQL_HEADER_LEN + 5)
+    {
+        return NULL;
+    }
+
+    switch (MYSQL_GET_COMMAND(data))
+    {
+        case MYSQL_COM_STMT_EXECUTE:
+        case MYSQL_COM_STMT_FETCH:
+        case MYSQL_COM_STMT_RESET:
+        case MYSQL_COM_STMT_SEND_LONG_DATA:
+        case MYSQL_COM_STMT_CLOSE:
+            return hashtable_fetch(rses->rses_ps,
+                                   (void *)(uintptr_t)gw_mysql_get_byte4(data + 5));
+
+        default:
+            return NULL;
+    }
+}
+
+/**
+ * Find the backend that must receive a command that depends on the state of
+ * an earlier command of the prepared statement.
+ *
+ * The parameter data sent with COM_STMT_SEND_LONG_DATA only exists in the
+ * master so the statement is executed there until it is reset. A cursor only
+ * exists in the backend that executed the statement.
+ *
+ * Router session must be locked.
+ *
+ * @param rses        The router session
+ * @param ps          The prepared statement
+ * @param packet_type The command
+ * @return The backend or NULL if the statement can be routed normally
+ */
+static backend_ref_t *rses_ps_target(ROUTER_CLIENT_SES *rses, rses_ps_t *ps,
+                                     mysql_server_cmd_t packet_type)
+{
+    backend_ref_t *master = rses->rses_master_ref;
+
+    if (master && !BREF_IS_IN_USE(master))
+    {
+        master = NULL;
+    }
+
+    switch (packet_type)
+    {
+        case MYSQL_COM_STMT_SEND_LONG_DATA:
+            ps->ps_long_data = true;
+            return master;
+
+        case MYSQL_COM_STMT_EXECUTE:
+            return ps->ps_long_data ? master : NULL;
+
+        case MYSQL_COM_STMT_RESET:
+            if (ps->ps_long_data)
+            {
+                ps->ps_long_data = false;
+                return master;
+            }
+            /** Fallthrough */
+
+        case MYSQL_COM_STMT_FETCH:
+            if (ps->ps_exec_bref && BREF_IS_IN_USE(ps->ps_exec_bref))
+            {
+                return ps->ps_exec_bref;
+            }
+            return master;
+
+        default:
+            return NULL;
+    }
+}
+
+/**
+ * Choose the backend that executes a command of a prepared statement
+ *
+ * The command can only be sent to a backend that knows the ID of the
+ * statement. A backend that is still executing the session commands will
+ * know it once it has answered the COM_STMT_PREPARE, the command then waits
+ * in the backend until the ID is known. Commands are only moved from a slave
+ * to the master, never the other way around.
+ *
+ * Router session must be locked.
+ *
+ * @param rses The router session
+ * @param ps   The prepared statement
+ * @param bref The backend chosen by the normal routing
+ * @return The backend or NULL if the statement can't be executed
+ */
+static backend_ref_t *rses_ps_backend(ROUTER_CLIENT_SES *rses, rses_ps_t *ps,
+                                      backend_ref_t *bref)
+{
+    backend_ref_t *master = rses->rses_master_ref;
+
+    if (master && !BREF_IS_IN_USE(master))
+    {
+        master = NULL;
+    }
+
+    if (ps->ps_backend_ids[bref - rses->rses_backend_ref])
     {
-        MXS_ERROR("Couldn't establish required amount of slave connections for "
-                  "router session. Would need between %d and %d slaves but only have %d.",
-                  min_nslaves, max_nslaves, slaves_connected);
+        return bref;
+    }
 
-        /** Clean up connections */
-        for (int i = 0; i < router_nservers; i++)
-        {
-            if (BREF_IS_IN_USE((&backend_ref[i])))
-            {
-                ss_dassert(backend_ref[i].bref_backend->backend_conn_count > 0);
+    if (master && master != bref && ps->ps_backend_ids[master - rses->rses_backend_ref])
+    {
+        /** The slave hasn't prepared the statement */
+        return master;
+    }
 
-                close_failed_bref(&backend_ref[i], true);
+    if (sescmd_cursor_is_active(&bref->bref_sescmd_cur))
+    {
+        return bref;
+    }
 
-                /** Decrease backend's connection counter. */
-                atomic_add(&backend_ref[i].bref_backend->backend_conn_count, -1);
-                RW_CHK_DCB(&backend_ref[i], backend_ref[i].bref_dcb);
-                dcb_close(backend_ref[i].bref_dcb);
-                RW_CLOSE_BREF(&backend_ref[i]);
-            }
-        }
+    if (master && sescmd_cursor_is_active(&master->bref_sescmd_cur))
+    {
+        return master;
     }
 
-    return succp;
+    return NULL;
 }
 
 /**
- * Create a generic router session property strcture.
+ * Send COM_STMT_CLOSE to a backend.
+ *
+ * @param bref The backend
+ * @param id   ID of the statement in the backend
  */
-static rses_property_t *rses_property_init(rses_property_type_t prop_type)
+static void bref_ps_close(backend_ref_t *bref, uint32_t id)
 {
-    rses_property_t *prop;
+    GWBUF *buf = gwbuf_alloc(MYSQL_HEADER_LEN + 5);
 
-    prop = (rses_property_t *)calloc(1, sizeof(rses_property_t));
-    if (prop == NULL)
+    if (buf)
     {
-        MXS_ERROR("Error: Malloc returned NULL. (%s:%d)", __FILE__, __LINE__);
-        return NULL;
-    }
-    prop->rses_prop_type = prop_type;
-#if defined(SS_DEBUG)
-    prop->rses_prop_chk_top = CHK_NUM_ROUTER_PROPERTY;
-    prop->rses_prop_chk_tail = CHK_NUM_ROUTER_PROPERTY;
-#endif
+        uint8_t *data = GWBUF_DATA(buf);
 
-    CHK_RSES_PROP(prop);
-    return prop;
+        gw_mysql_set_byte3(data, 5);
+        data[3] = 0;
+        data[4] = MYSQL_COM_STMT_CLOSE;
+        gw_mysql_set_byte4(data + 5, id);
+        gwbuf_set_type(buf, GWBUF_TYPE_MYSQL);
+        bref->bref_dcb->func.write(bref->bref_dcb, buf);
+    }
 }
 
 /**
- * Property is freed at the end of router client session.
+ * Close a prepared statement in all backends and forget it.
+ *
+ * The COM_STMT_PREPARE is removed from the session command history if all
+ * backends have executed it. Otherwise the backends that prepare the statement
+ * later close it as soon as they reply.
+ *
+ * Router session must be locked.
+ *
+ * @param rses The router session
+ * @param ps   The prepared statement, freed by this function
  */
-static void rses_property_done(rses_property_t *prop)
+static void rses_ps_close(ROUTER_CLIENT_SES *rses, rses_ps_t *ps)
 {
-    if (prop == NULL)
+    rses_property_t **pprop = &rses->rses_properties[RSES_PROP_TYPE_SESCMD];
+
+    for (int i = 0; i < rses->rses_nbackends; i++)
     {
-        MXS_ERROR("[%s] Error: NULL parameter.", __FUNCTION__);
-        return;
+        backend_ref_t *bref = &rses->rses_backend_ref[i];
+
+        if (BREF_IS_IN_USE(bref) && ps->ps_backend_ids[i])
+        {
+            bref_ps_close(bref, ps->ps_backend_ids[i]);
+        }
     }
-    CHK_RSES_PROP(prop);
 
-    switch (prop->rses_prop_type)
+    while (*pprop)
     {
-        case RSES_PROP_TYPE_SESCMD:
-            mysql_sescmd_done(&prop->rses_prop_data.sescmd);
-            break;
+        rses_property_t *prop = *pprop;
 
-        case RSES_PROP_TYPE_TMPTABLES:
-            hashtable_free(prop->rses_prop_data.temp_tables);
+        if (prop->rses_prop_data.sescmd.my_sescmd_ps_id == ps->ps_id)
+        {
+            if (sescmd_is_executed(rses, prop))
+            {
+                *pprop = prop->rses_prop_next;
+                rses_property_done(prop);
+            }
             break;
+        }
 
-        default:
-            MXS_DEBUG("%lu [rses_property_done] Unknown property type %d "
-                      "in property %p", pthread_self(), prop->rses_prop_type, prop);
-
-            ss_dassert(false);
-            break;
+        pprop = &prop->rses_prop_next;
     }
-    free(prop);
+
+    hashtable_delete(rses->rses_ps, (void *)(uintptr_t)ps->ps_id);
 }
 
 /**
- * Add property to the router_client_ses structure's rses_properties
- * array. The slot is determined by the type of property.
- * In each slot there is a list of properties of similar type.
+ * Store the ID a backend gave to a prepared statement.
  *
- * Router client session must be locked.
+ * The ID in the reply is replaced with the ID of the router. If the client
+ * has already closed the statement, it is closed in the backend.
+ *
+ * Router session must be locked.
+ *
+ * @param rses  The router session
+ * @param bref  The backend that replied
+ * @param ps_id ID of the statement given by the router
+ * @param reply Reply to the COM_STMT_PREPARE
  */
-static int rses_property_add(ROUTER_CLIENT_SES *rses, rses_property_t *prop)
+static void rses_ps_prepare_reply(ROUTER_CLIENT_SES *rses, backend_ref_t *bref,
+                                  uint32_t ps_id, GWBUF *reply)
 {
-    if (rses == NULL)
-    {
-        MXS_ERROR("Router client session is NULL. (%s:%d)", __FILE__, __LINE__);
-        return -1;
-    }
-    if (prop == NULL)
+    uint8_t *data = GWBUF_DATA(reply);
+
+    if (GWBUF_LENGTH(reply) < MYSQL_HEADER_LEN + 9 || MYSQL_GET_COMMAND(data) != 0x00)
     {
-        MXS_ERROR("Router client session property is NULL. (%s:%d)", __FILE__, __LINE__);
-        return -1;
+        return;
     }
-    rses_property_t *p;
 
-    CHK_CLIENT_RSES(rses);
-    CHK_RSES_PROP(prop);
-    ss_dassert(SPINLOCK_IS_LOCKED(&rses->rses_lock));
+    uint32_t id = gw_mysql_get_byte4(data + 5);
+    rses_ps_t *ps = rses->rses_ps ? hashtable_fetch(rses->rses_ps, (void *)(uintptr_t)ps_id) : NULL;
 
-    prop->rses_prop_rsession = rses;
-    p = rses->rses_properties[prop->rses_prop_type];
+    if (ps)
+    {
+        int i = bref - rses->rses_backend_ref;
 
-    if (p == NULL)
+        ps->ps_backend_ids[i] = id;
+        ps->ps_types_sent[i] = false;
+
+        if (ps->ps_n_params < 0)
+        {
+            /** The number of parameters follows the number of columns */
+            ps->ps_n_params = gw_mysql_get_byte2(data + 11);
+        }
+    }
+    else if (BREF_IS_IN_USE(bref))
     {
-        rses->rses_properties[prop->rses_prop_type] = prop;
+        bref_ps_close(bref, id);
     }
-    else
+
+    gw_mysql_set_byte4(data + 5, ps_id);
+}
+
+/**
+ * Forget the IDs of the prepared statements in a closed backend.
+ *
+ * @param rses The router session
+ * @param bref The closed backend
+ */
+static void rses_ps_bref_closed(ROUTER_CLIENT_SES *rses, backend_ref_t *bref)
+{
+    if (rses && rses->rses_ps)
     {
-        while (p->rses_prop_next != NULL)
+        HASHITERATOR *iter = hashtable_iterator(rses->rses_ps);
+        int i = bref - rses->rses_backend_ref;
+        void *key;
+
+        while (iter && (key = hashtable_next(iter)) != NULL)
         {
-            p = p->rses_prop_next;
+            rses_ps_t *ps = hashtable_fetch(rses->rses_ps, key);
+
+            ps->ps_backend_ids[i] = 0;
+            ps->ps_types_sent[i] = false;
+
+            if (ps->ps_exec_bref == bref)
+            {
+                ps->ps_exec_bref = NULL;
+            }
+        }
+
+        if (iter)
+        {
+            hashtable_iterator_free(iter);
         }
-        p->rses_prop_next = prop;
     }
-    return 0;
 }
 
 /**
+ * Replace the statement ID of a binary protocol command with the ID of the
+ * backend.
+ *
+ * The client sends the parameter types only when they change. If the backend
+ * hasn't seen the latest types, they are added to a COM_STMT_EXECUTE that
+ * doesn't have them.
+ *
  * Router session must be locked.
- * Return session command pointer if succeed, NULL if failed.
+ *
+ * @param rses     The router session
+ * @param bref     The backend where the command is sent
+ * @param ps       The prepared statement
+ * @param querybuf The command, not modified as it can be shared with the
+ *                 session command history and the clones sent to other backends
+ * @return A new buffer with the backend's ID and the parameter types added or
+ *         NULL if @c querybuf can be sent as such
  */
-static mysql_sescmd_t *rses_property_get_sescmd(rses_property_t *prop)
+static GWBUF *bref_ps_rewrite(ROUTER_CLIENT_SES *rses, backend_ref_t *bref,
+                              rses_ps_t *ps, GWBUF *querybuf)
 {
-    mysql_sescmd_t *sescmd;
+    int i = bref - rses->rses_backend_ref;
+    uint8_t *data = GWBUF_DATA(querybuf);
+    size_t len = GWBUF_LENGTH(querybuf);
+    uint32_t id = ps->ps_backend_ids[i];
+    int n = ps->ps_n_params;
+    size_t flag_offset = MYSQL_HEADER_LEN + 10 + (n + 7) / 8;
+    bool add_types = false;
+    GWBUF *buf = NULL;
+
+    if (MYSQL_GET_COMMAND(data) == MYSQL_COM_STMT_EXECUTE && n > 0 && flag_offset < len &&
+        len == MYSQL_GET_PACKET_LEN(data) + MYSQL_HEADER_LEN)
+    {
+        if (data[flag_offset])
+        {
+            if (flag_offset + 1 + 2 * n <= len &&
+                (ps->ps_param_types || (ps->ps_param_types = malloc(2 * n))))
+            {
+                memcpy(ps->ps_param_types, data + flag_offset + 1, 2 * n);
+                memset(ps->ps_types_sent, 0, rses->rses_nbackends * sizeof(bool));
+                ps->ps_types_sent[i] = true;
+            }
+        }
+        else
+        {
+            add_types = !ps->ps_types_sent[i] && ps->ps_param_types;
+        }
+    }
 
-    if (prop == NULL)
+    if (add_types)
     {
-        MXS_ERROR("[%s] Error: NULL parameter.", __FUNCTION__);
-        return NULL;
-    }
+        if ((buf = gwbuf_alloc(len + 2 * n)) != NULL)
+        {
+            uint8_t *ptr = GWBUF_DATA(buf);
 
-    CHK_RSES_PROP(prop);
-    ss_dassert(prop->rses_prop_rsession == NULL ||
-               SPINLOCK_IS_LOCKED(&prop->rses_prop_rsession->rses_lock));
+            memcpy(ptr, data, flag_offset);
+            gw_mysql_set_byte3(ptr, len + 2 * n - MYSQL_HEADER_LEN);
+            ptr[flag_offset] = 1;
+            memcpy(ptr + flag_offset + 1, ps->ps_param_types, 2 * n);
+            memcpy(ptr + flag_offset + 1 + 2 * n, data + flag_offset + 1, len - flag_offset - 1);
+            ps->ps_types_sent[i] = true;
+        }
+    }
+    else if (id && len >= MYSQL_HEADER_LEN + 5 && id != gw_mysql_get_byte4(data + 5))
+    {
+        size_t total = gwbuf_length(querybuf);
 
-    sescmd = &prop->rses_prop_data.sescmd;
+        if ((buf = gwbuf_alloc(total)) != NULL)
+        {
+            gwbuf_copy_data(querybuf, 0, total, GWBUF_DATA(buf));
+        }
+    }
 
-    if (sescmd != NULL)
+    if (buf)
     {
-        CHK_MYSQL_SESCMD(sescmd);
+        if (id)
+        {
+            gw_mysql_set_byte4((uint8_t *)GWBUF_DATA(buf) + 5, id);
+        }
+        gwbuf_set_type(buf, querybuf->gwbuf_type);
     }
-    return sescmd;
+
+    return buf;
 }
 
 /**
- * Create session command property.
+ * Replace the statement IDs of the commands that waited for a backend to
+ * execute the session commands
+ *
+ * Router session must be locked.
+ *
+ * @param rses    The router session
+ * @param bref    The backend
+ * @param pending The commands, freed by this function
+ * @return The commands to send to the backend
  */
-static mysql_sescmd_t *mysql_sescmd_init(rses_property_t *rses_prop,
-                                         GWBUF *sescmd_buf,
-                                         unsigned char packet_type,
-                                         ROUTER_CLIENT_SES *rses)
+static GWBUF *bref_ps_rewrite_pending(ROUTER_CLIENT_SES *rses, backend_ref_t *bref,
+                                      GWBUF *pending)
 {
-    mysql_sescmd_t *sescmd;
+    GWBUF *head = NULL;
+    GWBUF *packet;
 
-    CHK_RSES_PROP(rses_prop);
-    /** Can't call rses_property_get_sescmd with uninitialized sescmd */
-    sescmd = &rses_prop->rses_prop_data.sescmd;
-    sescmd->my_sescmd_prop = rses_prop; /*< reference to owning property */
-#if defined(SS_DEBUG)
-    sescmd->my_sescmd_chk_top = CHK_NUM_MY_SESCMD;
-    sescmd->my_sescmd_chk_tail = CHK_NUM_MY_SESCMD;
-#endif
-    /** Set session command buffer */
-    sescmd->my_sescmd_buf = sescmd_buf;
-    sescmd->my_sescmd_packet_type = packet_type;
-    sescmd->position = atomic_add(&rses->pos_generator, 1);
+    while ((packet = modutil_get_next_MySQL_packet(&pending)) != NULL)
+    {
+        rses_ps_t *ps = rses_ps_get(rses, packet);
 
-    return sescmd;
-}
+        if (ps)
+        {
+            if (ps->ps_backend_ids[bref - rses->rses_backend_ref] == 0)
+            {
+                MXS_ERROR("Prepared statement %u was not prepared in %s:%d.", ps->ps_id,
+                          bref->bref_backend->backend_server->name,
+                          bref->bref_backend->backend_server->port);
+            }
 
-static void mysql_sescmd_done(mysql_sescmd_t *sescmd)
-{
-    if (sescmd == NULL)
-    {
-        MXS_ERROR("[%s] Error: NULL parameter.", __FUNCTION__);
-        return;
+            GWBUF *rewritten = bref_ps_rewrite(rses, bref, ps, packet);
+
+            if (rewritten)
+            {
+                gwbuf_free(packet);
+                packet = rewritten;
+            }
+        }
+
+        head = gwbuf_append(head, packet);
     }
-    CHK_RSES_PROP(sescmd->my_sescmd_prop);
-    gwbuf_free(sescmd->my_sescmd_buf);
-    memset(sescmd, 0, sizeof(mysql_sescmd_t));
+
+    gwbuf_free(pending);
+
+    return head;
 }
 
 /**
@@ -3542,6 +6335,13 @@ static GWBUF *sescmd_cursor_process_replies(GWBUF *replybuf,
     {
         bref->reply_cmd = *((unsigned char *)replybuf->start + 4);
         scur->position = scmd->position;
+
+        if (scmd->my_sescmd_ps_id)
+        {
+            /** Each backend has its own ID for the prepared statement */
+            rses_ps_prepare_reply(ses, bref, scmd->my_sescmd_ps_id, replybuf);
+        }
+
         /** Faster backend has already responded to client : discard */
         if (scmd->my_sescmd_is_replied)
         {
@@ -3596,6 +6396,12 @@ static GWBUF *sescmd_cursor_process_replies(GWBUF *replybuf,
             scmd->my_sescmd_is_replied = true;
             scmd->reply_cmd = *((unsigned char *)replybuf->start + 4);
 
+            if (scmd->my_sescmd_ps_id && scmd->reply_cmd == 0xff && ses->rses_ps)
+            {
+                /** The client doesn't know about the failed statement */
+                hashtable_delete(ses->rses_ps, (void *)(uintptr_t)scmd->my_sescmd_ps_id);
+            }
+
             MXS_INFO("Server '%s' responded to a session command, sending the response "
                      "to the client.", bref->bref_backend->backend_server->unique_name);
 
@@ -3884,6 +6690,7 @@ static bool execute_sescmd_in_backend(backend_ref_t *backend_ref)
 
     if (rc == 1)
     {
+        bref_causal_passthrough(backend_ref, scur->scmd_cur_cmd->my_sescmd_packet_type);
         succp = true;
     }
     else
@@ -4050,6 +6857,8 @@ static int getCapabilities()
  * @param inst          Router instance
  * @param packet_type       Type of MySQL packet
  * @param qtype         Query type from query_classifier
+ * @param ps_id         Router's ID of a prepared statement, 0 if the command
+ *                      is not a COM_STMT_PREPARE
  *
  * @return True if at least one backend is used and routing succeed to all
  * backends being used, otherwise false.
@@ -4058,7 +6867,7 @@ static int getCapabilities()
 static bool route_session_write(ROUTER_CLIENT_SES *router_cli_ses,
                                 GWBUF *querybuf, ROUTER_INSTANCE *inst,
                                 unsigned char packet_type,
-                                qc_query_type_t qtype)
+                                qc_query_type_t qtype, uint32_t ps_id)
 {
     bool succp;
     rses_property_t *prop;
@@ -4067,6 +6876,7 @@ static bool route_session_write(ROUTER_CLIENT_SES *router_cli_ses,
     int max_nslaves;
     int nbackends;
     int nsucc;
+    char *key = NULL;
 
     MXS_INFO("Session write, routing to all servers.");
     /** Maximum number of slaves in this router client session */
@@ -4093,6 +6903,8 @@ static bool route_session_write(ROUTER_CLIENT_SES *router_cli_ses,
             goto return_succp;
         }
 
+        rses_multiplex_acquire(router_cli_ses);
+
         for (i = 0; i < router_cli_ses->rses_nbackends; i++)
         {
             DCB *dcb = backend_ref[i].bref_dcb;
@@ -4133,8 +6945,21 @@ static bool route_session_write(ROUTER_CLIENT_SES *router_cli_ses,
         goto return_succp;
     }
 
+    rses_multiplex_acquire(router_cli_ses);
+
+    if (!router_cli_ses->rses_config.rw_disable_sescmd_hist &&
+        router_cli_ses->rses_config.rw_compact_sescmd_hist &&
+        (key = sescmd_get_key(querybuf, packet_type)) != NULL)
+    {
+        rses_compact_sescmd_history(router_cli_ses, key);
+    }
+
+    /**
+     * The limit is on the length of the history after the superseded
+     * commands have been removed from it.
+     */
     if (router_cli_ses->rses_config.rw_max_sescmd_history_size > 0 &&
-        router_cli_ses->rses_nsescmd >=
+        router_cli_ses->rses_sescmd_count >=
         router_cli_ses->rses_config.rw_max_sescmd_history_size)
     {
         MXS_WARNING("Router session exceeded session command history limit. "
@@ -4143,6 +6968,7 @@ static bool route_session_write(ROUTER_CLIENT_SES *router_cli_ses,
                     "for the duration of the session.");
         router_cli_ses->rses_config.rw_disable_sescmd_hist = true;
         router_cli_ses->rses_config.rw_max_sescmd_history_size = 0;
+        atomic_add(&inst->stats.n_sescmd_hist_exceeded, 1);
     }
 
     if (router_cli_ses->rses_config.rw_disable_sescmd_hist)
@@ -4192,10 +7018,12 @@ static bool route_session_write(ROUTER_CLIENT_SES *router_cli_ses,
     {
         MXS_ERROR("Router session property initialization failed");
         rses_end_locked_router_action(router_cli_ses);
+        free(key);
         return false;
     }
 
-    mysql_sescmd_init(prop, querybuf, packet_type, router_cli_ses);
+    mysql_sescmd_init(prop, querybuf, packet_type, key, router_cli_ses);
+    prop->rses_prop_data.sescmd.my_sescmd_ps_id = ps_id;
 
     /** Add sescmd property to router client session */
     if (rses_property_add(router_cli_ses, prop) != 0)
@@ -4345,14 +7173,15 @@ static bool rwsplit_process_router_options(ROUTER_INSTANCE *router,
                 c = GET_SELECT_CRITERIA(value);
                 ss_dassert(c == LEAST_GLOBAL_CONNECTIONS ||
                            c == LEAST_ROUTER_CONNECTIONS || c == LEAST_BEHIND_MASTER ||
-                           c == LEAST_CURRENT_OPERATIONS || c == UNDEFINED_CRITERIA);
+                           c == LEAST_CURRENT_OPERATIONS || c == ADAPTIVE_ROUTING ||
+                           c == UNDEFINED_CRITERIA);
 
                 if (c == UNDEFINED_CRITERIA)
                 {
                     MXS_ERROR("Unknown slave selection criteria \"%s\". "
                                 "Allowed values are LEAST_GLOBAL_CONNECTIONS, "
-                                "LEAST_ROUTER_CONNECTIONS, LEAST_BEHIND_MASTER,"
-                                "and LEAST_CURRENT_OPERATIONS.",
+                                "LEAST_ROUTER_CONNECTIONS, LEAST_BEHIND_MASTER, "
+                                "LEAST_CURRENT_OPERATIONS and ADAPTIVE_ROUTING.",
                                 STRCRITERIA(router->rwsplit_config.rw_slave_select_criteria));
                     success = false;
                 }
@@ -4369,6 +7198,56 @@ static bool rwsplit_process_router_options(ROUTER_INSTANCE *router,
             {
                 router->rwsplit_config.rw_disable_sescmd_hist = config_truth_value(value);
             }
+            else if (strcmp(options[i], "compact_sescmd_history") == 0)
+            {
+                router->rwsplit_config.rw_compact_sescmd_hist = config_truth_value(value);
+            }
+            else if (strcmp(options[i], "causal_reads") == 0)
+            {
+                router->rwsplit_config.rw_causal_reads = config_truth_value(value);
+            }
+            else if (strcmp(options[i], "causal_reads_timeout") == 0)
+            {
+                router->rwsplit_config.rw_causal_reads_timeout = atoi(value);
+
+                if (router->rwsplit_config.rw_causal_reads_timeout <= 0)
+                {
+                    MXS_ERROR("Invalid value for 'causal_reads_timeout': %s", value);
+                    success = false;
+                }
+            }
+            else if (strcmp(options[i], "hedged_reads") == 0)
+            {
+                router->rwsplit_config.rw_hedged_reads = config_truth_value(value);
+            }
+            else if (strcmp(options[i], "hedged_reads_percentile") == 0)
+            {
+                router->rwsplit_config.rw_hedged_reads_percentile = atoi(value);
+
+                if (router->rwsplit_config.rw_hedged_reads_percentile <= 0 ||
+                    router->rwsplit_config.rw_hedged_reads_percentile >= 100)
+                {
+                    MXS_ERROR("Invalid value for 'hedged_reads_percentile', expected "
+                              "a value between 1 and 99: %s", value);
+                    success = false;
+                }
+            }
+            else if (strcmp(options[i], "connection_multiplexing") == 0)
+            {
+                router->rwsplit_config.rw_multiplex = config_truth_value(value);
+            }
+            else if (strcmp(options[i], "prepared_stmt_routing") == 0)
+            {
+                router->rwsplit_config.rw_ps_routing = config_truth_value(value);
+            }
+            else if (strcmp(options[i], "read_only_trx_to_slave") == 0)
+            {
+                router->rwsplit_config.rw_read_only_trx = config_truth_value(value);
+            }
+            else if (strcmp(options[i], "lazy_connect") == 0)
+            {
+                router->rwsplit_config.rw_lazy_connect = config_truth_value(value);
+            }
             else if (strcmp(options[i], "master_accept_reads") == 0)
             {
                 router->rwsplit_config.rw_master_reads = config_truth_value(value);
@@ -4666,7 +7545,7 @@ static bool handle_error_new_connection(ROUTER_INSTANCE *inst,
      * the backend server it is necessary to send an error to the client
      * because it is waiting for reply.
      */
-    if (BREF_IS_WAITING_RESULT(bref))
+    if (BREF_IS_WAITING_RESULT(bref) && bref->bref_hedge_peer == NULL)
     {
         DCB *client_dcb = ses->client_dcb;
         client_dcb->func.write(client_dcb, gwbuf_clone(errmsg));
@@ -2315,6 +2315,7 @@ static int routeQuery(ROUTER* instance,
             bref_set_state(bref, BREF_QUERY_ACTIVE);
             bref_set_state(bref, BREF_WAITING_RESULT);
             atomic_add(&bref->bref_backend->stats.queries, 1);
+            mxs_mysql_latency_start(&bref->bref_latency, querybuf);
         }
         else
         {
@@ -2678,11 +2679,17 @@ static void clientReply(ROUTER* instance,
      * Clear BREF_QUERY_ACTIVE flag and decrease waiter counter.
      * This applies for queries  other than session commands.
      */
-    else if (BREF_IS_QUERY_ACTIVE(bref))
+    else
     {
-        bref_clear_state(bref, BREF_QUERY_ACTIVE);
-        /** Set response status as replied */
-        bref_clear_state(bref, BREF_WAITING_RESULT);
+        mxs_mysql_latency_track(&bref->bref_latency, writebuf, bref->bref_backend->backend_server,
+                                ((ROUTER_INSTANCE*) instance)->service);
+
+        if (BREF_IS_QUERY_ACTIVE(bref))
+        {
+            bref_clear_state(bref, BREF_QUERY_ACTIVE);
+            /** Set response status as replied */
+            bref_clear_state(bref, BREF_WAITING_RESULT);
+        }
     }
 
     if (writebuf != NULL && client_dcb != NULL)
@@ -2733,6 +2740,7 @@ static void clientReply(ROUTER* instance,
              */
             bref_set_state(bref, BREF_QUERY_ACTIVE);
             bref_set_state(bref, BREF_WAITING_RESULT);
+            mxs_mysql_latency_start(&bref->bref_latency, bref->bref_pending_cmd);
         }
         else
         {
@@ -2995,6 +3003,7 @@ static bool connect_backend_servers(backend_ref_t*   backend_ref,
                      */
 
                     backend_ref[i].bref_state = 0;
+                    backend_ref[i].bref_latency.sent = 0;
                     bref_set_state(&backend_ref[i], BREF_IN_USE);
                     /**
                      * Increase backend connection counter.